@@ -0,0 +1,209 @@
+#include <pthread.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../filemap.h"
+
+#define DEBUG
+
+#ifdef DEBUG
+#define _debug(x...) do {printf("[debug][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _info(x...) do {printf("[info][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _error(x...) do {printf("[error][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#else 
+#define _debug(x...) do {;} while (0)
+#define _info(x...) do {printf("[info][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _error(x...) do {printf("[error][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#endif 
+
+/* 每个线程的参数 */
+typedef struct 
+{
+    FILEMAP_HANDLE hFileMap;
+    int nItemNum;       // 表中的项数
+    int nOpNum;         // 本线程的操作次数
+    int nWritePerMille; // 写操作的千分比
+    unsigned int uSeed;
+    int nFailed;
+} BENCH_THREAD_ARG;
+
+static double bench_now ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *bench_thread (void *pArg)
+{
+    BENCH_THREAD_ARG *psArg = (BENCH_THREAD_ARG*)pArg;
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+
+    for (int i = 0; i < psArg->nOpNum; ++i)
+    {
+        const int nItem = rand_r (&psArg->uSeed) % psArg->nItemNum;
+        const int bWrite = (rand_r (&psArg->uSeed) % 1000) < psArg->nWritePerMille;
+
+        snprintf (key.szKey, sizeof(key.szKey), "bench_%d", nItem);
+
+        int ret = 0;
+        if (bWrite)
+        {
+            snprintf (value.byteData, sizeof(value.byteData), "value_%d_%d", nItem, i);
+            ret = filemap_setitem (psArg->hFileMap, &key, &value);
+        }
+        else 
+        {
+            ret = filemap_getitem (psArg->hFileMap, &key, &value);
+        }
+
+        if (ret < 0)
+        {
+            psArg->nFailed += 1;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 用@nThreadNum个线程并发读写，返回每秒操作数
+ */
+static double bench_run (FILEMAP_HANDLE hFileMap, int nThreadNum, int nItemNum, 
+                int nOpNum, int nWritePerMille)
+{
+    pthread_t *pThread = (pthread_t*)calloc (nThreadNum, sizeof(pthread_t));
+    BENCH_THREAD_ARG *psArg = (BENCH_THREAD_ARG*)calloc (nThreadNum, sizeof(BENCH_THREAD_ARG));
+    if (NULL == pThread || NULL == psArg)
+    {
+        _error ("calloc failed\n");
+        free (pThread);
+        free (psArg);
+        return -1;
+    }
+
+    const double dStart = bench_now ();
+
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        psArg[i].hFileMap = hFileMap;
+        psArg[i].nItemNum = nItemNum;
+        psArg[i].nOpNum = nOpNum / nThreadNum;
+        psArg[i].nWritePerMille = nWritePerMille;
+        psArg[i].uSeed = i + 1;
+        pthread_create (&pThread[i], NULL, bench_thread, &psArg[i]);
+    }
+
+    int nFailed = 0;
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        pthread_join (pThread[i], NULL);
+        nFailed += psArg[i].nFailed;
+    }
+
+    const double dCost = bench_now () - dStart;
+
+    if (nFailed > 0)
+    {
+        _error ("%d operations failed\n", nFailed);
+    }
+
+    free (pThread);
+    free (psArg);
+
+    return (nOpNum / nThreadNum) * nThreadNum / dCost;
+}
+
+int main (int argc, const char **argv)
+{
+    if (argc < 2)
+    {
+        _error ("usage: %s <bench_file> [max_thread=32] [item_num=10000] [op_num=1000000] [write_per_mille=5] [mmap=0] "
+                    "[wal=0] [durability=0(none)/1(periodic)/2(group)] [interval_ms=10]\n", argv[0]);
+        return -1;
+    }
+
+    const char *szFile = argv[1];
+    const int nMaxThread = (argc > 2 ? atoi (argv[2]) : 32);
+    const int nItemNum = (argc > 3 ? atoi (argv[3]) : 10000);
+    const int nOpNum = (argc > 4 ? atoi (argv[4]) : 1000000);
+    const int nWritePerMille = (argc > 5 ? atoi (argv[5]) : 5);
+    int nFlags = (argc > 6 && atoi (argv[6]) ? FILEMAP_FLAG_MMAP : 0);
+    nFlags |= (argc > 7 && atoi (argv[7]) ? FILEMAP_FLAG_WAL : 0);
+    const int nDurability = (argc > 8 ? atoi (argv[8]) : FILEMAP_DURABILITY_NONE);
+    const int nIntervalMs = (argc > 9 ? atoi (argv[9]) : 10);
+
+    if (nMaxThread <= 0 || nItemNum <= 0 || nOpNum <= 0)
+    {
+        _error ("invalid param\n");
+        return -1;
+    }
+
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szFile, nItemNum, nFlags);
+    if (NULL == hFileMap)
+    {
+        _error ("create <%s> failed\n", szFile);
+        return -1;
+    }
+
+    /* 预先写满 */
+    filemap_setdurability (hFileMap, FILEMAP_DURABILITY_NONE, 0);
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    for (int i = 0; i < nItemNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "bench_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "value_%d", i);
+        if (filemap_setitem (hFileMap, &key, &value) < 0)
+        {
+            _error ("set item %d failed\n", i);
+            filemap_close (hFileMap);
+            return -1;
+        }
+    }
+
+    if (filemap_setdurability (hFileMap, nDurability, nIntervalMs) < 0)
+    {
+        _error ("set durability failed\n");
+        filemap_close (hFileMap);
+        return -1;
+    }
+
+    printf ("items=%d,ops=%d,write=%d/1000,mmap=%d,wal=%d,durability=%d\n", 
+                nItemNum, nOpNum, nWritePerMille, (nFlags & FILEMAP_FLAG_MMAP) ? 1 : 0,
+                (nFlags & FILEMAP_FLAG_WAL) ? 1 : 0, nDurability);
+    printf ("%8s %14s %8s\n", "threads", "ops/sec", "speedup");
+
+    double dBase = 0;
+    for (int nThreadNum = 1; nThreadNum <= nMaxThread; nThreadNum *= 2)
+    {
+        const double dOps = bench_run (hFileMap, nThreadNum, nItemNum, nOpNum, nWritePerMille);
+        if (dOps < 0)
+        {
+            break;
+        }
+        if (1 == nThreadNum)
+        {
+            dBase = dOps;
+        }
+        printf ("%8d %14.0f %8.2f\n", nThreadNum, dOps, dBase > 0 ? dOps / dBase : 0);
+    }
+
+    if (filemap_close (hFileMap) < 0)
+    {
+        _error ("close filemap failed\n");
+        return -1;
+    }
+
+    return 0;
+}
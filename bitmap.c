@@ -0,0 +1,313 @@
+#include "bitmap.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*********** MACROS ***********/
+
+#define DEBUG
+
+#ifdef DEBUG
+#define _debug(x...) do {printf("[debug][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _info(x...) do {printf("[info][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _error(x...) do {printf("[error][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#else 
+#define _debug(x...) do {;} while (0)
+#define _info(x...) do {printf("[info][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _error(x...) do {printf("[error][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#endif 
+
+#define BITMAP_WORD_BITS 64
+#define BITMAP_WORD_FULL (~(uint64_t)0)
+
+/*********** TYPES ***********/
+
+typedef struct 
+{
+    int nBitNum;
+    int nWordNum;
+    uint64_t *pWords;       // 比特表，第i位在第i/64个字的第i%64位
+
+    int nSummaryNum;
+    uint64_t *pSummary;     // 摘要，第i位表示第i个字已满
+
+    int nHintSummary;       // 该摘要字之前没有空位
+} BITMAP_Obj;
+
+/*********** STATIC FUNCS ***********/
+
+static int bitmap_wordnum (int nBitNum)
+{
+    return nBitNum / BITMAP_WORD_BITS + (nBitNum % BITMAP_WORD_BITS ? 1 : 0);
+}
+
+/**
+ * @brief 第@nWord个字变化后更新摘要
+ */
+static void bitmap_updatesummary (BITMAP_Obj *pObj, int nWord)
+{
+    const int nSummary = nWord / BITMAP_WORD_BITS;
+    const uint64_t uMask = (uint64_t)1 << (nWord % BITMAP_WORD_BITS);
+
+    if (BITMAP_WORD_FULL == pObj->pWords[nWord])
+    {
+        pObj->pSummary[nSummary] |= uMask;
+    }
+    else 
+    {
+        pObj->pSummary[nSummary] &= ~uMask;
+        if (nSummary < pObj->nHintSummary)
+        {
+            pObj->nHintSummary = nSummary;
+        }
+    }
+}
+
+/**
+ * @brief 将超出比特数的位置为1，使其不会被找到
+ */
+static void bitmap_filltail (BITMAP_Obj *pObj)
+{
+    const int nTailBits = pObj->nBitNum % BITMAP_WORD_BITS;
+    if (nTailBits != 0)
+    {
+        pObj->pWords[pObj->nWordNum - 1] |= (BITMAP_WORD_FULL << nTailBits);
+    }
+
+    const int nTailWords = pObj->nWordNum % BITMAP_WORD_BITS;
+    if (nTailWords != 0)
+    {
+        pObj->pSummary[pObj->nSummaryNum - 1] |= (BITMAP_WORD_FULL << nTailWords);
+    }
+}
+
+/*********** GLOBAL FUNCS ***********/
+
+BITMAP_HANDLE bitmap_create (int nBitNum)
+{
+    if (nBitNum < 0)
+    {
+        _error ("param error, num=%d\n", nBitNum);
+        return NULL;
+    }
+
+    BITMAP_Obj *pObj = (BITMAP_Obj*)malloc (sizeof(BITMAP_Obj));
+    if (NULL == pObj)
+    {
+        _error ("malloc failed\n");
+        return NULL;
+    }
+
+    pObj->nBitNum = nBitNum;
+    pObj->nWordNum = bitmap_wordnum (nBitNum);
+    pObj->nSummaryNum = bitmap_wordnum (pObj->nWordNum);
+    pObj->nHintSummary = 0;
+
+    /* 至少分配一个字，避免空表的特殊处理 */
+    pObj->pWords = (uint64_t*)calloc (pObj->nWordNum + 1, sizeof(uint64_t));
+    pObj->pSummary = (uint64_t*)calloc (pObj->nSummaryNum + 1, sizeof(uint64_t));
+    if (NULL == pObj->pWords || NULL == pObj->pSummary)
+    {
+        _error ("calloc failed, num=%d\n", nBitNum);
+        free (pObj->pWords);
+        free (pObj->pSummary);
+        free (pObj);
+        return NULL;
+    }
+
+    bitmap_filltail (pObj);
+
+    return (BITMAP_HANDLE)pObj;
+}
+
+int bitmap_destroy (BITMAP_HANDLE hInstance)
+{
+    BITMAP_Obj *pObj = (BITMAP_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    free (pObj->pWords);
+    free (pObj->pSummary);
+    free (pObj);
+
+    return 0;
+}
+
+int bitmap_load (BITMAP_HANDLE hInstance, const char *pMem, int nSize)
+{
+    BITMAP_Obj *pObj = (BITMAP_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    memset (pObj->pWords, 0, pObj->nWordNum * sizeof(uint64_t));
+    memset (pObj->pSummary, 0, pObj->nSummaryNum * sizeof(uint64_t));
+
+    /* 文件中每字节高位在前 */
+    for (int i = 0; i < nSize && i * 8 < pObj->nBitNum; ++i)
+    {
+        const unsigned char cByte = (unsigned char)pMem[i];
+        if (0 == cByte)
+        {
+            continue;
+        }
+
+        for (int k = 0; k < 8; ++k)
+        {
+            const int nIndex = i * 8 + k;
+            if (nIndex >= pObj->nBitNum)
+            {
+                break;
+            }
+            if (cByte & (0x80 >> k))
+            {
+                pObj->pWords[nIndex / BITMAP_WORD_BITS] |= (uint64_t)1 << (nIndex % BITMAP_WORD_BITS);
+            }
+        }
+    }
+
+    bitmap_filltail (pObj);
+
+    for (int i = 0; i < pObj->nWordNum; ++i)
+    {
+        bitmap_updatesummary (pObj, i);
+    }
+
+    bitmap_filltail (pObj);
+    pObj->nHintSummary = 0;
+
+    return 0;
+}
+
+int bitmap_store (BITMAP_HANDLE hInstance, char *pMem, int nSize)
+{
+    BITMAP_Obj *pObj = (BITMAP_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    memset (pMem, 0, nSize);
+
+    /* 文件中每字节高位在前 */
+    for (int i = 0; i < nSize && i * 8 < pObj->nBitNum; ++i)
+    {
+        unsigned char cByte = 0;
+        for (int k = 0; k < 8; ++k)
+        {
+            const int nIndex = i * 8 + k;
+            if (nIndex >= pObj->nBitNum)
+            {
+                break;
+            }
+            if (pObj->pWords[nIndex / BITMAP_WORD_BITS] & ((uint64_t)1 << (nIndex % BITMAP_WORD_BITS)))
+            {
+                cByte |= (0x80 >> k);
+            }
+        }
+        pMem[i] = (char)cByte;
+    }
+
+    return 0;
+}
+
+int bitmap_setbit (BITMAP_HANDLE hInstance, int nIndex, int bBit)
+{
+    BITMAP_Obj *pObj = (BITMAP_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    if (nIndex < 0 || nIndex >= pObj->nBitNum)
+    {
+        _error ("index over limit, <index=%d,num=%d>\n", nIndex, pObj->nBitNum);
+        return -1;
+    }
+
+    const int nWord = nIndex / BITMAP_WORD_BITS;
+    const uint64_t uMask = (uint64_t)1 << (nIndex % BITMAP_WORD_BITS);
+
+    if (bBit)
+    {
+        pObj->pWords[nWord] |= uMask;
+    }
+    else 
+    {
+        pObj->pWords[nWord] &= ~uMask;
+    }
+
+    bitmap_updatesummary (pObj, nWord);
+
+    return 0;
+}
+
+int bitmap_getbit (BITMAP_HANDLE hInstance, int nIndex)
+{
+    BITMAP_Obj *pObj = (BITMAP_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    if (nIndex < 0 || nIndex >= pObj->nBitNum)
+    {
+        _error ("index over limit, <index=%d,num=%d>\n", nIndex, pObj->nBitNum);
+        return -1;
+    }
+
+    const uint64_t uWord = pObj->pWords[nIndex / BITMAP_WORD_BITS];
+    return (uWord >> (nIndex % BITMAP_WORD_BITS)) & 1 ? 1 : 0;
+}
+
+int bitmap_findfirstzero (BITMAP_HANDLE hInstance, int *pnIndex)
+{
+    BITMAP_Obj *pObj = (BITMAP_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    /* 先在摘要中找出未满的字，再在字中找出空位 */
+    for (int i = pObj->nHintSummary; i < pObj->nSummaryNum; ++i)
+    {
+        const uint64_t uSummary = pObj->pSummary[i];
+        if (BITMAP_WORD_FULL == uSummary)
+        {
+            pObj->nHintSummary = i + 1;
+            continue;
+        }
+
+        const int nWord = i * BITMAP_WORD_BITS + __builtin_ctzll (~uSummary);
+        const uint64_t uWord = pObj->pWords[nWord];
+        const int nIndex = nWord * BITMAP_WORD_BITS + __builtin_ctzll (~uWord);
+
+        pObj->nHintSummary = i;
+        *pnIndex = nIndex;
+        return 1;
+    }
+
+    return 0;
+}
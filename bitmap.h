@@ -0,0 +1,74 @@
+/**
+ * filename: bitmap.h
+ * date: 20261018
+ * os: linux
+ * 
+ * description:
+ * 内存中的比特表，用于快速查找空位
+ * 按64位字扫描，并维护一层摘要（每个字是否已满）和一个最早空位的提示，
+ * 查找空位时跳过已满的部分，接近O(1)
+ */
+
+#ifndef BITMAP_H__
+#define BITMAP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif 
+
+typedef void * BITMAP_HANDLE;
+
+/**
+ * @brief bitmap_create 创建比特表，所有位为0
+ * @param [IN] nBitNum 比特数
+ * @return 失败返回NULL，否则返回新创建的实例句柄
+ */
+BITMAP_HANDLE bitmap_create (int nBitNum);
+
+/**
+ * @brief bitmap_destroy 销毁比特表
+ * @return 成功返回0，否则返回-1
+ */
+int bitmap_destroy (BITMAP_HANDLE hInstance);
+
+/**
+ * @brief bitmap_load 从文件中的比特表格式导入
+ * @param [IN] pMem 文件中的比特表，每字节高位在前
+ * @param [IN] nSize 字节数
+ * @return 成功返回0，否则返回-1
+ * @note 超出比特数的位被忽略
+ */
+int bitmap_load (BITMAP_HANDLE hInstance, const char *pMem, int nSize);
+
+/**
+ * @brief bitmap_store 导出为文件中的比特表格式
+ * @param [OUT] pMem 文件中的比特表，每字节高位在前
+ * @param [IN] nSize 字节数
+ * @return 成功返回0，否则返回-1
+ */
+int bitmap_store (BITMAP_HANDLE hInstance, char *pMem, int nSize);
+
+/**
+ * @brief bitmap_setbit 设置第@nIndex位为@bBit
+ * @return 成功返回0，否则返回-1
+ */
+int bitmap_setbit (BITMAP_HANDLE hInstance, int nIndex, int bBit);
+
+/**
+ * @brief bitmap_getbit 获取第@nIndex位
+ * @return 返回0或1，失败返回-1
+ */
+int bitmap_getbit (BITMAP_HANDLE hInstance, int nIndex);
+
+/**
+ * @brief bitmap_findfirstzero 找出第一个为0的位
+ * @param [OUT] pnIndex 找到的位
+ * @return 找到返回1，已满返回0，失败返回-1
+ */
+int bitmap_findfirstzero (BITMAP_HANDLE hInstance, int *pnIndex);
+
+#ifdef __cplusplus
+}
+#endif 
+
+#endif // BITMAP_H__
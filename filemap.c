@@ -1,14 +1,28 @@
+#define _GNU_SOURCE /* pthread_rwlockattr_setkind_np */
 
 #include "filemap.h"
 
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mem2file.h"
 #include "hash.h"
+#include "bitmap.h"
 
 /************ MACROS ************/
 
@@ -45,16 +59,100 @@
         printf ("timestamp[%s %d %s] %s\n", __FILE__,__LINE__,__FUNCTION__, szResult); \
 	} while (0)
 
-#define FILEMAP_VERSION "FILEMAP V1.0"
+#define FILEMAP_VERSION "FILEMAP V2.0"
+#define FILEMAP_VERSION_V10 "FILEMAP V1.0" /* 没有空位栈，FILEMAP_FLAG_UPGRADE时加载就地升级 */
+#define FILEMAP_VERSION_V11 "FILEMAP V1.1" /* 键为字符串 */
+#define FILEMAP_VERSION_V12 "FILEMAP V1.2" /* 键为字符串，有变长值存储区 */
+#define FILEMAP_VERSION_V21 "FILEMAP V2.1" /* 开放寻址的索引 */
+#define FILEMAP_VERSION_V22 "FILEMAP V2.2" /* 扩容过，文件末尾追加了新的区域 */
+#define FILEMAP_VERSION_V23 "FILEMAP V2.3" /* 文件超过2GB，位置为64位 */
+#define FILEMAP_VERSION_V24 "FILEMAP V2.4" /* 数据段按页对齐 */
+
+/* 索引中键的格式 */
+#define FILEMAP_KEYFORMAT_STRING 0  // 64字节的字符串，V1.x
+#define FILEMAP_KEYFORMAT_BINARY 1  // 任意字节串，记录长度和哈希值，短键直接保存，长键保存在键段中
+#define FILEMAP_KEY_INLINE_MAX 20   // 直接保存在索引中的键的最大长度
+#define FILEMAP_NODE_SIZE_MAX \
+    (sizeof(FILEMAP_STRING_NODE) > sizeof(FILEMAP_BINARY_NODE) ? sizeof(FILEMAP_STRING_NODE) : sizeof(FILEMAP_BINARY_NODE))
 
 #define INDEX_NULL (-1)
 
+/* 哈希表分段锁的段数，按哈希表位置取模 */
+#define FILEMAP_BUCKET_LOCK_NUM 256
+
+/* 不加锁读取时的重试次数，超过后加锁读取 */
+#define FILEMAP_OPTIMISTIC_RETRY_NUM 16
+
+/* 多进程共享区在定义段中的位置 */
+#define FILEMAP_SHARED_POS 1024
+#define FILEMAP_SHARED_MAGIC 0x46534852
+
+/* 空位栈 */
+#define FILEMAP_FREELIST_DATA 0
+#define FILEMAP_FREELIST_HASHLINK 1
+#define FILEMAP_FREELIST_HEAP 2     // 变长值存储区，按块的位置释放
+#define FILEMAP_FREELIST_KEY 3      // 键段
+
+/* 开放寻址的索引，每个位置一个控制字节，为0表示从未使用，全0的文件即为空表 */
+#define FILEMAP_OPEN_CTRL_EMPTY 0x00
+#define FILEMAP_OPEN_CTRL_DELETED 0x01  // 已删除，查找时继续向后探测
+#define FILEMAP_OPEN_CTRL_FULL 0x80     // 低7位为hash的高7位
+#define FILEMAP_OPEN_GROUP_SIZE 16      // 一次读取、比较的控制字节数
+#define FILEMAP_OPEN_CLEAN_MAX 256      // 删除时最多一并清理的已删除位置数
+
+/* 变长值存储区，以单元为分配粒度，块的大小分级，每级一个空闲链表 */
+#define FILEMAP_HEAP_UNIT_SIZE 64
+#define FILEMAP_HEAP_CLASS_NUM 28   // 1个单元到16384个单元(1MB)
+#define FILEMAP_HEAP_NULL 0         // 第0个单元为存储区头部，不会是块的位置
+#define FILEMAP_HEAP_HEAD_UNIT_NUM \
+    ((int)((sizeof(FILEMAP_SECTION_HEAP_HEAD) + FILEMAP_HEAP_UNIT_SIZE - 1) / FILEMAP_HEAP_UNIT_SIZE))
+#define FILEMAP_HEAP_SIZE_MAX ((long long)(INT_MAX / 2) * FILEMAP_HEAP_UNIT_SIZE)  // 单元数为int，留出余量，约64GB
+
+/* 数量的上限，计算哈希表大小时不溢出；实际的上限由索引段不超过2GB决定，见filemap_create_opt */
+#define FILEMAP_NUM_MAX (INT_MAX / 2)
+
+/* 日志文件 */
+#define FILEMAP_WAL_SUFFIX ".wal"
+#define FILEMAP_WAL_MAGIC 0x46574C48
+#define FILEMAP_WAL_MAGIC_V1 0x46574C47 // 位置为32位的旧记录，加载时仍然重做
+#define FILEMAP_WAL_WRITE_MAX 16        // 一次操作最多修改的索引位置数
+#define FILEMAP_WAL_DATA_MAX 2048       // 一次操作最多修改的索引字节数
+#define FILEMAP_WAL_SLOT_MAX 8          // 一次操作最多分配、释放的空位数
+#define FILEMAP_WAL_CHECKPOINT_SIZE (4 * 1024 * 1024)   // 日志超过该大小时，写磁盘后清空
+
+/* 直接读写 */
+#define FILEMAP_DIRECT_DATA_ALIGN MEM2FILE_DIRECT_PAGE_SIZE     // 新建的文件中数据段起始位置和每项占用空间的对齐大小
+#define FILEMAP_DATA_ALIGN_MAX (1024 * 1024)                    // 文件中记录的对齐大小的上限
+
+/* 批量写入 */
+#define FILEMAP_BATCH_RANGE_MAX 65536   // 推迟写入的范围数，满时先写入文件
+#define FILEMAP_BATCH_GAP 256           // 间隔不超过该字节数的范围合并为一次写入
+
+/* 扩容 */
+#define FILEMAP_GROW_MAX 15     // 最多扩容的次数
+#define FILEMAP_GROW_STEP 4     // 迁移期间每次写操作顺带迁移的旧哈希表位置数
+#define FILEMAP_GROW_ZERO_SIZE (1024 * 1024)    // 扩容时清零上次异常退出留下的部分，每次写入的字节数
+
+/* 按新的数量重建文件 */
+#define FILEMAP_MIGRATE_SUFFIX ".migrate"       // 重建期间的临时文件<szFileName>.migrate
+#define FILEMAP_MIGRATE_PROGRESS_STEP 4096      // 每读取这么多哈希表位置报告一次进度
+
+/* 遍历 */
+#define FILEMAP_ITER_BUFFER_SIZE (4 * 1024 * 1024)  // 每次顺序读取的数据段大小
+#define FILEMAP_FOREACH_BUFFER_SIZE (1024 * 1024)   // 并行遍历时每个线程每次读取的大小
+#define FILEMAP_FOREACH_THREAD_MAX 64
+
+/* 批量建立文件 */
+#define FILEMAP_BULKLOAD_SUFFIX ".bulkload"                 // 建立期间的临时文件<szFileName>.bulkload
+#define FILEMAP_BULKLOAD_BUFFER_SIZE (8 * 1024 * 1024)      // 每段顺序写入合并的大小
+#define FILEMAP_BULKLOAD_PROGRESS_STEP 65536                // 每写入这么多项报告一次进度
+
 /************ TYPES ************/
 
 typedef struct 
 {
-    int pos;
-    int size;
+    long long pos;
+    long long size;
 } FILEMAP_SEGMENT;
 
 typedef struct 
@@ -77,13 +175,25 @@ typedef struct
     FILEMAP_SEGMENT seg;
 } FILEMAP_INDEX_HASHLINK_MAP;
 
+typedef struct 
+{
+    FILEMAP_SEGMENT seg;
+} FILEMAP_INDEX_CTRL_MAP;
+
+typedef struct 
+{
+    FILEMAP_SEGMENT seg;
+} FILEMAP_INDEX_MIGRATE_MAP;
+
 typedef struct 
 {
     FILEMAP_SEGMENT seg;
     FILEMAP_INDEX_BITMAP_MAP seg_bitmap_data;
     FILEMAP_INDEX_BITMAP_MAP seg_bitmap_hashlink;
+    FILEMAP_INDEX_CTRL_MAP seg_ctrl;            // 开放寻址的控制字节，链表方式下为空
     FILEMAP_INDEX_POSHASHMAP_MAP seg_hashmap;
-    FILEMAP_INDEX_HASHLINK_MAP seg_hashlink;
+    FILEMAP_INDEX_HASHLINK_MAP seg_hashlink;    // 开放寻址方式下为空
+    FILEMAP_INDEX_MIGRATE_MAP seg_migrate;      // 从扩容前的索引迁移的进度，扩容前的索引段中为空
 } FILEMAP_INDEX_MAP;
 
 typedef struct 
@@ -91,13 +201,50 @@ typedef struct
     FILEMAP_SEGMENT seg;
 } FILEMAP_DATA_MAP;
 
-/* 各段地图 */
 typedef struct 
 {
     FILEMAP_SEGMENT seg;
+} FILEMAP_KEY_MAP;
+
+typedef struct 
+{
+    FILEMAP_SEGMENT seg;
+} FILEMAP_FREELIST_STACK_MAP;
+
+typedef struct 
+{
+    FILEMAP_SEGMENT seg;
+    FILEMAP_FREELIST_STACK_MAP seg_head;
+    FILEMAP_FREELIST_STACK_MAP seg_stack_data;
+    FILEMAP_FREELIST_STACK_MAP seg_stack_hashlink;
+    FILEMAP_FREELIST_STACK_MAP seg_stack_key;
+} FILEMAP_FREELIST_MAP;
+
+/* 数据段和键段的一段，第nSlotBegin个元素在开头 */
+typedef struct 
+{
+    int nSlotBegin;
+    FILEMAP_DATA_MAP seg_data;
+    FILEMAP_KEY_MAP seg_key;
+} FILEMAP_EXTENT_MAP;
+
+/**
+ * 各段地图；扩容时在文件末尾依次追加新的索引段、数据段和键段的扩展部分、空位栈，
+ * 索引段和空位栈为最后一次扩容的，之前的不再使用
+ */
+typedef struct 
+{
+    FILEMAP_SEGMENT seg;
+    int nDataStride;                    // 数据段每项占用的字节数，对齐时大于sizeof(FILEMAP_SECTION_DATA_ELEMENT)
     FILEMAP_DEF_MAP seg_def;
     FILEMAP_INDEX_MAP seg_index;
     FILEMAP_DATA_MAP seg_data;
+    FILEMAP_KEY_MAP seg_key;            // 长键，字符串键格式下为空
+    FILEMAP_FREELIST_MAP seg_freelist; // 放在文件末尾，旧版本文件可以就地升级
+
+    FILEMAP_INDEX_MAP seg_index_old;    // 最后一次扩容前的索引段，迁移期间只读
+    int nExtentNum;                     // 第0段为seg_data和seg_key，之后每次扩容一段
+    FILEMAP_EXTENT_MAP asExtent[FILEMAP_GROW_MAX + 1];
 } FILEMAP_GLOBAL_MAP;
 
 /* 定义区结构 */
@@ -105,17 +252,60 @@ typedef struct
 {
     char szVersion[16];
     int nMaxFileNum;
+    int nHeapUnitNum;   // 变长值存储区的单元数，为0时数据段为固定大小的数组；V1.2起使用
+    int nKeyFormat;     // FILEMAP_KEYFORMAT_*，V2.0起使用
+    int nHashType;      // FILEMAP_HASH_*，旧文件为0，与FILEMAP_HASH_BKDR相同
+    unsigned long long ullHashSeed; // FILEMAP_HASH_WYHASH的种子，创建文件时随机生成
+    int nIndexLayout;   // FILEMAP_INDEX_*，V2.1起使用
+    int nGrowNum;       // 扩容的次数，V2.2起使用
+    int anGrowFrom[FILEMAP_GROW_MAX];   // 各次扩容前的数量
+    int nDataAlign;     // 数据段起始位置和每项占用的空间按该字节数对齐，为0时不对齐；V2.4起使用
 } FILEMAP_SECTION_DEF;
 
+/**
+ * 索引中的一项，读取时由文件中的节点转换而来；
+ * 长键只记录在键段中的位置，比较时才读取
+ */
 typedef struct 
 {
     int bUsedFlag; // 在哈希表中标记是否使用
-    FILEMAP_KEY key;
+    unsigned int uHash; // 键的哈希值，字符串键格式下不保存，为0
+    int nKeyLen;
+    int nKeyIndex; // 长键在键段中的位置，键在byteKey中时为INDEX_NULL
+    unsigned char byteKey[FILEMAP_KEY_MAX];
     int nIndex; // 该项在数据段中的索引位置
 
     int nNextIndex; // 链表索引
 } FILEMAP_DATAMAP;
 
+/* 文件中的节点，字符串键格式 */
+typedef struct 
+{
+    int bUsedFlag;
+    FILEMAP_DATA_64B key;
+    int nIndex;
+    int nNextIndex;
+} FILEMAP_STRING_NODE;
+
+/* 文件中的节点，任意字节串键格式 */
+typedef struct 
+{
+    int bUsedFlag;
+    unsigned int uHash;
+    int nKeyLen;
+    unsigned char byteKey[FILEMAP_KEY_INLINE_MAX]; // 长键时开头为在键段中的位置
+    int nIndex;
+    int nNextIndex;
+} FILEMAP_BINARY_NODE;
+
+/* 调用者传入的键，哈希值在进入时计算一次 */
+typedef struct 
+{
+    const unsigned char *pData;
+    int nLen;
+    unsigned int uHash;
+} FILEMAP_KEYREF;
+
 /* 位置哈希表元素 */
 typedef struct 
 {
@@ -128,53 +318,519 @@ typedef struct
     FILEMAP_DATAMAP node;
 } FILEMAP_POSHASHLINKMAP_ELEMENT;
 
+/**
+ * 多进程共享区，位于定义段中，仅FILEMAP_FLAG_SHARED方式使用；
+ * 由第一个打开文件的进程初始化
+ */
+typedef struct 
+{
+    int nMagic;
+    pthread_mutex_t mutex_write;    // 各进程的写操作互斥，持有者退出后可恢复
+    unsigned int auBucketSeq[FILEMAP_BUCKET_LOCK_NUM];  // 各段的版本号
+} FILEMAP_SECTION_SHARED;
+
+/* 空位栈头部，栈中为空闲的索引，栈顶为下一个分配的位置 */
+typedef struct 
+{
+    int nDataFreeNum;       // 数据段空位栈的元素个数
+    int nHashlinkFreeNum;   // 位置哈希链表空位栈的元素个数
+    int nKeyFreeNum;        // 键段空位栈的元素个数，字符串键格式下没有
+} FILEMAP_SECTION_FREELIST_HEAD;
+
 /* 数据段元素 */
 typedef struct 
 {
     FILEMAP_VALUE value;
 } FILEMAP_SECTION_DATA_ELEMENT;
 
+/**
+ * 扩容后的迁移进度，位于新的索引段末尾，其后为旧哈希表每个位置一个字节的已迁移标记；
+ * nCursor之前的位置都已迁移
+ */
+typedef struct 
+{
+    int nCursor;
+} FILEMAP_SECTION_MIGRATE_HEAD;
+
+/* 文件中一段数据在内存中的副本，扩容时整体替换，不加锁的读取根据其中的位置判断是否可用 */
+typedef struct 
+{
+    FILEMAP_SEGMENT seg;
+    char byteData[];
+} FILEMAP_SEG_CACHE;
+
+/* 重建空位栈时，迁移期间旧索引中的项所占用的位置 */
+typedef struct 
+{
+    BITMAP_HANDLE hBitmapData;
+    BITMAP_HANDLE hBitmapKey;
+    int *pnUnit;        // 有存储区时为各项的存储单元
+    int nUnitNum;
+    int nUnitMax;
+} FILEMAP_RECOVER_STATE;
+
+/**
+ * 变长值存储区头部，位于数据段开头；空闲链表中为块的单元位置，
+ * nTopUnit之后的单元尚未分配过。全为0时为空的存储区
+ */
+typedef struct 
+{
+    int nTopUnit;
+    int anFreeHead[FILEMAP_HEAP_CLASS_NUM];
+} FILEMAP_SECTION_HEAP_HEAD;
+
+/* 存储区中的块头部，其后为值 */
+typedef struct 
+{
+    int nClass;
+    int nLen;   // 值的长度；空闲时为链表中下一个块的位置
+} FILEMAP_HEAP_CHUNK_HEAD;
+
+/**
+ * 日志记录头部，每次操作一条记录，其后依次为nWriteNum个FILEMAP_WAL_WRITE
+ * 和nDataSize字节的数据；校验和计算时uChecksum为0
+ */
+typedef struct 
+{
+    unsigned int uMagic;
+    int nWriteNum;
+    int nDataSize;
+    unsigned int uChecksum;
+} FILEMAP_WAL_RECORD_HEAD;
+
+/* 日志中的一次写入 */
+typedef struct 
+{
+    long long llPos;    // 在文件中的位置
+    int nSize;
+    int nReserved;
+} FILEMAP_WAL_WRITE;
+
+/* 旧版本日志中的一次写入，记录头部为FILEMAP_WAL_MAGIC_V1 */
+typedef struct 
+{
+    int nPos;
+    int nSize;
+} FILEMAP_WAL_WRITE_V1;
+
+/* 日志中的空位 */
+typedef struct 
+{
+    int nWhich;
+    int nIndex;
+} FILEMAP_WAL_SLOT;
+
 /* 主对象 */
 typedef struct 
 {
     MEM2FILE_HANDLE hMem2File;
     int nMaxFileNum;
-    pthread_mutex_t mutex_entrance_call;
+    int nHeapUnitNum;   // 变长值存储区的单元数，为0时为固定大小方式
+    int nKeyFormat;     // FILEMAP_KEYFORMAT_*
+    int nNodeSize;      // 文件中哈希表和哈希链表的元素大小
+    int nHashType;      // FILEMAP_HASH_*
+    unsigned long long ullHashSeed;
+    int nIndexLayout;   // FILEMAP_INDEX_*
+    int nFlags;
+
+    /**
+     * 锁的顺序：入口锁 -> 分段锁 -> 索引锁 -> 借用锁 -> 分配锁
+     * 入口锁在关闭等整体操作时独占，其余调用共享；
+     * 同一个哈希表位置上的读写由分段锁互斥，不同位置的读写可以并行；
+     * 开放寻址方式下，新增的项可能占用其他分段的探测路径上的位置，写操作另外由索引锁互斥
+     */
+    pthread_rwlock_t rwlock_entrance_call;
+    pthread_rwlock_t rwlock_bucket[FILEMAP_BUCKET_LOCK_NUM];
+
+    /**
+     * 各段的版本号，写操作持有分段锁期间为奇数，结束后为偶数；
+     * 查询不加锁，读取前后版本号相同且为偶数则结果有效。
+     * 多进程共享方式下使用共享区中的版本号
+     */
+    unsigned int auBucketSeq[FILEMAP_BUCKET_LOCK_NUM];
+    unsigned int *puBucketSeq;
+
+    /**
+     * 多进程共享方式下，写操作和加锁读取改用共享区中的锁；
+     * fdShared持有文件的共享flock，表示本进程正在使用该文件
+     */
+    FILEMAP_SECTION_SHARED *psShared;
+    int fdShared;
+    pthread_mutex_t mutex_index;    // 开放寻址方式下的写操作
+    pthread_mutex_t mutex_pin;      // 借用状态
+    pthread_mutex_t mutex_alloc;    // 空位栈、内存中的比特表和变长值存储区的分配
+
+    FILEMAP_GLOBAL_MAP sGMap;   // 各段地图
+
+    /**
+     * 索引段和空位栈在内存中的副本，修改时同时写入文件；映射方式下不需要，为NULL。
+     * 扩容时替换，不加锁的读取可能仍在使用被替换的副本，关闭时才释放
+     */
+    FILEMAP_SEG_CACHE *psIndexCache;
+    FILEMAP_SEG_CACHE *psFreeListCache;
+    FILEMAP_SEG_CACHE *psOldIndexCache;  // 扩容前的索引段，迁移期间查找
+    FILEMAP_SEG_CACHE *apsRetiredCache[2 * FILEMAP_GROW_MAX];
+    int nRetiredCacheNum;
+
+    /**
+     * 扩容后从旧索引迁移到新索引，迁移期间旧索引只读，查找时旧索引中未迁移的位置优先；
+     * 写操作与其他调用并行，修改key之前先迁移key在旧索引中所在的位置，再顺带迁移FILEMAP_GROW_STEP个位置，
+     * 每一项在其所在段的写锁下迁移。扩容只在切换各段地图时独占入口锁，期间版本号为奇数，
+     * 不加锁的读取同时检查该版本号和段的版本号
+     */
+    int nOldMaxFileNum;
+    int bMigrating;
+    unsigned int uGrowSeq;
+    pthread_mutex_t mutex_grow;     // 扩容之间互斥
+    pthread_mutex_t mutex_migrate;  // 迁移进度，同一时间只有一个线程顺序迁移
+    int anGrowFreeMark[FILEMAP_FREELIST_KEY + 1];  // 扩容准备期间各空位栈计数的最小值，之下的元素不变；不记录时为-1
+
+    /* 比特表在内存中的副本，由空位栈建立，用于校验，关闭时写回文件 */
+    BITMAP_HANDLE hBitmapData;
+    BITMAP_HANDLE hBitmapHashlink;
+
+    /* 借用状态，首次借用时分配 */
+    int *pnPinCount;        // 各数据项被借用的次数
+    char *pbFreePending;    // 各数据项是否等待归还后释放
+
+    /* 日志文件，FILEMAP_FLAG_WAL方式下打开，否则为-1 */
+    int fdWal;
+    int nWalPending;    // 已写入日志但尚未写入文件的操作数，为0时才能清空日志
+
+    /**
+     * 持久化方式，写操作依次编号，ullSyncDone及之前的写操作已写磁盘；
+     * 同一时间只有一个线程写磁盘，其余等待的写操作由它一起完成。
+     * 写磁盘锁保护以下状态，以及日志的写入和清空
+     */
+    int nDurability;
+    int nSyncIntervalMs;
+    unsigned long long ullSyncReq;
+    unsigned long long ullSyncDone;
+    int bSyncing;
+    int bSyncThread;    // 是否有后台写磁盘线程
+    int bSyncStop;
+    pthread_t thread_sync;
+    pthread_mutex_t mutex_sync;
+    pthread_cond_t cond_sync;   // 写磁盘完成，或后台线程需要退出
 } FILEMAP_OBJ;
 
+/* 扩容准备好的新状态，切换时替换实例中的对应部分 */
+typedef struct 
+{
+    FILEMAP_SECTION_DEF sDef;
+    FILEMAP_GLOBAL_MAP sGMap;
+    FILEMAP_SEG_CACHE *psIndexCache;
+    FILEMAP_SEG_CACHE *psFreeListCache;
+    BITMAP_HANDLE hBitmapData;
+    BITMAP_HANDLE hBitmapHashlink;
+    char *pBitmapMem;       // 复制比特表的缓冲区
+    int *pnPinCount;
+    char *pbFreePending;
+} FILEMAP_GROW_STATE;
+
+/* filemap_multiget中的一个key */
+typedef struct 
+{
+    FILEMAP_KEYREF sKey;
+    int nKey;       // 在调用者的数组中的位置
+    int nUnit;      // 在哈希表中的位置
+    long long llPos;    // 找到后为数据在文件中的位置，变长方式下为存储单元
+} FILEMAP_MULTIGET_REQ;
+
+/* 批量写入期间已修改内存副本、尚未写入文件的一段 */
+typedef struct 
+{
+    long long llPos;
+    int nSize;
+} FILEMAP_BATCH_RANGE;
+
+typedef struct 
+{
+    FILEMAP_OBJ *pObj;
+    int bWhole;         // 为1时不记录范围，结束时整个写入索引段和空位栈的内存副本
+    int nRangeNum;
+    FILEMAP_BATCH_RANGE asRange[FILEMAP_BATCH_RANGE_MAX];
+} FILEMAP_BATCH;
+
+/* 遍历中的一项：数据段中的位置（变长方式下为存储单元）和哈希表中的位置 */
+typedef struct 
+{
+    int nIndex;
+    int nUnit;
+    unsigned int uHash;
+} FILEMAP_ITER_ENTRY;
+
+typedef struct 
+{
+    FILEMAP_OBJ *pObj;
+    int nMaxFileNum;            // 打开时的数量，扩容后不能继续
+    FILEMAP_ITER_ENTRY *psEntry;  // 按数据位置排序
+    int nEntryNum;
+    int nEntryMax;
+    int nNext;
+
+    char *pBuffer;              // 顺序读取的一段数据
+    int nBufferSize;
+    long long llBufferPos;
+    int nBufferLen;
+    int nBufferedLen;           // 最近一次从缓冲区中取得的值的长度
+    unsigned int auSeq[FILEMAP_BUCKET_LOCK_NUM];  // 读取缓冲区前各段的版本号
+} FILEMAP_ITER;
+
+/* 遍历哈希表一个位置时的参数 */
+typedef struct 
+{
+    FILEMAP_ITER *psIter;
+    int nUnit;
+    int nIndex;                 // 要找的数据位置
+    int bFound;
+    FILEMAP_DATAMAP sNode;
+} FILEMAP_ITER_WALK;
+
+/* 并行遍历的一个线程 */
+typedef struct 
+{
+    FILEMAP_ITER sIter;         // 共用打开时记录的项，只遍历其中连续的一段
+    int (*pfnCallback)(void *pCtx, const void *pKey, int nKeyLen, const void *pData, int nLen);
+    void *pCtx;
+    int *pbStop;                // 所有线程共用，出错或回调函数要求停止时置1
+    int nResult;                // 0为遍历完成，1为回调函数要求停止，-1为失败
+    pthread_t thread;
+} FILEMAP_FOREACH_WORKER;
+
+/* 按新的数量重建文件时的状态 */
+typedef struct 
+{
+    FILEMAP_OBJ *pNew;
+    char *pValue;       // 读取旧文件中的值的缓冲区
+    int nValueSize;
+    int nItemNum;       // 已写入新文件的项数
+} FILEMAP_MIGRATE_STATE;
+
+/**
+ * 一次操作对索引的修改，提交前只记录在这里，提交时写入日志后再写入文件；
+ * 空位的分配立即生效，释放推迟到提交之后，放弃时归还分配的空位
+ */
+typedef struct 
+{
+    FILEMAP_OBJ *pObj;
+
+    int nWriteNum;
+    FILEMAP_WAL_WRITE asWrite[FILEMAP_WAL_WRITE_MAX];
+    int nDataSize;
+    char byteData[FILEMAP_WAL_DATA_MAX];
+
+    int nPopNum;
+    FILEMAP_WAL_SLOT asPop[FILEMAP_WAL_SLOT_MAX];
+    int nPushNum;
+    FILEMAP_WAL_SLOT asPush[FILEMAP_WAL_SLOT_MAX];
+} FILEMAP_WAL_TXN;
+
+/* 非映射方式下借出的值的拷贝 */
+typedef struct 
+{
+    int nIndex; // 该项在数据段中的索引位置
+    FILEMAP_VALUE value;
+} FILEMAP_BORROWED_COPY;
+
+
+/************ VARIABLES ************/
+
+/* 本线程正在进行的操作，同一时间一个线程只会在一个实例上进行一次写操作 */
+static __thread FILEMAP_WAL_TXN *s_pWalTxn = NULL;
+
+/* 本线程正在进行的批量写入 */
+static __thread FILEMAP_BATCH *s_pBatch = NULL;
+
+/* 存储区各级块的单元数，相邻两级相差约1.5倍，块内浪费不超过1/3 */
+static const int s_anHeapClassUnit[FILEMAP_HEAP_CLASS_NUM] = {
+    1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 
+    192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384,
+};
 
 /************ FUNCTION_DELARATION ************/
 static int filemap_get_defseg (MEM2FILE_HANDLE hMem2File, FILEMAP_SECTION_DEF *psDef);
 static int filemap_set_defseg (MEM2FILE_HANDLE hMem2File, const FILEMAP_SECTION_DEF *psDef);
 static int filemap_check_version (MEM2FILE_HANDLE hMem2File);
-static int filemap_check_compatibility (MEM2FILE_HANDLE hMem2File, int nMaxFileNum);
-static int filemap_init_defsec (MEM2FILE_HANDLE hMem2File, int nMaxFileNum);
-static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum);
+static int filemap_check_compatibility (MEM2FILE_HANDLE hMem2File, const FILEMAP_SECTION_DEF *psDef);
+static int filemap_init_defsec (MEM2FILE_HANDLE hMem2File, const FILEMAP_SECTION_DEF *psDef);
+static FILEMAP_HANDLE filemap_init_file (const char *szFileName, const FILEMAP_SECTION_DEF *psDef, int nFlags);
 static int filemap_close_file (FILEMAP_HANDLE hInstance);
-static int filemap_file_existitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key);
-static int filemap_getsegmap (int nMaxFileNum, FILEMAP_GLOBAL_MAP *psMap);
-static int filemap_scanfirstemptybit (const char *pMem, int size, int *pnIndex);
-static int filemap_setbitofmem (char *pMem, int nSize, int nIndex, int bitValue);
-static int filemap_file_scanfirstemptybit (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nPos, int nSize, int *pnIndex);
-static int filemap_file_setbitmap (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nPos, int nSize, int nIndex, int bBit);
-static int filemap_file_getposhashmapitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, FILEMAP_POSHASHMAP_ELEMENT *pEle);
-static int filemap_file_setposhashmapitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, const FILEMAP_POSHASHMAP_ELEMENT *pEle);
-static int filemap_file_getposhashlinkitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, FILEMAP_POSHASHLINKMAP_ELEMENT *pEle);
-static int filemap_file_setposhashlinkitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, const FILEMAP_POSHASHLINKMAP_ELEMENT *pEle);
-static int filemap_file_getdatasegitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, FILEMAP_SECTION_DATA_ELEMENT *pElem);
-static int filemap_file_setdatasegitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, const FILEMAP_SECTION_DATA_ELEMENT *pElem);
-static int filemap_file_getdatamap(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key, FILEMAP_DATAMAP *map);
-static int filemap_file_adddatamap(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_DATAMAP *map);
-static int filemap_file_deldatamap(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key);
-static int filemap_hashmap_getindex (int nMaxFileNum, const FILEMAP_KEY *key);
-static int filemap_keycmp (const FILEMAP_KEY *keyA, const FILEMAP_KEY *keyB);
+static int filemap_file_existitem (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key);
+static int filemap_getsegmap (const FILEMAP_SECTION_DEF *psDef, FILEMAP_GLOBAL_MAP *psMap);
+static long long filemap_getindexmap (const FILEMAP_SECTION_DEF *psDef, int nMaxFileNum, int nPrevNum, 
+                long long llPos, FILEMAP_INDEX_MAP *psMap);
+static long long filemap_getfreelistmap (const FILEMAP_SECTION_DEF *psDef, int nMaxFileNum, 
+                long long llPos, FILEMAP_FREELIST_MAP *psMap);
+static int filemap_index_getnode (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nNum, 
+                int bLink, int nIndex, FILEMAP_DATAMAP *psNode);
+static int filemap_index_find (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nNum, 
+                const FILEMAP_KEYREF *key, int *pnUnit, FILEMAP_DATAMAP *pMap);
+static long long filemap_data_getpos (FILEMAP_OBJ *pObj, int nIndex);
+static long long filemap_key_getpos (FILEMAP_OBJ *pObj, int nKeyIndex);
+static int filemap_file_getposhashmapitem (FILEMAP_OBJ *pObj, int nIndex, FILEMAP_POSHASHMAP_ELEMENT *pEle);
+static int filemap_file_setposhashmapitem (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_POSHASHMAP_ELEMENT *pEle);
+static int filemap_file_getposhashlinkitem (FILEMAP_OBJ *pObj, int nIndex, FILEMAP_POSHASHLINKMAP_ELEMENT *pEle);
+static int filemap_file_setposhashlinkitem (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_POSHASHLINKMAP_ELEMENT *pEle);
+static int filemap_file_getdatasegitem (FILEMAP_OBJ *pObj, int nIndex, FILEMAP_SECTION_DATA_ELEMENT *pElem);
+static int filemap_file_setdatasegitem (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_SECTION_DATA_ELEMENT *pElem);
+static int filemap_file_getdatasegrange (FILEMAP_OBJ *pObj, int nIndex, int nOffset, void *pData, int nSize);
+static int filemap_file_setdatasegrange (FILEMAP_OBJ *pObj, int nIndex, int nOffset, const void *pData, int nSize);
+static int filemap_file_getdatamap(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_DATAMAP *map);
+static int filemap_file_adddatamap(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_DATAMAP *map);
+static int filemap_file_deldatamap(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key);
+static int filemap_hashmap_getindex (int nMaxFileNum, unsigned int uHash);
+static int filemap_keycmp (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap, const FILEMAP_KEYREF *key);
 static int filemap_getdefsegmap (FILEMAP_DEF_MAP *psMap);
-static int filemap_file_getitem(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key, FILEMAP_VALUE *value);
-static int filemap_file_setitem(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key, const FILEMAP_VALUE *value);
-static int filemap_file_deleteitem(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key);
+static int filemap_file_getitem(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_VALUE *value);
+static int filemap_multiget_unitcmp (const void *pA, const void *pB);
+static int filemap_multiget_poscmp (const void *pA, const void *pB);
+static int filemap_file_multiget (FILEMAP_OBJ *pObj, FILEMAP_MULTIGET_REQ *psReq, int nNum, 
+                FILEMAP_VALUE *pValues, int *pnStatus);
+static int filemap_file_setitem(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_VALUE *value);
+static int filemap_file_deleteitem(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key);
+static int filemap_file_getrange(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int nOffset, void *pData, int nSize);
+static int filemap_file_setrange(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int nOffset, const void *pData, int nSize);
 static int filemap_entrancecall_lock (FILEMAP_HANDLE hInstance);
+static int filemap_entrancecall_lockexclusive (FILEMAP_HANDLE hInstance);
 static int filemap_entrancecall_unlock (FILEMAP_HANDLE hInstance);
-static int filemap_file_generateinfo (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const char *szFileName);
+static int filemap_bucket_getlock (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key);
+static int filemap_bucket_lock (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int bWrite);
+static int filemap_bucket_unlock (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int bWrite);
+static int filemap_bucket_lockset (FILEMAP_OBJ *pObj, const unsigned char *pbyteLock);
+static int filemap_bucket_unlockset (FILEMAP_OBJ *pObj, const unsigned char *pbyteLock);
+static int filemap_bucket_readbegin (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, unsigned long long *pullSeq);
+static int filemap_bucket_readend (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, unsigned long long ullSeq);
+static int filemap_shared_enter (const char *szFileName, int *pbFirstProcess);
+static int filemap_shared_leave (int fdShared);
+static int filemap_shared_attach (FILEMAP_OBJ *pObj, int bFirstProcess);
+static int filemap_shared_lock (FILEMAP_OBJ *pObj);
+static int filemap_shared_unlock (FILEMAP_OBJ *pObj);
+static int filemap_file_generateinfo (FILEMAP_OBJ *pObj, const char *szFileName);
+static int filemap_indexcache_load (FILEMAP_OBJ *pObj);
+static int filemap_file_getindexdata (FILEMAP_OBJ *pObj, long long llPos, void *pData, int nSize);
+static int filemap_bitmap_load (FILEMAP_OBJ *pObj);
+static int filemap_bitmap_sync (FILEMAP_OBJ *pObj);
+static char *filemap_indexcache_find (FILEMAP_OBJ *pObj, long long llPos, int nSize);
+static FILEMAP_SEG_CACHE *filemap_indexcache_read (FILEMAP_OBJ *pObj, const FILEMAP_SEGMENT *psSeg);
+static int filemap_indexcache_retire (FILEMAP_OBJ *pObj, FILEMAP_SEG_CACHE *psCache);
+static int filemap_freelist_getpos (FILEMAP_OBJ *pObj, int nWhich, long long *pllCountPos, long long *pllStackPos);
+static int filemap_freelist_rebuild (FILEMAP_OBJ *pObj);
+static int filemap_freelist_pop_nolock (FILEMAP_OBJ *pObj, int nWhich, int *pnIndex);
+static int filemap_freelist_push_nolock (FILEMAP_OBJ *pObj, int nWhich, int nIndex);
+static int filemap_freelist_pop (FILEMAP_OBJ *pObj, int nWhich, int *pnIndex);
+static int filemap_freelist_push (FILEMAP_OBJ *pObj, int nWhich, int nIndex);
+static int filemap_file_setindexdata (FILEMAP_OBJ *pObj, long long llPos, const void *pData, int nSize);
+static int filemap_pin_init (FILEMAP_OBJ *pObj);
+static int filemap_pin_ispinned (FILEMAP_OBJ *pObj, int nIndex);
+static int filemap_file_freedataslot (FILEMAP_OBJ *pObj, int nIndex);
+static int filemap_file_getdatasegaddr (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_SECTION_DATA_ELEMENT **ppElem);
+static int filemap_file_acquireitem (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_VALUE **ppValue);
+static int filemap_file_releaseitem (FILEMAP_OBJ *pObj, const FILEMAP_VALUE *pValue);
+static int filemap_freelist_store (FILEMAP_OBJ *pObj, int nWhich, BITMAP_HANDLE hBitmap);
+static int filemap_freelist_recover (FILEMAP_OBJ *pObj);
+static int filemap_wal_open (const char *szFileName, int bCreate);
+static unsigned int filemap_wal_checksum (const FILEMAP_WAL_RECORD_HEAD *psHead, const char *pBody, int nBodySize);
+static int filemap_wal_replay (int fdWal, MEM2FILE_HANDLE hMem2File, int *pnRecordNum);
+static int filemap_wal_checkpoint (FILEMAP_OBJ *pObj);
+static FILEMAP_WAL_TXN *filemap_wal_gettxn (FILEMAP_OBJ *pObj);
+static int filemap_wal_begin (FILEMAP_OBJ *pObj, FILEMAP_WAL_TXN *pTxn);
+static int filemap_wal_record (FILEMAP_WAL_TXN *pTxn, long long llPos, const void *pData, int nSize);
+static int filemap_wal_overlay (FILEMAP_WAL_TXN *pTxn, long long llPos, void *pData, int nSize);
+static int filemap_wal_commit (FILEMAP_OBJ *pObj, FILEMAP_WAL_TXN *pTxn);
+static int filemap_wal_abort (FILEMAP_OBJ *pObj, FILEMAP_WAL_TXN *pTxn);
+static int filemap_batch_begin (FILEMAP_OBJ *pObj, FILEMAP_BATCH *psBatch, int bWhole);
+static FILEMAP_BATCH *filemap_batch_get (FILEMAP_OBJ *pObj);
+static int filemap_batch_record (FILEMAP_BATCH *psBatch, long long llPos, int nSize);
+static int filemap_batch_rangecmp (const void *pA, const void *pB);
+static int filemap_batch_flush (FILEMAP_BATCH *psBatch);
+static int filemap_batch_end (FILEMAP_OBJ *pObj, FILEMAP_BATCH *psBatch);
+static int filemap_multiwrite (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, 
+                const FILEMAP_VALUE *pValues, int *pnStatus, int bDelete);
+static int filemap_sync_file (FILEMAP_OBJ *pObj);
+static int filemap_sync_wait (FILEMAP_OBJ *pObj, unsigned long long ullSeq);
+static int filemap_sync_afterwrite (FILEMAP_OBJ *pObj);
+static void *filemap_sync_thread (void *pArg);
+static int filemap_sync_stopthread (FILEMAP_OBJ *pObj);
+static int filemap_file_setdurability (FILEMAP_OBJ *pObj, int nMode, int nIntervalMs);
+static int filemap_heap_getclass (int nLen);
+static int filemap_heap_gethead (FILEMAP_OBJ *pObj, FILEMAP_SECTION_HEAP_HEAD *psHead);
+static int filemap_heap_sethead (FILEMAP_OBJ *pObj, const FILEMAP_SECTION_HEAP_HEAD *psHead);
+static int filemap_heap_getchunk (FILEMAP_OBJ *pObj, int nUnit, FILEMAP_HEAP_CHUNK_HEAD *psChunk);
+static int filemap_heap_push_nolock (FILEMAP_OBJ *pObj, FILEMAP_SECTION_HEAP_HEAD *psHead, int nUnit, int nClass);
+static int filemap_heap_carve_nolock (FILEMAP_OBJ *pObj, FILEMAP_SECTION_HEAP_HEAD *psHead, int nUnit, int nUnitNum);
+static int filemap_heap_alloc_nolock (FILEMAP_OBJ *pObj, int nClass, int *pnUnit);
+static int filemap_heap_free_nolock (FILEMAP_OBJ *pObj, int nUnit);
+static int filemap_heap_alloc (FILEMAP_OBJ *pObj, int nLen, int *pnUnit);
+static int filemap_heap_unitcmp (const void *pA, const void *pB);
+static int filemap_heap_rebuild (FILEMAP_OBJ *pObj, int *pnUnit, int nUnitNum);
+static int filemap_heap_getdatapos (FILEMAP_OBJ *pObj, int nUnit, long long *pllPos, int *pnLen);
+static int filemap_heap_getvalue (FILEMAP_OBJ *pObj, int nUnit, void *pData, int nSize, int *pnLen);
+static int filemap_heap_setvalue (FILEMAP_OBJ *pObj, int nUnit, const void *pData, int nLen);
+static int filemap_heap_getrange (FILEMAP_OBJ *pObj, int nUnit, int nOffset, void *pData, int nSize);
+static int filemap_heap_setrange (FILEMAP_OBJ *pObj, int nUnit, int nOffset, const void *pData, int nSize);
+static int filemap_file_getvalue (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, void *pData, int nSize, int *pnLen);
+static int filemap_file_setvalue (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const void *pData, int nLen);
+static int filemap_key_make (FILEMAP_OBJ *pObj, const void *pKey, int nKeyLen, FILEMAP_KEYREF *psKey);
+static int filemap_node_decode (FILEMAP_OBJ *pObj, const char *pNode, FILEMAP_DATAMAP *psMap);
+static int filemap_node_encode (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap, char *pNode);
+static int filemap_file_getkeyslot (FILEMAP_OBJ *pObj, int nKeyIndex, int nKeyLen, unsigned char *pKey);
+static int filemap_file_newkey (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_DATAMAP *psMap);
+static int filemap_file_freekey (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap);
+static BITMAP_HANDLE filemap_freelist_getbitmap (FILEMAP_OBJ *pObj, int nWhich);
+static int filemap_file_getnodekey (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap, unsigned char *pKey);
+static int filemap_key_format (const unsigned char *pKey, int nKeyLen, char *szOut, int nSize);
+static unsigned int filemap_node_gethash (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap);
+static unsigned int filemap_key_hash (FILEMAP_OBJ *pObj, const void *pKey, int nKeyLen);
+static unsigned long long filemap_hash_newseed (void);
+static unsigned char filemap_open_getctrl (unsigned int uHash);
+static void filemap_open_match (const unsigned char *pCtrl, int nNum, unsigned char byteCtrl, 
+                unsigned int *puMatch, unsigned int *puEmpty, unsigned int *puFree);
+static int filemap_open_find (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nMaxFileNum, 
+                const FILEMAP_KEYREF *key, int *pnSlot, FILEMAP_DATAMAP *pMap);
+static int filemap_open_findfree (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int *pnSlot);
+static int filemap_open_adddatamap (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_DATAMAP *map);
+static int filemap_open_deldatamap (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key);
+static int filemap_grow_load (FILEMAP_OBJ *pObj);
+static int filemap_grow_ismigrated (FILEMAP_OBJ *pObj, int nUnit);
+static int filemap_grow_find (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_DATAMAP *pMap);
+static int filemap_grow_ismoved (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, 
+                unsigned char *pbyteKey, FILEMAP_KEYREF *key);
+static int filemap_grow_moveentry (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode);
+static int filemap_index_walkunit (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nNum, int nUnit, 
+                int (*pfnVisit)(FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg), void *pArg);
+static int filemap_grow_visitmove (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg);
+static int filemap_grow_moveunit (FILEMAP_OBJ *pObj, int nUnit);
+static int filemap_grow_visitrecover (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg);
+static int filemap_grow_step (FILEMAP_OBJ *pObj, int nStepNum, int bWait);
+static int filemap_grow_migrate (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key);
+static int filemap_grow_finish (FILEMAP_OBJ *pObj);
+static int filemap_grow_setdata (FILEMAP_OBJ *pObj, FILEMAP_SEG_CACHE *psCache, long long llPos, 
+                const void *pData, int nSize);
+static int filemap_grow_extend (FILEMAP_OBJ *pObj, long long llNewSize);
+static int filemap_grow_preparefreelist (FILEMAP_OBJ *pObj, const FILEMAP_GLOBAL_MAP *psNewMap, int nNewNum);
+static int filemap_grow_storefreelist (FILEMAP_OBJ *pObj, const FILEMAP_GLOBAL_MAP *psNewMap, int nNewNum, 
+                FILEMAP_SEG_CACHE *psCache);
+static int filemap_grow_prepare (FILEMAP_OBJ *pObj, int nNewNum, FILEMAP_GROW_STATE *psState);
+static int filemap_grow_switch (FILEMAP_OBJ *pObj, FILEMAP_GROW_STATE *psState);
+static void filemap_grow_release (FILEMAP_OBJ *pObj, FILEMAP_GROW_STATE *psState);
+static int filemap_migrate_check (const char *szFileName, const FILEMAP_SECTION_DEF *psDef, 
+                FILEMAP_SECTION_DEF *psOldDef);
+static int filemap_migrate_visit (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg);
+static int filemap_migrate_file (const char *szFileName, const FILEMAP_SECTION_DEF *psDef, 
+                const FILEMAP_OPTION *psOption);
+static int filemap_migrate_syncdir (const char *szFileName);
+static int filemap_iter_visitcollect (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg);
+static int filemap_iter_visitfind (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg);
+static int filemap_iter_entrycmp (const void *pA, const void *pB);
+static int filemap_iter_fill (FILEMAP_ITER *psIter, long long llPos);
+static int filemap_iter_locate (FILEMAP_ITER *psIter, const FILEMAP_ITER_ENTRY *psEntry, const char **ppBuffered);
+static int filemap_iter_load (FILEMAP_OBJ *pObj, FILEMAP_ITER *psIter);
+static int filemap_iter_step (FILEMAP_ITER *psIter, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen);
+static void *filemap_foreach_thread (void *pArg);
+static int filemap_bulkload_file (FILEMAP_OBJ *pObj, const FILEMAP_OPTION *psOption, 
+                int (*pfnSource)(void *pArg, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen), 
+                void *pArg, int *pnItemNum);
 
 /************ STATIC FUNCS ************/
 
@@ -196,30 +852,31 @@ static int filemap_get_defseg (MEM2FILE_HANDLE hMem2File, FILEMAP_SECTION_DEF *p
         return -1;
     }
 
-    const int nSegDefPos = sMap.seg.pos;
-    const int nSegDefSize = sMap.seg.size;
+    const long long llSegDefPos = sMap.seg.pos;
+    const long long llSegDefSize = sMap.seg.size;
 
-    int nFileSize = 0;
-    if (mem2file_size(hMem2File, &nFileSize) < 0)
+    long long llFileSize = 0;
+    if (mem2file_size(hMem2File, &llFileSize) < 0)
     {
         _error ("get size failed\n");
         return -1;
     }
 
-    if (nFileSize < nSegDefSize)
+    if (llFileSize < llSegDefSize)
     {
         _error ("size too small\n");
         return -1;
     }
 
-    if (mem2file_getdata(hMem2File, nSegDefPos, psDef, sizeof(FILEMAP_SECTION_DEF)) < 0)
+    if (mem2file_getdata(hMem2File, llSegDefPos, psDef, sizeof(FILEMAP_SECTION_DEF)) < 0)
     {
         _error ("get def sec failed\n");
         return -1;
     }
 
-    _debug ("head=<pos=%d,ver=%s,maxfilenum=%d>\n", 
-        nSegDefPos, psDef->szVersion, psDef->nMaxFileNum);
+    _debug ("head=<pos=%lld,ver=%s,maxfilenum=%d,heapunitnum=%d,keyformat=%d,hashtype=%d,layout=%d,align=%d>\n", 
+        llSegDefPos, psDef->szVersion, psDef->nMaxFileNum, psDef->nHeapUnitNum, psDef->nKeyFormat, 
+        psDef->nHashType, psDef->nIndexLayout, psDef->nDataAlign);
 
     return 0;
 }
@@ -233,16 +890,16 @@ static int filemap_set_defseg (MEM2FILE_HANDLE hMem2File, const FILEMAP_SECTION_
         return -1;
     }
 
-    const int nSegDefSize = sMap.seg.size;
+    const long long llSegDefSize = sMap.seg.size;
 
-    int nFileSize = 0;
-    if (mem2file_size(hMem2File, &nFileSize) < 0)
+    long long llFileSize = 0;
+    if (mem2file_size(hMem2File, &llFileSize) < 0)
     {
         _error ("get size failed\n");
         return -1;
     }
 
-    if (nFileSize < nSegDefSize)
+    if (llFileSize < llSegDefSize)
     {
         _error ("size too small\n");
         return -1;
@@ -259,7 +916,7 @@ static int filemap_set_defseg (MEM2FILE_HANDLE hMem2File, const FILEMAP_SECTION_
 
 /**
  * @brief 检查一个已有对象的版本号
- * @return 兼容返回0，否则返回-1
+ * @return 兼容返回0，可以就地升级返回1，否则返回-1
  */
 static int filemap_check_version (MEM2FILE_HANDLE hMem2File)
 {
@@ -270,7 +927,16 @@ static int filemap_check_version (MEM2FILE_HANDLE hMem2File)
         return -1;
     }
 
-    if (strcmp (sDef.szVersion, FILEMAP_VERSION) != 0)
+    if (strcmp (sDef.szVersion, FILEMAP_VERSION_V10) == 0)
+    {
+        _info ("old version, <%s,%s>\n", sDef.szVersion, FILEMAP_VERSION_V11);
+        return 1;
+    }
+
+    if (strcmp (sDef.szVersion, FILEMAP_VERSION) != 0 && strcmp (sDef.szVersion, FILEMAP_VERSION_V11) != 0 &&
+            strcmp (sDef.szVersion, FILEMAP_VERSION_V12) != 0 && strcmp (sDef.szVersion, FILEMAP_VERSION_V21) != 0 &&
+            strcmp (sDef.szVersion, FILEMAP_VERSION_V22) != 0 && strcmp (sDef.szVersion, FILEMAP_VERSION_V23) != 0 &&
+            strcmp (sDef.szVersion, FILEMAP_VERSION_V24) != 0)
     {
         _info ("version not same, <%s,%s>\n", sDef.szVersion, FILEMAP_VERSION);
         return -1;
@@ -281,9 +947,10 @@ static int filemap_check_version (MEM2FILE_HANDLE hMem2File)
 
 /**
  * @brief 检查与旧文件的兼容性
+ * @param psDef 新的设置，为NULL时从旧文件加载，总是兼容
  * @return 兼容返回0，否则返回-1
  */
-static int filemap_check_compatibility (MEM2FILE_HANDLE hMem2File, int nMaxFileNum)
+static int filemap_check_compatibility (MEM2FILE_HANDLE hMem2File, const FILEMAP_SECTION_DEF *psDef)
 {
     FILEMAP_SECTION_DEF sDef = {};
     if (filemap_get_defseg (hMem2File, & sDef) < 0)
@@ -292,7 +959,7 @@ static int filemap_check_compatibility (MEM2FILE_HANDLE hMem2File, int nMaxFileN
         return -1;
     }
     
-    if (nMaxFileNum != -1 && sDef.nMaxFileNum != nMaxFileNum)
+    if (psDef != NULL && (sDef.nMaxFileNum != psDef->nMaxFileNum || sDef.nHeapUnitNum != psDef->nHeapUnitNum))
     {
         return -1;
     }
@@ -303,35 +970,59 @@ static int filemap_check_compatibility (MEM2FILE_HANDLE hMem2File, int nMaxFileN
 /**
  * @brief 填充定义区信息
  */
-static int filemap_init_defsec (MEM2FILE_HANDLE hMem2File, int nMaxFileNum)
+static int filemap_init_defsec (MEM2FILE_HANDLE hMem2File, const FILEMAP_SECTION_DEF *psDef)
 {
     FILEMAP_GLOBAL_MAP sGMap = {};
-    if (filemap_getsegmap (nMaxFileNum, &sGMap) < 0)
+    if (filemap_getsegmap (psDef, &sGMap) < 0)
     {
         _error ("get seg map failed\n");
         return -1;
     }
 
-    const int nSegDefSize = sGMap.seg_def.seg.size;
-    // const int nSegIndexSize = sGMap.seg_index.seg.size;
+    const long long llSegDefSize = sGMap.seg_def.seg.size;
+    // const long long llSegIndexSize = sGMap.seg_index.seg.size;
 
-    int nFileSize = 0;
-    if (mem2file_size(hMem2File, &nFileSize) < 0)
+    long long llFileSize = 0;
+    if (mem2file_size(hMem2File, &llFileSize) < 0)
     {
         _error ("get size failed\n");
         return -1;
     }
 
-    if (nFileSize < nSegDefSize)
+    if (llFileSize < llSegDefSize)
     {
         _error ("size too small\n");
         return -1;
     }
 
+    /* 字符串键格式的文件仍写V1.1/V1.2，写这两个版本的程序可以继续使用；写V1.0的程序不能读取 */
     FILEMAP_SECTION_DEF sDef = {
         FILEMAP_VERSION,
-        nMaxFileNum,
+        psDef->nMaxFileNum,
+        psDef->nHeapUnitNum,
+        psDef->nKeyFormat,
+        psDef->nHashType,
+        psDef->ullHashSeed,
+        psDef->nIndexLayout,
     };
+    sDef.nDataAlign = psDef->nDataAlign;
+    if (FILEMAP_INDEX_OPEN == psDef->nIndexLayout)
+    { /* 旧版本的程序不能读取 */
+        strncpy (sDef.szVersion, FILEMAP_VERSION_V21, sizeof(sDef.szVersion) - 1);
+    }
+    if (FILEMAP_KEYFORMAT_STRING == psDef->nKeyFormat)
+    {
+        strncpy (sDef.szVersion, psDef->nHeapUnitNum > 0 ? FILEMAP_VERSION_V12 : FILEMAP_VERSION_V11, 
+                    sizeof(sDef.szVersion) - 1);
+    }
+    if (sGMap.seg.size > INT_MAX)
+    { /* 超过2GB的文件中的位置需要64位，旧版本的程序不能读取 */
+        strncpy (sDef.szVersion, FILEMAP_VERSION_V23, sizeof(sDef.szVersion) - 1);
+    }
+    if (sDef.nDataAlign > 0)
+    { /* 数据段的位置与未对齐时不同，旧版本的程序不能读取 */
+        strncpy (sDef.szVersion, FILEMAP_VERSION_V24, sizeof(sDef.szVersion) - 1);
+    }
 
     if (filemap_set_defseg (hMem2File, &sDef) < 0)
     {
@@ -345,19 +1036,63 @@ static int filemap_init_defsec (MEM2FILE_HANDLE hMem2File, int nMaxFileNum)
 /**
  * @brief 根据给定的文件名，创建一个已经初始化了的文件映射，并
  * 返回文件映射句柄
- * @param nMaxFileNum 最大文件数量，如果为-1，则从旧文件加载
+ * @param psDef 最大文件数量和存储区大小，如果为NULL，则从旧文件加载
+ * @param nFlags 工作方式，FILEMAP_FLAG_*
  * @note 单进单出
  */
-static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum)
+static FILEMAP_HANDLE filemap_init_file (const char *szFileName, const FILEMAP_SECTION_DEF *psDef, int nFlags)
 {
     int bError = 0;
 
+    FILEMAP_SECTION_DEF sDef = {};
+    if (psDef != NULL)
+    {
+        sDef = *psDef;
+    }
+    else 
+    {
+        sDef.nMaxFileNum = -1;
+    }
+
+    if (nFlags & FILEMAP_FLAG_SHARED)
+    { /* 各进程通过映射共享索引 */
+        nFlags |= FILEMAP_FLAG_MMAP;
+    }
+
+    if ((nFlags & FILEMAP_FLAG_DIRECT) && (nFlags & FILEMAP_FLAG_MMAP))
+    {
+        _error ("direct can not be used with mmap or shared, flags=%x\n", nFlags);
+        bError = 1;
+    }
+
+    /* 多进程共享方式下，与其他进程的初始化互斥 */
+    int fdShared = -1;
+    int bFirstProcess = 1;
+    if (0 == bError && (nFlags & FILEMAP_FLAG_SHARED))
+    {
+        fdShared = filemap_shared_enter (szFileName, &bFirstProcess);
+        if (fdShared < 0)
+        {
+            _error ("enter shared file failed\n");
+            bError = 1;
+        }
+    }
+
+    int nMem2FileFlags = 0;
+    if (nFlags & FILEMAP_FLAG_MMAP)
+    {
+        nMem2FileFlags |= MEM2FILE_FLAG_MMAP;
+    }
+    if (nFlags & FILEMAP_FLAG_DIRECT)
+    {
+        nMem2FileFlags |= MEM2FILE_FLAG_DIRECT;
+    }
 
     /* 文件转换为mem2file */
     MEM2FILE_HANDLE hMem2File = NULL;
     if (0 == bError)
     {
-        hMem2File = mem2file_create (szFileName);
+        hMem2File = mem2file_create_ex (szFileName, nMem2FileFlags);
         if (NULL == hMem2File)
         {
             _error ("create mem2file failed\n");
@@ -365,18 +1100,28 @@ static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum
         }
     }
 
+    /* 直接读写方式下，索引读取经过大小固定的缓冲池 */
+    if (0 == bError && (nFlags & FILEMAP_FLAG_DIRECT))
+    {
+        if (mem2file_setbufferpool (hMem2File, FILEMAP_DIRECT_POOL_SIZE) < 0)
+        {
+            _error ("set buffer pool failed\n");
+            bError = 1;
+        }
+    }
+
     /* 获取对象大小 */
-    int nOriginalFileSize = 0;
+    long long llOriginalFileSize = 0;
     if (0 == bError)
     {
-        if (mem2file_size(hMem2File, &nOriginalFileSize) < 0)
+        if (mem2file_size(hMem2File, &llOriginalFileSize) < 0)
         {
             _error ("get size failed\n");
             bError = 1;
         }
         else 
         {
-            _debug ("file size = %d\n", nOriginalFileSize);
+            _debug ("file size = %lld\n", llOriginalFileSize);
         }
     }
 
@@ -384,7 +1129,7 @@ static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum
     int bNeedReinitialize = 0;
     if (0 == bNeedReinitialize && 0 == bError)
     {
-        if (0 == nOriginalFileSize)
+        if (0 == llOriginalFileSize)
         {
             _info ("file empty, need reinitialize\n");
             bNeedReinitialize = 1;
@@ -392,55 +1137,89 @@ static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum
     }
 
     /* 检查版本号 */
+    int bNeedUpgrade = 0;
     if (0 == bNeedReinitialize && 0 == bError)
     {
-        if (filemap_check_version (hMem2File) < 0)
+        int ret = filemap_check_version (hMem2File);
+        if (ret < 0)
         {
             _info ("version not compatible, need reinitialize\n");
             bNeedReinitialize = 1;
         }
+        else if (ret == 1 && 0 == (nFlags & FILEMAP_FLAG_UPGRADE))
+        { /* 升级会改写文件格式且无法撤销，只在调用者明确要求时进行；文件保持不变 */
+            _error ("old version V1.0, load with FILEMAP_FLAG_UPGRADE to upgrade in place\n");
+            bError = 1;
+        }
+        else if (ret == 1)
+        {
+            _info ("old version, need upgrade\n");
+            bNeedUpgrade = 1;
+        }
     }
 
     /* 检查旧文件兼容性 */
     if (0 == bNeedReinitialize && 0 == bError)
     {   
-        if (filemap_check_compatibility (hMem2File, nMaxFileNum) < 0)
+        if (filemap_check_compatibility (hMem2File, psDef) < 0)
         { /* 如果不兼容 */
             _info ("new setting not compatible to old, need reinitialize\n");
             bNeedReinitialize = 1;
         }
         else 
         { 
-            if (nMaxFileNum == -1)
+            FILEMAP_SECTION_DEF sDefSeg = {};
+            if (filemap_get_defseg (hMem2File, &sDefSeg) < 0)
+            {
+                bNeedReinitialize = 1;
+            }
+            else if (NULL == psDef)
             { /* 特殊情况 */
-                FILEMAP_SECTION_DEF sDefSeg = {};
-                if (filemap_get_defseg (hMem2File, &sDefSeg) < 0)
-                {
-                    bNeedReinitialize = 1;
-                }
-                else 
-                {
-                    nMaxFileNum = sDefSeg.nMaxFileNum; /* 从旧文件获取 */
-                }
+                sDef.nMaxFileNum = sDefSeg.nMaxFileNum; /* 从旧文件获取 */
+                sDef.nHeapUnitNum = sDefSeg.nHeapUnitNum;
+                sDef.nKeyFormat = sDefSeg.nKeyFormat;
+                sDef.nHashType = sDefSeg.nHashType;
+                sDef.ullHashSeed = sDefSeg.ullHashSeed;
+                sDef.nIndexLayout = sDefSeg.nIndexLayout;
+                sDef.nGrowNum = sDefSeg.nGrowNum;
+                memcpy (sDef.anGrowFrom, sDefSeg.anGrowFrom, sizeof(sDef.anGrowFrom));
+                sDef.nDataAlign = sDefSeg.nDataAlign;
+            }
+            else 
+            { /* 已有文件的键格式、hash函数、索引结构、扩容历史和数据段对齐不变 */
+                sDef.nKeyFormat = sDefSeg.nKeyFormat;
+                sDef.nHashType = sDefSeg.nHashType;
+                sDef.ullHashSeed = sDefSeg.ullHashSeed;
+                sDef.nIndexLayout = sDefSeg.nIndexLayout;
+                sDef.nGrowNum = sDefSeg.nGrowNum;
+                memcpy (sDef.anGrowFrom, sDefSeg.anGrowFrom, sizeof(sDef.anGrowFrom));
+                sDef.nDataAlign = sDefSeg.nDataAlign;
             }
         }
     }
 
+    /* 其他进程正在使用，不能重新初始化 */
+    if (0 == bError && ! bFirstProcess && (bNeedReinitialize || bNeedUpgrade))
+    {
+        _error ("file used by other process, can not reinitialize\n");
+        bError = 1;
+    }
+
     FILEMAP_GLOBAL_MAP sGMap = {};
     if (0 == bError)
     {
-        if (filemap_getsegmap (nMaxFileNum, &sGMap) < 0)
+        if (filemap_getsegmap (&sDef, &sGMap) < 0)
         {
             _error ("get seg map failed\n");
             bError = 1;
         }
     }
 
-    const int nSegDefSize = sGMap.seg_def.seg.size;
-    const int nSegIndexSize = sGMap.seg_index.seg.size;
-    
-    /* 初始化的时候，不填充数据段，避免过多耗时 */
-    const int nInitialSize = nSegDefSize + nSegIndexSize;
+    /**
+     * 初始化的时候，不填充数据段，避免过多耗时；空位栈在文件末尾，
+     * 因此直接扩展到完整大小（稀疏文件，不占用磁盘）
+     */
+    const long long llInitialSize = sGMap.seg.size;
 
     /* 处理不兼容版本 */
     if (0 == bError)
@@ -452,12 +1231,12 @@ static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum
                 _error ("resize failed\n");
                 bError = 1;
             }
-            if (mem2file_resize (hMem2File, nInitialSize) < 0)
+            if (mem2file_resize (hMem2File, llInitialSize) < 0)
             {
                 _error ("resize failed\n");
                 bError = 1;
             }
-            if (filemap_init_defsec (hMem2File, nMaxFileNum) < 0)
+            if (filemap_init_defsec (hMem2File, &sDef) < 0)
             {
                 _error ("init def sec failed\n");
                 bError = 1;
@@ -466,6 +1245,70 @@ static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum
         }
     }
 
+    /* 旧版本文件，以及数据段未写满的文件，扩展到完整大小 */
+    if (0 == bError)
+    {
+        long long llFileSize = 0;
+        if (mem2file_size (hMem2File, &llFileSize) < 0)
+        {
+            _error ("get size failed\n");
+            bError = 1;
+        }
+        else if (llFileSize < sGMap.seg.size)
+        {
+            if (mem2file_resize (hMem2File, sGMap.seg.size) < 0)
+            {
+                _error ("resize failed\n");
+                bError = 1;
+            }
+        }
+    }
+
+    /**
+     * 上次异常退出时留下的日志，重做后写磁盘并清空；重新初始化时直接清空。
+     * 其他进程正在使用时，日志中的记录都已写入文件，不需要处理
+     */
+    int fdWal = -1;
+    int bWalReplayed = 0;
+    if (0 == bError)
+    {
+        fdWal = filemap_wal_open (szFileName, (nFlags & FILEMAP_FLAG_WAL) ? 1 : 0);
+        if (fdWal < -1)
+        {
+            _error ("open wal failed\n");
+            bError = 1;
+        }
+    }
+    if (0 == bError && fdWal >= 0 && bFirstProcess)
+    {
+        int nRecordNum = 0;
+        if (! bNeedReinitialize && filemap_wal_replay (fdWal, hMem2File, &nRecordNum) < 0)
+        {
+            _error ("replay wal failed\n");
+            bError = 1;
+        }
+        else if (nRecordNum > 0 && mem2file_sync (hMem2File) < 0)
+        {
+            _error ("sync file failed\n");
+            bError = 1;
+        }
+        else if (ftruncate (fdWal, 0) < 0)
+        {
+            _error ("truncate wal failed\n");
+            bError = 1;
+        }
+        else if (nRecordNum > 0)
+        {
+            _info ("wal replayed, record=%d\n", nRecordNum);
+            bWalReplayed = 1;
+        }
+    }
+    if (fdWal >= 0 && ! (nFlags & FILEMAP_FLAG_WAL))
+    {
+        close (fdWal);
+        fdWal = -1;
+    }
+
     /* 创建文件映射对象 */
     FILEMAP_HANDLE hFileMap = NULL;
     if (0 == bError)
@@ -487,10 +1330,26 @@ static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum
     /* 初始化锁 */
     if (0 == bError)
     {
-        pthread_mutex_t mutexTmp = PTHREAD_MUTEX_INITIALIZER;
         FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hFileMap;
 
-        pObj->mutex_entrance_call = mutexTmp;
+        /* 写优先：扩容切换等独占的调用不会被不断进入的共享调用一直推迟；各调用都不重复进入 */
+        pthread_rwlockattr_t sAttr;
+        pthread_rwlockattr_init (&sAttr);
+        pthread_rwlockattr_setkind_np (&sAttr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init (& pObj->rwlock_entrance_call, &sAttr);
+        pthread_rwlockattr_destroy (&sAttr);
+        for (int i = 0; i < FILEMAP_BUCKET_LOCK_NUM; ++i)
+        {
+            pthread_rwlock_init (& pObj->rwlock_bucket[i], NULL);
+            pObj->auBucketSeq[i] = 0;
+        }
+        pthread_mutex_init (& pObj->mutex_index, NULL);
+        pthread_mutex_init (& pObj->mutex_pin, NULL);
+        pthread_mutex_init (& pObj->mutex_alloc, NULL);
+        pthread_mutex_init (& pObj->mutex_sync, NULL);
+        pthread_cond_init (& pObj->cond_sync, NULL);
+        pthread_mutex_init (& pObj->mutex_grow, NULL);
+        pthread_mutex_init (& pObj->mutex_migrate, NULL);
     }
 
     /* 填充文件映射对象 */
@@ -498,30 +1357,218 @@ static FILEMAP_HANDLE filemap_init_file (const char *szFileName, int nMaxFileNum
     {
         FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hFileMap;
         pObj->hMem2File = hMem2File;
-        pObj->nMaxFileNum = nMaxFileNum;
+        pObj->nMaxFileNum = sDef.nMaxFileNum;
+        pObj->nHeapUnitNum = sDef.nHeapUnitNum;
+        pObj->nKeyFormat = sDef.nKeyFormat;
+        pObj->nNodeSize = (FILEMAP_KEYFORMAT_STRING == sDef.nKeyFormat ? 
+                    sizeof(FILEMAP_STRING_NODE) : sizeof(FILEMAP_BINARY_NODE));
+        pObj->nHashType = (FILEMAP_HASH_WYHASH == sDef.nHashType ? FILEMAP_HASH_WYHASH : FILEMAP_HASH_BKDR);
+        pObj->ullHashSeed = sDef.ullHashSeed;
+        pObj->nIndexLayout = sDef.nIndexLayout;
+        pObj->nFlags = nFlags;
+        pObj->sGMap = sGMap;
+        pObj->psIndexCache = NULL;
+        pObj->psFreeListCache = NULL;
+        pObj->psOldIndexCache = NULL;
+        pObj->nRetiredCacheNum = 0;
+        pObj->nOldMaxFileNum = 0;
+        pObj->bMigrating = 0;
+        pObj->uGrowSeq = 0;
+        for (int i = 0; i <= FILEMAP_FREELIST_KEY; ++i)
+        {
+            pObj->anGrowFreeMark[i] = -1;
+        }
+        pObj->hBitmapData = NULL;
+        pObj->hBitmapHashlink = NULL;
+        pObj->pnPinCount = NULL;
+        pObj->pbFreePending = NULL;
+        pObj->puBucketSeq = pObj->auBucketSeq;
+        pObj->psShared = NULL;
+        pObj->fdShared = fdShared;
+        pObj->fdWal = fdWal;
+        pObj->nWalPending = 0;
+        pObj->nDurability = (fdWal >= 0 ? FILEMAP_DURABILITY_GROUP : FILEMAP_DURABILITY_NONE);
+        pObj->nSyncIntervalMs = 0;
+        pObj->ullSyncReq = 0;
+        pObj->ullSyncDone = 0;
+        pObj->bSyncing = 0;
+        pObj->bSyncThread = 0;
+        pObj->bSyncStop = 0;
         hMem2File = NULL;
+        fdShared = -1;
+        fdWal = -1;
     }
 
-    /* 错误处理 */
-    if (bError)
+    /* 扩容过的文件，读取迁移进度 */
+    if (0 == bError)
     {
-        if (hFileMap != NULL)
+        if (filemap_grow_load ((FILEMAP_OBJ*)hFileMap) < 0)
         {
-            FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hFileMap;
-            if (pObj->hMem2File != NULL)
-            {
-                mem2file_close (pObj->hMem2File);
-                pObj->hMem2File = NULL;
-            }
-
-            free (pObj);
-            _debug ("mem freed, p=%p\n", pObj);
+            _error ("load migrate state failed\n");
+            bError = 1;
         }
-        if (hMem2File != NULL)
-        {
+    }
+
+    /* 读入索引段；直接读写方式下不整段读入，内存占用只有缓冲池 */
+    if (0 == bError && ! (nFlags & (FILEMAP_FLAG_MMAP | FILEMAP_FLAG_DIRECT)))
+    {
+        if (filemap_indexcache_load ((FILEMAP_OBJ*)hFileMap) < 0)
+        {
+            _error ("load index failed\n");
+            bError = 1;
+        }
+    }
+
+    /* 新文件和旧版本文件，根据比特表建立空位栈 */
+    if (0 == bError && (bNeedReinitialize || bNeedUpgrade))
+    {
+        if (filemap_freelist_rebuild ((FILEMAP_OBJ*)hFileMap) < 0)
+        {
+            _error ("rebuild free list failed\n");
+            bError = 1;
+        }
+    }
+
+    /* 重做日志后，找回异常退出时未放回的空位 */
+    if (0 == bError && bWalReplayed && ! bNeedReinitialize && ! bNeedUpgrade)
+    {
+        if (filemap_freelist_recover ((FILEMAP_OBJ*)hFileMap) < 0)
+        {
+            _error ("recover free list failed\n");
+            bError = 1;
+        }
+    }
+
+    /* 空位栈建立后才更新版本号 */
+    if (0 == bError && bNeedUpgrade)
+    {
+        FILEMAP_SECTION_DEF sDef = {};
+        FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hFileMap;
+        if (filemap_get_defseg (pObj->hMem2File, &sDef) < 0)
+        {
+            _error ("get def sec failed\n");
+            bError = 1;
+        }
+        else 
+        {
+            memset (sDef.szVersion, 0, sizeof(sDef.szVersion));
+            strncpy (sDef.szVersion, FILEMAP_VERSION_V11, sizeof(sDef.szVersion) - 1);
+            if (filemap_set_defseg (pObj->hMem2File, &sDef) < 0)
+            {
+                _error ("set def sec failed\n");
+                bError = 1;
+            }
+            else 
+            {
+                _info ("upgrade successful\n");
+            }
+        }
+    }
+
+    /* 多进程共享方式下各进程无法同步迁移进度，加载时完成迁移 */
+    if (0 == bError && (nFlags & FILEMAP_FLAG_SHARED) && ((FILEMAP_OBJ*)hFileMap)->bMigrating)
+    {
+        if (filemap_grow_finish ((FILEMAP_OBJ*)hFileMap) < 0)
+        {
+            _error ("finish migrate failed\n");
+            bError = 1;
+        }
+    }
+
+    /* 连接共享区 */
+    if (0 == bError && (nFlags & FILEMAP_FLAG_SHARED))
+    {
+        if (filemap_shared_attach ((FILEMAP_OBJ*)hFileMap, bFirstProcess) < 0)
+        {
+            _error ("attach shared seg failed\n");
+            bError = 1;
+        }
+    }
+
+    /* 建立比特表，多进程共享方式下各进程的比特表无法同步，不建立 */
+    if (0 == bError && ! (nFlags & FILEMAP_FLAG_SHARED))
+    {
+        if (filemap_bitmap_load ((FILEMAP_OBJ*)hFileMap) < 0)
+        {
+            _error ("load bitmap failed\n");
+            bError = 1;
+        }
+    }
+
+    /* 错误处理 */
+    if (bError)
+    {
+        if (hFileMap != NULL)
+        {
+            FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hFileMap;
+            if (pObj->hMem2File != NULL)
+            {
+                mem2file_close (pObj->hMem2File);
+                pObj->hMem2File = NULL;
+            }
+            if (pObj->hBitmapData != NULL)
+            {
+                bitmap_destroy (pObj->hBitmapData);
+            }
+            if (pObj->hBitmapHashlink != NULL)
+            {
+                bitmap_destroy (pObj->hBitmapHashlink);
+            }
+            free (pObj->psIndexCache);
+            free (pObj->psFreeListCache);
+            free (pObj->psOldIndexCache);
+            if (pObj->fdShared >= 0)
+            { /* 先结束初始化，其他进程可以打开 */
+                filemap_shared_leave (pObj->fdShared);
+                close (pObj->fdShared);
+            }
+            if (pObj->fdWal >= 0)
+            {
+                close (pObj->fdWal);
+            }
+            free (pObj->pnPinCount);
+            free (pObj->pbFreePending);
+
+            pthread_rwlock_destroy (& pObj->rwlock_entrance_call);
+            for (int i = 0; i < FILEMAP_BUCKET_LOCK_NUM; ++i)
+            {
+                pthread_rwlock_destroy (& pObj->rwlock_bucket[i]);
+            }
+            pthread_mutex_destroy (& pObj->mutex_index);
+            pthread_mutex_destroy (& pObj->mutex_pin);
+            pthread_mutex_destroy (& pObj->mutex_alloc);
+            pthread_mutex_destroy (& pObj->mutex_sync);
+            pthread_cond_destroy (& pObj->cond_sync);
+            pthread_mutex_destroy (& pObj->mutex_grow);
+            pthread_mutex_destroy (& pObj->mutex_migrate);
+
+            _debug ("mem freed, p=%p\n", pObj);
+            free (pObj);
+            pObj = NULL;
+            hFileMap = NULL;
+        }
+        if (hMem2File != NULL)
+        {
             mem2file_close (hMem2File);
             hMem2File = NULL;
         }
+        if (fdShared >= 0)
+        {
+            filemap_shared_leave (fdShared);
+            close (fdShared);
+            fdShared = -1;
+        }
+        if (fdWal >= 0)
+        {
+            close (fdWal);
+            fdWal = -1;
+        }
+    }
+
+    /* 初始化结束，其他进程可以打开；失败时已在错误处理中结束 */
+    if (0 == bError && ((FILEMAP_OBJ*)hFileMap)->fdShared >= 0)
+    {
+        filemap_shared_leave (((FILEMAP_OBJ*)hFileMap)->fdShared);
     }
 
     /* 报告 */
@@ -543,6 +1590,91 @@ static int filemap_close_file (FILEMAP_HANDLE hInstance)
     }
     else 
     {
+        filemap_sync_stopthread (pObj);
+
+        if (pObj->pbFreePending != NULL)
+        { /* 未归还的借用不再有效，释放等待中的数据项 */
+            for (int i = 0; i < pObj->nMaxFileNum; ++i)
+            {
+                if (pObj->pnPinCount[i] > 0)
+                {
+                    _error ("item not released, index=%d\n", i);
+                    pObj->pnPinCount[i] = 0;
+                }
+                if (pObj->pbFreePending[i])
+                {
+                    filemap_file_freedataslot (pObj, i);
+                }
+            }
+
+            free (pObj->pnPinCount);
+            free (pObj->pbFreePending);
+            pObj->pnPinCount = NULL;
+            pObj->pbFreePending = NULL;
+        }
+
+        /* 多进程共享方式下，由最后一个关闭的进程写回比特表 */
+        if (NULL == pObj->psShared || flock (pObj->fdShared, LOCK_EX | LOCK_NB) == 0)
+        {
+            if (filemap_bitmap_sync (pObj) < 0)
+            {
+                _error ("sync bitmap failed\n");
+            }
+        }
+
+        /* 文件写磁盘后，日志不再需要 */
+        if (pObj->fdWal >= 0)
+        {
+            if (pObj->psShared != NULL)
+            {
+                filemap_shared_lock (pObj);
+            }
+            pthread_mutex_lock (& pObj->mutex_sync);
+            if (filemap_wal_checkpoint (pObj) < 0)
+            {
+                _error ("checkpoint failed\n");
+            }
+            pthread_mutex_unlock (& pObj->mutex_sync);
+            if (pObj->psShared != NULL)
+            {
+                filemap_shared_unlock (pObj);
+            }
+
+            close (pObj->fdWal);
+            pObj->fdWal = -1;
+        }
+        else if (pObj->nDurability != FILEMAP_DURABILITY_NONE)
+        {
+            if (mem2file_sync (pObj->hMem2File) < 0)
+            {
+                _error ("sync file failed\n");
+            }
+        }
+
+        free (pObj->psIndexCache);
+        free (pObj->psFreeListCache);
+        free (pObj->psOldIndexCache);
+        pObj->psIndexCache = NULL;
+        pObj->psFreeListCache = NULL;
+        pObj->psOldIndexCache = NULL;
+        for (int i = 0; i < pObj->nRetiredCacheNum; ++i)
+        {
+            free (pObj->apsRetiredCache[i]);
+        }
+        pObj->nRetiredCacheNum = 0;
+
+        if (pObj->hBitmapData != NULL)
+        {
+            bitmap_destroy (pObj->hBitmapData);
+            pObj->hBitmapData = NULL;
+        }
+
+        if (pObj->hBitmapHashlink != NULL)
+        {
+            bitmap_destroy (pObj->hBitmapHashlink);
+            pObj->hBitmapHashlink = NULL;
+        }
+
         if (NULL == pObj->hMem2File)
         {
             _error ("inner error\n");
@@ -552,6 +1684,25 @@ static int filemap_close_file (FILEMAP_HANDLE hInstance)
             mem2file_close (pObj->hMem2File);
         }
 
+        if (pObj->fdShared >= 0)
+        { /* 同时释放flock */
+            close (pObj->fdShared);
+            pObj->fdShared = -1;
+        }
+
+        pthread_rwlock_destroy (& pObj->rwlock_entrance_call);
+        for (int i = 0; i < FILEMAP_BUCKET_LOCK_NUM; ++i)
+        {
+            pthread_rwlock_destroy (& pObj->rwlock_bucket[i]);
+        }
+        pthread_mutex_destroy (& pObj->mutex_index);
+        pthread_mutex_destroy (& pObj->mutex_pin);
+        pthread_mutex_destroy (& pObj->mutex_alloc);
+        pthread_mutex_destroy (& pObj->mutex_sync);
+        pthread_cond_destroy (& pObj->cond_sync);
+        pthread_mutex_destroy (& pObj->mutex_grow);
+        pthread_mutex_destroy (& pObj->mutex_migrate);
+
         _debug ("free mem, p=%p\n", pObj);
         free (pObj);
         pObj = NULL;
@@ -561,1505 +1712,7653 @@ static int filemap_close_file (FILEMAP_HANDLE hInstance)
 }
 
 /**
- * @brief 找出内存块中的第一个空位
- * @return 找到空位返回1，且将索引返回至@pnIndex，否则返回0
+ * @brief 将文件中的一段读入新的内存副本
  */
-static int filemap_scanfirstemptybit (const char *pMem, int size, int *pnIndex)
+static FILEMAP_SEG_CACHE *filemap_indexcache_read (FILEMAP_OBJ *pObj, const FILEMAP_SEGMENT *psSeg)
 {
-    int bFound = 0;
-
-    /* 先逐个字节判断，后期优化 */
-    for (int i = 0; i < size; ++i)
+    FILEMAP_SEG_CACHE *psCache = (FILEMAP_SEG_CACHE*)malloc (sizeof(FILEMAP_SEG_CACHE) + psSeg->size);
+    if (NULL == psCache)
     {
-        char cByte = *(pMem + i);
-
-        // _debug ("cByte=%#x\n", cByte);
-
-        if (cByte != (char)0xFF)
-        {
-            for (int k = 0; k < sizeof(char) * 8; ++k)
-            {
-                char bitMask = ((char)0x1 << (7-k));
-                // _debug ("bitMask=%#x\n", bitMask);
+        _error ("malloc failed, size=%lld\n", psSeg->size);
+        return NULL;
+    }
 
-                if ( (bitMask & cByte) == 0)
-                {
-                    bFound = 1;
-                    *pnIndex = i * sizeof (char) * 8 + k;
-                    break;
-                }
-            }
-            break;
-        }
+    psCache->seg = *psSeg;
+    if (mem2file_getdata (pObj->hMem2File, psSeg->pos, psCache->byteData, psSeg->size) < 0)
+    {
+        _error ("get seg failed, pos=%lld\n", psSeg->pos);
+        free (psCache);
+        return NULL;
     }
 
-    return bFound ? 1 : 0;
+    _debug ("seg cached, pos=%lld,size=%lld\n", psSeg->pos, psSeg->size);
+
+    return psCache;
 }
 
 /**
- * @brief 设置内存块中的第@nIndex个bit为@bitValue
+ * @brief 被替换的内存副本，不加锁的读取可能仍在使用，关闭时才释放
  */
-static int filemap_setbitofmem (char *pMem, int nSize, int nIndex, int bitValue)
+static int filemap_indexcache_retire (FILEMAP_OBJ *pObj, FILEMAP_SEG_CACHE *psCache)
 {
-    if (nIndex >= nSize * sizeof(char) * 8)
+    if (NULL == psCache)
     {
-        _error ("index over limit, <index=%d,size=%d>\n", nIndex, nSize);
-        return -1;
+        return 0;
     }
 
-    const int nIndexByte = nIndex / (sizeof(char) * 8); // 比特索引对应的字节序号
-    const int nIndexOfBitInByte = nIndex % (sizeof(char) * 8);    // 比特索引在字节中的索引
-
-    char byteOriginal = *(pMem + nIndexByte);
-    
-    char byteNew = byteOriginal;
-
-    if (bitValue)
-    {
-        byteNew = byteOriginal | ((char)0x1 << (7 - nIndexOfBitInByte));
-    }
-    else 
+    if (pObj->nRetiredCacheNum >= (int)(sizeof(pObj->apsRetiredCache) / sizeof(pObj->apsRetiredCache[0])))
     {
-        char byteMask = ((char)0x1 << (7 - nIndexOfBitInByte));    // eg. 0000 1000
-        byteMask = ~byteMask;   // eg. 1111 0111
-        byteNew = byteOriginal & byteMask;
+        _error ("too many retired caches\n");
+        return -1;
     }
 
-    *(pMem + nIndexByte) = byteNew;
-
+    pObj->apsRetiredCache[pObj->nRetiredCacheNum++] = psCache;
     return 0;
 }
 
 /**
- * @brief 找出比特表中第一个空缺
- * @return 失败返回-1，成功返回1，@nIndex返回索引值，不存在返回0
- */ 
-static int filemap_file_scanfirstemptybit (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nPos, int nSize, int *pnIndex)
+ * @brief 将整个索引段和空位栈读入内存，迁移期间同时读入扩容前的索引段
+ */
+static int filemap_indexcache_load (FILEMAP_OBJ *pObj)
 {
-    FILEMAP_GLOBAL_MAP sMap = {};
-    int ret = filemap_getsegmap (nMaxFileNum, &sMap);
-    
-    const int nBitmapPos = nPos;
-    const int nBitmapSize = nSize;
-
-    int bFound = 0;
-
-    int i = 0;
-    for (i = 0; ; ++i)
+    pObj->psIndexCache = filemap_indexcache_read (pObj, & pObj->sGMap.seg_index.seg);
+    pObj->psFreeListCache = filemap_indexcache_read (pObj, & pObj->sGMap.seg_freelist.seg);
+    if (NULL == pObj->psIndexCache || NULL == pObj->psFreeListCache)
     {
-        char byteBuffer[64] = {}; // 这里循环生效，则测试的文件数目要超过 64 * 8 = 512
-
-        const int nPos = nBitmapPos + sizeof(byteBuffer) * i;
-
-        if ( (nPos - nBitmapPos) > nBitmapSize)
-        {
-            // _debug ("scan finished\n");
-            break;
-        }
-
-        const int nLeftSize = nBitmapSize - (nPos - nBitmapPos);
-        const int nReadSize = (nLeftSize > sizeof(byteBuffer) ? 
-                                    sizeof(byteBuffer) : nLeftSize);
+        return -1;
+    }
 
-        ret = mem2file_getdata (hMem2File, nPos, byteBuffer, nReadSize);
-        if (ret < 0)
+    if (pObj->bMigrating)
+    {
+        pObj->psOldIndexCache = filemap_indexcache_read (pObj, & pObj->sGMap.seg_index_old.seg);
+        if (NULL == pObj->psOldIndexCache)
         {
-            _error ("getdata failed, <bitmappos=%d,bitmapsize=%d,pos=%d,size=%d>\n",
-                        nBitmapPos, nBitmapSize, nPos, nReadSize);
             return -1;
         }
-        
-        int nIndex = 0;
-        ret = filemap_scanfirstemptybit (byteBuffer, nReadSize, &nIndex);
-        if (1 == ret && (nIndex < nMaxFileNum)) /* 由于每个字节8位，因此要考虑找出来的是越界的位的问题 */
-        { /* 找到了 */
-            bFound = 1;
-            *pnIndex = nIndex + i * sizeof(byteBuffer) * 8;
-            break;
-        }
     }
 
-    return bFound ? 1 : 0;
+    return 0;
 }
 
 /**
- * @brief 设置比特表中的第@nIndex个位为@bBit
- * @param nPos 比特表的起始位置
- * @param nSize 比特表的大小
+ * @brief 找出文件中一段数据在内存副本中的位置
+ * @return 不在内存副本中返回NULL
+ * @note 扩容时副本被替换，每个副本只取一次，按其中记录的位置判断
  */
-static int filemap_file_setbitmap (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nPos, int nSize, int nIndex, int bBit)
+static char *filemap_indexcache_find (FILEMAP_OBJ *pObj, long long llPos, int nSize)
 {
-    FILEMAP_GLOBAL_MAP sMap = {};
-    int ret = filemap_getsegmap (nMaxFileNum, &sMap);
-    
-    const int nBitmapPos = nPos;
-    const int nBitmapSize = nSize;
-
-    const int nTotalBit = nBitmapSize * sizeof(char) * 8;
+    FILEMAP_SEG_CACHE *psCache[3] = {
+        __atomic_load_n (& pObj->psIndexCache, __ATOMIC_ACQUIRE),
+        __atomic_load_n (& pObj->psFreeListCache, __ATOMIC_ACQUIRE),
+        __atomic_load_n (& pObj->psOldIndexCache, __ATOMIC_ACQUIRE),
+    };
 
-    if (nIndex >= nTotalBit)
+    for (int i = 0; i < 3; ++i)
     {
-        _error ("index over limit, <%d>=%d>\n", nIndex, nTotalBit);
-        return -1;
+        if (psCache[i] != NULL && llPos >= psCache[i]->seg.pos && nSize >= 0 &&
+                llPos + nSize <= psCache[i]->seg.pos + psCache[i]->seg.size)
+        {
+            return psCache[i]->byteData + (llPos - psCache[i]->seg.pos);
+        }
     }
 
-    const int nIndexByte = nIndex / (sizeof(char) * 8); // 比特索引对应的字节序号
-    const int nIndexBitInByte = nIndex % (sizeof(char) * 8);    // 比特索引在字节中的序号
-    const int nBytePos = nIndexByte + nBitmapPos;   // 对应的实际字节位置
+    return NULL;
+}
 
-    char byteOriginal = 0;
-    ret = mem2file_getdata (hMem2File, nBytePos, & byteOriginal, sizeof(byteOriginal));
-    if (ret < 0)
+/**
+ * @brief 读取索引段中的数据，有内存副本时不访问文件
+ * @note 本线程有进行中的操作时，能读到该操作尚未提交的修改
+ */
+static int filemap_file_getindexdata (FILEMAP_OBJ *pObj, long long llPos, void *pData, int nSize)
+{
+    char *pCache = filemap_indexcache_find (pObj, llPos, nSize);
+    if (pCache != NULL)
     {
-        _error ("get data failed\n");
-        return -1;
+        memcpy (pData, pCache, nSize);
     }
-
-    ret = filemap_setbitofmem (&byteOriginal, sizeof(byteOriginal), nIndexBitInByte, bBit);
-    if (ret < 0)
+    else if (mem2file_getdata (pObj->hMem2File, llPos, pData, nSize) < 0)
     {
-        _error ("set bit failed\n");
         return -1;
     }
 
-    ret = mem2file_setdata (hMem2File, nBytePos, & byteOriginal, sizeof(byteOriginal));
-    if (ret < 0)
+    FILEMAP_WAL_TXN *pTxn = filemap_wal_gettxn (pObj);
+    if (pTxn != NULL)
     {
-        _error ("set data failed\n");
-        return -1;
+        filemap_wal_overlay (pTxn, llPos, pData, nSize);
     }
 
     return 0;
 }
 
 /**
- * @brief 获取位置哈希表中的第@nIndex个元素
+ * @brief 写入索引段中的数据，先写文件，成功后再更新内存副本
+ * @note 本线程有进行中的操作时，对哈希表和哈希链表的修改推迟到提交时写入；
+ * 空位栈不记录在日志中，异常退出后根据索引重建。
+ * 本线程在进行批量写入时，只写内存副本，结束时再写文件
  */
-static int filemap_file_getposhashmapitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, FILEMAP_POSHASHMAP_ELEMENT *pEle)
+static int filemap_file_setindexdata (FILEMAP_OBJ *pObj, long long llPos, const void *pData, int nSize)
 {
-    /* 获取总元素 */
-    int nNumEx = filemap_get_poshashmap_num (nMaxFileNum);
-
-    if (nIndex >= nNumEx || nIndex < 0)
+    FILEMAP_WAL_TXN *pTxn = filemap_wal_gettxn (pObj);
+    const FILEMAP_SEGMENT *psSeg = & pObj->sGMap.seg_index.seg;
+    if (pTxn != NULL && llPos >= psSeg->pos && llPos + nSize <= psSeg->pos + psSeg->size)
     {
-        _error ("nIndex invalid, <%d,%d>\n", nIndex, nNumEx);
-        return -1;
+        return filemap_wal_record (pTxn, llPos, pData, nSize);
+    }
+
+    char *pCache = filemap_indexcache_find (pObj, llPos, nSize);
+    FILEMAP_BATCH *psBatch = filemap_batch_get (pObj);
+    if (psBatch != NULL && pCache != NULL)
+    { /* 批量写入结束时再写文件 */
+        memcpy (pCache, pData, nSize);
+        return filemap_batch_record (psBatch, llPos, nSize);
     }
 
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    if (mem2file_setdata (pObj->hMem2File, llPos, pData, nSize) < 0)
     {
-        _error ("get map failed\n");
         return -1;
     }
 
-    /* 得到待获取元素的位置 */
-    const int nDataPos = sMap.seg_index.seg_hashmap.seg.pos + 
-                    sizeof(FILEMAP_POSHASHMAP_ELEMENT) * nIndex;
-    const int nDataSize = sizeof(FILEMAP_POSHASHMAP_ELEMENT);
-
-    if (mem2file_getdata (hMem2File, nDataPos, pEle, nDataSize) < 0)
+    if (pCache != NULL)
     {
-        _error ("get data failed\n");
-        return -1;
+        memcpy (pCache, pData, nSize);
     }
 
     return 0;
 }
 
 /**
- * @brief 设置位置哈希表中的第@nIndex个元素
+ * @brief 取得空位栈的计数和栈的位置
  */
-static int filemap_file_setposhashmapitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, const FILEMAP_POSHASHMAP_ELEMENT *pEle)
+static int filemap_freelist_getpos (FILEMAP_OBJ *pObj, int nWhich, long long *pllCountPos, long long *pllStackPos)
 {
-    /* 获取总元素 */
-    int nNumEx = filemap_get_poshashmap_num (nMaxFileNum);
+    const FILEMAP_FREELIST_MAP *psMap = & pObj->sGMap.seg_freelist;
 
-    if (nIndex >= nNumEx || nIndex < 0)
+    if (FILEMAP_FREELIST_DATA == nWhich)
     {
-        _error ("nIndex invalid, <%d,%d>\n", nIndex, nNumEx);
-        return -1;
+        *pllCountPos = psMap->seg_head.seg.pos + offsetof(FILEMAP_SECTION_FREELIST_HEAD, nDataFreeNum);
+        *pllStackPos = psMap->seg_stack_data.seg.pos;
     }
-
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    else if (FILEMAP_FREELIST_HASHLINK == nWhich)
     {
-        _error ("get map failed\n");
-        return -1;
+        *pllCountPos = psMap->seg_head.seg.pos + offsetof(FILEMAP_SECTION_FREELIST_HEAD, nHashlinkFreeNum);
+        *pllStackPos = psMap->seg_stack_hashlink.seg.pos;
     }
-
-    /* 得到待获取元素的位置 */
-    const int nDataPos = sMap.seg_index.seg_hashmap.seg.pos + 
-                    sizeof(FILEMAP_POSHASHMAP_ELEMENT) * nIndex;
-    const int nDataSize = sizeof(FILEMAP_POSHASHMAP_ELEMENT);
-
-    if (mem2file_setdata (hMem2File, nDataPos, pEle, nDataSize) < 0)
+    else if (FILEMAP_FREELIST_KEY == nWhich && psMap->seg_stack_key.seg.size > 0)
     {
-        _error ("get data failed\n");
+        *pllCountPos = psMap->seg_head.seg.pos + offsetof(FILEMAP_SECTION_FREELIST_HEAD, nKeyFreeNum);
+        *pllStackPos = psMap->seg_stack_key.seg.pos;
+    }
+    else 
+    {
+        _error ("unknown free list, which=%d\n", nWhich);
         return -1;
     }
 
     return 0;
 }
 
-static int filemap_file_getposhashlinkitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, FILEMAP_POSHASHLINKMAP_ELEMENT *pEle)
+/**
+ * @brief 空位栈对应的内存中的比特表，键段没有比特表，返回NULL
+ */
+static BITMAP_HANDLE filemap_freelist_getbitmap (FILEMAP_OBJ *pObj, int nWhich)
 {
-    if (nIndex < 0 || nIndex >= nMaxFileNum)
-    {
-        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
-        return -1;
-    }
-
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    if (FILEMAP_FREELIST_DATA == nWhich)
     {
-        _error ("get map failed\n");
-        return -1;
+        return pObj->hBitmapData;
     }
-
-    /* 得到待获取元素的位置 */
-    const int nDataPos = sMap.seg_index.seg_hashlink.seg.pos + 
-                    sizeof(FILEMAP_POSHASHLINKMAP_ELEMENT) * nIndex;
-    const int nDataSize = sizeof(FILEMAP_POSHASHLINKMAP_ELEMENT);
-
-    if (mem2file_getdata (hMem2File, nDataPos, pEle, nDataSize) < 0)
+    else if (FILEMAP_FREELIST_HASHLINK == nWhich)
     {
-        _error ("get data failed\n");
-        return -1;
+        return pObj->hBitmapHashlink;
     }
 
-    return 0;    
+    return NULL;
 }
 
-static int filemap_file_setposhashlinkitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, const FILEMAP_POSHASHLINKMAP_ELEMENT *pEle)
+/**
+ * @brief 根据比特表写入空位栈，比特为0的视为空位，小的索引在栈顶
+ */
+static int filemap_freelist_store (FILEMAP_OBJ *pObj, int nWhich, BITMAP_HANDLE hBitmap)
 {
-    if (nIndex < 0 || nIndex >= nMaxFileNum)
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    int *pnStack = (int*)malloc (sizeof(int) * (nMaxFileNum > 0 ? nMaxFileNum : 1));
+    if (NULL == pnStack)
     {
-        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
+        _error ("malloc failed\n");
         return -1;
     }
 
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    int nFreeNum = 0;
+    for (int k = nMaxFileNum - 1; k >= 0; --k)
     {
-        _error ("get map failed\n");
-        return -1;
+        if (0 == bitmap_getbit (hBitmap, k))
+        {
+            pnStack[nFreeNum++] = k;
+        }
     }
 
-    /* 得到待获取元素的位置 */
-    const int nDataPos = sMap.seg_index.seg_hashlink.seg.pos + 
-                    sizeof(FILEMAP_POSHASHLINKMAP_ELEMENT) * nIndex;
-    const int nDataSize = sizeof(FILEMAP_POSHASHLINKMAP_ELEMENT);
-
-    if (mem2file_setdata (hMem2File, nDataPos, pEle, nDataSize) < 0)
+    long long llCountPos = 0;
+    long long llStackPos = 0;
+    if (filemap_freelist_getpos (pObj, nWhich, &llCountPos, &llStackPos) < 0 ||
+            filemap_file_setindexdata (pObj, llStackPos, pnStack, sizeof(int) * nFreeNum) < 0 ||
+            filemap_file_setindexdata (pObj, llCountPos, &nFreeNum, sizeof(nFreeNum)) < 0)
     {
-        _error ("set data failed\n");
+        _error ("set free list failed\n");
+        free (pnStack);
         return -1;
     }
 
-    return 0;  
+    free (pnStack);
+
+    _info ("free list rebuilt, which=%d,free=%d\n", nWhich, nFreeNum);
+
+    return 0;
 }
 
 /**
- * @brief 获取数据段的元素
+ * @brief 根据文件中的比特表重建空位栈
+ * @note 用于新文件和旧版本文件
  */
-static int filemap_file_getdatasegitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, FILEMAP_SECTION_DATA_ELEMENT *pElem)
+static int filemap_freelist_rebuild (FILEMAP_OBJ *pObj)
 {
-    if (nIndex > nMaxFileNum || nIndex < 0)
-    {
-        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
-        return -1;
-    }
+    const int nMaxFileNum = pObj->nMaxFileNum;
 
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
-    {
-        _error ("get map failed\n");
-        return -1;
-    }
-
-    const int nDataPos = sMap.seg_data.seg.pos + 
-                    sizeof(FILEMAP_SECTION_DATA_ELEMENT) * nIndex;
-    const int nDataSize = sizeof(FILEMAP_SECTION_DATA_ELEMENT);
-
-    if (mem2file_getdata (hMem2File, nDataPos, pElem, nDataSize) < 0)
-    {
-        _error ("get data failed\n");
-        return -1;
-    }
+    const FILEMAP_INDEX_BITMAP_MAP *psBitmapMap[2] = {
+        & pObj->sGMap.seg_index.seg_bitmap_data,
+        & pObj->sGMap.seg_index.seg_bitmap_hashlink,
+    };
+    const int nWhich[2] = {
+        FILEMAP_FREELIST_DATA,
+        FILEMAP_FREELIST_HASHLINK,
+    };
 
-    return 0;
-}
+    BITMAP_HANDLE hBitmap = bitmap_create (nMaxFileNum);
+    char *pMem = (char*)malloc (psBitmapMap[0]->seg.size > 0 ? psBitmapMap[0]->seg.size : 1);
+    int bError = 0;
 
-/**
- * @brief 设置数据段的元素
- */
-static int filemap_file_setdatasegitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, int nIndex, const FILEMAP_SECTION_DATA_ELEMENT *pElem)
-{
-    if (nIndex > nMaxFileNum || nIndex < 0)
+    if (NULL == hBitmap || NULL == pMem)
     {
-        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
-        return -1;
+        _error ("alloc failed\n");
+        bError = 1;
     }
 
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    for (int i = 0; i < 2 && 0 == bError; ++i)
     {
-        _error ("get map failed\n");
-        return -1;
-    }
+        const long long llBitmapPos = psBitmapMap[i]->seg.pos;
+        const int nBitmapSize = psBitmapMap[i]->seg.size;
 
-    const int nDataPos = sMap.seg_data.seg.pos + 
-                    sizeof(FILEMAP_SECTION_DATA_ELEMENT) * nIndex;
-    const int nDataSize = sizeof(FILEMAP_SECTION_DATA_ELEMENT);
+        if (filemap_file_getindexdata (pObj, llBitmapPos, pMem, nBitmapSize) < 0)
+        {
+            _error ("get bitmap failed\n");
+            bError = 1;
+            break;
+        }
 
-    /* 检查是否需要扩展文件 */
-    const int nFinalSize = nDataPos + nDataSize;
+        bitmap_load (hBitmap, pMem, nBitmapSize);
 
-    int nFileSize = 0;
-    if (mem2file_size (hMem2File, &nFileSize) < 0)
-    {
-        _error ("get size failed\n");
-        return -1;
+        if (filemap_freelist_store (pObj, nWhich[i], hBitmap) < 0)
+        {
+            bError = 1;
+            break;
+        }
     }
 
-    if (nFinalSize > nFileSize && nFinalSize <= sMap.seg.size)
+    /* 键段没有比特表，新文件中都是空位 */
+    if (0 == bError && pObj->sGMap.seg_freelist.seg_stack_key.seg.size > 0)
     {
-        if (mem2file_resize (hMem2File, nFinalSize) < 0)
+        memset (pMem, 0, psBitmapMap[0]->seg.size);
+        bitmap_load (hBitmap, pMem, psBitmapMap[0]->seg.size);
+
+        if (filemap_freelist_store (pObj, FILEMAP_FREELIST_KEY, hBitmap) < 0)
         {
-            _error ("resize failed\n");
-            return -1;
+            bError = 1;
         }
     }
 
-    if (mem2file_setdata (hMem2File, nDataPos, pElem, nDataSize) < 0)
+    free (pMem);
+    if (hBitmap != NULL)
     {
-        _error ("set data failed\n");
-        return -1;
+        bitmap_destroy (hBitmap);
     }
 
-    return 0;
+    return bError ? -1 : 0;
 }
 
 /**
- * @brief 获取key对应的映射数据
- * @return 失败返回-1，找到返回1，没有找到返回0
+ * @brief 根据哈希表和哈希链表重建空位栈，不被索引引用的位置都视为空位
+ * @note 用于重做日志之后：异常退出时已分配但未提交的空位，以及已提交但
+ * 未放回的空位，都在这里找回；有存储区时同样重建存储区的空闲链表，有键段时同样重建键段的空位栈
  */
-static int filemap_file_getdatamap(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key, FILEMAP_DATAMAP *pMap)
+static int filemap_freelist_recover (FILEMAP_OBJ *pObj)
 {
-    int nHashIndex = filemap_hashmap_getindex (nMaxFileNum, key);
+    const int nMaxFileNum = pObj->nMaxFileNum;
+    const int nNumEx = filemap_get_poshashmap_num (nMaxFileNum);
+    const int bHeap = (pObj->nHeapUnitNum > 0);
+    const int bKeySeg = (pObj->sGMap.seg_freelist.seg_stack_key.seg.size > 0);
+
+    BITMAP_HANDLE hBitmapData = bitmap_create (nMaxFileNum);
+    BITMAP_HANDLE hBitmapHashlink = bitmap_create (nMaxFileNum);
+    BITMAP_HANDLE hBitmapKey = bitmap_create (nMaxFileNum);
+    int *pnUnit = (bHeap ? (int*)malloc (sizeof(int) * (nMaxFileNum > 0 ? nMaxFileNum : 1)) : NULL);
+    int nUnitNum = 0;
+    int bError = 0;
 
-    FILEMAP_POSHASHMAP_ELEMENT sHashEle = {};
-    if (filemap_file_getposhashmapitem(hMem2File, nMaxFileNum, nHashIndex, &sHashEle) < 0)
+    if (NULL == hBitmapData || NULL == hBitmapHashlink || NULL == hBitmapKey || (bHeap && NULL == pnUnit))
     {
-        _error("get hashmap item failed\n");
-        return -1;
+        _error ("alloc failed\n");
+        bError = 1;
     }
 
-    if (! sHashEle.node.bUsedFlag)
+    for (int i = 0; i < nNumEx && 0 == bError; ++i)
     {
-        return 0;
-    }
-    
-    if (filemap_keycmp (& sHashEle.node.key, key) == 0)
-    { /* 直接命中 */
-        *pMap = sHashEle.node;
-        return 1;
-    }
-    else 
-    { /* 到链表中去找 */
-        int nIndexNext = sHashEle.node.nNextIndex;
+        FILEMAP_POSHASHMAP_ELEMENT sHashEle = {};
+        if (filemap_file_getposhashmapitem (pObj, i, &sHashEle) < 0)
+        {
+            bError = 1;
+            break;
+        }
 
-        while (1)
+        if (! sHashEle.node.bUsedFlag)
         {
-            if (INDEX_NULL == nIndexNext)
+            continue;
+        }
+
+        if (bHeap && nUnitNum < nMaxFileNum)
+        {
+            pnUnit[nUnitNum++] = sHashEle.node.nIndex;
+        }
+        else if (! bHeap)
+        {
+            bitmap_setbit (hBitmapData, sHashEle.node.nIndex, 1);
+        }
+        if (sHashEle.node.nKeyIndex != INDEX_NULL)
+        {
+            bitmap_setbit (hBitmapKey, sHashEle.node.nKeyIndex, 1);
+        }
+
+        int nIndexNext = sHashEle.node.nNextIndex;
+        for (int nStep = 0; INDEX_NULL != nIndexNext && nStep < nMaxFileNum; ++nStep)
+        {
+            FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEle = {};
+            if (filemap_file_getposhashlinkitem (pObj, nIndexNext, &sHashLinkEle) < 0)
             {
+                bError = 1;
                 break;
             }
 
-            FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEle = {};
-            if (filemap_file_getposhashlinkitem (hMem2File, nMaxFileNum, nIndexNext, & sHashLinkEle) < 0)
+            bitmap_setbit (hBitmapHashlink, nIndexNext, 1);
+            if (bHeap && nUnitNum < nMaxFileNum)
             {
-                _error ("get hashmap link item failed\n");
-                return -1;
+                pnUnit[nUnitNum++] = sHashLinkEle.node.nIndex;
             }
-
-            if (filemap_keycmp (& sHashLinkEle.node.key, key) == 0)
-            { /* 在链表中命中 */
-                *pMap = sHashLinkEle.node;
-                return 1;
+            else if (! bHeap)
+            {
+                bitmap_setbit (hBitmapData, sHashLinkEle.node.nIndex, 1);
+            }
+            if (sHashLinkEle.node.nKeyIndex != INDEX_NULL)
+            {
+                bitmap_setbit (hBitmapKey, sHashLinkEle.node.nKeyIndex, 1);
             }
 
             nIndexNext = sHashLinkEle.node.nNextIndex;
         }
     }
 
-    return 0;
-}
-
-/**
- * @brief 添加key对应的映射数据，若已存在，则替换
- * @return 失败返回-1，成功返回1，已满返回0
- */
-static int filemap_file_adddatamap(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_DATAMAP *map)
-{
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    /* 迁移期间，旧索引中尚未迁移的项同样占用位置 */
+    const int nOldNumEx = (pObj->bMigrating ? filemap_get_poshashmap_num (pObj->nOldMaxFileNum) : 0);
+    FILEMAP_RECOVER_STATE sState = {hBitmapData, hBitmapKey, pnUnit, nUnitNum, nMaxFileNum};
+    for (int i = 0; i < nOldNumEx && 0 == bError; ++i)
     {
-        _error ("get map failed\n");
-        return -1;
+        int ret = filemap_grow_ismigrated (pObj, i);
+        if (ret < 0 || (0 == ret && filemap_index_walkunit (pObj, & pObj->sGMap.seg_index_old, 
+                    pObj->nOldMaxFileNum, i, filemap_grow_visitrecover, &sState) < 0))
+        {
+            bError = 1;
+        }
     }
+    nUnitNum = sState.nUnitNum;
 
-    const int nPosHashLinkMap = sMap.seg_index.seg_bitmap_hashlink.seg.pos;
-    const int nSizeHashLinkMap = sMap.seg_index.seg_bitmap_hashlink.seg.size;
-
-    /* 获取元素在哈希表中的索引 */
-    int nHashMapIndex = filemap_hashmap_getindex (nMaxFileNum, & (map->key));
-
-    FILEMAP_POSHASHMAP_ELEMENT sHashEle = {};
-    if (filemap_file_getposhashmapitem(hMem2File, nMaxFileNum, nHashMapIndex, &sHashEle) < 0)
+    if (0 == bError)
     {
-        _error("get hashmap item failed\n");
-        return -1;
+        if (filemap_freelist_store (pObj, FILEMAP_FREELIST_DATA, hBitmapData) < 0 ||
+                filemap_freelist_store (pObj, FILEMAP_FREELIST_HASHLINK, hBitmapHashlink) < 0 ||
+                (bKeySeg && filemap_freelist_store (pObj, FILEMAP_FREELIST_KEY, hBitmapKey) < 0))
+        {
+            bError = 1;
+        }
     }
 
-    if (! sHashEle.node.bUsedFlag)
-    { /* 直接找到了空位 */
-        sHashEle.node = *map;
-        sHashEle.node.bUsedFlag = 1;
-        if (filemap_file_setposhashmapitem (hMem2File, nMaxFileNum, nHashMapIndex, &sHashEle) < 0)
+    if (0 == bError && bHeap)
+    {
+        if (filemap_heap_rebuild (pObj, pnUnit, nUnitNum) < 0)
         {
-            _error ("set hashmap item failed\n");
-            return -1;
+            bError = 1;
         }
-
-        return 1;
     }
-    else 
-    { /* 哈希表已有数据 */
-        if (filemap_keycmp (& map->key, &sHashEle.node.key) == 0)
-        { /* 哈希表为相同项，则直接替换 */
-            sHashEle.node = *map;
-            if (filemap_file_setposhashmapitem (hMem2File, nMaxFileNum, nHashMapIndex, &sHashEle) < 0)
-            {
-                _error ("set hashmap item failed\n");
-                return -1;
-            }
-            return 1;
-        }
-        else 
-        { /* 哈希表为不同项，则在链表中找 */
-            if (INDEX_NULL == sHashEle.node.nNextIndex)
-            { /* 如果只有一项：也即需要在链表中创建第一个项 */
-                int nEmptyIndex = 0;
-                if (filemap_file_scanfirstemptybit(hMem2File, nMaxFileNum,
-                                                   nPosHashLinkMap, nSizeHashLinkMap, &nEmptyIndex) != 1)
-                {
-                    _error("get empty failed\n");
-                    return -1;
-                }
-
-                FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEleNew = {};
-                sHashLinkEleNew.node.bUsedFlag = 1;
-                sHashLinkEleNew.node.key = map->key;
-                sHashLinkEleNew.node.nIndex = map->nIndex;
-                sHashLinkEleNew.node.nNextIndex = INDEX_NULL;
-
-                FILEMAP_POSHASHMAP_ELEMENT sHashLinkMod = sHashEle;
-                sHashLinkMod.node.nNextIndex = nEmptyIndex;
-
-                if (1 || "union operation")
-                {
-                    if (filemap_file_setposhashmapitem(hMem2File, nMaxFileNum, nHashMapIndex, &sHashLinkMod) < 0)
-                    { /* 调整本项 */
-                        _error("set pos hash link item failed\n");
-                        return -1;
-                    }
-
-                    if (filemap_file_setposhashlinkitem(hMem2File, nMaxFileNum, nEmptyIndex, &sHashLinkEleNew) < 0)
-                    { /* 加入下一项 */
-                        _error("set hashlink item failed\n");
-                        return -1;
-                    }
-
-                    if (filemap_file_setbitmap(hMem2File, nMaxFileNum, nPosHashLinkMap, nSizeHashLinkMap,
-                                               nEmptyIndex, 1) < 0)
-                    { /* 记录下一项 */
-                        _error("set hashlink bit failed\n");
-                        return -1;
-                    }
-                }
-            }
-            else 
-            { /* 如果不只有一项：也即链表已存在第一项 */
-                int nIndexNext = sHashEle.node.nNextIndex; /* 链表的第一项索引 */
-
-                while (1)
-                {
-                    FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEle = {};
-                    if (filemap_file_getposhashlinkitem(hMem2File, nMaxFileNum, nIndexNext, &sHashLinkEle) < 0)
-                    {
-                        _error("get hashmap link item failed\n");
-                        return -1;
-                    }
-
-                    if (filemap_keycmp(&sHashLinkEle.node.key, &map->key) == 0)
-                    { /* 在链表中命中 */
-                        sHashLinkEle.node = *map;
-                        if (filemap_file_setposhashlinkitem(hMem2File, nMaxFileNum, nIndexNext, &sHashLinkEle) < 0)
-                        {
-                            _error("set hashmap link failed\n");
-                            return -1;
-                        }
-                        return 1;
-                    }
-
-                    int nIndexPrev = nIndexNext;    /* 记录当前项 */ 
-                    nIndexNext = sHashLinkEle.node.nNextIndex; /* 指向下一项 */
-
-                    if (INDEX_NULL == nIndexNext)
-                    { /* 如果链表中不存在，则需要新增 */
-
-
-                        int nEmptyIndex = 0;
-                        if (filemap_file_scanfirstemptybit(hMem2File, nMaxFileNum,
-                                                           nPosHashLinkMap, nSizeHashLinkMap, &nEmptyIndex) != 1)
-                        {
-                            _error("get empty failed\n");
-                            return -1;
-                        }
 
-                        FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEleNew = sHashLinkEle;
-                        sHashLinkEleNew.node.bUsedFlag = 1;
-                        sHashLinkEleNew.node.key = map->key;
-                        sHashLinkEleNew.node.nIndex = map->nIndex;
-                        sHashLinkEleNew.node.nNextIndex = INDEX_NULL;
+    free (pnUnit);
 
-                        FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEleMod = sHashLinkEle;
-                        sHashLinkEleMod.node.nNextIndex = nEmptyIndex;
+    if (hBitmapData != NULL)
+    {
+        bitmap_destroy (hBitmapData);
+    }
+    if (hBitmapHashlink != NULL)
+    {
+        bitmap_destroy (hBitmapHashlink);
+    }
+    if (hBitmapKey != NULL)
+    {
+        bitmap_destroy (hBitmapKey);
+    }
 
-                        /* 以下为联合操作，若出错，则会引起一致性问题 */
-                        if (1 || "union operation")
-                        {
-                            if (filemap_file_setposhashlinkitem (hMem2File, nMaxFileNum, nIndexPrev, &sHashLinkEleMod) < 0)
-                            { /* 调整本项 */
-                                _error ("set pos hash link item failed\n");
-                                return -1;
-                            }
+    return bError ? -1 : 0;
+}
 
-                            if (filemap_file_setposhashlinkitem(hMem2File, nMaxFileNum, nEmptyIndex, &sHashLinkEleNew) < 0)
-                            { /* 加入下一项 */
-                                _error("set hashlink item failed\n");
-                                return -1;
-                            }
-                            if (filemap_file_setbitmap(hMem2File, nMaxFileNum, nPosHashLinkMap, nSizeHashLinkMap,
-                                                       nEmptyIndex, 1) < 0)
-                            { /* 记录下一项 */
-                                _error("set hashlink bit failed\n");
-                                return -1;
-                            }
-                        }
-                        return 1;
-                    }
-                }
-            }
+/**
+ * @brief 记录旧索引中一项占用的位置，已迁移到新的索引中的项在新的索引中记录
+ */
+static int filemap_grow_visitrecover (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg)
+{
+    FILEMAP_RECOVER_STATE *psState = (FILEMAP_RECOVER_STATE*)pArg;
 
+    unsigned char byteKey[FILEMAP_KEY_MAX];
+    FILEMAP_KEYREF sKey;
+    int ret = filemap_grow_ismoved (pObj, psNode, byteKey, &sKey);
+    if (ret != 0)
+    {
+        return ret < 0 ? -1 : 0;
+    }
 
-            return 0;
+    if (pObj->nHeapUnitNum > 0)
+    {
+        if (psState->nUnitNum < psState->nUnitMax)
+        {
+            psState->pnUnit[psState->nUnitNum++] = psNode->nIndex;
         }
     }
+    else 
+    {
+        bitmap_setbit (psState->hBitmapData, psNode->nIndex, 1);
+    }
+    if (psNode->nKeyIndex != INDEX_NULL)
+    {
+        bitmap_setbit (psState->hBitmapKey, psNode->nKeyIndex, 1);
+    }
+
     return 0;
 }
 
 /**
- * @brief 删除key对应的映射数据
- * @return 失败返回-1，成功返回0
+ * @brief 从空位栈中取出一个空位
+ * @return 失败返回-1，成功返回1，@pnIndex返回索引值，已满返回0
+ * @note 调用者持有分配锁
  */
-static int filemap_file_deldatamap(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key)
+static int filemap_freelist_pop_nolock (FILEMAP_OBJ *pObj, int nWhich, int *pnIndex)
 {
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    long long llCountPos = 0;
+    long long llStackPos = 0;
+    if (filemap_freelist_getpos (pObj, nWhich, &llCountPos, &llStackPos) < 0)
     {
-        _error ("get map failed\n");
         return -1;
     }
 
-    const int nPosHashLinkMap = sMap.seg_index.seg_bitmap_hashlink.seg.pos;
-    const int nSizeHashLinkMap = sMap.seg_index.seg_bitmap_hashlink.seg.size;
-    const int nPosDataBitMap = sMap.seg_index.seg_bitmap_data.seg.pos;
-    const int nSizeDataBitMap = sMap.seg_index.seg_bitmap_data.seg.size;
+    int nFreeNum = 0;
+    if (filemap_file_getindexdata (pObj, llCountPos, &nFreeNum, sizeof(nFreeNum)) < 0)
+    {
+        _error ("get free num failed\n");
+        return -1;
+    }
 
-    /* 获取元素在哈希表中的索引 */
-    const int nHashMapIndex = filemap_hashmap_getindex (nMaxFileNum, key);
+    if (nFreeNum <= 0)
+    {
+        return 0;
+    }
 
-    FILEMAP_POSHASHMAP_ELEMENT sHashEle = {};
-    if (filemap_file_getposhashmapitem(hMem2File, nMaxFileNum, nHashMapIndex, &sHashEle) < 0)
+    int nIndex = INDEX_NULL;
+    if (filemap_file_getindexdata (pObj, llStackPos + sizeof(int) * (nFreeNum - 1), 
+                &nIndex, sizeof(nIndex)) < 0)
     {
-        _error("get hashmap item failed\n");
+        _error ("get free index failed\n");
         return -1;
     }
 
-    if (! sHashEle.node.bUsedFlag)
-    { /* 要删除的映射不存在 */
-        _error ("key not exist\n");
+    nFreeNum -= 1;
+    if (filemap_file_setindexdata (pObj, llCountPos, &nFreeNum, sizeof(nFreeNum)) < 0)
+    {
+        _error ("set free num failed\n");
         return -1;
     }
-    else 
-    { /* 在哈希表中存在 */
-        if (filemap_keycmp (key, &sHashEle.node.key) == 0)
-        { /* 哈希表为相同项，则删除该项 */
 
-            if (INDEX_NULL != sHashEle.node.nNextIndex)
-            { /* 如果存在后继节点 */
-                /* 取出一个节点，并替换掉当前节点即可 */
-                FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEle = {};
-                if (filemap_file_getposhashlinkitem (hMem2File, nMaxFileNum, sHashEle.node.nNextIndex, &sHashLinkEle) < 0)
-                {
-                    _error ("get item failed\n");
-                    return -1;
-                }
+    if (nFreeNum < pObj->anGrowFreeMark[nWhich])
+    { /* 扩容准备期间，之后写入的元素需要重新复制 */
+        pObj->anGrowFreeMark[nWhich] = nFreeNum;
+    }
 
-                FILEMAP_POSHASHMAP_ELEMENT sHashEleTmp = {};
-                sHashEleTmp.node = sHashLinkEle.node;
-                sHashEleTmp.node.bUsedFlag = 1;
+    BITMAP_HANDLE hBitmap = filemap_freelist_getbitmap (pObj, nWhich);
+    if (hBitmap != NULL)
+    {
+        bitmap_setbit (hBitmap, nIndex, 1);
+    }
 
-                if (1 || "union operation")
-                {
-                    if (filemap_file_setposhashmapitem(hMem2File, nMaxFileNum, nHashMapIndex, &sHashEleTmp) < 0)
-                    { /* 将当前节点替换位下一个节点 */
-                        _error ("set item failed\n");
-                        return -1;
-                    }
-                    if (filemap_file_setbitmap (hMem2File, nMaxFileNum, nPosDataBitMap, nSizeDataBitMap,
-                                sHashEle.node.nIndex, 0) < 0)
-                    { /* 将数据标记位删除 */
-                        _error ("set bit failed\n");
-                        return -1;
-                    }
-                    if (filemap_file_setbitmap (hMem2File, nMaxFileNum, nPosHashLinkMap, nSizeHashLinkMap, 
-                                sHashEle.node.nNextIndex, 0) < 0)
-                    { /* 下一个节点标记为删除 */
-                        _error ("set bit failed\n");
-                        return -1;
-                    }
-                }
-            }
-            else 
-            { /* 如果不存在后继节点，则直接删除即可 */
-                sHashEle.node.bUsedFlag = 0;
+    *pnIndex = nIndex;
+    return 1;
+}
 
-                if (1 || "union operation")
-                {
-                    if (filemap_file_setposhashmapitem(hMem2File, nMaxFileNum, nHashMapIndex, &sHashEle) < 0)
-                    { /* 将当前节点置为无效 */
-                        _error("set hashmap item failed\n");
-                        return -1;
-                    }
-                    if (filemap_file_setbitmap(hMem2File, nMaxFileNum, nPosDataBitMap, nSizeDataBitMap,
-                                               sHashEle.node.nIndex, 0) < 0)
-                    { /* 将数据标记位删除 */
-                        _error("set bit failed\n");
-                        return -1;
-                    }
-                }
-                return 0;
-            }
+/**
+ * @brief 将一个空位放回空位栈
+ * @note 先写入栈中的元素，再修改计数；调用者持有分配锁
+ */
+static int filemap_freelist_push_nolock (FILEMAP_OBJ *pObj, int nWhich, int nIndex)
+{
+    if (FILEMAP_FREELIST_HEAP == nWhich)
+    { /* 放弃或提交操作时，存储区的块也在这里释放 */
+        return filemap_heap_free_nolock (pObj, nIndex);
+    }
 
-            return 0;
-        }
-        else 
-        { /* 哈希表中不存在，则去链表中删除 */
-            int nIndexNext = sHashEle.node.nNextIndex; /* 链表的第一项 */
+    if (nIndex < 0 || nIndex >= pObj->nMaxFileNum)
+    {
+        _error ("index invalid, <which=%d,index=%d>\n", nWhich, nIndex);
+        return -1;
+    }
 
-            if (INDEX_NULL == nIndexNext)
-            { /* 链表是空的 */
-                _error ("del item, item not exist\n");
-                return -1;
-            }
-            else 
-            {
-                int nIndexPrevItem = INDEX_NULL;
-                while (1)
-                {
-                    FILEMAP_POSHASHLINKMAP_ELEMENT sEleHashLinkEle = {};
-                    if (filemap_file_getposhashlinkitem (hMem2File, nMaxFileNum, nIndexNext, &sEleHashLinkEle) < 0)
-                    {
-                        _error ("get item failed\n");
-                        return -1;
-                    }
+    BITMAP_HANDLE hBitmap = filemap_freelist_getbitmap (pObj, nWhich);
+    if (hBitmap != NULL && bitmap_getbit (hBitmap, nIndex) != 1)
+    {
+        _error ("slot not in use, <which=%d,index=%d>\n", nWhich, nIndex);
+        return -1;
+    }
 
-                    if (filemap_keycmp(&sEleHashLinkEle.node.key, key) == 0)
-                    { /* 找到了这一项 */
-                        if (nIndexNext == sHashEle.node.nNextIndex)
-                        { /* 如果是链表的第一项 */
-                            FILEMAP_POSHASHMAP_ELEMENT sHashMapEleMod = sHashEle;
-                            sHashMapEleMod.node.nNextIndex = sEleHashLinkEle.node.nNextIndex; /* 指向下一个节点 */
-                            
-                            if (1 || "union operation")
-                            {
-                                if (filemap_file_setposhashmapitem (hMem2File, nMaxFileNum, nHashMapIndex,
-                                        & sHashMapEleMod) < 0)
-                                { /* 修改哈希表中的节点 */
-                                    _error ("set hash map item failed\n");
-                                    return -1;
-                                }
+    long long llCountPos = 0;
+    long long llStackPos = 0;
+    if (filemap_freelist_getpos (pObj, nWhich, &llCountPos, &llStackPos) < 0)
+    {
+        return -1;
+    }
 
-                                if (filemap_file_setbitmap(hMem2File, nMaxFileNum, nPosHashLinkMap, nSizeHashLinkMap,
-                                                           nIndexNext, 0) < 0)
-                                { /* 删除这一项的记录 */
-                                    _error("set hashlink bit failed\n");
-                                    return -1;
-                                }
+    int nFreeNum = 0;
+    if (filemap_file_getindexdata (pObj, llCountPos, &nFreeNum, sizeof(nFreeNum)) < 0)
+    {
+        _error ("get free num failed\n");
+        return -1;
+    }
 
-                                if (filemap_file_setbitmap(hMem2File, nMaxFileNum, nPosDataBitMap, nSizeDataBitMap,
-                                                           sEleHashLinkEle.node.nIndex, 0) < 0)
-                                { /* 将数据标记位删除 */
-                                    _error("set bit failed\n");
-                                    return -1;
-                                }
-                            }
+    if (nFreeNum < 0 || nFreeNum >= pObj->nMaxFileNum)
+    {
+        _error ("free list broken, <which=%d,free=%d>\n", nWhich, nFreeNum);
+        return -1;
+    }
 
-                            return 0;
-                        }
-                        else
-                        { /* 如果不是链表的第一项 */
-                            FILEMAP_POSHASHLINKMAP_ELEMENT sEleHashLinkElePrev = {};
-                            if (filemap_file_getposhashlinkitem(hMem2File, nMaxFileNum, nIndexPrevItem, &sEleHashLinkElePrev) < 0)
-                            { /* 找到上一项 */
-                                _error("get item failed\n");
-                                return -1;
-                            }
-                            sEleHashLinkElePrev.node.nNextIndex = sEleHashLinkEle.node.nNextIndex; /* 指向下一项 */
+    if (filemap_file_setindexdata (pObj, llStackPos + sizeof(int) * nFreeNum, 
+                &nIndex, sizeof(nIndex)) < 0)
+    {
+        _error ("set free index failed\n");
+        return -1;
+    }
 
-                            if (1 || "union operation")
-                            {
-                                if (filemap_file_setposhashlinkitem (hMem2File, nMaxFileNum, nIndexPrevItem,
-                                        & sEleHashLinkElePrev) < 0)
-                                { /* 修改上一项 */
-                                    _error ("set hash map item failed\n");
-                                    return -1;
-                                }
+    nFreeNum += 1;
+    if (filemap_file_setindexdata (pObj, llCountPos, &nFreeNum, sizeof(nFreeNum)) < 0)
+    {
+        _error ("set free num failed\n");
+        return -1;
+    }
 
-                                if (filemap_file_setbitmap(hMem2File, nMaxFileNum, nPosHashLinkMap, nSizeHashLinkMap,
-                                                           nIndexNext, 0) < 0)
-                                { /* 删除这一项的记录 */
-                                    _error("set hashlink bit failed\n");
-                                    return -1;
-                                }
+    if (hBitmap != NULL)
+    {
+        bitmap_setbit (hBitmap, nIndex, 0);
+    }
 
-                                if (filemap_file_setbitmap(hMem2File, nMaxFileNum, nPosDataBitMap, nSizeDataBitMap,
-                                                           sEleHashLinkEle.node.nIndex, 0) < 0)
-                                { /* 将数据标记位删除 */
-                                    _error("set bit failed\n");
-                                    return -1;
-                                }
-                            }
+    return 0;
+}
 
-                            return 0;
-                        }
-                    }
+/**
+ * @brief 加锁后从空位栈中取出一个空位
+ */
+static int filemap_freelist_pop (FILEMAP_OBJ *pObj, int nWhich, int *pnIndex)
+{
+    FILEMAP_WAL_TXN *pTxn = filemap_wal_gettxn (pObj);
+    if (pTxn != NULL && pTxn->nPopNum >= FILEMAP_WAL_SLOT_MAX)
+    {
+        _error ("too many slots in one operation\n");
+        return -1;
+    }
 
-                    nIndexPrevItem = nIndexNext; /* 记录上一个循环的项 */
-                    nIndexNext = sEleHashLinkEle.node.nNextIndex; /* 指向下一项 */
+    pthread_mutex_lock (& pObj->mutex_alloc);
+    int ret = filemap_freelist_pop_nolock (pObj, nWhich, pnIndex);
+    pthread_mutex_unlock (& pObj->mutex_alloc);
 
-                    if (INDEX_NULL == nIndexNext)
-                    {
-                        _error ("delete item, item not found\n");
-                        return -1;
-                    }
-                }
-            }
-        }
+    if (1 == ret && pTxn != NULL)
+    { /* 操作放弃时归还 */
+        pTxn->asPop[pTxn->nPopNum].nWhich = nWhich;
+        pTxn->asPop[pTxn->nPopNum].nIndex = *pnIndex;
+        pTxn->nPopNum += 1;
     }
 
-    return -1;
+    return ret;
 }
 
 /**
- * @brief 根据key计算出项在位置哈希表中的索引值
+ * @brief 加锁后将一个空位放回空位栈
+ * @note 本线程有进行中的操作时，推迟到提交之后，避免索引仍指向该位置时被再次分配
  */
-static int filemap_hashmap_getindex (int nMaxFileNum, const FILEMAP_KEY *key)
+static int filemap_freelist_push (FILEMAP_OBJ *pObj, int nWhich, int nIndex)
 {
-    const int nHashMapSize = filemap_get_poshashmap_num (nMaxFileNum);
+    FILEMAP_WAL_TXN *pTxn = filemap_wal_gettxn (pObj);
+    if (pTxn != NULL)
+    {
+        if (pTxn->nPushNum >= FILEMAP_WAL_SLOT_MAX)
+        {
+            _error ("too many slots in one operation\n");
+            return -1;
+        }
 
-    /* 根据key得到索引 */
-    unsigned int uIndex = BKDRHash (key->szKey); /* 这里要用无符号型，进行取整 */
-    uIndex %= nHashMapSize;
+        pTxn->asPush[pTxn->nPushNum].nWhich = nWhich;
+        pTxn->asPush[pTxn->nPushNum].nIndex = nIndex;
+        pTxn->nPushNum += 1;
+        return 0;
+    }
 
-    return uIndex;
+    pthread_mutex_lock (& pObj->mutex_alloc);
+    int ret = filemap_freelist_push_nolock (pObj, nWhich, nIndex);
+    pthread_mutex_unlock (& pObj->mutex_alloc);
+
+    return ret;
 }
 
 /**
- * @return 若存在，返回1，否则返回0
+ * @brief 能放下@nLen字节的值的最小一级
+ * @return 超过最大一级返回-1
  */
-static int filemap_file_existitem (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key)
+static int filemap_heap_getclass (int nLen)
 {
-    int bExist = 0;
-
-    FILEMAP_DATAMAP map = {};
-    int ret = filemap_file_getdatamap (hMem2File, nMaxFileNum, key, & map);
-
-    if (ret <= 0)
-    { /* 失败也认为是不存在 */
-        bExist = 0;
-    }
-    else 
+    for (int i = 0; i < FILEMAP_HEAP_CLASS_NUM; ++i)
     {
-        bExist = 1;
+        if ((long long)s_anHeapClassUnit[i] * FILEMAP_HEAP_UNIT_SIZE - (long long)sizeof(FILEMAP_HEAP_CHUNK_HEAD) >= nLen)
+        {
+            return i;
+        }
     }
 
-    return bExist;
+    return -1;
 }
 
-static int filemap_keycmp (const FILEMAP_KEY *keyA, const FILEMAP_KEY *keyB)
+/**
+ * @brief 读取存储区头部，新的存储区从头部之后开始分配
+ */
+static int filemap_heap_gethead (FILEMAP_OBJ *pObj, FILEMAP_SECTION_HEAP_HEAD *psHead)
 {
-    return strcmp (keyA->szKey, keyB->szKey);
+    if (mem2file_getdata (pObj->hMem2File, pObj->sGMap.seg_data.seg.pos, psHead, sizeof(*psHead)) < 0)
+    {
+        _error ("get heap head failed\n");
+        return -1;
+    }
+
+    if (psHead->nTopUnit < FILEMAP_HEAP_HEAD_UNIT_NUM)
+    {
+        psHead->nTopUnit = FILEMAP_HEAP_HEAD_UNIT_NUM;
+    }
+
+    return 0;
 }
 
-static int filemap_getdefsegmap (FILEMAP_DEF_MAP *psMap)
+static int filemap_heap_sethead (FILEMAP_OBJ *pObj, const FILEMAP_SECTION_HEAP_HEAD *psHead)
 {
-    psMap->seg.pos = 0;
-    psMap->seg.size = 10 * 1024;
+    if (mem2file_setdata (pObj->hMem2File, pObj->sGMap.seg_data.seg.pos, psHead, sizeof(*psHead)) < 0)
+    {
+        _error ("set heap head failed\n");
+        return -1;
+    }
 
     return 0;
 }
 
-static int filemap_file_getitem(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key, FILEMAP_VALUE *value)
+/**
+ * @brief 读取块头部，并检查块是否在存储区内
+ * @note 不加锁读取时块可能正被修改，检查失败返回-1
+ */
+static int filemap_heap_getchunk (FILEMAP_OBJ *pObj, int nUnit, FILEMAP_HEAP_CHUNK_HEAD *psChunk)
 {
-    FILEMAP_DATAMAP map = {};
-    int ret = filemap_file_getdatamap (hMem2File, nMaxFileNum, key, & map);
-    if (ret < 0)
+    if (nUnit < FILEMAP_HEAP_HEAD_UNIT_NUM || nUnit >= pObj->nHeapUnitNum)
     {
-        _error ("get data index failed\n");
+        _error ("unit invalid, <%d,%d>\n", nUnit, pObj->nHeapUnitNum);
         return -1;
     }
-    else if (ret == 0)
+
+    const long long llPos = pObj->sGMap.seg_data.seg.pos + (long long)FILEMAP_HEAP_UNIT_SIZE * nUnit;
+    if (mem2file_getdata (pObj->hMem2File, llPos, psChunk, sizeof(*psChunk)) < 0)
     {
+        _error ("get chunk failed, unit=%d\n", nUnit);
         return -1;
     }
-    else 
-    {
-        FILEMAP_SECTION_DATA_ELEMENT sDataElem = {};
-        ret = filemap_file_getdatasegitem (hMem2File, nMaxFileNum, map.nIndex, & sDataElem);
-        if (ret < 0)
-        {
-            _error ("get data element failed\n");
-            return -1;
-        }
 
-        *value = sDataElem.value;
+    if (psChunk->nClass < 0 || psChunk->nClass >= FILEMAP_HEAP_CLASS_NUM ||
+            nUnit + s_anHeapClassUnit[psChunk->nClass] > pObj->nHeapUnitNum)
+    {
+        _error ("chunk broken, <unit=%d,class=%d>\n", nUnit, psChunk->nClass);
+        return -1;
     }
 
     return 0;
 }
 
 /**
- * @brief 记录一个项，若存在，则替换，若不存在，则新增
- * @return 成功返回1，出错返回-1，已满返回0
+ * @brief 将一个块放入所在级的空闲链表
+ * @note 只修改@psHead，由调用者写回；调用者持有分配锁
  */
-static int filemap_file_setitem(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key, const FILEMAP_VALUE *value)
+static int filemap_heap_push_nolock (FILEMAP_OBJ *pObj, FILEMAP_SECTION_HEAP_HEAD *psHead, int nUnit, int nClass)
 {
-    /**
-     * 如果该项存在，则替换，否则
-     * 找出要放的位置，然后记录索引
-     */
+    FILEMAP_HEAP_CHUNK_HEAD sChunk = {
+        nClass,
+        psHead->anFreeHead[nClass],
+    };
 
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    const long long llPos = pObj->sGMap.seg_data.seg.pos + (long long)FILEMAP_HEAP_UNIT_SIZE * nUnit;
+    if (mem2file_setdata (pObj->hMem2File, llPos, &sChunk, sizeof(sChunk)) < 0)
     {
-        _error ("get map failed\n");
+        _error ("set chunk failed, unit=%d\n", nUnit);
         return -1;
-    }    
-
-    const int nPosBitmapData = sMap.seg_index.seg_bitmap_data.seg.pos;
-    const int nSizeBitmapData = sMap.seg_index.seg_bitmap_data.seg.size;
-
-    FILEMAP_DATAMAP sDataMap = {};
-    int ret = filemap_file_getdatamap (hMem2File, nMaxFileNum, key, & sDataMap);
+    }
 
-    int bAddNew = 0;
+    psHead->anFreeHead[nClass] = nUnit;
+    return 0;
+}
 
-    if (ret < 0)
+/**
+ * @brief 将从@nUnit开始的@nUnitNum个单元分成尽量大的块，放入空闲链表
+ * @note 调用者持有分配锁
+ */
+static int filemap_heap_carve_nolock (FILEMAP_OBJ *pObj, FILEMAP_SECTION_HEAP_HEAD *psHead, int nUnit, int nUnitNum)
+{
+    int nClass = FILEMAP_HEAP_CLASS_NUM - 1;
+    while (nUnitNum > 0)
     {
-        _error ("getdatamap failed\n");
-        return -1;
-    }
-    else if (ret == 1)
-    { /* 存在 */
-        FILEMAP_SECTION_DATA_ELEMENT sEle = {
-            *value,
-        };
-        ret = filemap_file_setdatasegitem(hMem2File, nMaxFileNum,
-                                            sDataMap.nIndex, &sEle);
-        if (ret < 0)
+        while (s_anHeapClassUnit[nClass] > nUnitNum)
+        {
+            --nClass;
+        }
+
+        if (filemap_heap_push_nolock (pObj, psHead, nUnit, nClass) < 0)
         {
-            _error("set data to segitem failed\n");
             return -1;
         }
-        return 1;
-    }
-    else if (ret == 0)
-    { /* 不存在，则需要新增映射和数据 */
-        bAddNew = 1;
+
+        nUnit += s_anHeapClassUnit[nClass];
+        nUnitNum -= s_anHeapClassUnit[nClass];
     }
 
-    if (bAddNew)
+    return 0;
+}
+
+/**
+ * @brief 分配一个第@nClass级的块：先取该级的空闲块，再从未分配的部分取，
+ * 最后拆分更大的空闲块
+ * @return 失败返回-1，成功返回1，@pnUnit返回块的位置，已满返回0
+ * @note 调用者持有分配锁
+ */
+static int filemap_heap_alloc_nolock (FILEMAP_OBJ *pObj, int nClass, int *pnUnit)
+{
+    FILEMAP_SECTION_HEAP_HEAD sHead = {};
+    if (filemap_heap_gethead (pObj, &sHead) < 0)
     {
-        /* 先填充数据 */
-        int nEmptyDataIndex = 0;
-        if (filemap_file_scanfirstemptybit (hMem2File, nMaxFileNum, nPosBitmapData, nSizeBitmapData, &nEmptyDataIndex) != 1)
-        {
-            _error ("scan empty bit failed\n");
-            return -1;
-        }
+        return -1;
+    }
 
-        FILEMAP_SECTION_DATA_ELEMENT sDataEle = {
-            *value,
-        };
+    const int nUnitNum = s_anHeapClassUnit[nClass];
+    int nUnit = FILEMAP_HEAP_NULL;
 
-        if (filemap_file_setdatasegitem (hMem2File, nMaxFileNum, nEmptyDataIndex, &sDataEle) < 0)
+    if (sHead.anFreeHead[nClass] != FILEMAP_HEAP_NULL)
+    {
+        FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+        nUnit = sHead.anFreeHead[nClass];
+        if (filemap_heap_getchunk (pObj, nUnit, &sChunk) < 0 || sChunk.nClass != nClass)
         {
-            _error ("set seg item failed\n");
+            _error ("free list broken, <class=%d,unit=%d>\n", nClass, nUnit);
             return -1;
         }
-
-        if (1 || "union operation")
+        sHead.anFreeHead[nClass] = sChunk.nLen;
+    }
+    else if (sHead.nTopUnit + nUnitNum <= pObj->nHeapUnitNum)
+    {
+        nUnit = sHead.nTopUnit;
+        sHead.nTopUnit += nUnitNum;
+    }
+    else 
+    {
+        for (int i = nClass + 1; i < FILEMAP_HEAP_CLASS_NUM; ++i)
         {
-            /* 设置数据标志位 */
-            if (filemap_file_setbitmap (hMem2File, nMaxFileNum, nPosBitmapData, nSizeBitmapData, 
-                        nEmptyDataIndex, 1) < 0)
+            if (FILEMAP_HEAP_NULL == sHead.anFreeHead[i])
+            {
+                continue;
+            }
+
+            FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+            nUnit = sHead.anFreeHead[i];
+            if (filemap_heap_getchunk (pObj, nUnit, &sChunk) < 0 || sChunk.nClass != i)
             {
-                _error ("set data seg bit failed\n");
+                _error ("free list broken, <class=%d,unit=%d>\n", i, nUnit);
                 return -1;
             }
-            
-            /* 增加索引 */
-            FILEMAP_DATAMAP sNewMap = {};
-            sNewMap.bUsedFlag = 1;
-            sNewMap.key = *key;
-            sNewMap.nIndex = nEmptyDataIndex;
-            sNewMap.nNextIndex = INDEX_NULL;
-            if (filemap_file_adddatamap (hMem2File, nMaxFileNum, & sNewMap) < 0)
+            sHead.anFreeHead[i] = sChunk.nLen;
+
+            /* 多出的部分放回空闲链表 */
+            if (filemap_heap_carve_nolock (pObj, &sHead, nUnit + nUnitNum, s_anHeapClassUnit[i] - nUnitNum) < 0)
             {
-                _error ("set new map failed\n");
                 return -1;
             }
+            break;
         }
+    }
 
-        return 1;
+    if (FILEMAP_HEAP_NULL == nUnit)
+    {
+        return 0;
     }
 
-    return -1;
+    FILEMAP_HEAP_CHUNK_HEAD sChunk = {
+        nClass,
+        0,
+    };
+    const long long llPos = pObj->sGMap.seg_data.seg.pos + (long long)FILEMAP_HEAP_UNIT_SIZE * nUnit;
+    if (mem2file_setdata (pObj->hMem2File, llPos, &sChunk, sizeof(sChunk)) < 0 ||
+            filemap_heap_sethead (pObj, &sHead) < 0)
+    {
+        _error ("set chunk failed, unit=%d\n", nUnit);
+        return -1;
+    }
+
+    *pnUnit = nUnit;
+    return 1;
 }
 
 /**
- * @brief 删除一项
- * @return 成功返回1，元素不存在返回0，失败返回-1
+ * @brief 释放一个块，不与相邻的空闲块合并
+ * @note 调用者持有分配锁
  */
-static int filemap_file_deleteitem(MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const FILEMAP_KEY *key)
+static int filemap_heap_free_nolock (FILEMAP_OBJ *pObj, int nUnit)
 {
-    /**
-     * 如果该项存在，则替换，否则
-     * 找出要放的位置，然后记录索引
-     */
+    FILEMAP_SECTION_HEAP_HEAD sHead = {};
+    FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+    if (filemap_heap_gethead (pObj, &sHead) < 0 || 
+            filemap_heap_getchunk (pObj, nUnit, &sChunk) < 0)
+    {
+        return -1;
+    }
 
-    /* 获取地图 */
-    FILEMAP_GLOBAL_MAP sMap = {};
-    if (filemap_getsegmap (nMaxFileNum, & sMap) < 0)
+    if (nUnit + s_anHeapClassUnit[sChunk.nClass] > sHead.nTopUnit)
     {
-        _error ("get map failed\n");
+        _error ("chunk not allocated, unit=%d\n", nUnit);
         return -1;
-    }    
+    }
 
-    FILEMAP_DATAMAP sDataMap = {};
-    int ret = filemap_file_getdatamap (hMem2File, nMaxFileNum, key, & sDataMap);
+    if (filemap_heap_push_nolock (pObj, &sHead, nUnit, sChunk.nClass) < 0 ||
+            filemap_heap_sethead (pObj, &sHead) < 0)
+    {
+        return -1;
+    }
 
-    if (ret < 0)
+    return 0;
+}
+
+/**
+ * @brief 加锁后分配一个能放下@nLen字节的块
+ * @return 失败返回-1，成功返回1，已满返回0
+ */
+static int filemap_heap_alloc (FILEMAP_OBJ *pObj, int nLen, int *pnUnit)
+{
+    const int nClass = filemap_heap_getclass (nLen);
+    if (nClass < 0)
     {
-        _error ("get data map failed\n");
+        _error ("value too large, len=%d\n", nLen);
         return -1;
     }
-    else if (ret == 0)
+
+    FILEMAP_WAL_TXN *pTxn = filemap_wal_gettxn (pObj);
+    if (pTxn != NULL && pTxn->nPopNum >= FILEMAP_WAL_SLOT_MAX)
     {
-        _error ("not exist\n");
-        return 0;
+        _error ("too many slots in one operation\n");
+        return -1;
     }
-    else if (ret == 1)
+
+    pthread_mutex_lock (& pObj->mutex_alloc);
+    int ret = filemap_heap_alloc_nolock (pObj, nClass, pnUnit);
+    pthread_mutex_unlock (& pObj->mutex_alloc);
+
+    if (1 == ret && pTxn != NULL)
+    { /* 操作放弃时释放 */
+        pTxn->asPop[pTxn->nPopNum].nWhich = FILEMAP_FREELIST_HEAP;
+        pTxn->asPop[pTxn->nPopNum].nIndex = *pnUnit;
+        pTxn->nPopNum += 1;
+    }
+
+    return ret;
+}
+
+static int filemap_heap_unitcmp (const void *pA, const void *pB)
+{
+    const int nA = *(const int*)pA;
+    const int nB = *(const int*)pB;
+    return (nA > nB) - (nA < nB);
+}
+
+/**
+ * @brief 根据被索引引用的块重建存储区头部，块之间的空隙都放入空闲链表，
+ * 最后一个块之后视为未分配
+ * @param pnUnit 被引用的块的位置，会被排序
+ * @note 用于重做日志之后
+ */
+static int filemap_heap_rebuild (FILEMAP_OBJ *pObj, int *pnUnit, int nUnitNum)
+{
+    qsort (pnUnit, nUnitNum, sizeof(int), filemap_heap_unitcmp);
+
+    FILEMAP_SECTION_HEAP_HEAD sHead = {};
+    sHead.nTopUnit = FILEMAP_HEAP_HEAD_UNIT_NUM;
+
+    int nFreeUnitNum = 0;
+    for (int i = 0; i < nUnitNum; ++i)
     {
-        if (1 || "union operation")
+        FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+        if (pnUnit[i] < sHead.nTopUnit || filemap_heap_getchunk (pObj, pnUnit[i], &sChunk) < 0)
         {
-            if (filemap_file_deldatamap (hMem2File, nMaxFileNum, key) < 0)
-            {
-                _error ("delete data map failed\n");
-                return -1;
-            }
+            _error ("chunk overlapped, unit=%d\n", pnUnit[i]);
+            return -1;
         }
-        return 1;
+
+        if (filemap_heap_carve_nolock (pObj, &sHead, sHead.nTopUnit, pnUnit[i] - sHead.nTopUnit) < 0)
+        {
+            return -1;
+        }
+
+        nFreeUnitNum += pnUnit[i] - sHead.nTopUnit;
+        sHead.nTopUnit = pnUnit[i] + s_anHeapClassUnit[sChunk.nClass];
     }
 
-    return -1;
+    if (filemap_heap_sethead (pObj, &sHead) < 0)
+    {
+        return -1;
+    }
+
+    _info ("heap rebuilt, <chunk=%d,top=%d,free=%d>\n", nUnitNum, sHead.nTopUnit, nFreeUnitNum);
+
+    return 0;
 }
 
-static int filemap_entrancecall_lock (FILEMAP_HANDLE hInstance)
+/**
+ * @brief 取得块中值的位置和长度
+ */
+static int filemap_heap_getdatapos (FILEMAP_OBJ *pObj, int nUnit, long long *pllPos, int *pnLen)
 {
-    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
-    int ret = pthread_mutex_lock (& pObj->mutex_entrance_call);
-    if (ret != 0)
+    FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+    if (filemap_heap_getchunk (pObj, nUnit, &sChunk) < 0)
     {
-        _error ("lock failed\n");
         return -1;
     }
 
+    const int nCapacity = s_anHeapClassUnit[sChunk.nClass] * FILEMAP_HEAP_UNIT_SIZE - sizeof(sChunk);
+    if (sChunk.nLen < 0 || sChunk.nLen > nCapacity)
+    {
+        _error ("chunk broken, <unit=%d,len=%d>\n", nUnit, sChunk.nLen);
+        return -1;
+    }
+
+    *pllPos = pObj->sGMap.seg_data.seg.pos + (long long)FILEMAP_HEAP_UNIT_SIZE * nUnit + sizeof(sChunk);
+    *pnLen = sChunk.nLen;
     return 0;
 }
 
-static int filemap_entrancecall_unlock (FILEMAP_HANDLE hInstance)
+/**
+ * @brief 读取块中的值，最多拷贝@nSize字节
+ */
+static int filemap_heap_getvalue (FILEMAP_OBJ *pObj, int nUnit, void *pData, int nSize, int *pnLen)
 {
-    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
-    int ret = pthread_mutex_unlock (& pObj->mutex_entrance_call);
-    if (ret != 0)
+    long long llPos = 0;
+    int nLen = 0;
+    if (filemap_heap_getdatapos (pObj, nUnit, &llPos, &nLen) < 0)
     {
-        _error ("lock failed\n");
         return -1;
     }
 
+    if (mem2file_getdata (pObj->hMem2File, llPos, pData, nLen < nSize ? nLen : nSize) < 0)
+    {
+        _error ("get data failed\n");
+        return -1;
+    }
+
+    if (pnLen != NULL)
+    {
+        *pnLen = nLen;
+    }
+
     return 0;
 }
 
-static int filemap_file_generateinfo (MEM2FILE_HANDLE hMem2File, int nMaxFileNum, const char *szFileName)
+/**
+ * @brief 将值写入块中，先写值再写长度
+ */
+static int filemap_heap_setvalue (FILEMAP_OBJ *pObj, int nUnit, const void *pData, int nLen)
 {
-#ifndef DEBUG
-    return 0;
-#endif 
+    FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+    if (filemap_heap_getchunk (pObj, nUnit, &sChunk) < 0)
+    {
+        return -1;
+    }
 
-    FILE *fp = fopen (szFileName, "w");
+    if (nLen < 0 || nLen > s_anHeapClassUnit[sChunk.nClass] * FILEMAP_HEAP_UNIT_SIZE - (int)sizeof(sChunk))
+    {
+        _error ("value too large, <unit=%d,len=%d>\n", nUnit, nLen);
+        return -1;
+    }
 
-    if (NULL == fp)
+    const long long llPos = pObj->sGMap.seg_data.seg.pos + (long long)FILEMAP_HEAP_UNIT_SIZE * nUnit;
+    sChunk.nLen = nLen;
+    if (mem2file_setdata (pObj->hMem2File, llPos + sizeof(sChunk), pData, nLen) < 0 ||
+            mem2file_setdata (pObj->hMem2File, llPos, &sChunk, sizeof(sChunk)) < 0)
     {
-        _error ("open <%s> failed\n", szFileName);
+        _error ("set data failed\n");
         return -1;
     }
 
-    if (1)
+    return 0;
+}
+
+/**
+ * @brief 读取块中值的一段，范围不能超出值的长度
+ */
+static int filemap_heap_getrange (FILEMAP_OBJ *pObj, int nUnit, int nOffset, void *pData, int nSize)
+{
+    long long llPos = 0;
+    int nLen = 0;
+    if (filemap_heap_getdatapos (pObj, nUnit, &llPos, &nLen) < 0)
     {
-        fprintf(fp, "filemapinfo: \n");
-        fprintf (fp, "{\n");
-        fprintf (fp, "  obj=%p\n", hMem2File);
-        fprintf (fp, "}\n\n");
-    }   
-    
-    FILEMAP_GLOBAL_MAP sMap = {};
-    filemap_getsegmap (nMaxFileNum, &sMap);
+        return -1;
+    }
 
-    if (1)
-    { /* 文件基本信息 */
-        fprintf (fp, "fileinfo: \n");
-        fprintf (fp, "{\n");
+    if (nOffset < 0 || nSize < 0 || nOffset + nSize > nLen)
+    {
+        _error ("range invalid, <offset=%d,size=%d,len=%d>\n", nOffset, nSize, nLen);
+        return -1;
+    }
 
-        int nFileSize = 0;
-        int ret_size = mem2file_size (hMem2File, & nFileSize);
-        fprintf (fp, "  file size=%d,ret=%d\n", nFileSize, ret_size);
+    if (mem2file_getdata (pObj->hMem2File, llPos + nOffset, pData, nSize) < 0)
+    {
+        _error ("get data failed\n");
+        return -1;
+    }
 
-        FILEMAP_SECTION_DEF sDefSec = {};
-        int ret_getdefseg = filemap_get_defseg (hMem2File, & sDefSec);
-        fprintf (fp, "  version=<%s>,maxfilenum=%d,ret=%d\n",
-                        sDefSec.szVersion, sDefSec.nMaxFileNum, ret_getdefseg);
+    return 0;
+}
 
-        fprintf (fp, "}\n\n");
+/**
+ * @brief 修改块中值的一段，范围不能超出值的长度
+ */
+static int filemap_heap_setrange (FILEMAP_OBJ *pObj, int nUnit, int nOffset, const void *pData, int nSize)
+{
+    long long llPos = 0;
+    int nLen = 0;
+    if (filemap_heap_getdatapos (pObj, nUnit, &llPos, &nLen) < 0)
+    {
+        return -1;
     }
 
-    if (1)
-    { /* 分区地图 */
-        fprintf (fp, "global_map:\n");
-        fprintf (fp, "{\n");
-        fprintf (fp, "  seg:[pos=%d,size=%d]\n", sMap.seg.pos, sMap.seg.size);
-        fprintf (fp, "  seg_def:\n");
-        fprintf (fp, "  {\n");
-        fprintf (fp, "    seg: [pos=%d,size=%d]\n",
-                        sMap.seg_def.seg.pos, 
-                        sMap.seg_def.seg.size);
-        fprintf (fp, "  }\n");
-        fprintf (fp, "  seg_index: \n");
-        fprintf (fp, "  {\n");
-        fprintf (fp, "    seg_bitmap_data:\n");
-        fprintf (fp, "    {\n");
-        fprintf (fp, "      seg: [pos=%d,size=%d]\n", 
-                        sMap.seg_index.seg_bitmap_data.seg.pos,
-                        sMap.seg_index.seg_bitmap_data.seg.size);
-        fprintf (fp, "    }\n");
-        fprintf (fp, "    seg_bitmap_hashlink:\n");
-        fprintf (fp, "    {\n");
-        fprintf (fp, "      seg: [pos=%d,size=%d]\n", 
-                        sMap.seg_index.seg_bitmap_hashlink.seg.pos,
-                        sMap.seg_index.seg_bitmap_hashlink.seg.size);
-        fprintf (fp, "    }\n");
-        fprintf (fp, "    seg_hashmap:\n");
-        fprintf (fp, "    {\n");
-        fprintf (fp, "      seg: [pos=%d,size=%d]\n",
-                        sMap.seg_index.seg_hashmap.seg.pos,
-                        sMap.seg_index.seg_hashmap.seg.size);
-        fprintf (fp, "    }\n");
-        fprintf (fp, "    seg_hashlink:\n");
-        fprintf (fp, "    {\n");
-        fprintf (fp, "       seg: [pos=%d,size=%d]\n",
-                        sMap.seg_index.seg_hashlink.seg.pos,
-                        sMap.seg_index.seg_hashlink.seg.size);
-        fprintf (fp, "    }\n");
-        fprintf (fp, "  }\n");
-        fprintf (fp, "  seg_data:\n");
-        fprintf (fp, "  {\n");
-        fprintf (fp, "    seg: [pos=%d,size=%d]\n", 
-                        sMap.seg_data.seg.pos,
-                        sMap.seg_data.seg.size);
-        fprintf (fp, "  }\n");
-        fprintf (fp, "}\n\n");
+    if (nOffset < 0 || nSize < 0 || nOffset + nSize > nLen)
+    {
+        _error ("range invalid, <offset=%d,size=%d,len=%d>\n", nOffset, nSize, nLen);
+        return -1;
     }
 
-    if (1)
-    { /* 数据位信息 */
-        fprintf (fp, "bitmap_data: \n");
-        fprintf (fp, "{\n");
+    if (mem2file_setdata (pObj->hMem2File, llPos + nOffset, pData, nSize) < 0)
+    {
+        _error ("set data failed\n");
+        return -1;
+    }
 
-        const int nBitmapPos = sMap.seg_index.seg_bitmap_data.seg.pos;
-        const int nBitmapSize = sMap.seg_index.seg_bitmap_data.seg.size;
+    return 0;
+}
 
-        for (int k = 0; ; ++k)
-        {
-            char byteBuffer[256] = {};
+/**
+ * @brief 根据空位栈建立比特表，不在空位栈中的视为已使用
+ */
+static BITMAP_HANDLE filemap_bitmap_build (FILEMAP_OBJ *pObj, int nWhich)
+{
+    const int nMaxFileNum = pObj->nMaxFileNum;
+    const int nBitmapSize = pObj->sGMap.seg_index.seg_bitmap_data.seg.size;
+
+    long long llCountPos = 0;
+    long long llStackPos = 0;
+    int nFreeNum = 0;
+    if (filemap_freelist_getpos (pObj, nWhich, &llCountPos, &llStackPos) < 0 ||
+            filemap_file_getindexdata (pObj, llCountPos, &nFreeNum, sizeof(nFreeNum)) < 0)
+    {
+        _error ("get free num failed\n");
+        return NULL;
+    }
 
-            const int nReadPos = nBitmapPos + sizeof(byteBuffer) * k;
-            if ( (nReadPos - nBitmapPos) > nBitmapSize)
-            {
-                _debug ("scan finished\n");
-                break;
-            }
+    if (nFreeNum < 0 || nFreeNum > nMaxFileNum)
+    {
+        _error ("free list broken, <which=%d,free=%d>\n", nWhich, nFreeNum);
+        return NULL;
+    }
 
-            const int nLeftSize = nBitmapSize - (nReadPos - nBitmapPos);
-            const int nReadSize = (nLeftSize > sizeof(byteBuffer) ? 
-                                        sizeof(byteBuffer) : nLeftSize);
+    int *pnStack = (int*)malloc (sizeof(int) * (nFreeNum > 0 ? nFreeNum : 1));
+    char *pMem = (char*)malloc (nBitmapSize > 0 ? nBitmapSize : 1);
+    BITMAP_HANDLE hBitmap = bitmap_create (nMaxFileNum);
+    if (NULL == pnStack || NULL == pMem || NULL == hBitmap)
+    {
+        _error ("alloc failed\n");
+        free (pnStack);
+        free (pMem);
+        if (hBitmap != NULL)
+        {
+            bitmap_destroy (hBitmap);
+        }
+        return NULL;
+    }
 
-            int ret = mem2file_getdata(hMem2File, nReadPos, byteBuffer, nReadSize);
-            if (ret < 0)
+    if (filemap_file_getindexdata (pObj, llStackPos, pnStack, sizeof(int) * nFreeNum) < 0)
+    {
+        _error ("get free list failed\n");
+        free (pnStack);
+        free (pMem);
+        bitmap_destroy (hBitmap);
+        return NULL;
+    }
+
+    memset (pMem, 0xFF, nBitmapSize);
+    bitmap_load (hBitmap, pMem, nBitmapSize);
+
+    for (int k = 0; k < nFreeNum; ++k)
+    {
+        if (bitmap_setbit (hBitmap, pnStack[k], 0) < 0)
+        {
+            _error ("free list broken, <which=%d,index=%d>\n", nWhich, pnStack[k]);
+        }
+    }
+
+    free (pnStack);
+    free (pMem);
+
+    return hBitmap;
+}
+
+/**
+ * @brief 根据空位栈建立内存中的比特表
+ */
+static int filemap_bitmap_load (FILEMAP_OBJ *pObj)
+{
+    pObj->hBitmapData = filemap_bitmap_build (pObj, FILEMAP_FREELIST_DATA);
+    pObj->hBitmapHashlink = filemap_bitmap_build (pObj, FILEMAP_FREELIST_HASHLINK);
+
+    if (NULL == pObj->hBitmapData || NULL == pObj->hBitmapHashlink)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 将内存中的比特表写回文件，没有内存中的比特表时根据空位栈生成
+ * @note 文件中的比特表不在读写过程中维护，仅用于校验和生成信息
+ */
+static int filemap_bitmap_sync (FILEMAP_OBJ *pObj)
+{
+    const FILEMAP_INDEX_BITMAP_MAP *psBitmapMap[2] = {
+        & pObj->sGMap.seg_index.seg_bitmap_data,
+        & pObj->sGMap.seg_index.seg_bitmap_hashlink,
+    };
+    BITMAP_HANDLE hBitmap[2] = {
+        pObj->hBitmapData,
+        pObj->hBitmapHashlink,
+    };
+
+    const int nWhich[2] = {
+        FILEMAP_FREELIST_DATA,
+        FILEMAP_FREELIST_HASHLINK,
+    };
+
+    for (int i = 0; i < 2; ++i)
+    {
+        BITMAP_HANDLE hBitmapTmp = NULL;
+        if (NULL == hBitmap[i])
+        {
+            hBitmapTmp = filemap_bitmap_build (pObj, nWhich[i]);
+            if (NULL == hBitmapTmp)
             {
-                _error ("get data failed\n");
+                return -1;
             }
+            hBitmap[i] = hBitmapTmp;
+        }
 
-            for (int i = 0; i < nReadSize; ++i)
-            {
-                if ((i % 10) == 0)
-                {
-                    fprintf(fp, "  [%d-%d] ", i, i + 10);
-                }
-                int cTmp = (unsigned char)byteBuffer[i];
+        const long long llBitmapPos = psBitmapMap[i]->seg.pos;
+        const int nBitmapSize = psBitmapMap[i]->seg.size;
 
-                fprintf(fp, "%02X ", cTmp);
+        char *pMem = (char*)malloc (nBitmapSize > 0 ? nBitmapSize : 1);
+        if (pMem != NULL)
+        {
+            bitmap_store (hBitmap[i], pMem, nBitmapSize);
+        }
 
-                if ((i + 1) % 10 == 0)
-                {
-                    fprintf(fp, "\n");
-                }
-            }
+        if (hBitmapTmp != NULL)
+        {
+            bitmap_destroy (hBitmapTmp);
+        }
 
-            fprintf (fp, "\n}\n\n");
+        if (NULL == pMem)
+        {
+            _error ("malloc failed, size=%d\n", nBitmapSize);
+            return -1;
+        }
+
+        if (filemap_file_setindexdata (pObj, llBitmapPos, pMem, nBitmapSize) < 0)
+        {
+            _error ("set bitmap failed\n");
+            free (pMem);
+            return -1;
         }
+
+        free (pMem);
     }
 
-    if (1)
-    { /* 数据链表位信息 */
-        fprintf (fp, "bitmap_hashlink: \n");
-        fprintf (fp, "{\n");
+    return 0;
+}
 
-        const int nBitmapPos = sMap.seg_index.seg_bitmap_hashlink.seg.pos;
-        const int nBitmapSize = sMap.seg_index.seg_bitmap_hashlink.seg.size;
+/**
+ * @brief 获取一个索引段中位置哈希表或位置哈希链表的第@nIndex个元素
+ * @param nNum 该索引段对应的数量
+ * @param bLink 为1时为位置哈希链表
+ */
+static int filemap_index_getnode (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nNum, 
+                int bLink, int nIndex, FILEMAP_DATAMAP *psNode)
+{
+    /* 获取总元素 */
+    const int nNumEx = (bLink ? nNum : filemap_get_poshashmap_num (nNum));
 
-        for (int k = 0; ; ++k)
+    if (nIndex >= nNumEx || nIndex < 0)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, nNumEx);
+        return -1;
+    }
+
+    /* 得到待获取元素的位置 */
+    const long long llDataPos = (bLink ? psIndex->seg_hashlink.seg.pos : psIndex->seg_hashmap.seg.pos) + 
+                    (long long)pObj->nNodeSize * nIndex;
+    const int nDataSize = pObj->nNodeSize;
+
+    char byteNode[FILEMAP_NODE_SIZE_MAX];
+    if (filemap_file_getindexdata (pObj, llDataPos, byteNode, nDataSize) < 0)
+    {
+        _error ("get data failed\n");
+        return -1;
+    }
+
+    return filemap_node_decode (pObj, byteNode, psNode);
+}
+
+/**
+ * @brief 获取位置哈希表中的第@nIndex个元素
+ */
+static int filemap_file_getposhashmapitem (FILEMAP_OBJ *pObj, int nIndex, FILEMAP_POSHASHMAP_ELEMENT *pEle)
+{
+    return filemap_index_getnode (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, 0, nIndex, & pEle->node);
+}
+
+/**
+ * @brief 设置位置哈希表中的第@nIndex个元素
+ */
+static int filemap_file_setposhashmapitem (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_POSHASHMAP_ELEMENT *pEle)
+{
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    /* 获取总元素 */
+    int nNumEx = filemap_get_poshashmap_num (nMaxFileNum);
+
+    if (nIndex >= nNumEx || nIndex < 0)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, nNumEx);
+        return -1;
+    }
+
+    const FILEMAP_GLOBAL_MAP *psMap = & pObj->sGMap;
+
+    /* 得到待获取元素的位置 */
+    const long long llDataPos = psMap->seg_index.seg_hashmap.seg.pos + (long long)pObj->nNodeSize * nIndex;
+    const int nDataSize = pObj->nNodeSize;
+
+    char byteNode[FILEMAP_NODE_SIZE_MAX];
+    if (filemap_node_encode (pObj, & pEle->node, byteNode) < 0 ||
+            filemap_file_setindexdata (pObj, llDataPos, byteNode, nDataSize) < 0)
+    {
+        _error ("get data failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int filemap_file_getposhashlinkitem (FILEMAP_OBJ *pObj, int nIndex, FILEMAP_POSHASHLINKMAP_ELEMENT *pEle)
+{
+    return filemap_index_getnode (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, 1, nIndex, & pEle->node);
+}
+
+static int filemap_file_setposhashlinkitem (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_POSHASHLINKMAP_ELEMENT *pEle)
+{
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    if (nIndex < 0 || nIndex >= nMaxFileNum)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
+        return -1;
+    }
+
+    const FILEMAP_GLOBAL_MAP *psMap = & pObj->sGMap;
+
+    /* 得到待获取元素的位置 */
+    const long long llDataPos = psMap->seg_index.seg_hashlink.seg.pos + (long long)pObj->nNodeSize * nIndex;
+    const int nDataSize = pObj->nNodeSize;
+
+    char byteNode[FILEMAP_NODE_SIZE_MAX];
+    if (filemap_node_encode (pObj, & pEle->node, byteNode) < 0 ||
+            filemap_file_setindexdata (pObj, llDataPos, byteNode, nDataSize) < 0)
+    {
+        _error ("set data failed\n");
+        return -1;
+    }
+
+    return 0;  
+}
+
+/**
+ * @brief 数据段第@nIndex个元素在文件中的位置，扩容后增加的元素在扩容时追加的区域中
+ */
+static long long filemap_data_getpos (FILEMAP_OBJ *pObj, int nIndex)
+{
+    const FILEMAP_GLOBAL_MAP *psMap = & pObj->sGMap;
+
+    int k = psMap->nExtentNum - 1;
+    while (k > 0 && nIndex < psMap->asExtent[k].nSlotBegin)
+    {
+        --k;
+    }
+
+    return psMap->asExtent[k].seg_data.seg.pos + (long long)psMap->nDataStride * (nIndex - psMap->asExtent[k].nSlotBegin);
+}
+
+/**
+ * @brief 键段第@nKeyIndex个位置在文件中的位置
+ */
+static long long filemap_key_getpos (FILEMAP_OBJ *pObj, int nKeyIndex)
+{
+    const FILEMAP_GLOBAL_MAP *psMap = & pObj->sGMap;
+
+    int k = psMap->nExtentNum - 1;
+    while (k > 0 && nKeyIndex < psMap->asExtent[k].nSlotBegin)
+    {
+        --k;
+    }
+
+    return psMap->asExtent[k].seg_key.seg.pos + (long long)FILEMAP_KEY_MAX * (nKeyIndex - psMap->asExtent[k].nSlotBegin);
+}
+
+/**
+ * @brief 获取数据段的元素
+ */
+static int filemap_file_getdatasegitem (FILEMAP_OBJ *pObj, int nIndex, FILEMAP_SECTION_DATA_ELEMENT *pElem)
+{
+    MEM2FILE_HANDLE hMem2File = pObj->hMem2File;
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    if (nIndex > nMaxFileNum || nIndex < 0)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
+        return -1;
+    }
+
+    const long long llDataPos = filemap_data_getpos (pObj, nIndex);
+    const int nDataSize = sizeof(FILEMAP_SECTION_DATA_ELEMENT);
+
+    if (mem2file_getdata (hMem2File, llDataPos, pElem, nDataSize) < 0)
+    {
+        _error ("get data failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 设置数据段的元素
+ */
+static int filemap_file_setdatasegitem (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_SECTION_DATA_ELEMENT *pElem)
+{
+    MEM2FILE_HANDLE hMem2File = pObj->hMem2File;
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    if (nIndex > nMaxFileNum || nIndex < 0)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
+        return -1;
+    }
+
+    const FILEMAP_GLOBAL_MAP *psMap = & pObj->sGMap;
+
+    const long long llDataPos = filemap_data_getpos (pObj, nIndex);
+    const int nDataSize = sizeof(FILEMAP_SECTION_DATA_ELEMENT);
+
+    /* 检查是否需要扩展文件 */
+    const long long llFinalSize = llDataPos + nDataSize;
+
+    long long llFileSize = 0;
+    if (mem2file_size (hMem2File, &llFileSize) < 0)
+    {
+        _error ("get size failed\n");
+        return -1;
+    }
+
+    if (llFinalSize > llFileSize && llFinalSize <= psMap->seg.size)
+    {
+        if (mem2file_resize (hMem2File, llFinalSize) < 0)
         {
-            char byteBuffer[256] = {};
+            _error ("resize failed\n");
+            return -1;
+        }
+    }
 
-            const int nReadPos = nBitmapPos + sizeof(byteBuffer) * k;
-            if ( (nReadPos - nBitmapPos) > nBitmapSize)
-            {
-                _debug ("scan finished\n");
-                break;
-            }
+    if (mem2file_setdata (hMem2File, llDataPos, pElem, nDataSize) < 0)
+    {
+        _error ("set data failed\n");
+        return -1;
+    }
 
-            const int nLeftSize = nBitmapSize - (nReadPos - nBitmapPos);
-            const int nReadSize = (nLeftSize > sizeof(byteBuffer) ? 
-                                        sizeof(byteBuffer) : nLeftSize);
+    return 0;
+}
 
-            int ret = mem2file_getdata(hMem2File, nReadPos, byteBuffer, nReadSize);
-            if (ret < 0)
-            {
-                _error ("get data failed\n");
-            }
+/**
+ * @brief 获取数据段元素中的一段
+ * @param nOffset 在元素中的起始位置
+ */
+static int filemap_file_getdatasegrange (FILEMAP_OBJ *pObj, int nIndex, int nOffset, void *pData, int nSize)
+{
+    MEM2FILE_HANDLE hMem2File = pObj->hMem2File;
+    const int nMaxFileNum = pObj->nMaxFileNum;
 
-            for (int i = 0; i < nReadSize; ++i)
-            {
-                if ((i % 10) == 0)
-                {
-                    fprintf(fp, "  [%d-%d] ", i, i + 10);
-                }
-                int cTmp = (unsigned char)byteBuffer[i];
+    if (nIndex >= nMaxFileNum || nIndex < 0)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
+        return -1;
+    }
+
+    if (nOffset < 0 || nSize < 0 || nOffset + nSize > (int)sizeof(FILEMAP_SECTION_DATA_ELEMENT))
+    {
+        _error ("range invalid, <offset=%d,size=%d>\n", nOffset, nSize);
+        return -1;
+    }
+
+    const long long llDataPos = filemap_data_getpos (pObj, nIndex) + nOffset;
+
+    if (mem2file_getdata (hMem2File, llDataPos, pData, nSize) < 0)
+    {
+        _error ("get data failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 设置数据段元素中的一段
+ * @param nOffset 在元素中的起始位置
+ * @note 该元素必须已经写入过
+ */
+static int filemap_file_setdatasegrange (FILEMAP_OBJ *pObj, int nIndex, int nOffset, const void *pData, int nSize)
+{
+    MEM2FILE_HANDLE hMem2File = pObj->hMem2File;
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    if (nIndex >= nMaxFileNum || nIndex < 0)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, nMaxFileNum);
+        return -1;
+    }
+
+    if (nOffset < 0 || nSize < 0 || nOffset + nSize > (int)sizeof(FILEMAP_SECTION_DATA_ELEMENT))
+    {
+        _error ("range invalid, <offset=%d,size=%d>\n", nOffset, nSize);
+        return -1;
+    }
+
+    const long long llDataPos = filemap_data_getpos (pObj, nIndex) + nOffset;
+
+    if (mem2file_setdata (hMem2File, llDataPos, pData, nSize) < 0)
+    {
+        _error ("set data failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 获取key对应的映射数据，迁移期间先查找扩容前的索引中尚未迁移的位置
+ * @return 失败返回-1，找到返回1，没有找到返回0
+ */
+static int filemap_file_getdatamap(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_DATAMAP *pMap)
+{
+    if (__atomic_load_n (& pObj->bMigrating, __ATOMIC_ACQUIRE))
+    {
+        int ret = filemap_grow_find (pObj, key, pMap);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    int nUnit = 0;
+    return filemap_index_find (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, key, &nUnit, pMap);
+}
+
+/**
+ * @brief 在一个索引段中查找key，只读
+ * @param nNum 该索引段对应的数量
+ * @param [OUT] pnUnit 链表方式下为key在哈希表中的位置，开放寻址方式下为找到的位置
+ * @return 失败返回-1，找到返回1，没有找到返回0
+ */
+static int filemap_index_find (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nNum, 
+                const FILEMAP_KEYREF *key, int *pnUnit, FILEMAP_DATAMAP *pMap)
+{
+    if (FILEMAP_INDEX_OPEN == pObj->nIndexLayout)
+    {
+        return filemap_open_find (pObj, psIndex, nNum, key, pnUnit, pMap);
+    }
+
+    int nHashIndex = filemap_hashmap_getindex (nNum, key->uHash);
+    *pnUnit = nHashIndex;
+
+    FILEMAP_DATAMAP sHashNode = {};
+    if (filemap_index_getnode (pObj, psIndex, nNum, 0, nHashIndex, &sHashNode) < 0)
+    {
+        _error("get hashmap item failed\n");
+        return -1;
+    }
+
+    if (! sHashNode.bUsedFlag)
+    {
+        return 0;
+    }
+    
+    if (filemap_keycmp (pObj, & sHashNode, key) == 0)
+    { /* 直接命中 */
+        *pMap = sHashNode;
+        return 1;
+    }
+    else 
+    { /* 到链表中去找 */
+        int nIndexNext = sHashNode.nNextIndex;
+
+        /* 不加锁读取时，链表可能正在被修改，限制查找的长度 */
+        for (int nStep = 0; ; ++nStep)
+        {
+            if (INDEX_NULL == nIndexNext)
+            {
+                break;
+            }
+
+            if (nStep >= nNum)
+            {
+                _error ("hash link too long\n");
+                return -1;
+            }
+
+            FILEMAP_DATAMAP sHashLinkNode = {};
+            if (filemap_index_getnode (pObj, psIndex, nNum, 1, nIndexNext, & sHashLinkNode) < 0)
+            {
+                _error ("get hashmap link item failed\n");
+                return -1;
+            }
+
+            if (filemap_keycmp (pObj, & sHashLinkNode, key) == 0)
+            { /* 在链表中命中 */
+                *pMap = sHashLinkNode;
+                return 1;
+            }
+
+            nIndexNext = sHashLinkNode.nNextIndex;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 添加key对应的映射数据，若已存在，则替换
+ * @return 失败返回-1，成功返回1，已满返回0
+ */
+static int filemap_file_adddatamap(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_DATAMAP *map)
+{
+    if (FILEMAP_INDEX_OPEN == pObj->nIndexLayout)
+    {
+        return filemap_open_adddatamap (pObj, key, map);
+    }
+
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    /* 获取元素在哈希表中的索引 */
+    int nHashMapIndex = filemap_hashmap_getindex (nMaxFileNum, key->uHash);
+
+    FILEMAP_POSHASHMAP_ELEMENT sHashEle = {};
+    if (filemap_file_getposhashmapitem(pObj, nHashMapIndex, &sHashEle) < 0)
+    {
+        _error("get hashmap item failed\n");
+        return -1;
+    }
+
+    if (! sHashEle.node.bUsedFlag)
+    { /* 直接找到了空位 */
+        sHashEle.node = *map;
+        sHashEle.node.bUsedFlag = 1;
+        if (filemap_file_setposhashmapitem (pObj, nHashMapIndex, &sHashEle) < 0)
+        {
+            _error ("set hashmap item failed\n");
+            return -1;
+        }
+
+        return 1;
+    }
+    else 
+    { /* 哈希表已有数据 */
+        if (filemap_keycmp (pObj, &sHashEle.node, key) == 0)
+        { /* 哈希表为相同项，则直接替换 */
+            sHashEle.node = *map;
+            if (filemap_file_setposhashmapitem (pObj, nHashMapIndex, &sHashEle) < 0)
+            {
+                _error ("set hashmap item failed\n");
+                return -1;
+            }
+            return 1;
+        }
+        else 
+        { /* 哈希表为不同项，则在链表中找 */
+            if (INDEX_NULL == sHashEle.node.nNextIndex)
+            { /* 如果只有一项：也即需要在链表中创建第一个项 */
+                int nEmptyIndex = 0;
+                if (filemap_freelist_pop (pObj, FILEMAP_FREELIST_HASHLINK, &nEmptyIndex) != 1)
+                {
+                    _error("get empty failed\n");
+                    return -1;
+                }
+
+                FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEleNew = {};
+                sHashLinkEleNew.node = *map;
+                sHashLinkEleNew.node.bUsedFlag = 1;
+                sHashLinkEleNew.node.nNextIndex = INDEX_NULL;
+
+                FILEMAP_POSHASHMAP_ELEMENT sHashLinkMod = sHashEle;
+                sHashLinkMod.node.nNextIndex = nEmptyIndex;
+
+                if (1 || "union operation")
+                {
+                    if (filemap_file_setposhashmapitem(pObj, nHashMapIndex, &sHashLinkMod) < 0)
+                    { /* 调整本项 */
+                        _error("set pos hash link item failed\n");
+                        return -1;
+                    }
+
+                    if (filemap_file_setposhashlinkitem(pObj, nEmptyIndex, &sHashLinkEleNew) < 0)
+                    { /* 加入下一项 */
+                        _error("set hashlink item failed\n");
+                        return -1;
+                    }
+                }
+            }
+            else 
+            { /* 如果不只有一项：也即链表已存在第一项 */
+                int nIndexNext = sHashEle.node.nNextIndex; /* 链表的第一项索引 */
+
+                while (1)
+                {
+                    FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEle = {};
+                    if (filemap_file_getposhashlinkitem(pObj, nIndexNext, &sHashLinkEle) < 0)
+                    {
+                        _error("get hashmap link item failed\n");
+                        return -1;
+                    }
+
+                    if (filemap_keycmp (pObj, &sHashLinkEle.node, key) == 0)
+                    { /* 在链表中命中 */
+                        sHashLinkEle.node = *map;
+                        if (filemap_file_setposhashlinkitem(pObj, nIndexNext, &sHashLinkEle) < 0)
+                        {
+                            _error("set hashmap link failed\n");
+                            return -1;
+                        }
+                        return 1;
+                    }
+
+                    int nIndexPrev = nIndexNext;    /* 记录当前项 */ 
+                    nIndexNext = sHashLinkEle.node.nNextIndex; /* 指向下一项 */
+
+                    if (INDEX_NULL == nIndexNext)
+                    { /* 如果链表中不存在，则需要新增 */
+
+
+                        int nEmptyIndex = 0;
+                        if (filemap_freelist_pop (pObj, FILEMAP_FREELIST_HASHLINK, &nEmptyIndex) != 1)
+                        {
+                            _error("get empty failed\n");
+                            return -1;
+                        }
+
+                        FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEleNew = {};
+                        sHashLinkEleNew.node = *map;
+                        sHashLinkEleNew.node.bUsedFlag = 1;
+                        sHashLinkEleNew.node.nNextIndex = INDEX_NULL;
+
+                        FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEleMod = sHashLinkEle;
+                        sHashLinkEleMod.node.nNextIndex = nEmptyIndex;
+
+                        /* 以下为联合操作，若出错，则会引起一致性问题 */
+                        if (1 || "union operation")
+                        {
+                            if (filemap_file_setposhashlinkitem (pObj, nIndexPrev, &sHashLinkEleMod) < 0)
+                            { /* 调整本项 */
+                                _error ("set pos hash link item failed\n");
+                                return -1;
+                            }
+
+                            if (filemap_file_setposhashlinkitem(pObj, nEmptyIndex, &sHashLinkEleNew) < 0)
+                            { /* 加入下一项 */
+                                _error("set hashlink item failed\n");
+                                return -1;
+                            }
+                        }
+                        return 1;
+                    }
+                }
+            }
+
+
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 删除key对应的映射数据
+ * @return 失败返回-1，成功返回0
+ */
+static int filemap_file_deldatamap(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key)
+{
+    if (FILEMAP_INDEX_OPEN == pObj->nIndexLayout)
+    {
+        return filemap_open_deldatamap (pObj, key);
+    }
+
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+    /* 获取元素在哈希表中的索引 */
+    const int nHashMapIndex = filemap_hashmap_getindex (nMaxFileNum, key->uHash);
+
+    FILEMAP_POSHASHMAP_ELEMENT sHashEle = {};
+    if (filemap_file_getposhashmapitem(pObj, nHashMapIndex, &sHashEle) < 0)
+    {
+        _error("get hashmap item failed\n");
+        return -1;
+    }
+
+    if (! sHashEle.node.bUsedFlag)
+    { /* 要删除的映射不存在 */
+        _error ("key not exist\n");
+        return -1;
+    }
+    else 
+    { /* 在哈希表中存在 */
+        if (filemap_keycmp (pObj, &sHashEle.node, key) == 0)
+        { /* 哈希表为相同项，则删除该项 */
+
+            if (INDEX_NULL != sHashEle.node.nNextIndex)
+            { /* 如果存在后继节点 */
+                /* 取出一个节点，并替换掉当前节点即可 */
+                FILEMAP_POSHASHLINKMAP_ELEMENT sHashLinkEle = {};
+                if (filemap_file_getposhashlinkitem (pObj, sHashEle.node.nNextIndex, &sHashLinkEle) < 0)
+                {
+                    _error ("get item failed\n");
+                    return -1;
+                }
+
+                FILEMAP_POSHASHMAP_ELEMENT sHashEleTmp = {};
+                sHashEleTmp.node = sHashLinkEle.node;
+                sHashEleTmp.node.bUsedFlag = 1;
+
+                if (1 || "union operation")
+                {
+                    if (filemap_file_setposhashmapitem(pObj, nHashMapIndex, &sHashEleTmp) < 0)
+                    { /* 将当前节点替换位下一个节点 */
+                        _error ("set item failed\n");
+                        return -1;
+                    }
+                    if (filemap_file_freedataslot (pObj, sHashEle.node.nIndex) < 0 ||
+                            filemap_file_freekey (pObj, &sHashEle.node) < 0)
+                    { /* 将数据标记位删除 */
+                        _error ("set bit failed\n");
+                        return -1;
+                    }
+                    if (filemap_freelist_push (pObj, FILEMAP_FREELIST_HASHLINK, 
+                                sHashEle.node.nNextIndex) < 0)
+                    { /* 下一个节点标记为删除 */
+                        _error ("set bit failed\n");
+                        return -1;
+                    }
+                }
+            }
+            else 
+            { /* 如果不存在后继节点，则直接删除即可 */
+                sHashEle.node.bUsedFlag = 0;
+
+                if (1 || "union operation")
+                {
+                    if (filemap_file_setposhashmapitem(pObj, nHashMapIndex, &sHashEle) < 0)
+                    { /* 将当前节点置为无效 */
+                        _error("set hashmap item failed\n");
+                        return -1;
+                    }
+                    if (filemap_file_freedataslot (pObj, sHashEle.node.nIndex) < 0 ||
+                            filemap_file_freekey (pObj, &sHashEle.node) < 0)
+                    { /* 将数据标记位删除 */
+                        _error("set bit failed\n");
+                        return -1;
+                    }
+                }
+                return 0;
+            }
+
+            return 0;
+        }
+        else 
+        { /* 哈希表中不存在，则去链表中删除 */
+            int nIndexNext = sHashEle.node.nNextIndex; /* 链表的第一项 */
+
+            if (INDEX_NULL == nIndexNext)
+            { /* 链表是空的 */
+                _error ("del item, item not exist\n");
+                return -1;
+            }
+            else 
+            {
+                int nIndexPrevItem = INDEX_NULL;
+                while (1)
+                {
+                    FILEMAP_POSHASHLINKMAP_ELEMENT sEleHashLinkEle = {};
+                    if (filemap_file_getposhashlinkitem (pObj, nIndexNext, &sEleHashLinkEle) < 0)
+                    {
+                        _error ("get item failed\n");
+                        return -1;
+                    }
+
+                    if (filemap_keycmp (pObj, &sEleHashLinkEle.node, key) == 0)
+                    { /* 找到了这一项 */
+                        if (nIndexNext == sHashEle.node.nNextIndex)
+                        { /* 如果是链表的第一项 */
+                            FILEMAP_POSHASHMAP_ELEMENT sHashMapEleMod = sHashEle;
+                            sHashMapEleMod.node.nNextIndex = sEleHashLinkEle.node.nNextIndex; /* 指向下一个节点 */
+                            
+                            if (1 || "union operation")
+                            {
+                                if (filemap_file_setposhashmapitem (pObj, nHashMapIndex,
+                                        & sHashMapEleMod) < 0)
+                                { /* 修改哈希表中的节点 */
+                                    _error ("set hash map item failed\n");
+                                    return -1;
+                                }
+
+                                if (filemap_freelist_push (pObj, FILEMAP_FREELIST_HASHLINK,
+                                                           nIndexNext) < 0)
+                                { /* 删除这一项的记录 */
+                                    _error("set hashlink bit failed\n");
+                                    return -1;
+                                }
+
+                                if (filemap_file_freedataslot (pObj, sEleHashLinkEle.node.nIndex) < 0 ||
+                                        filemap_file_freekey (pObj, &sEleHashLinkEle.node) < 0)
+                                { /* 将数据标记位删除 */
+                                    _error("set bit failed\n");
+                                    return -1;
+                                }
+                            }
+
+                            return 0;
+                        }
+                        else
+                        { /* 如果不是链表的第一项 */
+                            FILEMAP_POSHASHLINKMAP_ELEMENT sEleHashLinkElePrev = {};
+                            if (filemap_file_getposhashlinkitem(pObj, nIndexPrevItem, &sEleHashLinkElePrev) < 0)
+                            { /* 找到上一项 */
+                                _error("get item failed\n");
+                                return -1;
+                            }
+                            sEleHashLinkElePrev.node.nNextIndex = sEleHashLinkEle.node.nNextIndex; /* 指向下一项 */
+
+                            if (1 || "union operation")
+                            {
+                                if (filemap_file_setposhashlinkitem (pObj, nIndexPrevItem,
+                                        & sEleHashLinkElePrev) < 0)
+                                { /* 修改上一项 */
+                                    _error ("set hash map item failed\n");
+                                    return -1;
+                                }
+
+                                if (filemap_freelist_push (pObj, FILEMAP_FREELIST_HASHLINK,
+                                                           nIndexNext) < 0)
+                                { /* 删除这一项的记录 */
+                                    _error("set hashlink bit failed\n");
+                                    return -1;
+                                }
+
+                                if (filemap_file_freedataslot (pObj, sEleHashLinkEle.node.nIndex) < 0 ||
+                                        filemap_file_freekey (pObj, &sEleHashLinkEle.node) < 0)
+                                { /* 将数据标记位删除 */
+                                    _error("set bit failed\n");
+                                    return -1;
+                                }
+                            }
+
+                            return 0;
+                        }
+                    }
+
+                    nIndexPrevItem = nIndexNext; /* 记录上一个循环的项 */
+                    nIndexNext = sEleHashLinkEle.node.nNextIndex; /* 指向下一项 */
+
+                    if (INDEX_NULL == nIndexNext)
+                    {
+                        _error ("delete item, item not found\n");
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief 开放寻址方式下，key对应的控制字节
+ */
+static unsigned char filemap_open_getctrl (unsigned int uHash)
+{
+    return (unsigned char)(FILEMAP_OPEN_CTRL_FULL | (uHash >> 25));
+}
+
+/**
+ * @brief 比较一组控制字节，按位返回匹配的、从未使用的和可以占用的位置
+ */
+static void filemap_open_match (const unsigned char *pCtrl, int nNum, unsigned char byteCtrl, 
+                unsigned int *puMatch, unsigned int *puEmpty, unsigned int *puFree)
+{
+    unsigned int uMatch = 0;
+    unsigned int uEmpty = 0;
+    unsigned int uFree = 0;
+
+#ifdef __SSE2__
+    if (FILEMAP_OPEN_GROUP_SIZE == nNum)
+    {
+        const __m128i vCtrl = _mm_loadu_si128 ((const __m128i*)pCtrl);
+        uMatch = (unsigned int)_mm_movemask_epi8 (_mm_cmpeq_epi8 (vCtrl, _mm_set1_epi8 ((char)byteCtrl)));
+        uEmpty = (unsigned int)_mm_movemask_epi8 (_mm_cmpeq_epi8 (vCtrl, _mm_setzero_si128 ()));
+        uFree = (unsigned int)_mm_movemask_epi8 (vCtrl) ^ 0xFFFF; /* 最高位为0 */
+    }
+    else 
+#endif
+    {
+        for (int i = 0; i < nNum; ++i)
+        {
+            uMatch |= (pCtrl[i] == byteCtrl ? 1u : 0u) << i;
+            uEmpty |= (pCtrl[i] == FILEMAP_OPEN_CTRL_EMPTY ? 1u : 0u) << i;
+            uFree |= (pCtrl[i] & FILEMAP_OPEN_CTRL_FULL ? 0u : 1u) << i;
+        }
+    }
+
+    *puMatch = uMatch;
+    *puEmpty = uEmpty;
+    *puFree = uFree;
+}
+
+/**
+ * @brief 开放寻址方式下查找key，从hash位置开始按组顺序探测，遇到从未使用的位置结束
+ * @return 失败返回-1，找到返回1，@pnSlot返回位置，不存在返回0
+ * @note 先比较控制字节，只读取匹配的位置上的节点
+ */
+static int filemap_open_find (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nMaxFileNum, 
+                const FILEMAP_KEYREF *key, int *pnSlot, FILEMAP_DATAMAP *pMap)
+{
+    const int nSlotNum = filemap_get_poshashmap_num (nMaxFileNum);
+    const long long llCtrlPos = psIndex->seg_ctrl.seg.pos;
+    const unsigned char byteCtrl = filemap_open_getctrl (key->uHash);
+    int nSlot = filemap_hashmap_getindex (nMaxFileNum, key->uHash);
+
+    for (int nScan = 0; nScan < nSlotNum; )
+    {
+        int nNum = FILEMAP_OPEN_GROUP_SIZE;
+        nNum = (nNum < nSlotNum - nSlot ? nNum : nSlotNum - nSlot);
+        nNum = (nNum < nSlotNum - nScan ? nNum : nSlotNum - nScan);
+
+        unsigned char byteGroup[FILEMAP_OPEN_GROUP_SIZE];
+        if (filemap_file_getindexdata (pObj, llCtrlPos + nSlot, byteGroup, nNum) < 0)
+        {
+            _error ("get ctrl failed\n");
+            return -1;
+        }
+        /* 控制字节先于节点读取，与写入的顺序相反 */
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+        unsigned int uMatch = 0;
+        unsigned int uEmpty = 0;
+        unsigned int uFree = 0;
+        filemap_open_match (byteGroup, nNum, byteCtrl, &uMatch, &uEmpty, &uFree);
+        if (uEmpty != 0)
+        { /* 只有第一个从未使用的位置之前的才可能是 */
+            uMatch &= (uEmpty & (~uEmpty + 1)) - 1;
+        }
+
+        while (uMatch != 0)
+        {
+            const int i = __builtin_ctz (uMatch);
+            uMatch &= uMatch - 1;
+
+            FILEMAP_DATAMAP sNode = {};
+            if (filemap_index_getnode (pObj, psIndex, nMaxFileNum, 0, nSlot + i, &sNode) < 0)
+            {
+                _error ("get hashmap item failed\n");
+                return -1;
+            }
+
+            if (sNode.bUsedFlag && filemap_keycmp (pObj, & sNode, key) == 0)
+            {
+                *pnSlot = nSlot + i;
+                *pMap = sNode;
+                return 1;
+            }
+        }
+
+        if (uEmpty != 0)
+        {
+            return 0;
+        }
+
+        nScan += nNum;
+        nSlot = (nSlot + nNum) % nSlotNum;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 开放寻址方式下，为不存在的key找到第一个可以占用的位置
+ * @return 失败返回-1，成功返回1，已满返回0
+ */
+static int filemap_open_findfree (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int *pnSlot)
+{
+    const int nSlotNum = filemap_get_poshashmap_num (pObj->nMaxFileNum);
+    const long long llCtrlPos = pObj->sGMap.seg_index.seg_ctrl.seg.pos;
+    int nSlot = filemap_hashmap_getindex (pObj->nMaxFileNum, key->uHash);
+
+    for (int nScan = 0; nScan < nSlotNum; )
+    {
+        int nNum = FILEMAP_OPEN_GROUP_SIZE;
+        nNum = (nNum < nSlotNum - nSlot ? nNum : nSlotNum - nSlot);
+        nNum = (nNum < nSlotNum - nScan ? nNum : nSlotNum - nScan);
+
+        unsigned char byteGroup[FILEMAP_OPEN_GROUP_SIZE];
+        if (filemap_file_getindexdata (pObj, llCtrlPos + nSlot, byteGroup, nNum) < 0)
+        {
+            _error ("get ctrl failed\n");
+            return -1;
+        }
+
+        unsigned int uMatch = 0;
+        unsigned int uEmpty = 0;
+        unsigned int uFree = 0;
+        filemap_open_match (byteGroup, nNum, 0, &uMatch, &uEmpty, &uFree);
+        if (uFree != 0)
+        {
+            *pnSlot = nSlot + __builtin_ctz (uFree);
+            return 1;
+        }
+
+        nScan += nNum;
+        nSlot = (nSlot + nNum) % nSlotNum;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 开放寻址方式下添加key对应的映射数据，若已存在，则替换
+ * @return 失败返回-1，成功返回1
+ * @note 先写节点再写控制字节，不加锁的查找不会读到未写完的节点
+ */
+static int filemap_open_adddatamap (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_DATAMAP *map)
+{
+    FILEMAP_POSHASHMAP_ELEMENT sEle = {};
+    int nSlot = 0;
+    int ret = filemap_open_find (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, key, &nSlot, & sEle.node);
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    if (1 == ret)
+    { /* 已存在，直接替换 */
+        sEle.node = *map;
+        sEle.node.bUsedFlag = 1;
+        sEle.node.nNextIndex = INDEX_NULL;
+        if (filemap_file_setposhashmapitem (pObj, nSlot, &sEle) < 0)
+        {
+            _error ("set hashmap item failed\n");
+            return -1;
+        }
+        return 1;
+    }
+
+    if (filemap_open_findfree (pObj, key, &nSlot) != 1)
+    {
+        _error ("index full\n");
+        return -1;
+    }
+
+    sEle.node = *map;
+    sEle.node.bUsedFlag = 1;
+    sEle.node.nNextIndex = INDEX_NULL;
+    if (filemap_file_setposhashmapitem (pObj, nSlot, &sEle) < 0)
+    {
+        _error ("set hashmap item failed\n");
+        return -1;
+    }
+
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    const unsigned char byteCtrl = filemap_open_getctrl (key->uHash);
+    if (filemap_file_setindexdata (pObj, pObj->sGMap.seg_index.seg_ctrl.seg.pos + nSlot, &byteCtrl, 1) < 0)
+    {
+        _error ("set ctrl failed\n");
+        return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief 开放寻址方式下删除key对应的映射数据
+ * @return 失败返回-1，成功返回0
+ * @note 下一个位置从未使用时，本位置及之前连续的已删除位置都不会再被探测经过，一并改为从未使用
+ */
+static int filemap_open_deldatamap (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key)
+{
+    const int nSlotNum = filemap_get_poshashmap_num (pObj->nMaxFileNum);
+    const long long llCtrlPos = pObj->sGMap.seg_index.seg_ctrl.seg.pos;
+
+    FILEMAP_POSHASHMAP_ELEMENT sEle = {};
+    int nSlot = 0;
+    int ret = filemap_open_find (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, key, &nSlot, & sEle.node);
+    if (ret < 0)
+    {
+        return -1;
+    }
+    if (0 == ret)
+    {
+        _error ("key not exist\n");
+        return -1;
+    }
+
+    unsigned char byteNext = FILEMAP_OPEN_CTRL_DELETED;
+    if (filemap_file_getindexdata (pObj, llCtrlPos + (nSlot + 1) % nSlotNum, &byteNext, 1) < 0)
+    {
+        _error ("get ctrl failed\n");
+        return -1;
+    }
+
+    unsigned char byteCtrl[FILEMAP_OPEN_CLEAN_MAX];
+    int nBegin = nSlot;
+    if (FILEMAP_OPEN_CTRL_EMPTY == byteNext)
+    { /* 向前找连续的已删除位置，不跨过表头 */
+        const int nCheckNum = (nSlot < FILEMAP_OPEN_CLEAN_MAX - 1 ? nSlot : FILEMAP_OPEN_CLEAN_MAX - 1);
+        if (nCheckNum > 0 && filemap_file_getindexdata (pObj, llCtrlPos + nSlot - nCheckNum, byteCtrl, nCheckNum) < 0)
+        {
+            _error ("get ctrl failed\n");
+            return -1;
+        }
+        while (nSlot - nBegin < nCheckNum && FILEMAP_OPEN_CTRL_DELETED == byteCtrl[nCheckNum - (nSlot - nBegin) - 1])
+        {
+            --nBegin;
+        }
+    }
+    memset (byteCtrl, FILEMAP_OPEN_CTRL_EMPTY == byteNext ? FILEMAP_OPEN_CTRL_EMPTY : FILEMAP_OPEN_CTRL_DELETED, 
+                nSlot - nBegin + 1);
+
+    /* 先写控制字节，不加锁的查找不再读取该节点 */
+    if (filemap_file_setindexdata (pObj, llCtrlPos + nBegin, byteCtrl, nSlot - nBegin + 1) < 0)
+    {
+        _error ("set ctrl failed\n");
+        return -1;
+    }
+
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    FILEMAP_POSHASHMAP_ELEMENT sEleFree = {};
+    sEleFree.node.bUsedFlag = 0;
+    sEleFree.node.nKeyIndex = INDEX_NULL;
+    sEleFree.node.nIndex = INDEX_NULL;
+    sEleFree.node.nNextIndex = INDEX_NULL;
+    if (filemap_file_setposhashmapitem (pObj, nSlot, &sEleFree) < 0)
+    {
+        _error ("set hashmap item failed\n");
+        return -1;
+    }
+
+    if (filemap_file_freedataslot (pObj, sEle.node.nIndex) < 0 ||
+            filemap_file_freekey (pObj, &sEle.node) < 0)
+    {
+        _error ("set bit failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 扩容过的文件，取得扩容前的数量和迁移进度
+ */
+static int filemap_grow_load (FILEMAP_OBJ *pObj)
+{
+    const FILEMAP_INDEX_MIGRATE_MAP *psMigrate = & pObj->sGMap.seg_index.seg_migrate;
+    if (0 == psMigrate->seg.size)
+    {
+        return 0;
+    }
+
+    FILEMAP_SECTION_DEF sDef = {};
+    if (filemap_get_defseg (pObj->hMem2File, &sDef) < 0 || sDef.nGrowNum <= 0)
+    {
+        _error ("get def sec failed\n");
+        return -1;
+    }
+
+    FILEMAP_SECTION_MIGRATE_HEAD sHead = {};
+    if (filemap_file_getindexdata (pObj, psMigrate->seg.pos, &sHead, sizeof(sHead)) < 0)
+    {
+        _error ("get migrate head failed\n");
+        return -1;
+    }
+
+    pObj->nOldMaxFileNum = sDef.anGrowFrom[sDef.nGrowNum - 1];
+    pObj->bMigrating = (sHead.nCursor < filemap_get_poshashmap_num (pObj->nOldMaxFileNum) ? 1 : 0);
+
+    if (pObj->bMigrating)
+    {
+        _info ("migrating, <%d->%d,cursor=%d>\n", pObj->nOldMaxFileNum, pObj->nMaxFileNum, sHead.nCursor);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 扩容前的哈希表的第@nUnit个位置是否已迁移
+ * @return 已迁移返回1，未迁移返回0，失败返回-1
+ */
+static int filemap_grow_ismigrated (FILEMAP_OBJ *pObj, int nUnit)
+{
+    const long long llPos = pObj->sGMap.seg_index.seg_migrate.seg.pos + sizeof(FILEMAP_SECTION_MIGRATE_HEAD) + nUnit;
+
+    unsigned char byteMigrated = 0;
+    if (nUnit < 0 || nUnit >= filemap_get_poshashmap_num (pObj->nOldMaxFileNum) ||
+            filemap_file_getindexdata (pObj, llPos, &byteMigrated, 1) < 0)
+    {
+        _error ("get migrate flag failed, unit=%d\n", nUnit);
+        return -1;
+    }
+
+    /* 与写入标记前的屏障配对，看到标记时该位置的各项已在新的索引中 */
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    return byteMigrated ? 1 : 0;
+}
+
+/**
+ * @brief 在扩容前的索引中查找key，只返回尚未迁移的项
+ * @return 失败返回-1，找到返回1，没有找到或已迁移返回0
+ */
+static int filemap_grow_find (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_DATAMAP *pMap)
+{
+    int nUnit = 0;
+    int ret = filemap_index_find (pObj, & pObj->sGMap.seg_index_old, pObj->nOldMaxFileNum, key, &nUnit, pMap);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    ret = filemap_grow_ismigrated (pObj, nUnit);
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    return ret ? 0 : 1;
+}
+
+/**
+ * @brief 取得扩容前的索引中一项的key，并在新的索引中查找
+ * @param [OUT] pbyteKey 至少FILEMAP_KEY_MAX字节，@key引用其中的数据
+ * @return 失败返回-1，已在新的索引中返回1，否则返回0
+ */
+static int filemap_grow_ismoved (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, 
+                unsigned char *pbyteKey, FILEMAP_KEYREF *key)
+{
+    if (filemap_file_getnodekey (pObj, psNode, pbyteKey) < 0)
+    {
+        _error ("get key failed\n");
+        return -1;
+    }
+
+    key->pData = pbyteKey;
+    key->nLen = psNode->nKeyLen;
+    key->uHash = filemap_node_gethash (pObj, psNode);
+
+    FILEMAP_DATAMAP sMap = {};
+    int nUnit = 0;
+    return filemap_index_find (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, key, &nUnit, &sMap);
+}
+
+/**
+ * @brief 将扩容前的索引中的一项加入新的索引，数据段和键段的位置不变
+ * @note 调用者持有该项所在段的写锁；其他线程已迁移该项，或上次迁移中途异常退出时，
+ * 该项可能已在新的索引中，不再加入
+ */
+static int filemap_grow_moveentry (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode)
+{
+    unsigned char byteKey[FILEMAP_KEY_MAX];
+    FILEMAP_KEYREF sKey;
+    int ret = filemap_grow_ismoved (pObj, psNode, byteKey, &sKey);
+    if (ret != 0)
+    {
+        return ret < 0 ? -1 : 0;
+    }
+
+    FILEMAP_DATAMAP sMap = *psNode;
+    sMap.bUsedFlag = 1;
+    sMap.nNextIndex = INDEX_NULL;
+    if (filemap_file_adddatamap (pObj, &sKey, &sMap) < 0)
+    {
+        _error ("add to new index failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 对一个索引段的哈希表的第@nUnit个位置上的各项调用@pfnVisit：链表方式下为该位置及其链表中的各项，
+ * 开放寻址方式下为该位置上的一项
+ * @param nNum 该索引段对应的数量
+ * @return 失败或@pfnVisit失败返回-1，成功返回0
+ */
+static int filemap_index_walkunit (FILEMAP_OBJ *pObj, const FILEMAP_INDEX_MAP *psIndex, int nNum, int nUnit, 
+                int (*pfnVisit)(FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg), void *pArg)
+{
+    FILEMAP_DATAMAP sNode = {};
+    if (filemap_index_getnode (pObj, psIndex, nNum, 0, nUnit, &sNode) < 0)
+    {
+        _error ("get hashmap item failed, unit=%d\n", nUnit);
+        return -1;
+    }
+
+    int nIndexNext = INDEX_NULL;
+    if (FILEMAP_INDEX_OPEN == pObj->nIndexLayout)
+    { /* 以控制字节为准 */
+        unsigned char byteCtrl = FILEMAP_OPEN_CTRL_EMPTY;
+        if (filemap_file_getindexdata (pObj, psIndex->seg_ctrl.seg.pos + nUnit, &byteCtrl, 1) < 0)
+        {
+            _error ("get ctrl failed, unit=%d\n", nUnit);
+            return -1;
+        }
+        sNode.bUsedFlag = (byteCtrl & FILEMAP_OPEN_CTRL_FULL) ? sNode.bUsedFlag : 0;
+    }
+    else 
+    {
+        nIndexNext = sNode.nNextIndex;
+    }
+
+    if (! sNode.bUsedFlag)
+    {
+        return 0;
+    }
+
+    if (pfnVisit (pObj, &sNode, pArg) < 0)
+    {
+        return -1;
+    }
+
+    for (int nStep = 0; INDEX_NULL != nIndexNext; ++nStep)
+    {
+        if (nStep >= nNum)
+        {
+            _error ("hash link too long\n");
+            return -1;
+        }
+
+        if (filemap_index_getnode (pObj, psIndex, nNum, 1, nIndexNext, &sNode) < 0)
+        {
+            _error ("get hashlink item failed, index=%d\n", nIndexNext);
+            return -1;
+        }
+
+        if (pfnVisit (pObj, &sNode, pArg) < 0)
+        {
+            return -1;
+        }
+
+        nIndexNext = sNode.nNextIndex;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 迁移一项，@pArg为该项在旧哈希表中的位置：在该项所在段的写锁下，位置仍未标记为已迁移时加入新的索引
+ * @note 位置标记为已迁移之后写操作才会修改其中的key，此时不再迁移，不会覆盖之后的修改
+ */
+static int filemap_grow_visitmove (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg)
+{
+    const int nUnit = *(const int*)pArg;
+
+    /* 位置已标记时键段中的key可能已被其他项使用，下面在锁内检查标记后才使用 */
+    unsigned char byteKey[FILEMAP_KEY_MAX];
+    FILEMAP_KEYREF sKey;
+    if (filemap_file_getnodekey (pObj, psNode, byteKey) < 0)
+    {
+        _error ("get key failed\n");
+        return -1;
+    }
+    sKey.pData = byteKey;
+    sKey.nLen = psNode->nKeyLen;
+    sKey.uHash = filemap_node_gethash (pObj, psNode);
+
+    FILEMAP_WAL_TXN sTxn;
+    filemap_bucket_lock (pObj, & sKey, 1);
+    filemap_wal_begin (pObj, &sTxn);
+    int ret = filemap_grow_ismigrated (pObj, nUnit);
+    if (0 == ret)
+    {
+        ret = filemap_grow_moveentry (pObj, psNode);
+    }
+    if (ret >= 0)
+    {
+        ret = filemap_wal_commit (pObj, &sTxn);
+    }
+    else 
+    {
+        filemap_wal_abort (pObj, &sTxn);
+    }
+    filemap_bucket_unlock (pObj, & sKey, 1);
+
+    return ret < 0 ? -1 : 0;
+}
+
+/**
+ * @brief 迁移扩容前的哈希表的第@nUnit个位置上的各项，最后写入迁移标记
+ * @note 调用者持有入口锁，不持有分段锁。旧索引不修改，读取不加锁；多个线程可能同时迁移同一位置，
+ * 每一项单独提交，中途异常退出后重新迁移
+ */
+static int filemap_grow_moveunit (FILEMAP_OBJ *pObj, int nUnit)
+{
+    int ret = filemap_grow_ismigrated (pObj, nUnit);
+    if (ret != 0)
+    {
+        return ret < 0 ? -1 : 0;
+    }
+
+    if (filemap_index_walkunit (pObj, & pObj->sGMap.seg_index_old, pObj->nOldMaxFileNum, nUnit, 
+                    filemap_grow_visitmove, &nUnit) < 0)
+    {
+        return -1;
+    }
+
+    /* 之前的迁移不会晚于标记 */
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    FILEMAP_WAL_TXN sTxn;
+    filemap_wal_begin (pObj, &sTxn);
+
+    const unsigned char byteMigrated = 1;
+    const long long llPos = pObj->sGMap.seg_index.seg_migrate.seg.pos + sizeof(FILEMAP_SECTION_MIGRATE_HEAD) + nUnit;
+    if (filemap_file_setindexdata (pObj, llPos, &byteMigrated, 1) < 0)
+    {
+        _error ("set migrate flag failed, unit=%d\n", nUnit);
+        filemap_wal_abort (pObj, &sTxn);
+        return -1;
+    }
+
+    if (filemap_wal_commit (pObj, &sTxn) < 0)
+    {
+        _error ("commit failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 从进度处顺序迁移@nStepNum个位置，全部迁移后结束迁移
+ * @param bWait 为0时其他线程正在顺序迁移则直接返回，否则等待
+ * @note 调用者持有入口锁，不持有分段锁
+ */
+static int filemap_grow_step (FILEMAP_OBJ *pObj, int nStepNum, int bWait)
+{
+    if (bWait)
+    {
+        pthread_mutex_lock (& pObj->mutex_migrate);
+    }
+    else if (pthread_mutex_trylock (& pObj->mutex_migrate) != 0)
+    {
+        return 0;
+    }
+
+    if (! __atomic_load_n (& pObj->bMigrating, __ATOMIC_ACQUIRE))
+    { /* 等待期间其他线程已完成 */
+        pthread_mutex_unlock (& pObj->mutex_migrate);
+        return 0;
+    }
+
+    const int nUnitNum = filemap_get_poshashmap_num (pObj->nOldMaxFileNum);
+    const long long llHeadPos = pObj->sGMap.seg_index.seg_migrate.seg.pos;
+
+    FILEMAP_SECTION_MIGRATE_HEAD sHead = {};
+    if (filemap_file_getindexdata (pObj, llHeadPos, &sHead, sizeof(sHead)) < 0)
+    {
+        _error ("get migrate head failed\n");
+        pthread_mutex_unlock (& pObj->mutex_migrate);
+        return -1;
+    }
+
+    const int nCursor = sHead.nCursor;
+    int bError = 0;
+    for (int i = 0; i < nStepNum && sHead.nCursor < nUnitNum; ++i)
+    {
+        if (filemap_grow_moveunit (pObj, sHead.nCursor) < 0)
+        {
+            bError = 1;
+            break;
+        }
+        sHead.nCursor += 1;
+    }
+
+    /* 进度之前的位置都已标记，进度单独提交 */
+    if (sHead.nCursor != nCursor)
+    {
+        FILEMAP_WAL_TXN sTxn;
+        filemap_wal_begin (pObj, &sTxn);
+        if (filemap_file_setindexdata (pObj, llHeadPos, &sHead, sizeof(sHead)) < 0)
+        {
+            filemap_wal_abort (pObj, &sTxn);
+            bError = 1;
+        }
+        else if (filemap_wal_commit (pObj, &sTxn) < 0)
+        {
+            bError = 1;
+        }
+    }
+
+    if (bError)
+    {
+        _error ("migrate failed, cursor=%d\n", sHead.nCursor);
+    }
+    else if (sHead.nCursor >= nUnitNum)
+    {
+        __atomic_store_n (& pObj->bMigrating, 0, __ATOMIC_RELEASE);
+        _info ("migrate finished, <%d->%d>\n", pObj->nOldMaxFileNum, pObj->nMaxFileNum);
+    }
+
+    pthread_mutex_unlock (& pObj->mutex_migrate);
+
+    return bError ? -1 : 0;
+}
+
+/**
+ * @brief 写操作加分段锁之前调用：迁移期间先迁移key在旧索引中所在的位置，再顺带迁移一些位置
+ * @note 调用者持有入口锁；其他线程正在顺序迁移时不等待，写操作之间不因迁移互相等待
+ */
+static int filemap_grow_migrate (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key)
+{
+    if (! __atomic_load_n (& pObj->bMigrating, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    FILEMAP_DATAMAP sMap = {};
+    int nUnit = INDEX_NULL;
+    int ret = filemap_index_find (pObj, & pObj->sGMap.seg_index_old, pObj->nOldMaxFileNum, key, &nUnit, &sMap);
+    if (ret < 0 || (1 == ret && filemap_grow_moveunit (pObj, nUnit) < 0))
+    {
+        return -1;
+    }
+
+    return filemap_grow_step (pObj, FILEMAP_GROW_STEP, 0);
+}
+
+/**
+ * @brief 一次完成剩余的迁移
+ * @note 调用者持有入口锁，不持有分段锁
+ */
+static int filemap_grow_finish (FILEMAP_OBJ *pObj)
+{
+    if (! __atomic_load_n (& pObj->bMigrating, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    return filemap_grow_step (pObj, filemap_get_poshashmap_num (pObj->nOldMaxFileNum), 1);
+}
+
+/**
+ * @brief 写入扩容时新增的区域，同时更新尚未启用的内存副本@psCache（没有时为NULL）
+ */
+static int filemap_grow_setdata (FILEMAP_OBJ *pObj, FILEMAP_SEG_CACHE *psCache, long long llPos, 
+                const void *pData, int nSize)
+{
+    if (mem2file_setdata (pObj->hMem2File, llPos, pData, nSize) < 0)
+    {
+        _error ("set data failed, <pos=%lld,size=%d>\n", llPos, nSize);
+        return -1;
+    }
+
+    if (psCache != NULL)
+    {
+        memcpy (psCache->byteData + (llPos - psCache->seg.pos), pData, nSize);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 将文件扩大到@llNewSize，新的区域全为0
+ * @note 其他线程可能正在读写，文件不缩小：上次扩容中途异常退出留下的部分改为清零
+ */
+static int filemap_grow_extend (FILEMAP_OBJ *pObj, long long llNewSize)
+{
+    const long long llOldSize = pObj->sGMap.seg.size;
+
+    long long llFileSize = 0;
+    if (mem2file_size (pObj->hMem2File, &llFileSize) < 0)
+    {
+        _error ("get size failed\n");
+        return -1;
+    }
+
+    const long long llDirtyEnd = (llFileSize < llNewSize ? llFileSize : llNewSize);
+    if (llDirtyEnd > llOldSize)
+    {
+        _info ("clear remains of last grow, <%lld,%lld>\n", llOldSize, llDirtyEnd);
+
+        char *pZero = (char*)calloc (FILEMAP_GROW_ZERO_SIZE, 1);
+        if (NULL == pZero)
+        {
+            _error ("calloc failed\n");
+            return -1;
+        }
+
+        int bError = 0;
+        for (long long llPos = llOldSize; llPos < llDirtyEnd && 0 == bError; llPos += FILEMAP_GROW_ZERO_SIZE)
+        {
+            const int nSize = (llDirtyEnd - llPos < FILEMAP_GROW_ZERO_SIZE ? (int)(llDirtyEnd - llPos) : FILEMAP_GROW_ZERO_SIZE);
+            bError = (mem2file_setdata (pObj->hMem2File, llPos, pZero, nSize) < 0);
+        }
+
+        free (pZero);
+
+        if (bError)
+        {
+            _error ("clear failed\n");
+            return -1;
+        }
+    }
+
+    if (llFileSize < llNewSize && mem2file_resize (pObj->hMem2File, llNewSize) < 0)
+    {
+        _error ("resize failed, size=%lld\n", llNewSize);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 扩容准备时写入新的空位栈：新增的数据段和键段位置在栈底，其上复制原有的空位；
+ * 新的索引中还没有链表项，位置哈希链表都是空位。
+ * 原有的空位栈仍在变化，记录复制时的计数，之后取出过的位置切换时重新复制
+ * @note 新的空位栈直接写入文件，数据段和键段的计数在切换时写入
+ */
+static int filemap_grow_preparefreelist (FILEMAP_OBJ *pObj, const FILEMAP_GLOBAL_MAP *psNewMap, int nNewNum)
+{
+    const int nOldNum = pObj->nMaxFileNum;
+    const FILEMAP_FREELIST_MAP *psNew = & psNewMap->seg_freelist;
+
+    const int nWhich[3] = {
+        FILEMAP_FREELIST_DATA,
+        FILEMAP_FREELIST_HASHLINK,
+        FILEMAP_FREELIST_KEY,
+    };
+    const FILEMAP_SEGMENT *psNewStack[3] = {
+        & psNew->seg_stack_data.seg,
+        & psNew->seg_stack_hashlink.seg,
+        & psNew->seg_stack_key.seg,
+    };
+
+    int *pnStack = (int*)malloc (sizeof(int) * nNewNum);
+    if (NULL == pnStack)
+    {
+        _error ("malloc failed\n");
+        return -1;
+    }
+
+    int bError = 0;
+    for (int i = 0; i < 3 && 0 == bError; ++i)
+    {
+        if (0 == psNewStack[i]->size)
+        { /* 字符串键格式下没有键段 */
+            continue;
+        }
+
+        int nFreeNum = 0;
+        if (FILEMAP_FREELIST_HASHLINK == nWhich[i])
+        {
+            for (int k = nNewNum - 1; k >= 0; --k)
+            {
+                pnStack[nFreeNum++] = k;
+            }
+
+            const long long llCountPos = psNew->seg_head.seg.pos + 
+                        (long long)offsetof(FILEMAP_SECTION_FREELIST_HEAD, nHashlinkFreeNum);
+            if (mem2file_setdata (pObj->hMem2File, llCountPos, &nFreeNum, sizeof(nFreeNum)) < 0)
+            {
+                _error ("set free num failed, which=%d\n", nWhich[i]);
+                bError = 1;
+                break;
+            }
+        }
+        else 
+        {
+            for (int k = nNewNum - 1; k >= nOldNum; --k)
+            {
+                pnStack[nFreeNum++] = k;
+            }
+
+            long long llCountPos = 0;
+            long long llStackPos = 0;
+            int nOldFreeNum = 0;
+            int ret = filemap_freelist_getpos (pObj, nWhich[i], &llCountPos, &llStackPos);
+            if (0 == ret)
+            {
+                pthread_mutex_lock (& pObj->mutex_alloc);
+                ret = filemap_file_getindexdata (pObj, llCountPos, &nOldFreeNum, sizeof(nOldFreeNum));
+                pObj->anGrowFreeMark[nWhich[i]] = nOldFreeNum;
+                pthread_mutex_unlock (& pObj->mutex_alloc);
+            }
+
+            /* 计数之下的元素在取出之前不变，此后变化的部分由记录的最小计数得知 */
+            if (ret < 0 || nOldFreeNum < 0 || nOldFreeNum > nOldNum ||
+                    filemap_file_getindexdata (pObj, llStackPos, pnStack + nFreeNum, sizeof(int) * nOldFreeNum) < 0)
+            {
+                _error ("get free list failed, which=%d\n", nWhich[i]);
+                bError = 1;
+                break;
+            }
+            nFreeNum += nOldFreeNum;
+        }
+
+        if (mem2file_setdata (pObj->hMem2File, psNewStack[i]->pos, pnStack, sizeof(int) * nFreeNum) < 0)
+        {
+            _error ("set free list failed, which=%d\n", nWhich[i]);
+            bError = 1;
+        }
+    }
+
+    free (pnStack);
+
+    return bError ? -1 : 0;
+}
+
+/**
+ * @brief 扩容切换时，复制准备之后取出过又放回的原有空位，写入数据段和键段的新空位栈的计数
+ * @param psCache 新的空位栈的内存副本，没有时为NULL
+ * @note 调用者独占入口锁
+ */
+static int filemap_grow_storefreelist (FILEMAP_OBJ *pObj, const FILEMAP_GLOBAL_MAP *psNewMap, int nNewNum, 
+                FILEMAP_SEG_CACHE *psCache)
+{
+    const int nOldNum = pObj->nMaxFileNum;
+    const FILEMAP_FREELIST_MAP *psNew = & psNewMap->seg_freelist;
+
+    const int nWhich[2] = {
+        FILEMAP_FREELIST_DATA,
+        FILEMAP_FREELIST_KEY,
+    };
+    const FILEMAP_SEGMENT *psNewStack[2] = {
+        & psNew->seg_stack_data.seg,
+        & psNew->seg_stack_key.seg,
+    };
+    const long long llNewCountPos[2] = {
+        psNew->seg_head.seg.pos + (long long)offsetof(FILEMAP_SECTION_FREELIST_HEAD, nDataFreeNum),
+        psNew->seg_head.seg.pos + (long long)offsetof(FILEMAP_SECTION_FREELIST_HEAD, nKeyFreeNum),
+    };
+
+    int bError = 0;
+    for (int i = 0; i < 2 && 0 == bError; ++i)
+    {
+        if (0 == psNewStack[i]->size)
+        {
+            continue;
+        }
+
+        long long llCountPos = 0;
+        long long llStackPos = 0;
+        int nOldFreeNum = 0;
+        const int nMark = pObj->anGrowFreeMark[nWhich[i]];
+        if (filemap_freelist_getpos (pObj, nWhich[i], &llCountPos, &llStackPos) < 0 ||
+                filemap_file_getindexdata (pObj, llCountPos, &nOldFreeNum, sizeof(nOldFreeNum)) < 0 ||
+                nOldFreeNum < 0 || nOldFreeNum > nOldNum || nMark < 0 || nMark > nOldFreeNum)
+        {
+            _error ("get free list failed, <which=%d,free=%d,mark=%d>\n", nWhich[i], nOldFreeNum, nMark);
+            bError = 1;
+            break;
+        }
+
+        const int nChanged = nOldFreeNum - nMark;
+        int *pnStack = (int*)malloc (sizeof(int) * (nChanged > 0 ? nChanged : 1));
+        if (NULL == pnStack)
+        {
+            _error ("malloc failed\n");
+            bError = 1;
+            break;
+        }
+
+        const long long llNewPos = psNewStack[i]->pos + (long long)sizeof(int) * (nNewNum - nOldNum + nMark);
+        const int nNewFreeNum = nNewNum - nOldNum + nOldFreeNum;
+        if (filemap_file_getindexdata (pObj, llStackPos + (long long)sizeof(int) * nMark, pnStack, sizeof(int) * nChanged) < 0 ||
+                filemap_grow_setdata (pObj, psCache, llNewPos, pnStack, sizeof(int) * nChanged) < 0 ||
+                filemap_grow_setdata (pObj, psCache, llNewCountPos[i], &nNewFreeNum, sizeof(nNewFreeNum)) < 0)
+        {
+            _error ("set free list failed, which=%d\n", nWhich[i]);
+            bError = 1;
+        }
+
+        free (pnStack);
+    }
+
+    return bError ? -1 : 0;
+}
+
+/**
+ * @brief 扩容的准备：完成上次的迁移，扩大文件，写入新的空位栈，读入新的内存副本，分配新的比特表，最后写磁盘
+ * @note 调用者持有扩容锁和共享入口锁，其他调用同时进行。只写文件末尾新的区域，
+ * 各段地图和定义段不变，之前异常退出时文件仍为扩容前的
+ */
+static int filemap_grow_prepare (FILEMAP_OBJ *pObj, int nNewNum, FILEMAP_GROW_STATE *psState)
+{
+    MEM2FILE_HANDLE hMem2File = pObj->hMem2File;
+    const int nOldNum = pObj->nMaxFileNum;
+
+    if (pObj->psShared != NULL)
+    { /* 其他进程的地图和内存副本无法同步更新 */
+        _error ("can not grow shared file\n");
+        return -1;
+    }
+
+    if (nNewNum <= nOldNum)
+    {
+        _error ("new num invalid, <%d,%d>\n", nOldNum, nNewNum);
+        return -1;
+    }
+
+    if (pObj->nHeapUnitNum > 0)
+    { /* 存储区之后是其他段，无法原地扩大；只扩展数量时存储区很快用完 */
+        _error ("can not grow file with value heap, rebuild with FILEMAP_FLAG_MIGRATE and a larger heap\n");
+        return -1;
+    }
+
+    /* 上一次扩容的迁移先完成，旧索引不再需要 */
+    if (filemap_grow_finish (pObj) < 0)
+    {
+        _error ("finish migrate failed\n");
+        return -1;
+    }
+
+    FILEMAP_SECTION_DEF *psDef = & psState->sDef;
+    if (filemap_get_defseg (hMem2File, psDef) < 0)
+    {
+        _error ("get def sec failed\n");
+        return -1;
+    }
+
+    if (psDef->nGrowNum >= FILEMAP_GROW_MAX)
+    {
+        _error ("grow too many times, num=%d\n", psDef->nGrowNum);
+        return -1;
+    }
+
+    psDef->anGrowFrom[psDef->nGrowNum] = nOldNum;
+    psDef->nGrowNum += 1;
+    psDef->nMaxFileNum = nNewNum;
+    memset (psDef->szVersion, 0, sizeof(psDef->szVersion));
+    strncpy (psDef->szVersion, FILEMAP_VERSION_V22, sizeof(psDef->szVersion) - 1);
+
+    if (filemap_getsegmap (psDef, & psState->sGMap) < 0)
+    {
+        _error ("get seg map failed\n");
+        return -1;
+    }
+
+    if (psState->sGMap.seg.size > INT_MAX)
+    { /* 扩容后超过2GB */
+        memset (psDef->szVersion, 0, sizeof(psDef->szVersion));
+        strncpy (psDef->szVersion, FILEMAP_VERSION_V23, sizeof(psDef->szVersion) - 1);
+    }
+    if (psDef->nDataAlign > 0)
+    {
+        memset (psDef->szVersion, 0, sizeof(psDef->szVersion));
+        strncpy (psDef->szVersion, FILEMAP_VERSION_V24, sizeof(psDef->szVersion) - 1);
+    }
+
+    /**
+     * 日志不清空：其中的记录只修改扩容前的索引段，切换后该段不再修改，
+     * 加载时重做的结果与文件中的相同；切换后的记录只修改新的区域
+     */
+
+    /* 新的区域全为0：空的哈希表，迁移进度为0 */
+    if (filemap_grow_extend (pObj, psState->sGMap.seg.size) < 0 ||
+            filemap_grow_preparefreelist (pObj, & psState->sGMap, nNewNum) < 0)
+    {
+        return -1;
+    }
+
+    if (pObj->psIndexCache != NULL)
+    {
+        psState->psIndexCache = filemap_indexcache_read (pObj, & psState->sGMap.seg_index.seg);
+        psState->psFreeListCache = filemap_indexcache_read (pObj, & psState->sGMap.seg_freelist.seg);
+        if (NULL == psState->psIndexCache || NULL == psState->psFreeListCache)
+        {
+            return -1;
+        }
+    }
+
+    if (pObj->hBitmapData != NULL)
+    {
+        psState->pBitmapMem = (char*)malloc (psState->sGMap.seg_index.seg_bitmap_data.seg.size);
+        psState->hBitmapData = bitmap_create (nNewNum);
+        psState->hBitmapHashlink = bitmap_create (nNewNum);
+        if (NULL == psState->pBitmapMem || NULL == psState->hBitmapData || NULL == psState->hBitmapHashlink)
+        {
+            _error ("alloc failed\n");
+            return -1;
+        }
+    }
+
+    if (pObj->pnPinCount != NULL)
+    {
+        psState->pnPinCount = (int*)calloc (nNewNum, sizeof(int));
+        psState->pbFreePending = (char*)calloc (nNewNum, sizeof(char));
+        if (NULL == psState->pnPinCount || NULL == psState->pbFreePending)
+        {
+            _error ("calloc failed\n");
+            return -1;
+        }
+    }
+
+    /* 新的区域先写磁盘，切换时只剩少量修改 */
+    if (mem2file_sync (hMem2File) < 0)
+    {
+        _error ("sync failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 扩容的切换：复制准备期间变化的空位，更新定义段，替换各段地图、内存副本、比特表和借用状态
+ * @note 调用者持有扩容锁并独占入口锁。新的区域和复制的空位写磁盘后才更新定义段，
+ * 两次写磁盘的只有准备之后的修改和定义段；定义段写磁盘之后扩容才生效
+ */
+static int filemap_grow_switch (FILEMAP_OBJ *pObj, FILEMAP_GROW_STATE *psState)
+{
+    MEM2FILE_HANDLE hMem2File = pObj->hMem2File;
+    const int nOldNum = pObj->nMaxFileNum;
+    const int nNewNum = psState->sDef.nMaxFileNum;
+
+    if (filemap_grow_storefreelist (pObj, & psState->sGMap, nNewNum, psState->psFreeListCache) < 0)
+    {
+        return -1;
+    }
+
+    if (pObj->pnPinCount != NULL && NULL == psState->pnPinCount)
+    { /* 准备期间首次借用 */
+        psState->pnPinCount = (int*)calloc (nNewNum, sizeof(int));
+        psState->pbFreePending = (char*)calloc (nNewNum, sizeof(char));
+        if (NULL == psState->pnPinCount || NULL == psState->pbFreePending)
+        {
+            _error ("calloc failed\n");
+            return -1;
+        }
+    }
+
+    if (mem2file_sync (hMem2File) < 0 || filemap_set_defseg (hMem2File, & psState->sDef) < 0 ||
+            mem2file_sync (hMem2File) < 0)
+    {
+        _error ("set def sec failed\n");
+        return -1;
+    }
+
+    /* 不加锁的读取在此期间都需要重试 */
+    __atomic_store_n (& pObj->uGrowSeq, pObj->uGrowSeq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    if (psState->psIndexCache != NULL)
+    { /* 原来的索引段副本用于迁移期间查找旧索引 */
+        filemap_indexcache_retire (pObj, pObj->psOldIndexCache);
+        filemap_indexcache_retire (pObj, pObj->psFreeListCache);
+        __atomic_store_n (& pObj->psOldIndexCache, pObj->psIndexCache, __ATOMIC_RELEASE);
+        __atomic_store_n (& pObj->psIndexCache, psState->psIndexCache, __ATOMIC_RELEASE);
+        __atomic_store_n (& pObj->psFreeListCache, psState->psFreeListCache, __ATOMIC_RELEASE);
+        psState->psIndexCache = NULL;
+        psState->psFreeListCache = NULL;
+    }
+
+    pObj->sGMap = psState->sGMap;
+    pObj->nOldMaxFileNum = nOldNum;
+    __atomic_store_n (& pObj->nMaxFileNum, nNewNum, __ATOMIC_RELAXED);
+    __atomic_store_n (& pObj->bMigrating, 1, __ATOMIC_RELEASE);
+
+    if (psState->hBitmapData != NULL)
+    { /* 原有的位置不变，新增的位置和新的链表都是空位 */
+        const int nBitmapSize = psState->sGMap.seg_index.seg_bitmap_data.seg.size;
+        bitmap_store (pObj->hBitmapData, psState->pBitmapMem, nBitmapSize);
+        bitmap_load (psState->hBitmapData, psState->pBitmapMem, nBitmapSize);
+        bitmap_destroy (pObj->hBitmapData);
+        bitmap_destroy (pObj->hBitmapHashlink);
+        pObj->hBitmapData = psState->hBitmapData;
+        pObj->hBitmapHashlink = psState->hBitmapHashlink;
+        psState->hBitmapData = NULL;
+        psState->hBitmapHashlink = NULL;
+    }
+
+    if (pObj->pnPinCount != NULL)
+    {
+        pthread_mutex_lock (& pObj->mutex_pin);
+        memcpy (psState->pnPinCount, pObj->pnPinCount, sizeof(int) * nOldNum);
+        memcpy (psState->pbFreePending, pObj->pbFreePending, sizeof(char) * nOldNum);
+        free (pObj->pnPinCount);
+        free (pObj->pbFreePending);
+        pObj->pnPinCount = psState->pnPinCount;
+        pObj->pbFreePending = psState->pbFreePending;
+        psState->pnPinCount = NULL;
+        psState->pbFreePending = NULL;
+        pthread_mutex_unlock (& pObj->mutex_pin);
+    }
+
+    __atomic_store_n (& pObj->uGrowSeq, pObj->uGrowSeq + 1, __ATOMIC_RELEASE);
+
+    _info ("grow successful, <%d->%d,grow=%d>\n", nOldNum, nNewNum, psState->sDef.nGrowNum);
+
+    return 0;
+}
+
+/**
+ * @brief 扩容结束后停止记录空位栈的变化，释放没有用上的新状态
+ */
+static void filemap_grow_release (FILEMAP_OBJ *pObj, FILEMAP_GROW_STATE *psState)
+{
+    pthread_mutex_lock (& pObj->mutex_alloc);
+    for (int i = 0; i <= FILEMAP_FREELIST_KEY; ++i)
+    {
+        pObj->anGrowFreeMark[i] = -1;
+    }
+    pthread_mutex_unlock (& pObj->mutex_alloc);
+
+    free (psState->psIndexCache);
+    free (psState->psFreeListCache);
+    free (psState->pBitmapMem);
+    if (psState->hBitmapData != NULL)
+    {
+        bitmap_destroy (psState->hBitmapData);
+    }
+    if (psState->hBitmapHashlink != NULL)
+    {
+        bitmap_destroy (psState->hBitmapHashlink);
+    }
+    free (psState->pnPinCount);
+    free (psState->pbFreePending);
+}
+
+/**
+ * @brief 检查已有文件是否需要迁移：版本可以读取，但数量或存储区大小与新的设置不符
+ * @param [OUT] psOldDef 已有文件的定义段
+ * @return 需要迁移返回1，不需要返回0，失败返回-1
+ */
+static int filemap_migrate_check (const char *szFileName, const FILEMAP_SECTION_DEF *psDef, 
+                FILEMAP_SECTION_DEF *psOldDef)
+{
+    if (access (szFileName, F_OK) < 0)
+    { /* 新文件 */
+        return 0;
+    }
+
+    MEM2FILE_HANDLE hMem2File = mem2file_create_ex (szFileName, 0);
+    if (NULL == hMem2File)
+    {
+        _error ("create mem2file failed\n");
+        return -1;
+    }
+
+    int ret = 0;
+    long long llFileSize = 0;
+    if (mem2file_size (hMem2File, &llFileSize) < 0)
+    {
+        ret = -1;
+    }
+    else if (llFileSize > 0 && filemap_check_version (hMem2File) >= 0 && 
+                filemap_check_compatibility (hMem2File, psDef) < 0)
+    {
+        ret = (filemap_get_defseg (hMem2File, psOldDef) < 0 ? -1 : 1);
+    }
+
+    mem2file_close (hMem2File);
+
+    return ret;
+}
+
+/**
+ * @brief 将旧文件中的一项写入新的文件，@pArg为迁移状态
+ */
+static int filemap_migrate_visit (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg)
+{
+    FILEMAP_MIGRATE_STATE *psState = (FILEMAP_MIGRATE_STATE*)pArg;
+
+    unsigned char byteKey[FILEMAP_KEY_MAX];
+    if (filemap_file_getnodekey (pObj, psNode, byteKey) < 0)
+    {
+        _error ("get key failed\n");
+        return -1;
+    }
+
+    int nLen = 0;
+    if (pObj->nHeapUnitNum > 0)
+    {
+        if (filemap_heap_getvalue (pObj, psNode->nIndex, psState->pValue, psState->nValueSize, &nLen) < 0)
+        {
+            _error ("get value failed, index=%d\n", psNode->nIndex);
+            return -1;
+        }
+    }
+    else 
+    {
+        nLen = sizeof(FILEMAP_VALUE);
+        if (filemap_file_getdatasegrange (pObj, psNode->nIndex, 0, psState->pValue, nLen) < 0)
+        {
+            _error ("get data failed, index=%d\n", psNode->nIndex);
+            return -1;
+        }
+    }
+
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (psState->pNew, byteKey, psNode->nKeyLen, &sKey) < 0)
+    {
+        return -1;
+    }
+
+    int ret = filemap_file_setvalue (psState->pNew, &sKey, psState->pValue, nLen);
+    if (ret <= 0)
+    {
+        _error ("set value failed, ret=%d,num=%d\n", ret, psState->nItemNum);
+        return -1;
+    }
+
+    psState->nItemNum += 1;
+    return 0;
+}
+
+/**
+ * @brief 按新的数量和存储区大小重建已有文件：先将旧文件中的各项逐一写入新的临时文件，
+ * 写磁盘后再改名替换旧文件；失败时旧文件不变
+ * @note 两个文件都以映射方式打开，不读入索引段，内存占用与文件大小无关；
+ * 键格式、hash函数和种子、索引结构与旧文件相同，扩容历史清空
+ */
+static int filemap_migrate_file (const char *szFileName, const FILEMAP_SECTION_DEF *psDef, 
+                const FILEMAP_OPTION *psOption)
+{
+    FILEMAP_SECTION_DEF sOldDef = {};
+    int ret = filemap_migrate_check (szFileName, psDef, &sOldDef);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    if (psOption->nFlags & FILEMAP_FLAG_SHARED)
+    { /* 其他进程可能正在使用旧文件 */
+        _error ("can not migrate shared file\n");
+        return -1;
+    }
+
+    _info ("migrate, <%s,num=%d->%d,heapunitnum=%d->%d>\n", szFileName, sOldDef.nMaxFileNum, psDef->nMaxFileNum, 
+                    sOldDef.nHeapUnitNum, psDef->nHeapUnitNum);
+
+    char szTmpName[1024] = {};
+    char szTmpWalName[1024] = {};
+    if (snprintf (szTmpName, sizeof(szTmpName), "%s%s", szFileName, FILEMAP_MIGRATE_SUFFIX) >= (int)sizeof(szTmpName) ||
+            snprintf (szTmpWalName, sizeof(szTmpWalName), "%s%s", szTmpName, FILEMAP_WAL_SUFFIX) >= (int)sizeof(szTmpWalName))
+    {
+        _error ("file name too long, <%s>\n", szFileName);
+        return -1;
+    }
+
+    /* 上次迁移中途退出留下的临时文件 */
+    unlink (szTmpName);
+    unlink (szTmpWalName);
+
+    int bError = 0;
+    FILEMAP_OBJ *pOld = (FILEMAP_OBJ*)filemap_init_file (szFileName, NULL, 
+                    FILEMAP_FLAG_MMAP | (psOption->nFlags & FILEMAP_FLAG_UPGRADE));
+    if (NULL == pOld)
+    {
+        _error ("load old file failed\n");
+        return -1;
+    }
+
+    /* 扩容后尚未完成的迁移，先在旧文件中完成 */
+    if (filemap_grow_finish (pOld) < 0)
+    {
+        _error ("finish grow failed\n");
+        bError = 1;
+    }
+
+    FILEMAP_SECTION_DEF sNewDef = {};
+    if (0 == bError && filemap_get_defseg (pOld->hMem2File, &sNewDef) < 0)
+    {
+        _error ("get def sec failed\n");
+        bError = 1;
+    }
+    sNewDef.nMaxFileNum = psDef->nMaxFileNum;
+    sNewDef.nHeapUnitNum = psDef->nHeapUnitNum;
+    sNewDef.nGrowNum = 0;
+    memset (sNewDef.anGrowFrom, 0, sizeof(sNewDef.anGrowFrom));
+
+    FILEMAP_OBJ *pNew = NULL;
+    if (0 == bError)
+    {
+        pNew = (FILEMAP_OBJ*)filemap_init_file (szTmpName, &sNewDef, FILEMAP_FLAG_MMAP);
+        if (NULL == pNew)
+        {
+            _error ("create new file failed\n");
+            bError = 1;
+        }
+    }
+
+    FILEMAP_MIGRATE_STATE sState = {};
+    sState.pNew = pNew;
+    sState.nValueSize = (pOld->nHeapUnitNum > 0 ? FILEMAP_VALUE_MAX : (int)sizeof(FILEMAP_VALUE));
+    sState.pValue = (char*)malloc (sState.nValueSize);
+    if (NULL == sState.pValue)
+    {
+        _error ("malloc failed\n");
+        bError = 1;
+    }
+
+    /* 逐个位置读取旧的索引 */
+    const int nUnitNum = filemap_get_poshashmap_num (pOld->nMaxFileNum);
+    for (int i = 0; i < nUnitNum && 0 == bError; ++i)
+    {
+        if (filemap_index_walkunit (pOld, & pOld->sGMap.seg_index, pOld->nMaxFileNum, i, 
+                    filemap_migrate_visit, &sState) < 0)
+        {
+            _error ("migrate failed, unit=%d\n", i);
+            bError = 1;
+            break;
+        }
+
+        if (psOption->pfnProgress != NULL && ((i + 1) % FILEMAP_MIGRATE_PROGRESS_STEP == 0 || i + 1 == nUnitNum))
+        {
+            psOption->pfnProgress (psOption->pProgressArg, i + 1, nUnitNum);
+        }
+    }
+
+    free (sState.pValue);
+
+    if (0 == bError && mem2file_sync (pNew->hMem2File) < 0)
+    {
+        _error ("sync new file failed\n");
+        bError = 1;
+    }
+
+    if (pNew != NULL && filemap_close_file (pNew) < 0)
+    {
+        bError = 1;
+    }
+    if (filemap_close_file (pOld) < 0)
+    {
+        bError = 1;
+    }
+
+    /* 改名是原子的，之前异常退出时旧文件不变 */
+    if (0 == bError && rename (szTmpName, szFileName) < 0)
+    {
+        _error ("rename <%s> failed, errno=%d\n", szTmpName, errno);
+        bError = 1;
+    }
+
+    if (bError)
+    {
+        unlink (szTmpName);
+        unlink (szTmpWalName);
+        return -1;
+    }
+
+    filemap_migrate_syncdir (szFileName);
+
+    _info ("migrate successful, <%s,item=%d>\n", szFileName, sState.nItemNum);
+
+    return 0;
+}
+
+/**
+ * @brief 改名后将@szFileName所在的目录写磁盘
+ */
+static int filemap_migrate_syncdir (const char *szFileName)
+{
+    char szDir[1024] = {};
+    const char *pSlash = strrchr (szFileName, '/');
+    if (NULL == pSlash)
+    {
+        strncpy (szDir, ".", sizeof(szDir) - 1);
+    }
+    else 
+    {
+        const int nLen = (pSlash == szFileName ? 1 : (int)(pSlash - szFileName));
+        snprintf (szDir, sizeof(szDir), "%.*s", nLen, szFileName);
+    }
+
+    int fd = open (szDir, O_RDONLY);
+    if (fd < 0)
+    {
+        _error ("open <%s> failed\n", szDir);
+        return -1;
+    }
+
+    int ret = fsync (fd);
+    close (fd);
+
+    return ret < 0 ? -1 : 0;
+}
+
+/**
+ * @brief 打开遍历时记录一项所在的数据位置和哈希表位置，@pArg为FILEMAP_ITER_WALK
+ */
+static int filemap_iter_visitcollect (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg)
+{
+    FILEMAP_ITER_WALK *psWalk = (FILEMAP_ITER_WALK*)pArg;
+    FILEMAP_ITER *psIter = psWalk->psIter;
+
+    if (psIter->nEntryNum >= psIter->nEntryMax)
+    {
+        const int nNewMax = (psIter->nEntryMax > 0 ? psIter->nEntryMax * 2 : 1024);
+        FILEMAP_ITER_ENTRY *psNew = (FILEMAP_ITER_ENTRY*)realloc (psIter->psEntry, sizeof(FILEMAP_ITER_ENTRY) * nNewMax);
+        if (NULL == psNew)
+        {
+            _error ("realloc failed, num=%d\n", nNewMax);
+            return -1;
+        }
+        psIter->psEntry = psNew;
+        psIter->nEntryMax = nNewMax;
+    }
+
+    FILEMAP_ITER_ENTRY *psEntry = & psIter->psEntry[psIter->nEntryNum++];
+    psEntry->nIndex = psNode->nIndex;
+    psEntry->nUnit = psWalk->nUnit;
+    psEntry->uHash = filemap_node_gethash (pObj, psNode);
+
+    return 0;
+}
+
+/**
+ * @brief 在哈希表的一个位置上找出数据位置为psWalk->nIndex的项
+ */
+static int filemap_iter_visitfind (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psNode, void *pArg)
+{
+    FILEMAP_ITER_WALK *psWalk = (FILEMAP_ITER_WALK*)pArg;
+    if (psNode->nIndex == psWalk->nIndex)
+    {
+        psWalk->sNode = *psNode;
+        psWalk->bFound = 1;
+    }
+
+    return 0;
+}
+
+static int filemap_iter_entrycmp (const void *pA, const void *pB)
+{
+    const FILEMAP_ITER_ENTRY *psA = (const FILEMAP_ITER_ENTRY*)pA;
+    const FILEMAP_ITER_ENTRY *psB = (const FILEMAP_ITER_ENTRY*)pB;
+    return (psA->nIndex > psB->nIndex) - (psA->nIndex < psB->nIndex);
+}
+
+/**
+ * @brief 从@llPos开始顺序读取一段数据到缓冲区，读取前记录各段的版本号
+ * @note 缓冲区中的数据只在对应段的版本号不变时有效
+ */
+static int filemap_iter_fill (FILEMAP_ITER *psIter, long long llPos)
+{
+    FILEMAP_OBJ *pObj = psIter->pObj;
+
+    for (int i = 0; i < FILEMAP_BUCKET_LOCK_NUM; ++i)
+    {
+        psIter->auSeq[i] = __atomic_load_n (& pObj->puBucketSeq[i], __ATOMIC_ACQUIRE);
+    }
+
+    long long llFileSize = 0;
+    if (mem2file_size (pObj->hMem2File, &llFileSize) < 0)
+    {
+        _error ("get file size failed\n");
+        return -1;
+    }
+
+    const int nLen = (llFileSize - llPos < psIter->nBufferSize ? (int)(llFileSize - llPos) : psIter->nBufferSize);
+    if (nLen <= 0 || mem2file_getdata (pObj->hMem2File, llPos, psIter->pBuffer, nLen) < 0)
+    {
+        _error ("get data failed, <pos=%lld,len=%d>\n", llPos, nLen);
+        return -1;
+    }
+
+    psIter->llBufferPos = llPos;
+    psIter->nBufferLen = nLen;
+
+    return 0;
+}
+
+/**
+ * @brief 取得一项的值在文件中的位置和长度，尽量从缓冲区中取得
+ * @param [OUT] ppBuffered 值在缓冲区中时指向缓冲区，否则为NULL
+ */
+static int filemap_iter_locate (FILEMAP_ITER *psIter, const FILEMAP_ITER_ENTRY *psEntry, const char **ppBuffered)
+{
+    FILEMAP_OBJ *pObj = psIter->pObj;
+    *ppBuffered = NULL;
+
+    long long llPos = 0;
+    int nHead = 0;
+    if (pObj->nHeapUnitNum > 0)
+    {
+        llPos = pObj->sGMap.seg_data.seg.pos + (long long)FILEMAP_HEAP_UNIT_SIZE * psEntry->nIndex;
+        nHead = sizeof(FILEMAP_HEAP_CHUNK_HEAD);
+    }
+    else 
+    {
+        llPos = filemap_data_getpos (pObj, psEntry->nIndex);
+    }
+
+    if (llPos < psIter->llBufferPos || llPos + nHead >= psIter->llBufferPos + psIter->nBufferLen)
+    { /* 缓冲区之外，从该项开始读取下一段 */
+        if (filemap_iter_fill (psIter, llPos) < 0)
+        {
+            return -1;
+        }
+    }
+
+    const char *pData = psIter->pBuffer + (llPos - psIter->llBufferPos);
+    int nLen = sizeof(FILEMAP_VALUE);
+    if (pObj->nHeapUnitNum > 0)
+    { /* 长度在缓冲区中的块头部，无效时直接读取 */
+        FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+        if (llPos + nHead > psIter->llBufferPos + psIter->nBufferLen)
+        {
+            return 0;
+        }
+        memcpy (&sChunk, pData, sizeof(sChunk));
+        nLen = sChunk.nLen;
+        if (nLen < 0 || nLen > FILEMAP_VALUE_MAX)
+        {
+            return 0;
+        }
+    }
+
+    if (llPos + nHead + nLen > psIter->llBufferPos + psIter->nBufferLen)
+    {
+        if (nHead + nLen > psIter->nBufferSize || filemap_iter_fill (psIter, llPos) < 0)
+        { /* 比缓冲区大，直接读取 */
+            return 0;
+        }
+        pData = psIter->pBuffer;
+        if (llPos + nHead + nLen > psIter->llBufferPos + psIter->nBufferLen)
+        {
+            return 0;
+        }
+    }
+
+    psIter->nBufferedLen = nLen;
+    *ppBuffered = pData + nHead;
+
+    return 0;
+}
+
+/**
+ * @brief 记录所有项的位置，按数据在文件中的位置排序
+ * @note 只读取内存中的索引，期间写操作等待；扩容迁移未完成时先完成
+ */
+static int filemap_iter_load (FILEMAP_OBJ *pObj, FILEMAP_ITER *psIter)
+{
+    int bError = 0;
+
+    filemap_entrancecall_lockexclusive (pObj);
+    if (pObj->psShared != NULL)
+    {
+        filemap_shared_lock (pObj);
+    }
+    if (filemap_grow_finish (pObj) < 0)
+    { /* 以新的哈希表为准 */
+        bError = 1;
+    }
+
+    psIter->pObj = pObj;
+    psIter->nMaxFileNum = pObj->nMaxFileNum;
+    const int nUnitNum = filemap_get_poshashmap_num (pObj->nMaxFileNum);
+    FILEMAP_ITER_WALK sWalk = {};
+    sWalk.psIter = psIter;
+    for (int i = 0; i < nUnitNum && 0 == bError; ++i)
+    {
+        sWalk.nUnit = i;
+        if (filemap_index_walkunit (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, i, 
+                    filemap_iter_visitcollect, &sWalk) < 0)
+        {
+            _error ("walk index failed, unit=%d\n", i);
+            bError = 1;
+        }
+    }
+
+    if (pObj->psShared != NULL)
+    {
+        filemap_shared_unlock (pObj);
+    }
+    filemap_entrancecall_unlock (pObj);
+
+    if (bError)
+    {
+        return -1;
+    }
+
+    qsort (psIter->psEntry, psIter->nEntryNum, sizeof(FILEMAP_ITER_ENTRY), filemap_iter_entrycmp);
+
+    return 0;
+}
+
+/**
+ * @brief 取得遍历中的下一项，见filemap_iter_next
+ */
+static int filemap_iter_step (FILEMAP_ITER *psIter, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen)
+{
+    FILEMAP_OBJ *pObj = psIter->pObj;
+
+    while (psIter->nNext < psIter->nEntryNum)
+    {
+        const FILEMAP_ITER_ENTRY *psEntry = & psIter->psEntry[psIter->nNext++];
+
+        const char *pBuffered = NULL;
+        if (filemap_iter_locate (psIter, psEntry, &pBuffered) < 0)
+        {
+            return -1;
+        }
+
+        FILEMAP_KEYREF sKey = {};
+        sKey.uHash = psEntry->uHash;
+
+        filemap_entrancecall_lock (pObj);
+        if (pObj->nMaxFileNum != psIter->nMaxFileNum)
+        { /* 扩容后哈希表中的位置已改变 */
+            filemap_entrancecall_unlock (pObj);
+            _error ("grown during iteration, <%d,%d>\n", psIter->nMaxFileNum, pObj->nMaxFileNum);
+            return -1;
+        }
+        filemap_bucket_lock (pObj, & sKey, 0);
+
+        /* 该项可能已被删除，或其位置已被其他key使用 */
+        FILEMAP_ITER_WALK sWalk = {};
+        sWalk.nIndex = psEntry->nIndex;
+        int ret = filemap_index_walkunit (pObj, & pObj->sGMap.seg_index, pObj->nMaxFileNum, psEntry->nUnit, 
+                    filemap_iter_visitfind, &sWalk);
+        if (0 == ret && sWalk.bFound)
+        {
+            ret = filemap_file_getnodekey (pObj, & sWalk.sNode, (unsigned char*)pKey);
+            *pnKeyLen = sWalk.sNode.nKeyLen;
+        }
+
+        const int nLock = filemap_bucket_getlock (pObj, & sKey);
+        if (0 == ret && sWalk.bFound)
+        {
+            if (pBuffered != NULL && 0 == (psIter->auSeq[nLock] & 1) && psIter->auSeq[nLock] == pObj->puBucketSeq[nLock])
+            { /* 读取缓冲区之后该段没有写操作 */
+                memcpy (pData, pBuffered, psIter->nBufferedLen < nSize ? psIter->nBufferedLen : nSize);
+                if (pnLen != NULL)
+                {
+                    *pnLen = psIter->nBufferedLen;
+                }
+            }
+            else if (pObj->nHeapUnitNum > 0)
+            {
+                ret = filemap_heap_getvalue (pObj, psEntry->nIndex, pData, nSize, pnLen);
+            }
+            else 
+            {
+                const int nLen = sizeof(FILEMAP_VALUE);
+                ret = filemap_file_getdatasegrange (pObj, psEntry->nIndex, 0, pData, nLen < nSize ? nLen : nSize);
+                if (pnLen != NULL)
+                {
+                    *pnLen = nLen;
+                }
+            }
+        }
+
+        filemap_bucket_unlock (pObj, & sKey, 0);
+        filemap_entrancecall_unlock (pObj);
+
+        if (ret < 0)
+        {
+            _error ("get item failed, index=%d\n", psEntry->nIndex);
+            return -1;
+        }
+
+        if (sWalk.bFound)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 并行遍历的一个线程，依次取得本段中的项并调用回调函数
+ */
+static void *filemap_foreach_thread (void *pArg)
+{
+    FILEMAP_FOREACH_WORKER *psWorker = (FILEMAP_FOREACH_WORKER*)pArg;
+    FILEMAP_ITER *psIter = & psWorker->sIter;
+
+    const int nValueSize = (psIter->pObj->nHeapUnitNum > 0 ? FILEMAP_VALUE_MAX : (int)sizeof(FILEMAP_VALUE));
+    char *pValue = (char*)malloc (nValueSize);
+    if (NULL == pValue)
+    {
+        _error ("malloc failed\n");
+        psWorker->nResult = -1;
+        __atomic_store_n (psWorker->pbStop, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    unsigned char byteKey[FILEMAP_KEY_MAX];
+    while (! __atomic_load_n (psWorker->pbStop, __ATOMIC_RELAXED))
+    {
+        int nKeyLen = 0;
+        int nLen = 0;
+        int ret = filemap_iter_step (psIter, byteKey, &nKeyLen, pValue, nValueSize, &nLen);
+        if (ret < 0)
+        {
+            psWorker->nResult = -1;
+            __atomic_store_n (psWorker->pbStop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        else if (0 == ret)
+        {
+            break;
+        }
+
+        if (psWorker->pfnCallback (psWorker->pCtx, byteKey, nKeyLen, pValue, nLen) != 0)
+        { /* 回调函数要求停止，其他线程也停止 */
+            psWorker->nResult = 1;
+            __atomic_store_n (psWorker->pbStop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    free (pValue);
+
+    return NULL;
+}
+
+/**
+ * @brief 将@pfnSource给出的各项依次写入新建的@pObj
+ * @param [OUT] pnItemNum 写入的项数
+ * @note 索引段和空位栈的修改只写入内存副本，结束时整个写入；新文件的空位从小到大分配，
+ * 数据段和键段的写入都是顺序的，由mem2file合并为较大的写入
+ */
+static int filemap_bulkload_file (FILEMAP_OBJ *pObj, const FILEMAP_OPTION *psOption, 
+                int (*pfnSource)(void *pArg, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen), 
+                void *pArg, int *pnItemNum)
+{
+    const int nValueSize = (pObj->nHeapUnitNum > 0 ? FILEMAP_VALUE_MAX : (int)sizeof(FILEMAP_VALUE));
+    char *pValue = (char*)malloc (nValueSize);
+    FILEMAP_BATCH *psBatch = (FILEMAP_BATCH*)malloc (sizeof(FILEMAP_BATCH));
+    if (NULL == pValue || NULL == psBatch)
+    {
+        _error ("malloc failed\n");
+        free (pValue);
+        free (psBatch);
+        return -1;
+    }
+
+    int bError = 0;
+    if (mem2file_setwritebuffer (pObj->hMem2File, FILEMAP_BULKLOAD_BUFFER_SIZE) < 0)
+    {
+        _error ("set write buffer failed\n");
+        bError = 1;
+    }
+
+    filemap_entrancecall_lockexclusive (pObj);
+    filemap_batch_begin (pObj, psBatch, 1);
+
+    int nItemNum = 0;
+    unsigned char byteKey[FILEMAP_KEY_MAX];
+    while (0 == bError)
+    {
+        int nKeyLen = 0;
+        int nLen = 0;
+        int ret = pfnSource (pArg, byteKey, &nKeyLen, pValue, nValueSize, &nLen);
+        if (0 == ret)
+        {
+            break;
+        }
+        else if (ret < 0)
+        {
+            _error ("source failed, item=%d\n", nItemNum);
+            bError = 1;
+            break;
+        }
+
+        FILEMAP_KEYREF sKey;
+        if (nLen < 0 || nLen > nValueSize)
+        {
+            _error ("len invalid, <item=%d,len=%d>\n", nItemNum, nLen);
+            bError = 1;
+        }
+        else if (filemap_key_make (pObj, byteKey, nKeyLen, &sKey) < 0)
+        {
+            bError = 1;
+        }
+        else if (filemap_file_setvalue (pObj, &sKey, pValue, nLen) <= 0)
+        { /* 已满时也失败 */
+            _error ("set value failed, item=%d\n", nItemNum);
+            bError = 1;
+        }
+        else 
+        {
+            nItemNum += 1;
+        }
+
+        if (0 == bError && psOption != NULL && psOption->pfnProgress != NULL && 
+                nItemNum % FILEMAP_BULKLOAD_PROGRESS_STEP == 0)
+        {
+            psOption->pfnProgress (psOption->pProgressArg, nItemNum, pObj->nMaxFileNum);
+        }
+    }
+
+    if (filemap_batch_end (pObj, psBatch) < 0)
+    {
+        bError = 1;
+    }
+    filemap_entrancecall_unlock (pObj);
+
+    if (mem2file_setwritebuffer (pObj->hMem2File, 0) < 0)
+    {
+        _error ("flush write buffer failed\n");
+        bError = 1;
+    }
+
+    free (pValue);
+    free (psBatch);
+
+    *pnItemNum = nItemNum;
+
+    return bError ? -1 : 0;
+}
+
+/**
+ * @brief 根据key的hash值计算出项在位置哈希表中的索引值
+ */
+static int filemap_hashmap_getindex (int nMaxFileNum, unsigned int uHash)
+{
+    const int nHashMapSize = filemap_get_poshashmap_num (nMaxFileNum);
+
+    /* 根据hash得到索引 */
+    unsigned int uIndex = uHash; /* 这里要用无符号型，进行取整 */
+    uIndex %= nHashMapSize;
+
+    return uIndex;
+}
+
+/**
+ * @return 若存在，返回1，否则返回0
+ */
+static int filemap_file_existitem (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key)
+{
+    int bExist = 0;
+
+    FILEMAP_DATAMAP map = {};
+    int ret = filemap_file_getdatamap (pObj, key, & map);
+
+    if (ret <= 0)
+    { /* 失败也认为是不存在 */
+        bExist = 0;
+    }
+    else 
+    {
+        bExist = 1;
+    }
+
+    return bExist;
+}
+
+/**
+ * @brief 比较索引中的一项与key，先比较长度和哈希值，相同时才比较键的内容
+ * @return 相同返回0，否则返回非0
+ */
+static int filemap_keycmp (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap, const FILEMAP_KEYREF *key)
+{
+    /* 先比较索引项中保存的hash，不同则不必读取键 */
+    if (FILEMAP_KEYFORMAT_STRING != pObj->nKeyFormat && psMap->uHash != key->uHash)
+    {
+        return 1;
+    }
+
+    if (psMap->nKeyLen != key->nLen)
+    {
+        return 1;
+    }
+
+    if (INDEX_NULL == psMap->nKeyIndex)
+    {
+        return memcmp (psMap->byteKey, key->pData, key->nLen);
+    }
+
+    unsigned char byteKey[FILEMAP_KEY_MAX];
+    if (filemap_file_getkeyslot (pObj, psMap->nKeyIndex, psMap->nKeyLen, byteKey) < 0)
+    {
+        return 1;
+    }
+
+    return memcmp (byteKey, key->pData, key->nLen);
+}
+
+/**
+ * @brief 使用文件记录的hash函数计算键的hash值
+ */
+static unsigned int filemap_key_hash (FILEMAP_OBJ *pObj, const void *pKey, int nKeyLen)
+{
+    if (FILEMAP_HASH_WYHASH == pObj->nHashType)
+    { /* 高低位混合后取32位 */
+        unsigned long long ullHash = WyHash (pKey, nKeyLen, pObj->ullHashSeed);
+        return (unsigned int)(ullHash ^ (ullHash >> 32));
+    }
+
+    return (unsigned int)BKDRHashBin ((const char*)pKey, nKeyLen);
+}
+
+/**
+ * @brief 生成新文件的hash种子
+ */
+static unsigned long long filemap_hash_newseed (void)
+{
+    unsigned long long ullSeed = 0;
+
+    int fd = open ("/dev/urandom", O_RDONLY);
+    if (fd >= 0)
+    {
+        if (read (fd, &ullSeed, sizeof(ullSeed)) != (ssize_t)sizeof(ullSeed))
+        {
+            ullSeed = 0;
+        }
+        close (fd);
+    }
+
+    if (0 == ullSeed)
+    {
+        struct timespec ts = {};
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ullSeed = ((unsigned long long)ts.tv_sec << 32) ^ (unsigned long long)ts.tv_nsec ^ 
+                    ((unsigned long long)getpid () << 16);
+    }
+
+    return ullSeed;
+}
+
+/**
+ * @brief 检查调用者传入的键，并计算哈希值
+ * @note 字符串键格式下，键不能含有0，且短于64字节，哈希值与旧版本相同
+ */
+static int filemap_key_make (FILEMAP_OBJ *pObj, const void *pKey, int nKeyLen, FILEMAP_KEYREF *psKey)
+{
+    if (nKeyLen < 0 || nKeyLen > FILEMAP_KEY_MAX || (NULL == pKey && nKeyLen > 0))
+    {
+        _error ("key len invalid, len=%d\n", nKeyLen);
+        return -1;
+    }
+
+    if (FILEMAP_KEYFORMAT_STRING == pObj->nKeyFormat && 
+            (nKeyLen >= (int)sizeof(FILEMAP_DATA_64B) || memchr (pKey, 0, nKeyLen) != NULL))
+    {
+        _error ("key not a string, len=%d\n", nKeyLen);
+        return -1;
+    }
+
+    psKey->pData = (const unsigned char*)(nKeyLen > 0 ? pKey : "");
+    psKey->nLen = nKeyLen;
+    psKey->uHash = filemap_key_hash (pObj, psKey->pData, nKeyLen);
+
+    return 0;
+}
+
+/**
+ * @brief 文件中的节点转换为索引中的一项
+ * @note 不加锁读取时节点可能正被修改，检查失败返回-1
+ */
+static int filemap_node_decode (FILEMAP_OBJ *pObj, const char *pNode, FILEMAP_DATAMAP *psMap)
+{
+    if (FILEMAP_KEYFORMAT_STRING == pObj->nKeyFormat)
+    {
+        FILEMAP_STRING_NODE sNode;
+        memcpy (&sNode, pNode, sizeof(sNode));
+
+        psMap->bUsedFlag = sNode.bUsedFlag;
+        psMap->uHash = 0;
+        psMap->nKeyLen = strnlen (sNode.key.szKey, sizeof(sNode.key.szKey));
+        psMap->nKeyIndex = INDEX_NULL;
+        memcpy (psMap->byteKey, sNode.key.szKey, sizeof(psMap->byteKey));
+        psMap->nIndex = sNode.nIndex;
+        psMap->nNextIndex = sNode.nNextIndex;
+        return 0;
+    }
+
+    FILEMAP_BINARY_NODE sNode;
+    memcpy (&sNode, pNode, sizeof(sNode));
+
+    psMap->bUsedFlag = sNode.bUsedFlag;
+    psMap->uHash = sNode.uHash;
+    psMap->nKeyLen = sNode.nKeyLen;
+    psMap->nKeyIndex = INDEX_NULL;
+    psMap->nIndex = sNode.nIndex;
+    psMap->nNextIndex = sNode.nNextIndex;
+
+    if (! sNode.bUsedFlag)
+    {
+        psMap->nKeyLen = 0;
+    }
+    else if (sNode.nKeyLen < 0 || sNode.nKeyLen > FILEMAP_KEY_MAX)
+    {
+        _error ("node broken, keylen=%d\n", sNode.nKeyLen);
+        return -1;
+    }
+    else if (sNode.nKeyLen > FILEMAP_KEY_INLINE_MAX)
+    { /* 长键，比较时再读取 */
+        memcpy (& psMap->nKeyIndex, sNode.byteKey, sizeof(psMap->nKeyIndex));
+    }
+    else 
+    {
+        memcpy (psMap->byteKey, sNode.byteKey, sNode.nKeyLen);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 索引中的一项转换为文件中的节点
+ */
+static int filemap_node_encode (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap, char *pNode)
+{
+    if (FILEMAP_KEYFORMAT_STRING == pObj->nKeyFormat)
+    {
+        FILEMAP_STRING_NODE sNode;
+        memset (&sNode, 0, sizeof(sNode));
+
+        sNode.bUsedFlag = psMap->bUsedFlag;
+        memcpy (sNode.key.szKey, psMap->byteKey, psMap->nKeyLen < (int)sizeof(sNode.key.szKey) ? 
+                    psMap->nKeyLen : (int)sizeof(sNode.key.szKey) - 1);
+        sNode.nIndex = psMap->nIndex;
+        sNode.nNextIndex = psMap->nNextIndex;
+
+        memcpy (pNode, &sNode, sizeof(sNode));
+        return 0;
+    }
+
+    FILEMAP_BINARY_NODE sNode;
+    memset (&sNode, 0, sizeof(sNode));
+
+    sNode.bUsedFlag = psMap->bUsedFlag;
+    sNode.uHash = psMap->uHash;
+    sNode.nKeyLen = psMap->nKeyLen;
+    sNode.nIndex = psMap->nIndex;
+    sNode.nNextIndex = psMap->nNextIndex;
+
+    if (psMap->nKeyLen > FILEMAP_KEY_INLINE_MAX)
+    {
+        memcpy (sNode.byteKey, & psMap->nKeyIndex, sizeof(psMap->nKeyIndex));
+    }
+    else if (psMap->nKeyLen > 0)
+    {
+        memcpy (sNode.byteKey, psMap->byteKey, psMap->nKeyLen);
+    }
+
+    memcpy (pNode, &sNode, sizeof(sNode));
+    return 0;
+}
+
+/**
+ * @brief 读取键段中的一个长键
+ */
+static int filemap_file_getkeyslot (FILEMAP_OBJ *pObj, int nKeyIndex, int nKeyLen, unsigned char *pKey)
+{
+    if (nKeyIndex < 0 || nKeyIndex >= pObj->nMaxFileNum || nKeyLen < 0 || nKeyLen > FILEMAP_KEY_MAX ||
+            0 == pObj->sGMap.seg_key.seg.size)
+    {
+        _error ("key index invalid, <%d,%d>\n", nKeyIndex, nKeyLen);
+        return -1;
+    }
+
+    const long long llPos = filemap_key_getpos (pObj, nKeyIndex);
+    if (mem2file_getdata (pObj->hMem2File, llPos, pKey, nKeyLen) < 0)
+    {
+        _error ("get key failed, index=%d\n", nKeyIndex);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 为新增的项记录键，长键先写入键段中新分配的位置
+ * @note 与数据段相同，键段在索引指向它之前写入
+ */
+static int filemap_file_newkey (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_DATAMAP *psMap)
+{
+    psMap->uHash = (FILEMAP_KEYFORMAT_STRING == pObj->nKeyFormat ? 0 : key->uHash);
+    psMap->nKeyLen = key->nLen;
+    psMap->nKeyIndex = INDEX_NULL;
+    memset (psMap->byteKey, 0, sizeof(psMap->byteKey));
+
+    if (FILEMAP_KEYFORMAT_STRING == pObj->nKeyFormat || key->nLen <= FILEMAP_KEY_INLINE_MAX)
+    {
+        memcpy (psMap->byteKey, key->pData, key->nLen);
+        return 0;
+    }
+
+    int nKeyIndex = INDEX_NULL;
+    if (filemap_freelist_pop (pObj, FILEMAP_FREELIST_KEY, &nKeyIndex) != 1)
+    {
+        _error ("get empty key slot failed\n");
+        return -1;
+    }
+
+    const long long llPos = filemap_key_getpos (pObj, nKeyIndex);
+    if (mem2file_setdata (pObj->hMem2File, llPos, key->pData, key->nLen) < 0)
+    {
+        _error ("set key failed, index=%d\n", nKeyIndex);
+        return -1;
+    }
+
+    psMap->nKeyIndex = nKeyIndex;
+    return 0;
+}
+
+/**
+ * @brief 删除一项时释放键段中的位置
+ */
+static int filemap_file_freekey (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap)
+{
+    if (INDEX_NULL == psMap->nKeyIndex)
+    {
+        return 0;
+    }
+
+    return filemap_freelist_push (pObj, FILEMAP_FREELIST_KEY, psMap->nKeyIndex);
+}
+
+/**
+ * @brief 取得索引中一项的完整的键，长键从键段读取
+ */
+static int filemap_file_getnodekey (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap, unsigned char *pKey)
+{
+    if (INDEX_NULL == psMap->nKeyIndex)
+    {
+        memcpy (pKey, psMap->byteKey, psMap->nKeyLen);
+        return 0;
+    }
+
+    return filemap_file_getkeyslot (pObj, psMap->nKeyIndex, psMap->nKeyLen, pKey);
+}
+
+/**
+ * @brief 将键转换为可打印的字符串，不可打印的字节输出为\xHH
+ */
+static int filemap_key_format (const unsigned char *pKey, int nKeyLen, char *szOut, int nSize)
+{
+    int nOutLen = 0;
+    szOut[0] = '\0';
+
+    for (int i = 0; i < nKeyLen && nOutLen + 5 <= nSize; ++i)
+    {
+        if (pKey[i] >= 0x20 && pKey[i] < 0x7F && pKey[i] != '\\')
+        {
+            szOut[nOutLen++] = (char)pKey[i];
+            szOut[nOutLen] = '\0';
+        }
+        else 
+        {
+            nOutLen += snprintf (szOut + nOutLen, nSize - nOutLen, "\\x%02X", pKey[i]);
+        }
+    }
+
+    return nOutLen;
+}
+
+/**
+ * @brief 取得索引项的key的hash值
+ * @note 字符串键的索引项（V1.x格式）没有保存hash，需要重新计算
+ */
+static unsigned int filemap_node_gethash (FILEMAP_OBJ *pObj, const FILEMAP_DATAMAP *psMap)
+{
+    if (FILEMAP_KEYFORMAT_STRING == pObj->nKeyFormat)
+    {
+        return filemap_key_hash (pObj, psMap->byteKey, psMap->nKeyLen);
+    }
+
+    return psMap->uHash;
+}
+
+static int filemap_getdefsegmap (FILEMAP_DEF_MAP *psMap)
+{
+    psMap->seg.pos = 0;
+    psMap->seg.size = 10 * 1024;
+
+    return 0;
+}
+
+static int filemap_file_getitem(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, FILEMAP_VALUE *value)
+{
+    if (pObj->nHeapUnitNum > 0)
+    { /* 较短的值其余部分填0 */
+        memset (value, 0, sizeof(*value));
+        return filemap_file_getvalue (pObj, key, value, sizeof(*value), NULL);
+    }
+
+    FILEMAP_DATAMAP map = {};
+    int ret = filemap_file_getdatamap (pObj, key, & map);
+    if (ret < 0)
+    {
+        _error ("get data index failed\n");
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        return -1;
+    }
+    else 
+    {
+        FILEMAP_SECTION_DATA_ELEMENT sDataElem = {};
+        ret = filemap_file_getdatasegitem (pObj, map.nIndex, & sDataElem);
+        if (ret < 0)
+        {
+            _error ("get data element failed\n");
+            return -1;
+        }
+
+        *value = sDataElem.value;
+    }
+
+    return 0;
+}
+
+static int filemap_multiget_unitcmp (const void *pA, const void *pB)
+{
+    const FILEMAP_MULTIGET_REQ *psA = (const FILEMAP_MULTIGET_REQ*)pA;
+    const FILEMAP_MULTIGET_REQ *psB = (const FILEMAP_MULTIGET_REQ*)pB;
+    return (psA->nUnit > psB->nUnit) - (psA->nUnit < psB->nUnit);
+}
+
+static int filemap_multiget_poscmp (const void *pA, const void *pB)
+{
+    const FILEMAP_MULTIGET_REQ *psA = (const FILEMAP_MULTIGET_REQ*)pA;
+    const FILEMAP_MULTIGET_REQ *psB = (const FILEMAP_MULTIGET_REQ*)pB;
+    return (psA->llPos > psB->llPos) - (psA->llPos < psB->llPos);
+}
+
+/**
+ * @brief 一次读取多个项：按哈希表中的位置依次查找索引，再按数据在文件中的位置排序，
+ * 相邻的数据项合并为一次读取
+ * @param psReq 各个key，会被排序
+ * @return 失败返回-1，否则返回找到的项数
+ * @note 调用者已锁住所有key所在的段
+ */
+static int filemap_file_multiget (FILEMAP_OBJ *pObj, FILEMAP_MULTIGET_REQ *psReq, int nNum, 
+                FILEMAP_VALUE *pValues, int *pnStatus)
+{
+    qsort (psReq, nNum, sizeof(*psReq), filemap_multiget_unitcmp);
+
+    int nFound = 0;
+    for (int i = 0; i < nNum; ++i)
+    {
+        FILEMAP_DATAMAP map = {};
+        int ret = filemap_file_getdatamap (pObj, & psReq[i].sKey, & map);
+        if (ret < 0)
+        {
+            _error ("get data index failed\n");
+            return -1;
+        }
+        else if (ret == 0)
+        {
+            continue;
+        }
+
+        /* 找到的项放在前面 */
+        FILEMAP_MULTIGET_REQ sReq = psReq[i];
+        sReq.llPos = (pObj->nHeapUnitNum > 0 ? map.nIndex : filemap_data_getpos (pObj, map.nIndex));
+        psReq[i] = psReq[nFound];
+        psReq[nFound] = sReq;
+        nFound += 1;
+    }
+
+    qsort (psReq, nFound, sizeof(*psReq), filemap_multiget_poscmp);
+
+    if (pObj->nHeapUnitNum > 0)
+    { /* 变长方式下按存储单元的顺序读取 */
+        for (int i = 0; i < nFound; ++i)
+        {
+            FILEMAP_VALUE *pValue = & pValues[psReq[i].nKey];
+            memset (pValue, 0, sizeof(*pValue));
+            if (filemap_heap_getvalue (pObj, (int)psReq[i].llPos, pValue, sizeof(*pValue), NULL) < 0)
+            {
+                _error ("get value failed, unit=%lld\n", psReq[i].llPos);
+                return -1;
+            }
+            pnStatus[psReq[i].nKey] = 0;
+        }
+
+        return nFound;
+    }
+
+    struct iovec *psIov = (struct iovec*)malloc (sizeof(struct iovec) * (nFound > 0 ? nFound : 1));
+    if (NULL == psIov)
+    {
+        _error ("malloc failed\n");
+        return -1;
+    }
+
+    int bError = 0;
+    for (int i = 0; i < nFound && 0 == bError; )
+    { /* 文件中相邻的数据项 */
+        int nIovNum = 0;
+        do 
+        {
+            psIov[nIovNum].iov_base = & pValues[psReq[i + nIovNum].nKey];
+            psIov[nIovNum].iov_len = sizeof(FILEMAP_SECTION_DATA_ELEMENT);
+            nIovNum += 1;
+        } while (i + nIovNum < nFound && 
+                    psReq[i + nIovNum].llPos == psReq[i + nIovNum - 1].llPos + (long long)sizeof(FILEMAP_SECTION_DATA_ELEMENT));
+
+        if (mem2file_getdatav (pObj->hMem2File, psReq[i].llPos, psIov, nIovNum) < 0)
+        {
+            _error ("get data failed, pos=%lld,num=%d\n", psReq[i].llPos, nIovNum);
+            bError = 1;
+            break;
+        }
+
+        for (int k = i; k < i + nIovNum; ++k)
+        {
+            pnStatus[psReq[k].nKey] = 0;
+        }
+        i += nIovNum;
+    }
+
+    free (psIov);
+
+    return bError ? -1 : nFound;
+}
+
+/**
+ * @brief 记录一个项，若存在，则替换，若不存在，则新增
+ * @return 成功返回1，出错返回-1，已满返回0
+ */
+static int filemap_file_setitem(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_VALUE *value)
+{
+    /**
+     * 如果该项存在，则替换，否则
+     * 找出要放的位置，然后记录索引
+     */
+
+    if (pObj->nHeapUnitNum > 0)
+    {
+        return filemap_file_setvalue (pObj, key, value, sizeof(*value));
+    }
+
+    FILEMAP_DATAMAP sDataMap = {};
+    int ret = filemap_file_getdatamap (pObj, key, & sDataMap);
+
+    int bAddNew = 0;
+
+    if (ret < 0)
+    {
+        _error ("getdatamap failed\n");
+        return -1;
+    }
+    else if (ret == 1 && filemap_pin_ispinned (pObj, sDataMap.nIndex))
+    { /* 存在，但正被借用，则写到新的位置，原位置在归还后释放 */
+        int nEmptyDataIndex = 0;
+        if (filemap_freelist_pop (pObj, FILEMAP_FREELIST_DATA, &nEmptyDataIndex) != 1)
+        {
+            _error ("scan empty bit failed\n");
+            return 0;
+        }
+
+        FILEMAP_SECTION_DATA_ELEMENT sDataEle = {
+            *value,
+        };
+
+        if (filemap_file_setdatasegitem (pObj, nEmptyDataIndex, &sDataEle) < 0)
+        {
+            _error ("set seg item failed\n");
+            return -1;
+        }
+
+        if (1 || "union operation")
+        {
+            FILEMAP_DATAMAP sNewMap = sDataMap;
+            sNewMap.nIndex = nEmptyDataIndex;
+            if (filemap_file_adddatamap (pObj, key, & sNewMap) < 0)
+            {
+                _error ("replace map failed\n");
+                return -1;
+            }
+
+            if (filemap_file_freedataslot (pObj, sDataMap.nIndex) < 0)
+            {
+                _error ("free data slot failed\n");
+                return -1;
+            }
+        }
+
+        return 1;
+    }
+    else if (ret == 1)
+    { /* 存在 */
+        FILEMAP_SECTION_DATA_ELEMENT sEle = {
+            *value,
+        };
+        ret = filemap_file_setdatasegitem(pObj, sDataMap.nIndex, &sEle);
+        if (ret < 0)
+        {
+            _error("set data to segitem failed\n");
+            return -1;
+        }
+        return 1;
+    }
+    else if (ret == 0)
+    { /* 不存在，则需要新增映射和数据 */
+        bAddNew = 1;
+    }
+
+    if (bAddNew)
+    {
+        /* 先填充数据 */
+        int nEmptyDataIndex = 0;
+        if (filemap_freelist_pop (pObj, FILEMAP_FREELIST_DATA, &nEmptyDataIndex) != 1)
+        {
+            _error ("scan empty bit failed\n");
+            return -1;
+        }
+
+        FILEMAP_SECTION_DATA_ELEMENT sDataEle = {
+            *value,
+        };
+
+        if (filemap_file_setdatasegitem (pObj, nEmptyDataIndex, &sDataEle) < 0)
+        {
+            _error ("set seg item failed\n");
+            return -1;
+        }
+
+        if (1 || "union operation")
+        {
+            /* 增加索引 */
+            FILEMAP_DATAMAP sNewMap = {};
+            sNewMap.bUsedFlag = 1;
+            sNewMap.nIndex = nEmptyDataIndex;
+            sNewMap.nNextIndex = INDEX_NULL;
+            if (filemap_file_newkey (pObj, key, & sNewMap) < 0 ||
+                    filemap_file_adddatamap (pObj, key, & sNewMap) < 0)
+            {
+                _error ("set new map failed\n");
+                return -1;
+            }
+        }
+
+        return 1;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief 删除一项
+ * @return 成功返回1，元素不存在返回0，失败返回-1
+ */
+static int filemap_file_deleteitem(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key)
+{
+    /**
+     * 如果该项存在，则替换，否则
+     * 找出要放的位置，然后记录索引
+     */
+
+    FILEMAP_DATAMAP sDataMap = {};
+    int ret = filemap_file_getdatamap (pObj, key, & sDataMap);
+
+    if (ret < 0)
+    {
+        _error ("get data map failed\n");
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        _error ("not exist\n");
+        return 0;
+    }
+    else if (ret == 1)
+    {
+        if (1 || "union operation")
+        {
+            if (filemap_file_deldatamap (pObj, key) < 0)
+            {
+                _error ("delete data map failed\n");
+                return -1;
+            }
+        }
+        return 1;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief 分配借用状态表
+ * @note 调用者持有借用锁
+ */
+static int filemap_pin_init (FILEMAP_OBJ *pObj)
+{
+    if (pObj->pnPinCount != NULL)
+    {
+        return 0;
+    }
+
+    int *pnPinCount = (int*)calloc (pObj->nMaxFileNum, sizeof(int));
+    char *pbFreePending = (char*)calloc (pObj->nMaxFileNum, sizeof(char));
+    if (NULL == pnPinCount || NULL == pbFreePending)
+    {
+        _error ("calloc failed\n");
+        free (pnPinCount);
+        free (pbFreePending);
+        return -1;
+    }
+
+    pObj->pnPinCount = pnPinCount;
+    pObj->pbFreePending = pbFreePending;
+
+    return 0;
+}
+
+/**
+ * @return 数据项正被借用返回1，否则返回0
+ */
+static int filemap_pin_ispinned (FILEMAP_OBJ *pObj, int nIndex)
+{
+    int bPinned = 0;
+
+    pthread_mutex_lock (& pObj->mutex_pin);
+    if (pObj->pnPinCount != NULL && nIndex >= 0 && nIndex < pObj->nMaxFileNum)
+    {
+        bPinned = (pObj->pnPinCount[nIndex] > 0 ? 1 : 0);
+    }
+    pthread_mutex_unlock (& pObj->mutex_pin);
+
+    return bPinned;
+}
+
+/**
+ * @brief 释放数据段中的一项
+ * @note 若该项正被借用，则推迟到归还时释放
+ */
+static int filemap_file_freedataslot (FILEMAP_OBJ *pObj, int nIndex)
+{
+    if (pObj->nHeapUnitNum > 0)
+    { /* 没有借用状态 */
+        return filemap_freelist_push (pObj, FILEMAP_FREELIST_HEAP, nIndex);
+    }
+
+    int bPinned = 0;
+
+    pthread_mutex_lock (& pObj->mutex_pin);
+    if (pObj->pnPinCount != NULL && nIndex >= 0 && nIndex < pObj->nMaxFileNum)
+    {
+        bPinned = (pObj->pnPinCount[nIndex] > 0 ? 1 : 0);
+        pObj->pbFreePending[nIndex] = bPinned;
+    }
+    pthread_mutex_unlock (& pObj->mutex_pin);
+
+    if (bPinned)
+    {
+        return 0;
+    }
+
+    return filemap_freelist_push (pObj, FILEMAP_FREELIST_DATA, nIndex);
+}
+
+/**
+ * @brief 获取数据段的元素在映射中的地址
+ * @note 仅映射方式下可用
+ */
+static int filemap_file_getdatasegaddr (FILEMAP_OBJ *pObj, int nIndex, const FILEMAP_SECTION_DATA_ELEMENT **ppElem)
+{
+    if (nIndex >= pObj->nMaxFileNum || nIndex < 0)
+    {
+        _error ("nIndex invalid, <%d,%d>\n", nIndex, pObj->nMaxFileNum);
+        return -1;
+    }
+
+    const long long llDataPos = filemap_data_getpos (pObj, nIndex);
+    const int nDataSize = sizeof(FILEMAP_SECTION_DATA_ELEMENT);
+
+    void *pAddr = NULL;
+    if (mem2file_getaddr (pObj->hMem2File, llDataPos, nDataSize, &pAddr) < 0)
+    {
+        return -1;
+    }
+
+    *ppElem = (const FILEMAP_SECTION_DATA_ELEMENT*)pAddr;
+    return 0;
+}
+
+/**
+ * @brief 借用一项，映射方式下直接返回数据段中的地址，否则返回拷贝
+ * @return 成功返回0，否则返回-1
+ */
+static int filemap_file_acquireitem (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const FILEMAP_VALUE **ppValue)
+{
+    /**
+     * 多进程共享方式下，其他进程不知道借用状态，只能借出拷贝；
+     * 变长方式下值的长度不一定是sizeof(FILEMAP_VALUE)，也只能借出拷贝
+     */
+    const int bBorrowAddr = (pObj->nFlags & FILEMAP_FLAG_MMAP) && NULL == pObj->psShared && 0 == pObj->nHeapUnitNum;
+
+    FILEMAP_DATAMAP map = {};
+    int ret = filemap_file_getdatamap (pObj, key, & map);
+    if (ret < 0)
+    {
+        _error ("get data index failed\n");
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        return -1;
+    }
+
+    if (bBorrowAddr)
+    {
+        const FILEMAP_SECTION_DATA_ELEMENT *pElem = NULL;
+        if (filemap_file_getdatasegaddr (pObj, map.nIndex, &pElem) < 0)
+        {
+            _error ("get data element addr failed\n");
+            return -1;
+        }
+
+        *ppValue = & pElem->value;
+    }
+    else 
+    {
+        FILEMAP_BORROWED_COPY *pCopy = (FILEMAP_BORROWED_COPY*)malloc (sizeof(FILEMAP_BORROWED_COPY));
+        if (NULL == pCopy)
+        {
+            _error ("malloc failed\n");
+            return -1;
+        }
+
+        if (pObj->nHeapUnitNum > 0)
+        {
+            memset (& pCopy->value, 0, sizeof(pCopy->value));
+            ret = filemap_heap_getvalue (pObj, map.nIndex, & pCopy->value, sizeof(pCopy->value), NULL);
+        }
+        else 
+        {
+            ret = filemap_file_getdatasegitem (pObj, map.nIndex, (FILEMAP_SECTION_DATA_ELEMENT*)& pCopy->value);
+        }
+
+        if (ret < 0)
+        {
+            _error ("get data element failed\n");
+            free (pCopy);
+            return -1;
+        }
+
+        pCopy->nIndex = map.nIndex;
+        *ppValue = & pCopy->value;
+    }
+
+    if (pObj->psShared != NULL || pObj->nHeapUnitNum > 0)
+    { /* 拷贝不受修改和删除影响，不需要记录借用状态 */
+        return 0;
+    }
+
+    pthread_mutex_lock (& pObj->mutex_pin);
+    ret = filemap_pin_init (pObj);
+    if (0 == ret)
+    {
+        pObj->pnPinCount[map.nIndex] += 1;
+    }
+    pthread_mutex_unlock (& pObj->mutex_pin);
+
+    if (ret < 0)
+    {
+        _error ("init pin failed\n");
+        if (! bBorrowAddr)
+        {
+            free ((char*)*ppValue - offsetof(FILEMAP_BORROWED_COPY, value));
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 归还借用的项，若该项在借用期间被删除或修改，则释放原位置
+ */
+static int filemap_file_releaseitem (FILEMAP_OBJ *pObj, const FILEMAP_VALUE *pValue)
+{
+    if (NULL == pValue)
+    {
+        _error ("release invalid value\n");
+        return -1;
+    }
+
+    int nIndex = INDEX_NULL;
+
+    if ((pObj->nFlags & FILEMAP_FLAG_MMAP) && NULL == pObj->psShared && 0 == pObj->nHeapUnitNum)
+    {
+        /* 扩容后数据段分为多个区域，借出的地址可能在扩大之前的映射中 */
+        long long llPos = 0;
+        if (mem2file_getpos (pObj->hMem2File, pValue, &llPos) < 0)
+        {
+            _error ("value not borrowed, p=%p\n", pValue);
+            return -1;
+        }
+
+        const FILEMAP_GLOBAL_MAP *psMap = & pObj->sGMap;
+        for (int k = 0; k < psMap->nExtentNum; ++k)
+        {
+            const FILEMAP_SEGMENT *psSeg = & psMap->asExtent[k].seg_data.seg;
+            const long long llOffset = llPos - psSeg->pos;
+            if (llOffset >= 0 && llOffset < psSeg->size && 0 == llOffset % psMap->nDataStride)
+            {
+                nIndex = psMap->asExtent[k].nSlotBegin + (int)(llOffset / psMap->nDataStride);
+                break;
+            }
+        }
+
+        if (INDEX_NULL == nIndex)
+        {
+            _error ("value not borrowed, p=%p\n", pValue);
+            return -1;
+        }
+    }
+    else 
+    {
+        FILEMAP_BORROWED_COPY *pCopy = (FILEMAP_BORROWED_COPY*)
+                    ((char*)pValue - offsetof(FILEMAP_BORROWED_COPY, value));
+        nIndex = pCopy->nIndex;
+        free (pCopy);
+
+        if (pObj->psShared != NULL || pObj->nHeapUnitNum > 0)
+        { /* 没有记录借用状态 */
+            return 0;
+        }
+    }
+
+    int bBorrowed = 0;
+    int bFreePending = 0;
+
+    pthread_mutex_lock (& pObj->mutex_pin);
+    if (pObj->pnPinCount != NULL && nIndex >= 0 && nIndex < pObj->nMaxFileNum &&
+            pObj->pnPinCount[nIndex] > 0)
+    {
+        bBorrowed = 1;
+        pObj->pnPinCount[nIndex] -= 1;
+        bFreePending = (0 == pObj->pnPinCount[nIndex] && pObj->pbFreePending[nIndex]);
+    }
+    pthread_mutex_unlock (& pObj->mutex_pin);
+
+    if (! bBorrowed)
+    {
+        _error ("value not borrowed, index=%d\n", nIndex);
+        return -1;
+    }
+
+    if (bFreePending)
+    { /* 借用期间被删除或修改过，该项已不在索引中，不会再被借出 */
+        if (filemap_file_freedataslot (pObj, nIndex) < 0)
+        {
+            _error ("free data slot failed\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 读取一项的值中的一段
+ * @return 成功返回0，不存在或失败返回-1
+ */
+static int filemap_file_getrange(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int nOffset, void *pData, int nSize)
+{
+    FILEMAP_DATAMAP map = {};
+    int ret = filemap_file_getdatamap (pObj, key, & map);
+    if (ret < 0)
+    {
+        _error ("get data index failed\n");
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        return -1;
+    }
+
+    if (pObj->nHeapUnitNum > 0)
+    {
+        return filemap_heap_getrange (pObj, map.nIndex, nOffset, pData, nSize);
+    }
+
+    if (filemap_file_getdatasegrange (pObj, map.nIndex, nOffset, pData, nSize) < 0)
+    {
+        _error ("get data range failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 修改一项的值中的一段
+ * @return 成功返回0，不存在或失败返回-1
+ */
+static int filemap_file_setrange(FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int nOffset, const void *pData, int nSize)
+{
+    FILEMAP_DATAMAP map = {};
+    int ret = filemap_file_getdatamap (pObj, key, & map);
+    if (ret < 0)
+    {
+        _error ("get data index failed\n");
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        return -1;
+    }
+
+    if (pObj->nHeapUnitNum > 0)
+    { /* 借出的都是拷贝，直接修改 */
+        return filemap_heap_setrange (pObj, map.nIndex, nOffset, pData, nSize);
+    }
+
+    if (filemap_pin_ispinned (pObj, map.nIndex))
+    { /* 正被借用，则整项改写，由setitem写到新的位置 */
+        FILEMAP_SECTION_DATA_ELEMENT sEle = {};
+        if (filemap_file_getdatasegitem (pObj, map.nIndex, &sEle) < 0)
+        {
+            _error ("get data element failed\n");
+            return -1;
+        }
+
+        if (nOffset < 0 || nSize < 0 || nOffset + nSize > (int)sizeof(sEle))
+        {
+            _error ("range invalid, <offset=%d,size=%d>\n", nOffset, nSize);
+            return -1;
+        }
+
+        memcpy ((char*)&sEle + nOffset, pData, nSize);
+
+        return filemap_file_setitem (pObj, key, &sEle.value) == 1 ? 0 : -1;
+    }
+
+    if (filemap_file_setdatasegrange (pObj, map.nIndex, nOffset, pData, nSize) < 0)
+    {
+        _error ("set data range failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 读取一项的值，最多拷贝@nSize字节，@pnLen返回值的长度
+ * @return 成功返回0，不存在或失败返回-1
+ */
+static int filemap_file_getvalue (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, void *pData, int nSize, int *pnLen)
+{
+    if (nSize < 0)
+    {
+        _error ("size invalid, size=%d\n", nSize);
+        return -1;
+    }
+
+    FILEMAP_DATAMAP map = {};
+    int ret = filemap_file_getdatamap (pObj, key, & map);
+    if (ret < 0)
+    {
+        _error ("get data index failed\n");
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        return -1;
+    }
+
+    if (pObj->nHeapUnitNum > 0)
+    {
+        return filemap_heap_getvalue (pObj, map.nIndex, pData, nSize, pnLen);
+    }
+
+    const int nLen = sizeof(FILEMAP_VALUE);
+    if (filemap_file_getdatasegrange (pObj, map.nIndex, 0, pData, nLen < nSize ? nLen : nSize) < 0)
+    {
+        _error ("get data range failed\n");
+        return -1;
+    }
+
+    if (pnLen != NULL)
+    {
+        *pnLen = nLen;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 记录一项的值，若存在，则替换，若不存在，则新增
+ * @return 成功返回1，出错返回-1，已满返回0
+ * @note 有存储区时，同一级内就地改写，否则写到新的块，再释放原来的块
+ */
+static int filemap_file_setvalue (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, const void *pData, int nLen)
+{
+    if (nLen < 0 || nLen > FILEMAP_VALUE_MAX)
+    {
+        _error ("len invalid, len=%d\n", nLen);
+        return -1;
+    }
+
+    if (0 == pObj->nHeapUnitNum)
+    { /* 固定大小方式，其余部分填0 */
+        if (nLen > (int)sizeof(FILEMAP_VALUE))
+        {
+            _error ("value too large, len=%d\n", nLen);
+            return -1;
+        }
+
+        FILEMAP_SECTION_DATA_ELEMENT sEle = {};
+        memcpy (& sEle.value, pData, nLen);
+        return filemap_file_setitem (pObj, key, & sEle.value);
+    }
+
+    FILEMAP_DATAMAP sDataMap = {};
+    int ret = filemap_file_getdatamap (pObj, key, & sDataMap);
+    if (ret < 0)
+    {
+        _error ("getdatamap failed\n");
+        return -1;
+    }
+
+    const int bExist = (1 == ret);
+    FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+    if (bExist && filemap_heap_getchunk (pObj, sDataMap.nIndex, &sChunk) < 0)
+    {
+        return -1;
+    }
+
+    if (bExist && sChunk.nClass == filemap_heap_getclass (nLen))
+    { /* 同一级，就地改写 */
+        return filemap_heap_setvalue (pObj, sDataMap.nIndex, pData, nLen) < 0 ? -1 : 1;
+    }
+
+    int nUnit = FILEMAP_HEAP_NULL;
+    ret = filemap_heap_alloc (pObj, nLen, &nUnit);
+    if (ret < 0)
+    {
+        _error ("alloc chunk failed\n");
+        return -1;
+    }
+    else if (ret == 0)
+    { /* 已满，变短的值仍可以就地改写 */
+        if (bExist && sChunk.nClass > filemap_heap_getclass (nLen))
+        {
+            return filemap_heap_setvalue (pObj, sDataMap.nIndex, pData, nLen) < 0 ? -1 : 1;
+        }
+
+        _error ("heap full, len=%d\n", nLen);
+        return 0;
+    }
+
+    if (filemap_heap_setvalue (pObj, nUnit, pData, nLen) < 0)
+    {
+        _error ("set chunk failed\n");
+        return -1;
+    }
+
+    if (1 || "union operation")
+    {
+        FILEMAP_DATAMAP sNewMap = sDataMap;
+        if (! bExist)
+        {
+            sNewMap.bUsedFlag = 1;
+            sNewMap.nNextIndex = INDEX_NULL;
+            if (filemap_file_newkey (pObj, key, & sNewMap) < 0)
+            {
+                _error ("set new key failed\n");
+                return -1;
+            }
+        }
+        sNewMap.nIndex = nUnit;
+
+        if (filemap_file_adddatamap (pObj, key, & sNewMap) < 0)
+        {
+            _error ("set new map failed\n");
+            return -1;
+        }
+
+        if (bExist && filemap_file_freedataslot (pObj, sDataMap.nIndex) < 0)
+        {
+            _error ("free chunk failed\n");
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief 共享方式进入，与其他调用并行
+ */
+static int filemap_entrancecall_lock (FILEMAP_HANDLE hInstance)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    int ret = pthread_rwlock_rdlock (& pObj->rwlock_entrance_call);
+    if (ret != 0)
+    {
+        _error ("lock failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 独占方式进入，等待其他调用结束
+ */
+static int filemap_entrancecall_lockexclusive (FILEMAP_HANDLE hInstance)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    int ret = pthread_rwlock_wrlock (& pObj->rwlock_entrance_call);
+    if (ret != 0)
+    {
+        _error ("lock failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int filemap_entrancecall_unlock (FILEMAP_HANDLE hInstance)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    int ret = pthread_rwlock_unlock (& pObj->rwlock_entrance_call);
+    if (ret != 0)
+    {
+        _error ("lock failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief key在哈希表中的位置所在的段
+ */
+static int filemap_bucket_getlock (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key)
+{
+    return filemap_hashmap_getindex (pObj->nMaxFileNum, key->uHash) % FILEMAP_BUCKET_LOCK_NUM;
+}
+
+/**
+ * @brief 锁住key在哈希表中的位置所在的段
+ * @param bWrite 为1时独占，并将版本号改为奇数，否则共享
+ * @note key的哈希链表项和数据项只在该位置上访问，因此不同段的读写可以并行
+ */
+static int filemap_bucket_lock (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int bWrite)
+{
+    const int nLock = filemap_bucket_getlock (pObj, key);
+
+    int ret = 0;
+    if (pObj->psShared != NULL)
+    { /* 多进程共享方式下，与所有进程的写操作互斥 */
+        ret = filemap_shared_lock (pObj);
+    }
+    else 
+    {
+        ret = (bWrite ? pthread_rwlock_wrlock (& pObj->rwlock_bucket[nLock]) : 
+                        pthread_rwlock_rdlock (& pObj->rwlock_bucket[nLock]));
+    }
+    if (ret != 0)
+    {
+        _error ("lock failed\n");
+        return -1;
+    }
+
+    if (bWrite && FILEMAP_INDEX_OPEN == pObj->nIndexLayout && NULL == pObj->psShared)
+    { /* 多进程共享方式下写操作已经互斥 */
+        pthread_mutex_lock (& pObj->mutex_index);
+    }
+
+    if (bWrite)
+    { /* 之后的写入不会早于版本号的修改 */
+        __atomic_store_n (& pObj->puBucketSeq[nLock], pObj->puBucketSeq[nLock] + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence (__ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+static int filemap_bucket_unlock (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, int bWrite)
+{
+    const int nLock = filemap_bucket_getlock (pObj, key);
+
+    if (bWrite)
+    { /* 之前的写入不会晚于版本号的修改 */
+        __atomic_store_n (& pObj->puBucketSeq[nLock], pObj->puBucketSeq[nLock] + 1, __ATOMIC_RELEASE);
+    }
+
+    if (bWrite && FILEMAP_INDEX_OPEN == pObj->nIndexLayout && NULL == pObj->psShared)
+    {
+        pthread_mutex_unlock (& pObj->mutex_index);
+    }
+
+    int ret = 0;
+    if (pObj->psShared != NULL)
+    {
+        ret = filemap_shared_unlock (pObj);
+    }
+    else 
+    {
+        ret = pthread_rwlock_unlock (& pObj->rwlock_bucket[nLock]);
+    }
+    if (ret != 0)
+    {
+        _error ("unlock failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 以共享方式锁住@pbyteLock中标记的各段，按段的顺序加锁
+ * @note 写操作只锁住一个段，因此同时持有多个读锁不会死锁
+ */
+static int filemap_bucket_lockset (FILEMAP_OBJ *pObj, const unsigned char *pbyteLock)
+{
+    if (pObj->psShared != NULL)
+    { /* 多进程共享方式下只有一把锁 */
+        if (filemap_shared_lock (pObj) != 0)
+        {
+            _error ("lock failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < FILEMAP_BUCKET_LOCK_NUM; ++i)
+    {
+        if (pbyteLock[i] && pthread_rwlock_rdlock (& pObj->rwlock_bucket[i]) != 0)
+        {
+            _error ("lock failed, bucket=%d\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int filemap_bucket_unlockset (FILEMAP_OBJ *pObj, const unsigned char *pbyteLock)
+{
+    if (pObj->psShared != NULL)
+    {
+        if (filemap_shared_unlock (pObj) != 0)
+        {
+            _error ("unlock failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    for (int i = FILEMAP_BUCKET_LOCK_NUM - 1; i >= 0; --i)
+    {
+        if (pbyteLock[i] && pthread_rwlock_unlock (& pObj->rwlock_bucket[i]) != 0)
+        {
+            _error ("unlock failed, bucket=%d\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 不加锁读取前，取得扩容迁移的版本号和key所在段的版本号
+ * @return 成功返回0，正在写入返回-1
+ * @note 迁移在各项所在的段加锁，但扩容时段的划分会改变，因此同时检查扩容的版本号
+ */
+static int filemap_bucket_readbegin (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, unsigned long long *pullSeq)
+{
+    const unsigned int uGrowSeq = __atomic_load_n (& pObj->uGrowSeq, __ATOMIC_ACQUIRE);
+    if (uGrowSeq & 1)
+    {
+        return -1;
+    }
+
+    const int nLock = filemap_bucket_getlock (pObj, key);
+    const unsigned int uSeq = __atomic_load_n (& pObj->puBucketSeq[nLock], __ATOMIC_ACQUIRE);
+    if (uSeq & 1)
+    {
+        return -1;
+    }
+
+    *pullSeq = ((unsigned long long)uGrowSeq << 32) | uSeq;
+    return 0;
+}
+
+/**
+ * @brief 不加锁读取后，检查版本号是否变化
+ * @return 读取结果有效返回0，否则返回-1
+ */
+static int filemap_bucket_readend (FILEMAP_OBJ *pObj, const FILEMAP_KEYREF *key, unsigned long long ullSeq)
+{
+    /* 之前的读取不会晚于版本号的读取 */
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n (& pObj->uGrowSeq, __ATOMIC_RELAXED) != (unsigned int)(ullSeq >> 32))
+    {
+        return -1;
+    }
+
+    const int nLock = filemap_bucket_getlock (pObj, key);
+    return __atomic_load_n (& pObj->puBucketSeq[nLock], __ATOMIC_RELAXED) == (unsigned int)ullSeq ? 0 : -1;
+}
+
+/**
+ * @brief 多进程共享方式下打开文件前调用，与其他进程的初始化互斥
+ * @param [OUT] pbFirstProcess 没有其他进程正在使用该文件时为1
+ * @return 成功返回持有flock的文件描述符，失败返回-1
+ * @note 初始化期间持有第0字节的fcntl写锁，初始化结束后由filemap_shared_leave释放；
+ * flock在实例关闭前一直持有，用于判断是否有其他进程在使用
+ */
+static int filemap_shared_enter (const char *szFileName, int *pbFirstProcess)
+{
+    int fd = open (szFileName, O_RDWR | O_CREAT, 0664);
+    if (fd < 0)
+    {
+        _error ("open <%s> failed\n", szFileName);
+        return -1;
+    }
+
+    struct flock sLock = {};
+    sLock.l_type = F_WRLCK;
+    sLock.l_whence = SEEK_SET;
+    sLock.l_start = 0;
+    sLock.l_len = 1;
+    if (fcntl (fd, F_SETLKW, &sLock) < 0)
+    {
+        _error ("lock <%s> failed\n", szFileName);
+        close (fd);
+        return -1;
+    }
+
+    if (flock (fd, LOCK_EX | LOCK_NB) == 0)
+    { /* 没有其他进程 */
+        *pbFirstProcess = 1;
+    }
+    else 
+    {
+        *pbFirstProcess = 0;
+    }
+
+    /* 持有fcntl锁期间，其他进程不会尝试独占，转换不会被打断 */
+    if (flock (fd, LOCK_SH) < 0)
+    {
+        _error ("flock <%s> failed\n", szFileName);
+        close (fd);
+        return -1;
+    }
+
+    _info ("enter shared file<%s>, first=%d\n", szFileName, *pbFirstProcess);
+
+    return fd;
+}
+
+/**
+ * @brief 初始化结束，释放fcntl锁
+ */
+static int filemap_shared_leave (int fdShared)
+{
+    struct flock sLock = {};
+    sLock.l_type = F_UNLCK;
+    sLock.l_whence = SEEK_SET;
+    sLock.l_start = 0;
+    sLock.l_len = 1;
+    if (fcntl (fdShared, F_SETLK, &sLock) < 0)
+    {
+        _error ("unlock failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 连接定义段中的共享区，第一个进程负责初始化
+ */
+static int filemap_shared_attach (FILEMAP_OBJ *pObj, int bFirstProcess)
+{
+    void *pAddr = NULL;
+    if (mem2file_getaddr (pObj->hMem2File, pObj->sGMap.seg_def.seg.pos + FILEMAP_SHARED_POS,
+                sizeof(FILEMAP_SECTION_SHARED), &pAddr) < 0)
+    {
+        _error ("get shared seg addr failed\n");
+        return -1;
+    }
+
+    FILEMAP_SECTION_SHARED *psShared = (FILEMAP_SECTION_SHARED*)pAddr;
+
+    if (bFirstProcess)
+    { /* 上次使用的进程可能异常退出，锁和版本号都重新初始化 */
+        memset (psShared, 0, sizeof(*psShared));
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init (&attr);
+        pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+        int ret = pthread_mutex_init (& psShared->mutex_write, &attr);
+        pthread_mutexattr_destroy (&attr);
+        if (ret != 0)
+        {
+            _error ("init shared mutex failed\n");
+            return -1;
+        }
+
+        psShared->nMagic = FILEMAP_SHARED_MAGIC;
+    }
+    else if (psShared->nMagic != FILEMAP_SHARED_MAGIC)
+    {
+        _error ("shared seg not initialized, opened without FILEMAP_FLAG_SHARED?\n");
+        return -1;
+    }
+
+    pObj->psShared = psShared;
+    pObj->puBucketSeq = psShared->auBucketSeq;
+
+    return 0;
+}
+
+/**
+ * @brief 加共享区的写锁，若持有者已退出，则恢复后继续
+ */
+static int filemap_shared_lock (FILEMAP_OBJ *pObj)
+{
+    FILEMAP_SECTION_SHARED *psShared = pObj->psShared;
+
+    int ret = pthread_mutex_lock (& psShared->mutex_write);
+    if (EOWNERDEAD == ret)
+    { /* 持有者退出时可能正在写入，版本号停在奇数上 */
+        _error ("lock owner died, recover\n");
+        for (int i = 0; i < FILEMAP_BUCKET_LOCK_NUM; ++i)
+        {
+            const unsigned int uSeq = __atomic_load_n (& psShared->auBucketSeq[i], __ATOMIC_RELAXED);
+            if (uSeq & 1)
+            {
+                __atomic_store_n (& psShared->auBucketSeq[i], uSeq + 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        /* 持有者可能已写入日志但只修改了一部分索引，重做日志 */
+        int nRecordNum = 0;
+        if (pObj->fdWal >= 0 && filemap_wal_replay (pObj->fdWal, pObj->hMem2File, &nRecordNum) < 0)
+        {
+            _error ("replay wal failed\n");
+        }
+
+        ret = pthread_mutex_consistent (& psShared->mutex_write);
+    }
+
+    if (ret != 0)
+    {
+        _error ("lock shared mutex failed, ret=%d\n", ret);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int filemap_shared_unlock (FILEMAP_OBJ *pObj)
+{
+    if (pthread_mutex_unlock (& pObj->psShared->mutex_write) != 0)
+    {
+        _error ("unlock shared mutex failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 打开@szFileName对应的日志文件
+ * @param bCreate 为1时不存在则创建
+ * @return 成功返回文件描述符，不存在返回-1，失败返回-2
+ */
+static int filemap_wal_open (const char *szFileName, int bCreate)
+{
+    char szWalName[1024] = {};
+    if (snprintf (szWalName, sizeof(szWalName), "%s%s", szFileName, FILEMAP_WAL_SUFFIX) >= (int)sizeof(szWalName))
+    {
+        _error ("file name too long, <%s>\n", szFileName);
+        return -2;
+    }
+
+    int fd = open (szWalName, O_RDWR | O_APPEND | (bCreate ? O_CREAT : 0), 0664);
+    if (fd < 0)
+    {
+        if (ENOENT == errno && ! bCreate)
+        {
+            return -1;
+        }
+
+        _error ("open <%s> failed\n", szWalName);
+        return -2;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief 计算一条日志记录的校验和(FNV-1a)
+ */
+static unsigned int filemap_wal_checksum (const FILEMAP_WAL_RECORD_HEAD *psHead, const char *pBody, int nBodySize)
+{
+    FILEMAP_WAL_RECORD_HEAD sHead = *psHead;
+    sHead.uChecksum = 0;
+
+    unsigned int uHash = 2166136261u;
+    for (int i = 0; i < (int)sizeof(sHead); ++i)
+    {
+        uHash = (uHash ^ ((const unsigned char*)&sHead)[i]) * 16777619u;
+    }
+    for (int i = 0; i < nBodySize; ++i)
+    {
+        uHash = (uHash ^ (unsigned char)pBody[i]) * 16777619u;
+    }
+
+    return uHash;
+}
+
+/**
+ * @brief 按顺序重做日志中的全部完整记录，遇到不完整或校验失败的记录停止
+ * @param [OUT] pnRecordNum 重做的记录数
+ * @note 日志中的记录都是写入后的值，重复重做不影响结果
+ */
+static int filemap_wal_replay (int fdWal, MEM2FILE_HANDLE hMem2File, int *pnRecordNum)
+{
+    long long llFileSize = 0;
+    if (mem2file_size (hMem2File, &llFileSize) < 0)
+    {
+        _error ("get size failed\n");
+        return -1;
+    }
+
+    const off_t nWalSize = lseek (fdWal, 0, SEEK_END);
+    if (nWalSize < 0)
+    {
+        _error ("get wal size failed\n");
+        return -1;
+    }
+
+    char *pBody = NULL;
+    int nRecordNum = 0;
+    off_t nPos = 0;
+
+    while (nPos + (off_t)sizeof(FILEMAP_WAL_RECORD_HEAD) <= nWalSize)
+    {
+        FILEMAP_WAL_RECORD_HEAD sHead = {};
+        if (pread (fdWal, &sHead, sizeof(sHead), nPos) != sizeof(sHead))
+        {
+            break;
+        }
+
+        if ((sHead.uMagic != FILEMAP_WAL_MAGIC && sHead.uMagic != FILEMAP_WAL_MAGIC_V1) || sHead.nWriteNum <= 0 || sHead.nWriteNum > FILEMAP_WAL_WRITE_MAX ||
+                sHead.nDataSize <= 0 || sHead.nDataSize > FILEMAP_WAL_DATA_MAX)
+        {
+            break;
+        }
+
+        const int nWriteSize = (FILEMAP_WAL_MAGIC_V1 == sHead.uMagic ? 
+                    sizeof(FILEMAP_WAL_WRITE_V1) : sizeof(FILEMAP_WAL_WRITE)) * sHead.nWriteNum;
+        const int nBodySize = nWriteSize + sHead.nDataSize;
+        if (nPos + (off_t)sizeof(sHead) + nBodySize > nWalSize)
+        { /* 写了一半 */
+            break;
+        }
+
+        char *pBodyNew = (char*)realloc (pBody, nBodySize);
+        if (NULL == pBodyNew)
+        {
+            _error ("malloc failed\n");
+            free (pBody);
+            return -1;
+        }
+        pBody = pBodyNew;
+
+        if (pread (fdWal, pBody, nBodySize, nPos + sizeof(sHead)) != nBodySize ||
+                filemap_wal_checksum (&sHead, pBody, nBodySize) != sHead.uChecksum)
+        {
+            break;
+        }
+
+        FILEMAP_WAL_WRITE asWrite[FILEMAP_WAL_WRITE_MAX] = {};
+        for (int i = 0; i < sHead.nWriteNum; ++i)
+        {
+            if (FILEMAP_WAL_MAGIC_V1 == sHead.uMagic)
+            {
+                const FILEMAP_WAL_WRITE_V1 *psWriteV1 = (const FILEMAP_WAL_WRITE_V1*)pBody + i;
+                asWrite[i].llPos = psWriteV1->nPos;
+                asWrite[i].nSize = psWriteV1->nSize;
+            }
+            else 
+            {
+                memcpy (& asWrite[i], pBody + sizeof(FILEMAP_WAL_WRITE) * i, sizeof(FILEMAP_WAL_WRITE));
+            }
+        }
+        const FILEMAP_WAL_WRITE *psWrite = asWrite;
+        const char *pData = pBody + nWriteSize;
+
+        /* 先检查整条记录，避免只重做一部分 */
+        int bValid = 1;
+        int nDataOffset = 0;
+        for (int i = 0; i < sHead.nWriteNum; ++i)
+        {
+            if (psWrite[i].llPos < 0 || psWrite[i].nSize <= 0 || psWrite[i].llPos + psWrite[i].nSize > llFileSize ||
+                    nDataOffset + psWrite[i].nSize > sHead.nDataSize)
+            {
+                bValid = 0;
+                break;
+            }
+            nDataOffset += psWrite[i].nSize;
+        }
+        if (! bValid)
+        {
+            _error ("wal record invalid, pos=%ld\n", (long)nPos);
+            break;
+        }
+
+        nDataOffset = 0;
+        for (int i = 0; i < sHead.nWriteNum; ++i)
+        {
+            if (mem2file_setdata (hMem2File, psWrite[i].llPos, pData + nDataOffset, psWrite[i].nSize) < 0)
+            {
+                _error ("replay failed, pos=%lld\n", psWrite[i].llPos);
+                free (pBody);
+                return -1;
+            }
+            nDataOffset += psWrite[i].nSize;
+        }
+
+        nRecordNum += 1;
+        nPos += sizeof(sHead) + nBodySize;
+    }
+
+    free (pBody);
+
+    if (nPos < nWalSize)
+    {
+        _info ("wal tail dropped, <pos=%ld,size=%ld>\n", (long)nPos, (long)nWalSize);
+    }
+
+    *pnRecordNum = nRecordNum;
+    return 0;
+}
+
+/**
+ * @brief 将文件写磁盘，然后清空日志
+ * @note 调用者持有日志锁，且没有已写入日志但尚未写入文件的操作
+ */
+static int filemap_wal_checkpoint (FILEMAP_OBJ *pObj)
+{
+    if (mem2file_sync (pObj->hMem2File) < 0)
+    {
+        _error ("sync file failed\n");
+        return -1;
+    }
+
+    if (ftruncate (pObj->fdWal, 0) < 0)
+    {
+        _error ("truncate wal failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @return 本线程在@pObj上进行中的操作，没有返回NULL
+ */
+static FILEMAP_WAL_TXN *filemap_wal_gettxn (FILEMAP_OBJ *pObj)
+{
+    FILEMAP_WAL_TXN *pTxn = s_pWalTxn;
+    if (pTxn != NULL && pTxn->pObj == pObj)
+    {
+        return pTxn;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 开始一次操作，之后对索引的修改在提交时一起写入
+ * @note 调用者持有分段锁；没有打开日志时不做任何事
+ */
+static int filemap_wal_begin (FILEMAP_OBJ *pObj, FILEMAP_WAL_TXN *pTxn)
+{
+    if (pObj->fdWal < 0)
+    {
+        return 0;
+    }
+
+    pTxn->pObj = pObj;
+    pTxn->nWriteNum = 0;
+    pTxn->nDataSize = 0;
+    pTxn->nPopNum = 0;
+    pTxn->nPushNum = 0;
+
+    s_pWalTxn = pTxn;
+
+    return 0;
+}
+
+/**
+ * @brief 记录一次对索引的修改，同一位置的修改合并
+ */
+static int filemap_wal_record (FILEMAP_WAL_TXN *pTxn, long long llPos, const void *pData, int nSize)
+{
+    int nDataOffset = 0;
+    for (int i = 0; i < pTxn->nWriteNum; ++i)
+    {
+        if (pTxn->asWrite[i].llPos == llPos && pTxn->asWrite[i].nSize == nSize)
+        {
+            memcpy (pTxn->byteData + nDataOffset, pData, nSize);
+            return 0;
+        }
+        nDataOffset += pTxn->asWrite[i].nSize;
+    }
+
+    if (pTxn->nWriteNum >= FILEMAP_WAL_WRITE_MAX || pTxn->nDataSize + nSize > FILEMAP_WAL_DATA_MAX)
+    {
+        _error ("operation too large, <write=%d,size=%d>\n", pTxn->nWriteNum, pTxn->nDataSize + nSize);
+        return -1;
+    }
+
+    pTxn->asWrite[pTxn->nWriteNum].llPos = llPos;
+    pTxn->asWrite[pTxn->nWriteNum].nSize = nSize;
+    pTxn->asWrite[pTxn->nWriteNum].nReserved = 0;
+    pTxn->nWriteNum += 1;
+    memcpy (pTxn->byteData + pTxn->nDataSize, pData, nSize);
+    pTxn->nDataSize += nSize;
+
+    return 0;
+}
+
+/**
+ * @brief 将尚未提交的修改覆盖到读取的数据上
+ */
+static int filemap_wal_overlay (FILEMAP_WAL_TXN *pTxn, long long llPos, void *pData, int nSize)
+{
+    int nDataOffset = 0;
+    for (int i = 0; i < pTxn->nWriteNum; ++i)
+    {
+        const long long llWritePos = pTxn->asWrite[i].llPos;
+        const int nWriteSize = pTxn->asWrite[i].nSize;
+
+        const long long llBegin = (llWritePos > llPos ? llWritePos : llPos);
+        const long long llEnd = (llWritePos + nWriteSize < llPos + nSize ? llWritePos + nWriteSize : llPos + nSize);
+        if (llBegin < llEnd)
+        {
+            memcpy ((char*)pData + (llBegin - llPos), pTxn->byteData + nDataOffset + (llBegin - llWritePos), llEnd - llBegin);
+        }
+
+        nDataOffset += nWriteSize;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 提交一次操作：写日志，按持久化方式等待写磁盘，再写入文件，最后释放空位
+ * @note 写日志之前异常退出，操作不生效；之后异常退出，加载时重做。
+ * 只有FILEMAP_DURABILITY_GROUP方式等待日志写磁盘后才写入文件，其他方式掉电时没有这个保证
+ */
+static int filemap_wal_commit (FILEMAP_OBJ *pObj, FILEMAP_WAL_TXN *pTxn)
+{
+    if (NULL == filemap_wal_gettxn (pObj) || s_pWalTxn != pTxn)
+    {
+        return 0;
+    }
+
+    s_pWalTxn = NULL;
+
+    int bLogError = 0;
+    int bSyncError = 0;
+    int bError = 0;
+
+    if (pTxn->nWriteNum > 0)
+    {
+        const int nWriteSize = sizeof(FILEMAP_WAL_WRITE) * pTxn->nWriteNum;
+        const int nBodySize = nWriteSize + pTxn->nDataSize;
+        char byteRecord[sizeof(FILEMAP_WAL_RECORD_HEAD) + sizeof(pTxn->asWrite) + sizeof(pTxn->byteData)];
+
+        FILEMAP_WAL_RECORD_HEAD sHead = {};
+        sHead.uMagic = FILEMAP_WAL_MAGIC;
+        sHead.nWriteNum = pTxn->nWriteNum;
+        sHead.nDataSize = pTxn->nDataSize;
+
+        char *pBody = byteRecord + sizeof(sHead);
+        memcpy (pBody, pTxn->asWrite, nWriteSize);
+        memcpy (pBody + nWriteSize, pTxn->byteData, pTxn->nDataSize);
+        sHead.uChecksum = filemap_wal_checksum (&sHead, pBody, nBodySize);
+        memcpy (byteRecord, &sHead, sizeof(sHead));
+
+        const int nRecordSize = sizeof(sHead) + nBodySize;
+
+        pthread_mutex_lock (& pObj->mutex_sync);
+
+        if (write (pObj->fdWal, byteRecord, nRecordSize) != nRecordSize)
+        {
+            _error ("write wal failed\n");
+            bLogError = 1;
+        }
+        else 
+        {
+            pObj->nWalPending += 1;
+            pObj->ullSyncReq += 1;
+
+            /* 日志写磁盘之后才修改文件，掉电时不会只留下一部分修改 */
+            if (FILEMAP_DURABILITY_GROUP == pObj->nDurability && 
+                    filemap_sync_wait (pObj, pObj->ullSyncReq) < 0)
+            { /* 日志中已有记录，仍然写入文件 */
+                _error ("sync wal failed\n");
+                bSyncError = 1;
+            }
+        }
+
+        pthread_mutex_unlock (& pObj->mutex_sync);
+
+        /* 不同段的操作修改的位置不重叠，可以并行写入文件 */
+        int nDataOffset = 0;
+        for (int i = 0; i < pTxn->nWriteNum && 0 == bLogError; ++i)
+        {
+            if (filemap_file_setindexdata (pObj, pTxn->asWrite[i].llPos, 
+                        pTxn->byteData + nDataOffset, pTxn->asWrite[i].nSize) < 0)
+            { /* 日志已写入，加载时重做 */
+                _error ("apply failed, pos=%lld\n", pTxn->asWrite[i].llPos);
+                bError = 1;
+                break;
+            }
+            nDataOffset += pTxn->asWrite[i].nSize;
+        }
+
+        if (0 == bLogError)
+        {
+            pthread_mutex_lock (& pObj->mutex_sync);
+            pObj->nWalPending -= 1;
+            if (0 == pObj->nWalPending && 0 == bError && 
+                    lseek (pObj->fdWal, 0, SEEK_END) > FILEMAP_WAL_CHECKPOINT_SIZE)
+            {
+                filemap_wal_checkpoint (pObj);
+            }
+            pthread_mutex_unlock (& pObj->mutex_sync);
+        }
+    }
+
+    if (bLogError)
+    { /* 索引未修改，归还分配的空位 */
+        s_pWalTxn = pTxn;
+        filemap_wal_abort (pObj, pTxn);
+        return -1;
+    }
+
+    if (bError)
+    { /* 索引可能只修改了一部分，空位留到加载时重建 */
+        return -1;
+    }
+
+    for (int i = 0; i < pTxn->nPushNum; ++i)
+    {
+        if (filemap_freelist_push (pObj, pTxn->asPush[i].nWhich, pTxn->asPush[i].nIndex) < 0)
+        {
+            _error ("free slot failed, <which=%d,index=%d>\n", pTxn->asPush[i].nWhich, pTxn->asPush[i].nIndex);
+            bError = 1;
+        }
+    }
+
+    return (bError || bSyncError) ? -1 : 0;
+}
+
+/**
+ * @brief 放弃一次操作，对索引的修改不写入，分配的空位放回空位栈
+ */
+static int filemap_wal_abort (FILEMAP_OBJ *pObj, FILEMAP_WAL_TXN *pTxn)
+{
+    if (NULL == filemap_wal_gettxn (pObj) || s_pWalTxn != pTxn)
+    {
+        return 0;
+    }
+
+    s_pWalTxn = NULL;
+
+    for (int i = pTxn->nPopNum - 1; i >= 0; --i)
+    {
+        filemap_freelist_push (pObj, pTxn->asPop[i].nWhich, pTxn->asPop[i].nIndex);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 开始批量写入：之后对索引段和空位栈的修改只写入内存副本，并记录修改的范围，
+ * 结束时按位置排序、合并后写入文件
+ * @param bWhole 为1时不记录范围，结束时整个写入；用于修改遍布整个索引的情况
+ * @note 调用者独占实例；打开日志、映射方式或扩容迁移期间不推迟，每次修改直接写入文件
+ */
+static int filemap_batch_begin (FILEMAP_OBJ *pObj, FILEMAP_BATCH *psBatch, int bWhole)
+{
+    if (pObj->fdWal >= 0 || NULL == pObj->psIndexCache || pObj->bMigrating)
+    {
+        return 0;
+    }
+
+    psBatch->pObj = pObj;
+    psBatch->bWhole = bWhole;
+    psBatch->nRangeNum = 0;
+
+    s_pBatch = psBatch;
+
+    return 0;
+}
+
+/**
+ * @return 本线程在@pObj上进行中的批量写入，没有返回NULL
+ */
+static FILEMAP_BATCH *filemap_batch_get (FILEMAP_OBJ *pObj)
+{
+    FILEMAP_BATCH *psBatch = s_pBatch;
+    if (psBatch != NULL && psBatch->pObj == pObj)
+    {
+        return psBatch;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 记录一段已写入内存副本、尚未写入文件的范围，记录满时先写入文件
+ */
+static int filemap_batch_record (FILEMAP_BATCH *psBatch, long long llPos, int nSize)
+{
+    if (psBatch->bWhole)
+    {
+        return 0;
+    }
+
+    if (psBatch->nRangeNum >= FILEMAP_BATCH_RANGE_MAX && filemap_batch_flush (psBatch) < 0)
+    {
+        return -1;
+    }
+
+    psBatch->asRange[psBatch->nRangeNum].llPos = llPos;
+    psBatch->asRange[psBatch->nRangeNum].nSize = nSize;
+    psBatch->nRangeNum += 1;
+
+    return 0;
+}
+
+static int filemap_batch_rangecmp (const void *pA, const void *pB)
+{
+    const FILEMAP_BATCH_RANGE *psA = (const FILEMAP_BATCH_RANGE*)pA;
+    const FILEMAP_BATCH_RANGE *psB = (const FILEMAP_BATCH_RANGE*)pB;
+    return (psA->llPos > psB->llPos) - (psA->llPos < psB->llPos);
+}
+
+/**
+ * @brief 将记录的范围按位置排序，重叠或间隔很小的合并，从内存副本写入文件
+ * @note 间隔中的数据未被修改，与文件中相同，一起写入不影响结果
+ */
+static int filemap_batch_flush (FILEMAP_BATCH *psBatch)
+{
+    FILEMAP_OBJ *pObj = psBatch->pObj;
+
+    if (psBatch->bWhole)
+    {
+        const FILEMAP_SEG_CACHE *psCache[2] = {
+            pObj->psIndexCache,
+            pObj->psFreeListCache,
+        };
+
+        for (int i = 0; i < 2; ++i)
+        {
+            if (mem2file_setdata (pObj->hMem2File, psCache[i]->seg.pos, psCache[i]->byteData, psCache[i]->seg.size) < 0)
+            {
+                _error ("flush failed, <pos=%lld,size=%lld>\n", psCache[i]->seg.pos, psCache[i]->seg.size);
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    qsort (psBatch->asRange, psBatch->nRangeNum, sizeof(FILEMAP_BATCH_RANGE), filemap_batch_rangecmp);
+
+    int bError = 0;
+    for (int i = 0; i < psBatch->nRangeNum; )
+    {
+        const long long llBegin = psBatch->asRange[i].llPos;
+        long long llEnd = llBegin + psBatch->asRange[i].nSize;
+        const char *pCache = filemap_indexcache_find (pObj, llBegin, llEnd - llBegin);
+
+        int k = i + 1;
+        for ( ; k < psBatch->nRangeNum; ++k)
+        {
+            const long long llNextEnd = psBatch->asRange[k].llPos + psBatch->asRange[k].nSize;
+            if (psBatch->asRange[k].llPos > llEnd + FILEMAP_BATCH_GAP || 
+                    filemap_indexcache_find (pObj, llBegin, (llNextEnd > llEnd ? llNextEnd : llEnd) - llBegin) != pCache)
+            { /* 不能跨越不同的内存副本 */
+                break;
+            }
+            llEnd = (llNextEnd > llEnd ? llNextEnd : llEnd);
+        }
+
+        if (NULL == pCache || mem2file_setdata (pObj->hMem2File, llBegin, pCache, llEnd - llBegin) < 0)
+        {
+            _error ("flush failed, <pos=%lld,size=%lld>\n", llBegin, llEnd - llBegin);
+            bError = 1;
+        }
+
+        i = k;
+    }
+
+    psBatch->nRangeNum = 0;
+
+    return bError ? -1 : 0;
+}
+
+/**
+ * @brief 结束批量写入，将尚未写入的修改写入文件
+ */
+static int filemap_batch_end (FILEMAP_OBJ *pObj, FILEMAP_BATCH *psBatch)
+{
+    if (filemap_batch_get (pObj) != psBatch)
+    {
+        return 0;
+    }
+
+    s_pBatch = NULL;
+
+    return filemap_batch_flush (psBatch);
+}
+
+/**
+ * @brief 写磁盘：有日志时只写日志，否则写整个文件
+ */
+static int filemap_sync_file (FILEMAP_OBJ *pObj)
+{
+    if (pObj->fdWal >= 0)
+    {
+        if (fdatasync (pObj->fdWal) < 0)
+        {
+            _error ("sync wal failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    return mem2file_sync (pObj->hMem2File);
+}
+
+/**
+ * @brief 等待第@ullSeq个写操作写磁盘，没有线程在写磁盘时由本线程写，
+ * 期间到达的写操作等待下一次
+ * @note 调用者持有写磁盘锁，写磁盘期间释放
+ */
+static int filemap_sync_wait (FILEMAP_OBJ *pObj, unsigned long long ullSeq)
+{
+    while (pObj->ullSyncDone < ullSeq)
+    {
+        if (pObj->bSyncing)
+        {
+            pthread_cond_wait (& pObj->cond_sync, & pObj->mutex_sync);
+            continue;
+        }
+
+        const unsigned long long ullTarget = pObj->ullSyncReq;
+        pObj->bSyncing = 1;
+        pthread_mutex_unlock (& pObj->mutex_sync);
+
+        int ret = filemap_sync_file (pObj);
+
+        pthread_mutex_lock (& pObj->mutex_sync);
+        pObj->bSyncing = 0;
+        if (0 == ret && pObj->ullSyncDone < ullTarget)
+        {
+            pObj->ullSyncDone = ullTarget;
+        }
+        pthread_cond_broadcast (& pObj->cond_sync);
+
+        if (ret < 0)
+        { /* 其余等待者自己重试 */
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 没有日志时，写操作结束后按持久化方式记录或等待写磁盘
+ * @note 有日志时在提交中处理
+ */
+static int filemap_sync_afterwrite (FILEMAP_OBJ *pObj)
+{
+    if (pObj->fdWal >= 0 || FILEMAP_DURABILITY_NONE == pObj->nDurability)
+    {
+        return 0;
+    }
+
+    int ret = 0;
+
+    pthread_mutex_lock (& pObj->mutex_sync);
+    pObj->ullSyncReq += 1;
+    if (FILEMAP_DURABILITY_GROUP == pObj->nDurability)
+    {
+        ret = filemap_sync_wait (pObj, pObj->ullSyncReq);
+    }
+    pthread_mutex_unlock (& pObj->mutex_sync);
+
+    return ret;
+}
+
+/**
+ * @brief 后台写磁盘线程，每隔一段时间写一次有修改的内容
+ */
+static void *filemap_sync_thread (void *pArg)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)pArg;
+
+    pthread_mutex_lock (& pObj->mutex_sync);
+    while (! pObj->bSyncStop)
+    {
+        struct timespec ts = {};
+        clock_gettime (CLOCK_REALTIME, &ts);
+        ts.tv_sec += pObj->nSyncIntervalMs / 1000;
+        ts.tv_nsec += (long)(pObj->nSyncIntervalMs % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        while (! pObj->bSyncStop && 
+                pthread_cond_timedwait (& pObj->cond_sync, & pObj->mutex_sync, &ts) != ETIMEDOUT)
+        {
+            ;
+        }
+
+        if (! pObj->bSyncStop && pObj->ullSyncDone < pObj->ullSyncReq)
+        {
+            filemap_sync_wait (pObj, pObj->ullSyncReq);
+        }
+    }
+    pthread_mutex_unlock (& pObj->mutex_sync);
+
+    return NULL;
+}
+
+/**
+ * @brief 停止后台写磁盘线程
+ * @note 调用者独占入口锁
+ */
+static int filemap_sync_stopthread (FILEMAP_OBJ *pObj)
+{
+    if (! pObj->bSyncThread)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock (& pObj->mutex_sync);
+    pObj->bSyncStop = 1;
+    pthread_cond_broadcast (& pObj->cond_sync);
+    pthread_mutex_unlock (& pObj->mutex_sync);
+
+    pthread_join (pObj->thread_sync, NULL);
+    pObj->bSyncThread = 0;
+    pObj->bSyncStop = 0;
+
+    return 0;
+}
+
+/**
+ * @brief 修改持久化方式，之前未写磁盘的修改先写磁盘
+ * @note 调用者独占入口锁
+ */
+static int filemap_file_setdurability (FILEMAP_OBJ *pObj, int nMode, int nIntervalMs)
+{
+    if (nMode != FILEMAP_DURABILITY_NONE && nMode != FILEMAP_DURABILITY_PERIODIC && 
+            nMode != FILEMAP_DURABILITY_GROUP)
+    {
+        _error ("unknown durability, mode=%d\n", nMode);
+        return -1;
+    }
+
+    if (FILEMAP_DURABILITY_PERIODIC == nMode && nIntervalMs <= 0)
+    {
+        _error ("interval invalid, interval=%d\n", nIntervalMs);
+        return -1;
+    }
+
+    filemap_sync_stopthread (pObj);
+
+    pthread_mutex_lock (& pObj->mutex_sync);
+    int ret = filemap_sync_wait (pObj, pObj->ullSyncReq);
+    pObj->nDurability = nMode;
+    pObj->nSyncIntervalMs = nIntervalMs;
+    pthread_mutex_unlock (& pObj->mutex_sync);
+
+    if (FILEMAP_DURABILITY_PERIODIC == nMode)
+    {
+        if (pthread_create (& pObj->thread_sync, NULL, filemap_sync_thread, pObj) != 0)
+        {
+            _error ("create sync thread failed\n");
+            pObj->nDurability = FILEMAP_DURABILITY_GROUP; /* 退回到更可靠的方式 */
+            return -1;
+        }
+        pObj->bSyncThread = 1;
+    }
+
+    _info ("durability=%d,interval=%d\n", nMode, nIntervalMs);
+
+    return ret;
+}
+
+static int filemap_file_generateinfo (FILEMAP_OBJ *pObj, const char *szFileName)
+{
+    MEM2FILE_HANDLE hMem2File = pObj->hMem2File;
+    const int nMaxFileNum = pObj->nMaxFileNum;
+
+#ifndef DEBUG
+    return 0;
+#endif 
+
+    FILE *fp = fopen (szFileName, "w");
+
+    if (NULL == fp)
+    {
+        _error ("open <%s> failed\n", szFileName);
+        return -1;
+    }
+
+    if (1)
+    {
+        fprintf(fp, "filemapinfo: \n");
+        fprintf (fp, "{\n");
+        fprintf (fp, "  obj=%p\n", hMem2File);
+        fprintf (fp, "}\n\n");
+    }   
+    
+    const FILEMAP_GLOBAL_MAP sMap = pObj->sGMap;
+
+    /* 文件中的比特表在读写过程中不维护，先写回 */
+    filemap_bitmap_sync (pObj);
+
+    if (1)
+    { /* 文件基本信息 */
+        fprintf (fp, "fileinfo: \n");
+        fprintf (fp, "{\n");
+
+        long long llFileSize = 0;
+        int ret_size = mem2file_size (hMem2File, & llFileSize);
+        fprintf (fp, "  file size=%lld,ret=%d\n", llFileSize, ret_size);
+
+        FILEMAP_SECTION_DEF sDefSec = {};
+        int ret_getdefseg = filemap_get_defseg (hMem2File, & sDefSec);
+        fprintf (fp, "  version=<%s>,maxfilenum=%d,heapunitnum=%d,keyformat=%d,hashtype=%d,hashseed=%llx,layout=%d,align=%d,ret=%d\n",
+                        sDefSec.szVersion, sDefSec.nMaxFileNum, sDefSec.nHeapUnitNum, sDefSec.nKeyFormat, 
+                        sDefSec.nHashType, sDefSec.ullHashSeed, sDefSec.nIndexLayout, sDefSec.nDataAlign, ret_getdefseg);
+
+        fprintf (fp, "}\n\n");
+    }
+
+    if (1)
+    { /* 分区地图 */
+        fprintf (fp, "global_map:\n");
+        fprintf (fp, "{\n");
+        fprintf (fp, "  seg:[pos=%lld,size=%lld]\n", sMap.seg.pos, sMap.seg.size);
+        fprintf (fp, "  seg_def:\n");
+        fprintf (fp, "  {\n");
+        fprintf (fp, "    seg: [pos=%lld,size=%lld]\n",
+                        sMap.seg_def.seg.pos, 
+                        sMap.seg_def.seg.size);
+        fprintf (fp, "  }\n");
+        fprintf (fp, "  seg_index: \n");
+        fprintf (fp, "  {\n");
+        fprintf (fp, "    seg_bitmap_data:\n");
+        fprintf (fp, "    {\n");
+        fprintf (fp, "      seg: [pos=%lld,size=%lld]\n", 
+                        sMap.seg_index.seg_bitmap_data.seg.pos,
+                        sMap.seg_index.seg_bitmap_data.seg.size);
+        fprintf (fp, "    }\n");
+        fprintf (fp, "    seg_bitmap_hashlink:\n");
+        fprintf (fp, "    {\n");
+        fprintf (fp, "      seg: [pos=%lld,size=%lld]\n", 
+                        sMap.seg_index.seg_bitmap_hashlink.seg.pos,
+                        sMap.seg_index.seg_bitmap_hashlink.seg.size);
+        fprintf (fp, "    }\n");
+        fprintf (fp, "    seg_ctrl:\n");
+        fprintf (fp, "    {\n");
+        fprintf (fp, "      seg: [pos=%lld,size=%lld]\n",
+                        sMap.seg_index.seg_ctrl.seg.pos,
+                        sMap.seg_index.seg_ctrl.seg.size);
+        fprintf (fp, "    }\n");
+        fprintf (fp, "    seg_hashmap:\n");
+        fprintf (fp, "    {\n");
+        fprintf (fp, "      seg: [pos=%lld,size=%lld]\n",
+                        sMap.seg_index.seg_hashmap.seg.pos,
+                        sMap.seg_index.seg_hashmap.seg.size);
+        fprintf (fp, "    }\n");
+        fprintf (fp, "    seg_hashlink:\n");
+        fprintf (fp, "    {\n");
+        fprintf (fp, "       seg: [pos=%lld,size=%lld]\n",
+                        sMap.seg_index.seg_hashlink.seg.pos,
+                        sMap.seg_index.seg_hashlink.seg.size);
+        fprintf (fp, "    }\n");
+        fprintf (fp, "  }\n");
+        fprintf (fp, "  seg_data:\n");
+        fprintf (fp, "  {\n");
+        fprintf (fp, "    seg: [pos=%lld,size=%lld]\n", 
+                        sMap.seg_data.seg.pos,
+                        sMap.seg_data.seg.size);
+        fprintf (fp, "  }\n");
+        fprintf (fp, "  seg_key:\n");
+        fprintf (fp, "  {\n");
+        fprintf (fp, "    seg: [pos=%lld,size=%lld]\n", 
+                        sMap.seg_key.seg.pos,
+                        sMap.seg_key.seg.size);
+        fprintf (fp, "  }\n");
+        fprintf (fp, "  seg_freelist:\n");
+        fprintf (fp, "  {\n");
+        fprintf (fp, "    seg: [pos=%lld,size=%lld]\n", 
+                        sMap.seg_freelist.seg.pos,
+                        sMap.seg_freelist.seg.size);
+        fprintf (fp, "  }\n");
+        fprintf (fp, "}\n\n");
+    }
+
+    if (1)
+    { /* 扩容和迁移进度 */
+        FILEMAP_SECTION_DEF sDefSec = {};
+        FILEMAP_SECTION_MIGRATE_HEAD sMigrate = {};
+        int ret = filemap_get_defseg (hMem2File, & sDefSec);
+        if (0 == ret && sMap.seg_index.seg_migrate.seg.size > 0)
+        {
+            ret = filemap_file_getindexdata (pObj, sMap.seg_index.seg_migrate.seg.pos, &sMigrate, sizeof(sMigrate));
+        }
+
+        fprintf (fp, "grow: \n");
+        fprintf (fp, "{\n");
+        fprintf (fp, "  grow_num=%d,old_num=%d,migrating=%d,cursor=%d,ret=%d\n", 
+                        sDefSec.nGrowNum, pObj->nOldMaxFileNum, pObj->bMigrating, sMigrate.nCursor, ret);
+        for (int k = 0; k < sMap.nExtentNum; ++k)
+        {
+            fprintf (fp, "  extent[%d]: begin=%d,data=[pos=%lld,size=%lld],key=[pos=%lld,size=%lld]\n", k, 
+                            sMap.asExtent[k].nSlotBegin,
+                            sMap.asExtent[k].seg_data.seg.pos, sMap.asExtent[k].seg_data.seg.size,
+                            sMap.asExtent[k].seg_key.seg.pos, sMap.asExtent[k].seg_key.seg.size);
+        }
+        fprintf (fp, "}\n\n");
+    }
+
+    if (1)
+    { /* 空位栈 */
+        FILEMAP_SECTION_FREELIST_HEAD sHead = {};
+        int ret = filemap_file_getindexdata (pObj, sMap.seg_freelist.seg_head.seg.pos, 
+                        &sHead, sMap.seg_freelist.seg_head.seg.size);
+
+        fprintf (fp, "freelist: \n");
+        fprintf (fp, "{\n");
+        fprintf (fp, "  data_free=%d,hashlink_free=%d,key_free=%d,ret=%d\n", 
+                        sHead.nDataFreeNum, sHead.nHashlinkFreeNum, sHead.nKeyFreeNum, ret);
+        fprintf (fp, "}\n\n");
+    }
+
+    if (1)
+    { /* 数据位信息 */
+        fprintf (fp, "bitmap_data: \n");
+        fprintf (fp, "{\n");
+
+        const long long llBitmapPos = sMap.seg_index.seg_bitmap_data.seg.pos;
+        const int nBitmapSize = sMap.seg_index.seg_bitmap_data.seg.size;
+
+        for (int k = 0; ; ++k)
+        {
+            char byteBuffer[256] = {};
+
+            const long long llReadPos = llBitmapPos + sizeof(byteBuffer) * k;
+            if ( (llReadPos - llBitmapPos) > nBitmapSize)
+            {
+                _debug ("scan finished\n");
+                break;
+            }
+
+            const int nLeftSize = nBitmapSize - (llReadPos - llBitmapPos);
+            const int nReadSize = (nLeftSize > sizeof(byteBuffer) ? 
+                                        sizeof(byteBuffer) : nLeftSize);
+
+            int ret = mem2file_getdata(hMem2File, llReadPos, byteBuffer, nReadSize);
+            if (ret < 0)
+            {
+                _error ("get data failed\n");
+            }
+
+            for (int i = 0; i < nReadSize; ++i)
+            {
+                if ((i % 10) == 0)
+                {
+                    fprintf(fp, "  [%d-%d] ", i, i + 10);
+                }
+                int cTmp = (unsigned char)byteBuffer[i];
+
+                fprintf(fp, "%02X ", cTmp);
+
+                if ((i + 1) % 10 == 0)
+                {
+                    fprintf(fp, "\n");
+                }
+            }
+
+            fprintf (fp, "\n}\n\n");
+        }
+    }
+
+    if (1)
+    { /* 数据链表位信息 */
+        fprintf (fp, "bitmap_hashlink: \n");
+        fprintf (fp, "{\n");
+
+        const long long llBitmapPos = sMap.seg_index.seg_bitmap_hashlink.seg.pos;
+        const int nBitmapSize = sMap.seg_index.seg_bitmap_hashlink.seg.size;
+
+        for (int k = 0; ; ++k)
+        {
+            char byteBuffer[256] = {};
+
+            const long long llReadPos = llBitmapPos + sizeof(byteBuffer) * k;
+            if ( (llReadPos - llBitmapPos) > nBitmapSize)
+            {
+                _debug ("scan finished\n");
+                break;
+            }
+
+            const int nLeftSize = nBitmapSize - (llReadPos - llBitmapPos);
+            const int nReadSize = (nLeftSize > sizeof(byteBuffer) ? 
+                                        sizeof(byteBuffer) : nLeftSize);
+
+            int ret = mem2file_getdata(hMem2File, llReadPos, byteBuffer, nReadSize);
+            if (ret < 0)
+            {
+                _error ("get data failed\n");
+            }
+
+            for (int i = 0; i < nReadSize; ++i)
+            {
+                if ((i % 10) == 0)
+                {
+                    fprintf(fp, "  [%d-%d] ", i, i + 10);
+                }
+                int cTmp = (unsigned char)byteBuffer[i];
+
+                fprintf(fp, "%02X ", cTmp);
+
+                if ((i + 1) % 10 == 0)
+                {
+                    fprintf(fp, "\n");
+                }
+            }
+
+            fprintf (fp, "\n}\n\n");
+        }
+    }
+
+    if (1)
+    { /* 哈希映射表 */
+        fprintf (fp, "poshashmap:\n");
+        fprintf (fp, "{\n");
+
+        const int nMaxFileNumEx = filemap_get_poshashmap_num (nMaxFileNum);
+
+        for (int i = 0; i < nMaxFileNumEx; ++i)
+        {
+            FILEMAP_POSHASHMAP_ELEMENT sEle = {};
+            int ret = filemap_file_getposhashmapitem (pObj, i, & sEle);
+            if (ret < 0)
+            {
+                _error ("get poshashmap item failed\n");
+            }
+
+            /* hash取自索引项，不重新计算 */
+            const int nHashValue = filemap_hashmap_getindex (nMaxFileNum, filemap_node_gethash (pObj, & sEle.node));
+            unsigned char byteKey[FILEMAP_KEY_MAX] = {};
+            char szKey[FILEMAP_KEY_MAX * 4 + 1] = {};
+            if (filemap_file_getnodekey (pObj, & sEle.node, byteKey) == 0)
+            {
+                filemap_key_format (byteKey, sEle.node.nKeyLen, szKey, sizeof(szKey));
+            }
+
+            if (FILEMAP_INDEX_OPEN == pObj->nIndexLayout)
+            { /* 开放寻址方式下，hash是探测的起点，不一定是所在的位置 */
+                unsigned char byteCtrl = 0;
+                filemap_file_getindexdata (pObj, sMap.seg_index.seg_ctrl.seg.pos + i, &byteCtrl, 1);
+                fprintf (fp, "  [%d] used_flag=%d,key=%s,keylen=%d,hash=%d,index=%d,ctrl=%02X,ret=%d\n",
+                    i, sEle.node.bUsedFlag, szKey, sEle.node.nKeyLen, nHashValue, sEle.node.nIndex,
+                    byteCtrl, ret);
+                continue;
+            }
+
+            fprintf (fp, "  [%d] used_flag=%d,key=%s,keylen=%d,hash=%d,index=%d,next=%d,ret=%d\n",
+                i, sEle.node.bUsedFlag, szKey, sEle.node.nKeyLen, nHashValue, sEle.node.nIndex,
+                sEle.node.nNextIndex, ret);
+        }
+
+        fprintf (fp, "}\n\n");
+    }
+
+    if (FILEMAP_INDEX_CHAIN == pObj->nIndexLayout)
+    { /* 位置哈希链映射表，开放寻址方式下没有 */
+        fprintf(fp, "poshashlinkmap:\n");
+        fprintf (fp, "{\n");
+
+        for (int i = 0; i < nMaxFileNum; ++i)
+        {
+            FILEMAP_POSHASHLINKMAP_ELEMENT sEle = {};
+            int ret = filemap_file_getposhashlinkitem (pObj, i, & sEle);
+            if (ret < 0)
+            {
+                _error ("get pos hash link item failed\n");
+            }
+
+            /* hash取自索引项，不重新计算 */
+            const int nHashValue = filemap_hashmap_getindex (nMaxFileNum, filemap_node_gethash (pObj, & sEle.node));
+            unsigned char byteKey[FILEMAP_KEY_MAX] = {};
+            char szKey[FILEMAP_KEY_MAX * 4 + 1] = {};
+            if (filemap_file_getnodekey (pObj, & sEle.node, byteKey) == 0)
+            {
+                filemap_key_format (byteKey, sEle.node.nKeyLen, szKey, sizeof(szKey));
+            }
+
+            fprintf (fp, "  [%d] used_flag=%d,key=%s,keylen=%d,hash=%d,index=%d,next=%d,ret=%d\n",
+                i, sEle.node.bUsedFlag, szKey, sEle.node.nKeyLen, nHashValue, sEle.node.nIndex,
+                sEle.node.nNextIndex, ret);
+        }
+
+        fprintf (fp, "}\n\n");
+    }
+
+    if (pObj->nHeapUnitNum > 0)
+    { /* 存储区，各级空闲链表的长度 */
+        FILEMAP_SECTION_HEAP_HEAD sHead = {};
+        int ret = filemap_heap_gethead (pObj, &sHead);
+
+        fprintf (fp, "heap:\n");
+        fprintf (fp, "{\n");
+        fprintf (fp, "  unit=%d,top=%d,ret=%d\n", pObj->nHeapUnitNum, sHead.nTopUnit, ret);
+
+        for (int i = 0; i < FILEMAP_HEAP_CLASS_NUM; ++i)
+        {
+            int nFreeNum = 0;
+            for (int nUnit = sHead.anFreeHead[i]; FILEMAP_HEAP_NULL != nUnit && nFreeNum < pObj->nHeapUnitNum; ++nFreeNum)
+            {
+                FILEMAP_HEAP_CHUNK_HEAD sChunk = {};
+                if (filemap_heap_getchunk (pObj, nUnit, &sChunk) < 0)
+                {
+                    break;
+                }
+                nUnit = sChunk.nLen;
+            }
+
+            if (nFreeNum > 0)
+            {
+                fprintf (fp, "  [class=%d,unit=%d] free=%d\n", i, s_anHeapClassUnit[i], nFreeNum);
+            }
+        }
+
+        fprintf (fp, "}\n");
+    }
+    else 
+    { /* 数据段 */
+        fprintf (fp, "dataseg:\n");
+        fprintf (fp, "{\n");
+
+        for (int i = 0; i < nMaxFileNum; ++i)
+        {
+            FILEMAP_SECTION_DATA_ELEMENT sEle = {};
+            int ret = filemap_file_getdatasegitem (pObj, i, & sEle);
+            if (ret < 0)
+            {
+                _error ("get data at [%d] fail, break\n", i);
+                break;
+            }
+            char value[32] = {};
+            strncpy (value, sEle.value.byteData, sizeof(value) - 1);
+            fprintf (fp, "  [%d] value=%s...\n", i, value);
+        }
+
+        fprintf (fp, "}\n");
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * @brief 计算从@llPos开始的索引段中各部分的位置
+ * @param nPrevNum 扩容后的索引段为扩容前的数量，其后有迁移进度；否则为0
+ * @return 索引段的结束位置
+ */
+static long long filemap_getindexmap (const FILEMAP_SECTION_DEF *psDef, int nMaxFileNum, int nPrevNum, 
+                long long llPos, FILEMAP_INDEX_MAP *psMap)
+{
+    const int bBinaryKey = (FILEMAP_KEYFORMAT_STRING != psDef->nKeyFormat);
+    const int bOpen = (FILEMAP_INDEX_OPEN == psDef->nIndexLayout);
+    const int nNodeSize = (bBinaryKey ? sizeof(FILEMAP_BINARY_NODE) : sizeof(FILEMAP_STRING_NODE));
+    const long long llBegin = llPos;
+
+    /* 索引段 */
+    psMap->seg.pos = llPos;
+
+    /* 索引-数据段比特表 */
+    psMap->seg_bitmap_data.seg.pos = llPos;
+    psMap->seg_bitmap_data.seg.size = nMaxFileNum / 8 + (nMaxFileNum % 8 ? 1 : 0);
+
+    llPos += psMap->seg_bitmap_data.seg.size;
+
+    /* 索引-位置链表比特表 */
+    psMap->seg_bitmap_hashlink.seg.pos = llPos;
+    psMap->seg_bitmap_hashlink.seg.size = nMaxFileNum / 8 + (nMaxFileNum % 8 ? 1 : 0);
+
+    llPos += psMap->seg_bitmap_hashlink.seg.size;
+
+    /* 索引-开放寻址的控制字节，每个哈希表位置一个 */
+    psMap->seg_ctrl.seg.pos = llPos;
+    psMap->seg_ctrl.seg.size = (bOpen ? filemap_get_poshashmap_num (nMaxFileNum) : 0);
+
+    llPos += psMap->seg_ctrl.seg.size;
+
+    /* 索引-位置哈希表 */
+    psMap->seg_hashmap.seg.pos = llPos;
+    psMap->seg_hashmap.seg.size = (long long)filemap_get_poshashmap_num (nMaxFileNum) * nNodeSize;
+    
+    llPos += psMap->seg_hashmap.seg.size;
+
+    /* 索引-位置哈希链表 */
+    psMap->seg_hashlink.seg.pos = llPos;
+    psMap->seg_hashlink.seg.size = (bOpen ? 0 : (long long)nMaxFileNum * nNodeSize);
+    
+    llPos += psMap->seg_hashlink.seg.size;
+
+    /* 索引-迁移进度，旧哈希表每个位置一个标记 */
+    psMap->seg_migrate.seg.pos = llPos;
+    psMap->seg_migrate.seg.size = (nPrevNum > 0 ? 
+                    (int)sizeof(FILEMAP_SECTION_MIGRATE_HEAD) + filemap_get_poshashmap_num (nPrevNum) : 0);
+
+    llPos += psMap->seg_migrate.seg.size;
+
+    /* 索引段整体 */
+    psMap->seg.size = llPos - llBegin;
+
+    return llPos;
+}
+
+/**
+ * @brief 计算从@llPos开始的空位栈中各部分的位置
+ * @return 空位栈的结束位置
+ */
+static long long filemap_getfreelistmap (const FILEMAP_SECTION_DEF *psDef, int nMaxFileNum, 
+                long long llPos, FILEMAP_FREELIST_MAP *psMap)
+{
+    const int bBinaryKey = (FILEMAP_KEYFORMAT_STRING != psDef->nKeyFormat);
+    const long long llBegin = llPos;
+
+    /* 空位栈 */
+    psMap->seg.pos = llPos;
+
+    /* 空位栈-头部，字符串键格式下没有键段的计数 */
+    psMap->seg_head.seg.pos = llPos;
+    psMap->seg_head.seg.size = (bBinaryKey ? sizeof(FILEMAP_SECTION_FREELIST_HEAD) : 
+                    offsetof(FILEMAP_SECTION_FREELIST_HEAD, nKeyFreeNum));
+
+    llPos += psMap->seg_head.seg.size;
+
+    /* 空位栈-数据段 */
+    psMap->seg_stack_data.seg.pos = llPos;
+    psMap->seg_stack_data.seg.size = nMaxFileNum * sizeof(int);
+
+    llPos += psMap->seg_stack_data.seg.size;
+
+    /* 空位栈-位置哈希链表 */
+    psMap->seg_stack_hashlink.seg.pos = llPos;
+    psMap->seg_stack_hashlink.seg.size = nMaxFileNum * sizeof(int);
+
+    llPos += psMap->seg_stack_hashlink.seg.size;
+
+    /* 空位栈-键段 */
+    psMap->seg_stack_key.seg.pos = llPos;
+    psMap->seg_stack_key.seg.size = (bBinaryKey ? nMaxFileNum * sizeof(int) : 0);
+
+    llPos += psMap->seg_stack_key.seg.size;
+
+    /* 空位栈整体 */
+    psMap->seg.size = llPos - llBegin;
+
+    return llPos;
+}
+
+static int filemap_getsegmap (const FILEMAP_SECTION_DEF *psDef, FILEMAP_GLOBAL_MAP *psMap)
+{
+    const int bBinaryKey = (FILEMAP_KEYFORMAT_STRING != psDef->nKeyFormat);
+    const int bHeap = (psDef->nHeapUnitNum > 0);
+
+    if (psDef->nGrowNum < 0 || psDef->nGrowNum > FILEMAP_GROW_MAX)
+    {
+        _error ("grow num invalid, num=%d\n", psDef->nGrowNum);
+        return -1;
+    }
+    if (psDef->nMaxFileNum > FILEMAP_NUM_MAX)
+    {
+        _error ("num too large, num=%d\n", psDef->nMaxFileNum);
+        return -1;
+    }
+
+    /* 对齐时数据段的起始位置向上取整，每项占用的空间也向上取整，读写一项不会涉及相邻项所在的页 */
+    const int nAlign = psDef->nDataAlign;
+    if (nAlign < 0 || nAlign > FILEMAP_DATA_ALIGN_MAX || (nAlign & (nAlign - 1)) != 0)
+    {
+        _error ("data align invalid, align=%d\n", nAlign);
+        return -1;
+    }
+    psMap->nDataStride = (nAlign > 0 ? 
+                    (int)((sizeof(FILEMAP_SECTION_DATA_ELEMENT) + nAlign - 1) / nAlign * nAlign) : 
+                    (int)sizeof(FILEMAP_SECTION_DATA_ELEMENT));
+
+    /* 扩容前的区域按第一次扩容前的数量计算 */
+    const int nFirstNum = (psDef->nGrowNum > 0 ? psDef->anGrowFrom[0] : psDef->nMaxFileNum);
+    long long llPos = 0;
+
+    /* 整体 */
+    psMap->seg.pos = 0;
+
+    /* 定义段 */
+    filemap_getdefsegmap (& psMap->seg_def);
+
+    llPos = psMap->seg_def.seg.size + psMap->seg_def.seg.pos;
+
+    /* 索引段 */
+    llPos = filemap_getindexmap (psDef, nFirstNum, 0, llPos, & psMap->seg_index);
+
+    /* 数据段，有存储区时为存储区 */
+    const long long llDataSize = (bHeap ? 
+                    (long long)psDef->nHeapUnitNum * FILEMAP_HEAP_UNIT_SIZE :
+                    (long long)nFirstNum * psMap->nDataStride);
+    const long long llKeySize = (bBinaryKey ? (long long)nFirstNum * FILEMAP_KEY_MAX : 0);
+    if (nAlign > 0)
+    {
+        llPos = (llPos + nAlign - 1) / nAlign * nAlign;
+    }
+    psMap->seg_data.seg.pos = llPos;
+    psMap->seg_data.seg.size = llDataSize;
+
+    llPos += psMap->seg_data.seg.size;
+
+    /* 键段，每个长键占用FILEMAP_KEY_MAX字节 */
+    psMap->seg_key.seg.pos = llPos;
+    psMap->seg_key.seg.size = llKeySize;
+
+    llPos += psMap->seg_key.seg.size;
+
+    /* 空位栈 */
+    llPos = filemap_getfreelistmap (psDef, nFirstNum, llPos, & psMap->seg_freelist);
+
+    memset (& psMap->seg_index_old, 0, sizeof(psMap->seg_index_old));
+    psMap->nExtentNum = 1;
+    psMap->asExtent[0].nSlotBegin = 0;
+    psMap->asExtent[0].seg_data = psMap->seg_data;
+    psMap->asExtent[0].seg_key = psMap->seg_key;
+
+    /**
+     * 每次扩容依次追加：新的索引段、数据段和键段的扩展部分、新的空位栈；
+     * 有存储区时数据段不扩展
+     */
+    for (int k = 0; k < psDef->nGrowNum; ++k)
+    {
+        const int nPrevNum = psDef->anGrowFrom[k];
+        const int nNum = (k + 1 < psDef->nGrowNum ? psDef->anGrowFrom[k + 1] : psDef->nMaxFileNum);
+        if (nPrevNum <= 0 || nNum <= nPrevNum)
+        {
+            _error ("grow history invalid, <%d,%d->%d>\n", k, nPrevNum, nNum);
+            return -1;
+        }
+
+        FILEMAP_EXTENT_MAP *psExtent = & psMap->asExtent[k + 1];
+
+        psMap->seg_index_old = psMap->seg_index;
+        llPos = filemap_getindexmap (psDef, nNum, nPrevNum, llPos, & psMap->seg_index);
+
+        const long long llExtentDataSize = (bHeap ? 0 : 
+                    (long long)(nNum - nPrevNum) * psMap->nDataStride);
+        const long long llExtentKeySize = (bBinaryKey ? (long long)(nNum - nPrevNum) * FILEMAP_KEY_MAX : 0);
+        if (nAlign > 0 && llExtentDataSize > 0)
+        {
+            llPos = (llPos + nAlign - 1) / nAlign * nAlign;
+        }
+        psExtent->nSlotBegin = nPrevNum;
+        psExtent->seg_data.seg.pos = llPos;
+        psExtent->seg_data.seg.size = llExtentDataSize;
+
+        llPos += psExtent->seg_data.seg.size;
+
+        psExtent->seg_key.seg.pos = llPos;
+        psExtent->seg_key.seg.size = llExtentKeySize;
+
+        llPos += psExtent->seg_key.seg.size;
+
+        llPos = filemap_getfreelistmap (psDef, nNum, llPos, & psMap->seg_freelist);
+
+        psMap->nExtentNum = k + 2;
+    }
+
+    /* 整体；对齐时文件大小也取整，末尾的写入不会超出文件 */
+    if (nAlign > 0)
+    {
+        llPos = (llPos + nAlign - 1) / nAlign * nAlign;
+    }
+    psMap->seg.size = llPos;
+
+    /* 索引段和空位栈整体读写，文件中其余的位置可以超过2GB */
+    if (psMap->seg_index.seg.size > INT_MAX || psMap->seg_freelist.seg.size > INT_MAX)
+    {
+        _error ("index larger than 2GB, num too large, <num=%d,index=%lld,freelist=%lld>\n", 
+                    psDef->nMaxFileNum, psMap->seg_index.seg.size, psMap->seg_freelist.seg.size);
+        return -1;
+    }
+
+    return 0;
+}
+
+/************ GLOBAL FUNCS ************/
+
+/**
+ * 单进单出
+ */
+FILEMAP_HANDLE filemap_create (const char *szFileName, int nNum)
+{
+    return filemap_create_ex (szFileName, nNum, 0);
+}
+
+/**
+ * 单进单出
+ */
+FILEMAP_HANDLE filemap_create_ex (const char *szFileName, int nNum, int nFlags)
+{
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+
+    return filemap_create_opt (szFileName, nNum, &sOption);
+}
+
+/**
+ * 单进单出
+ */
+FILEMAP_HANDLE filemap_create_opt (const char *szFileName, int nNum, const FILEMAP_OPTION *psOption)
+{
+    int bError = 0;
+
+    FILEMAP_SECTION_DEF sDef = {};
+    sDef.nMaxFileNum = nNum;
+    sDef.nKeyFormat = FILEMAP_KEYFORMAT_BINARY;
+    sDef.nHashType = FILEMAP_HASH_WYHASH;
+
+    int nFlags = 0;
+    if (psOption != NULL)
+    {
+        nFlags = psOption->nFlags;
+
+        if (psOption->bStringKey)
+        { /* 旧版本的程序只能使用BKDR */
+            sDef.nKeyFormat = FILEMAP_KEYFORMAT_STRING;
+            sDef.nHashType = FILEMAP_HASH_BKDR;
+        }
+
+        if (psOption->nHashType < FILEMAP_HASH_DEFAULT || psOption->nHashType > FILEMAP_HASH_WYHASH ||
+                (psOption->bStringKey && FILEMAP_HASH_WYHASH == psOption->nHashType))
+        {
+            _error ("hash type invalid, type=%d,stringkey=%d\n", psOption->nHashType, psOption->bStringKey);
+            bError = 1;
+        }
+        else if (psOption->nHashType != FILEMAP_HASH_DEFAULT)
+        {
+            sDef.nHashType = psOption->nHashType;
+        }
+
+        if ((psOption->nIndexLayout != FILEMAP_INDEX_CHAIN && psOption->nIndexLayout != FILEMAP_INDEX_OPEN) ||
+                (psOption->bStringKey && FILEMAP_INDEX_OPEN == psOption->nIndexLayout))
+        {
+            _error ("index layout invalid, layout=%d,stringkey=%d\n", psOption->nIndexLayout, psOption->bStringKey);
+            bError = 1;
+        }
+        else 
+        {
+            sDef.nIndexLayout = psOption->nIndexLayout;
+        }
+
+        if (psOption->llValueHeapSize < 0 || psOption->llValueHeapSize > FILEMAP_HEAP_SIZE_MAX)
+        {
+            _error ("heap size invalid, size=%lld\n", psOption->llValueHeapSize);
+            bError = 1;
+        }
+        else if (psOption->llValueHeapSize > 0)
+        { /* 存储区头部另外占用单元 */
+            sDef.nHeapUnitNum = FILEMAP_HEAP_HEAD_UNIT_NUM + 
+                    (int)((psOption->llValueHeapSize + FILEMAP_HEAP_UNIT_SIZE - 1) / FILEMAP_HEAP_UNIT_SIZE);
+        }
+    }
+
+    if (nFlags & FILEMAP_FLAG_DIRECT)
+    { /* 新建的文件数据段按页对齐，已有文件保持不变 */
+        sDef.nDataAlign = FILEMAP_DIRECT_DATA_ALIGN;
+    }
+
+    if (FILEMAP_HASH_WYHASH == sDef.nHashType)
+    { /* 已有文件继续使用原来的种子 */
+        sDef.ullHashSeed = filemap_hash_newseed ();
+    }
+
+    /* 索引段超过2GB时在打开文件之前失败，已有文件不变 */
+    FILEMAP_GLOBAL_MAP sGMap = {};
+    if (0 == bError && filemap_getsegmap (&sDef, &sGMap) < 0)
+    {
+        _error ("num invalid, num=%d\n", nNum);
+        bError = 1;
+    }
+
+    if (0 == bError && (nFlags & FILEMAP_FLAG_MIGRATE))
+    { /* 数量或存储区大小不符时保留已有的项 */
+        if (filemap_migrate_file (szFileName, &sDef, psOption) < 0)
+        {
+            _error ("migrate file failed, <%s>\n", szFileName);
+            bError = 1;
+        }
+    }
+
+    FILEMAP_HANDLE hFileMap = NULL;
+    if (0 == bError)
+    {
+        hFileMap = filemap_init_file (szFileName, &sDef, nFlags); 
+        if (NULL == hFileMap)
+        {
+            _error ("init file failed\n");
+            bError = 1;
+        }
+    }
+
+    return hFileMap;
+}
+
+FILEMAP_HANDLE filemap_load (const char *szFileName)
+{
+    return filemap_load_ex (szFileName, 0);
+}
+
+FILEMAP_HANDLE filemap_load_ex (const char *szFileName, int nFlags)
+{
+    int bError = 0;
+
+    FILEMAP_HANDLE hFileMap = NULL;
+    if (0 == bError)
+    {
+        hFileMap = filemap_init_file (szFileName, NULL, nFlags); 
+        if (NULL == hFileMap)
+        {
+            _error ("load file failed\n");
+            bError = 1;
+        }
+    }
+
+    return hFileMap;
+}
+
+int filemap_close (FILEMAP_HANDLE hInstance)
+{
+    /* 等待进行中的调用结束，锁随对象一起销毁 */
+    filemap_entrancecall_lockexclusive (hInstance);
+    filemap_entrancecall_unlock (hInstance);
+    int ret = filemap_close_file (hInstance);
+
+    return ret;
+}
+
+int filemap_existitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key)
+{
+    return filemap_existitem_bin (hInstance, key->szKey, (int)strnlen (key->szKey, sizeof(key->szKey)));
+}
+
+int filemap_existitem_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, pKey, nKeyLen, & sKey) < 0)
+    {
+        return 0;
+    }
+
+    /* 不加锁读取，期间有写入则重试 */
+    for (int i = 0; i < FILEMAP_OPTIMISTIC_RETRY_NUM; ++i)
+    {
+        unsigned long long ullSeq = 0;
+        if (filemap_bucket_readbegin (pObj, & sKey, &ullSeq) < 0)
+        {
+            continue;
+        }
+
+        int ret = filemap_file_existitem (pObj, & sKey);
+
+        if (filemap_bucket_readend (pObj, & sKey, ullSeq) == 0)
+        {
+            return ret;
+        }
+    }
+
+    /* 写入频繁，加锁读取 */
+    filemap_entrancecall_lock (hInstance);
+    filemap_bucket_lock (pObj, & sKey, 0);
+    int ret = filemap_file_existitem (pObj, & sKey);
+    filemap_bucket_unlock (pObj, & sKey, 0);
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_getitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKey, FILEMAP_VALUE *value)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, psKey->szKey, strnlen (psKey->szKey, sizeof(psKey->szKey)), & sKey) < 0)
+    {
+        return -1;
+    }
+
+    /* 不加锁读取，期间有写入则重试 */
+    for (int i = 0; i < FILEMAP_OPTIMISTIC_RETRY_NUM; ++i)
+    {
+        unsigned long long ullSeq = 0;
+        if (filemap_bucket_readbegin (pObj, & sKey, &ullSeq) < 0)
+        {
+            continue;
+        }
+
+        int ret = filemap_file_getitem (pObj, & sKey, value);
+
+        if (filemap_bucket_readend (pObj, & sKey, ullSeq) == 0)
+        {
+            return ret;
+        }
+    }
+
+    /* 写入频繁，加锁读取 */
+    filemap_entrancecall_lock (hInstance);
+    filemap_bucket_lock (pObj, & sKey, 0);
+    int ret = filemap_file_getitem (pObj, & sKey, value);
+    filemap_bucket_unlock (pObj, & sKey, 0);
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_multiget (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, FILEMAP_VALUE *pValues, int *pnStatus)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    if (nNum < 0 || (nNum > 0 && (NULL == psKeys || NULL == pValues || NULL == pnStatus)))
+    {
+        _error ("param invalid, num=%d\n", nNum);
+        return -1;
+    }
+
+    FILEMAP_MULTIGET_REQ *psReq = (FILEMAP_MULTIGET_REQ*)malloc (sizeof(FILEMAP_MULTIGET_REQ) * (nNum > 0 ? nNum : 1));
+    if (NULL == psReq)
+    {
+        _error ("malloc failed\n");
+        return -1;
+    }
+
+    /* 先计算所有key的hash值 */
+    int nReq = 0;
+    for (int i = 0; i < nNum; ++i)
+    {
+        pnStatus[i] = -1;
+
+        FILEMAP_MULTIGET_REQ *psOne = & psReq[nReq];
+        if (filemap_key_make (pObj, psKeys[i].szKey, strnlen (psKeys[i].szKey, sizeof(psKeys[i].szKey)), & psOne->sKey) < 0)
+        {
+            continue;
+        }
+        psOne->nKey = i;
+        psOne->nUnit = filemap_hashmap_getindex (pObj->nMaxFileNum, psOne->sKey.uHash);
+        psOne->llPos = 0;
+        nReq += 1;
+    }
+
+    /* 只进入一次，持有期间不会扩容，段的划分不变 */
+    filemap_entrancecall_lock (hInstance);
+    unsigned char abyteLock[FILEMAP_BUCKET_LOCK_NUM] = {};
+    for (int i = 0; i < nReq; ++i)
+    {
+        abyteLock[filemap_bucket_getlock (pObj, & psReq[i].sKey)] = 1;
+    }
+    filemap_bucket_lockset (pObj, abyteLock);
+    int ret = filemap_file_multiget (pObj, psReq, nReq, pValues, pnStatus);
+    filemap_bucket_unlockset (pObj, abyteLock);
+    filemap_entrancecall_unlock (hInstance);
+
+    free (psReq);
+
+    return ret;
+}
+
+int filemap_getrange (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKey, int nOffset, void *pData, int nSize)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, psKey->szKey, strnlen (psKey->szKey, sizeof(psKey->szKey)), & sKey) < 0)
+    {
+        return -1;
+    }
+
+    /* 不加锁读取，期间有写入则重试 */
+    for (int i = 0; i < FILEMAP_OPTIMISTIC_RETRY_NUM; ++i)
+    {
+        unsigned long long ullSeq = 0;
+        if (filemap_bucket_readbegin (pObj, & sKey, &ullSeq) < 0)
+        {
+            continue;
+        }
+
+        int ret = filemap_file_getrange (pObj, & sKey, nOffset, pData, nSize);
+
+        if (filemap_bucket_readend (pObj, & sKey, ullSeq) == 0)
+        {
+            return ret;
+        }
+    }
+
+    /* 写入频繁，加锁读取 */
+    filemap_entrancecall_lock (hInstance);
+    filemap_bucket_lock (pObj, & sKey, 0);
+    int ret = filemap_file_getrange (pObj, & sKey, nOffset, pData, nSize);
+    filemap_bucket_unlock (pObj, & sKey, 0);
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_setrange (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKey, int nOffset, const void *pData, int nSize)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    FILEMAP_WAL_TXN sTxn;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, psKey->szKey, strnlen (psKey->szKey, sizeof(psKey->szKey)), & sKey) < 0)
+    {
+        return -1;
+    }
+
+    filemap_entrancecall_lock (hInstance);
+    int ret = filemap_grow_migrate (pObj, & sKey);
+    filemap_bucket_lock (pObj, & sKey, 1);
+    filemap_wal_begin (pObj, &sTxn);
+    if (0 == ret)
+    {
+        ret = filemap_file_setrange (pObj, & sKey, nOffset, pData, nSize);
+    }
+    if (0 == ret)
+    {
+        ret = filemap_wal_commit (pObj, &sTxn);
+    }
+    else 
+    {
+        filemap_wal_abort (pObj, &sTxn);
+    }
+    filemap_bucket_unlock (pObj, & sKey, 1);
+    if (0 == ret)
+    {
+        ret = filemap_sync_afterwrite (pObj);
+    }
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_acquireitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKey, const FILEMAP_VALUE **ppValue)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, psKey->szKey, strnlen (psKey->szKey, sizeof(psKey->szKey)), & sKey) < 0)
+    {
+        return -1;
+    }
+
+    filemap_entrancecall_lock (hInstance);
+    filemap_bucket_lock (pObj, & sKey, 0);
+    int ret = filemap_file_acquireitem (pObj, & sKey, ppValue);
+    filemap_bucket_unlock (pObj, & sKey, 0);
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_releaseitem (FILEMAP_HANDLE hInstance, const FILEMAP_VALUE *pValue)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+
+    filemap_entrancecall_lock (hInstance);
+    int ret = filemap_file_releaseitem (pObj, pValue);
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_setitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKey, const FILEMAP_VALUE *value)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    FILEMAP_WAL_TXN sTxn;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, psKey->szKey, strnlen (psKey->szKey, sizeof(psKey->szKey)), & sKey) < 0)
+    {
+        return -1;
+    }
+
+    filemap_entrancecall_lock (hInstance);
+    int ret = filemap_grow_migrate (pObj, & sKey);
+    filemap_bucket_lock (pObj, & sKey, 1);
+    filemap_wal_begin (pObj, &sTxn);
+    if (0 == ret)
+    {
+        ret = filemap_file_setitem (pObj, & sKey, value);
+        ret = (ret == 1 ? 0 : -1);
+    }
+    if (0 == ret)
+    {
+        ret = filemap_wal_commit (pObj, &sTxn);
+    }
+    else 
+    {
+        filemap_wal_abort (pObj, &sTxn);
+    }
+    filemap_bucket_unlock (pObj, & sKey, 1);
+    if (0 == ret)
+    {
+        ret = filemap_sync_afterwrite (pObj);
+    }
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_setvalue (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, const void *pData, int nLen)
+{
+    return filemap_setvalue_bin (hInstance, key->szKey, (int)strnlen (key->szKey, sizeof(key->szKey)), pData, nLen);
+}
+
+int filemap_setvalue_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen, const void *pData, int nLen)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    FILEMAP_WAL_TXN sTxn;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, pKey, nKeyLen, & sKey) < 0)
+    {
+        return -1;
+    }
+
+    filemap_entrancecall_lock (hInstance);
+    int ret = filemap_grow_migrate (pObj, & sKey);
+    filemap_bucket_lock (pObj, & sKey, 1);
+    filemap_wal_begin (pObj, &sTxn);
+    if (0 == ret)
+    {
+        ret = filemap_file_setvalue (pObj, & sKey, pData, nLen);
+        ret = (ret == 1 ? 0 : -1);
+    }
+    if (0 == ret)
+    {
+        ret = filemap_wal_commit (pObj, &sTxn);
+    }
+    else 
+    {
+        filemap_wal_abort (pObj, &sTxn);
+    }
+    filemap_bucket_unlock (pObj, & sKey, 1);
+    if (0 == ret)
+    {
+        ret = filemap_sync_afterwrite (pObj);
+    }
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_getvalue (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, void *pData, int nSize, int *pnLen)
+{
+    return filemap_getvalue_bin (hInstance, key->szKey, (int)strnlen (key->szKey, sizeof(key->szKey)), pData, nSize, pnLen);
+}
+
+int filemap_getvalue_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen, void *pData, int nSize, int *pnLen)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, pKey, nKeyLen, & sKey) < 0)
+    {
+        return -1;
+    }
+
+    /* 不加锁读取，期间有写入则重试 */
+    for (int i = 0; i < FILEMAP_OPTIMISTIC_RETRY_NUM; ++i)
+    {
+        unsigned long long ullSeq = 0;
+        if (filemap_bucket_readbegin (pObj, & sKey, &ullSeq) < 0)
+        {
+            continue;
+        }
+
+        int ret = filemap_file_getvalue (pObj, & sKey, pData, nSize, pnLen);
+
+        if (filemap_bucket_readend (pObj, & sKey, ullSeq) == 0)
+        {
+            return ret;
+        }
+    }
+
+    /* 写入频繁，加锁读取 */
+    filemap_entrancecall_lock (hInstance);
+    filemap_bucket_lock (pObj, & sKey, 0);
+    int ret = filemap_file_getvalue (pObj, & sKey, pData, nSize, pnLen);
+    filemap_bucket_unlock (pObj, & sKey, 0);
+    filemap_entrancecall_unlock (hInstance);
+
+    return ret;
+}
+
+int filemap_deleteitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key)
+{
+    return filemap_deleteitem_bin (hInstance, key->szKey, (int)strnlen (key->szKey, sizeof(key->szKey)));
+}
+
+int filemap_deleteitem_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    FILEMAP_WAL_TXN sTxn;
+    FILEMAP_KEYREF sKey;
+    if (filemap_key_make (pObj, pKey, nKeyLen, & sKey) < 0)
+    {
+        return -1;
+    }
+
+    filemap_entrancecall_lock (hInstance);
+    int ret = filemap_grow_migrate (pObj, & sKey);
+    filemap_bucket_lock (pObj, & sKey, 1);
+    filemap_wal_begin (pObj, &sTxn);
+    if (0 == ret)
+    {
+        ret = filemap_file_deleteitem (pObj, & sKey);
+        ret = (ret == 1 ? 0 : -1);
+    }
+    if (0 == ret)
+    {
+        ret = filemap_wal_commit (pObj, &sTxn);
+    }
+    else 
+    {
+        filemap_wal_abort (pObj, &sTxn);
+    }
+    filemap_bucket_unlock (pObj, & sKey, 1);
+    if (0 == ret)
+    {
+        ret = filemap_sync_afterwrite (pObj);
+    }
+    filemap_entrancecall_unlock (hInstance);
 
-                fprintf(fp, "%02X ", cTmp);
+    return ret;
+}
 
-                if ((i + 1) % 10 == 0)
-                {
-                    fprintf(fp, "\n");
-                }
-            }
+/**
+ * @brief 独占实例依次写入或删除多个项，对索引的修改在结束时合并写入文件
+ * @param bDelete 为1时删除，否则写入@pValues
+ */
+static int filemap_multiwrite (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, 
+                const FILEMAP_VALUE *pValues, int *pnStatus, int bDelete)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    if (nNum < 0 || (nNum > 0 && (NULL == psKeys || (NULL == pValues && ! bDelete) || NULL == pnStatus)))
+    {
+        _error ("param invalid, num=%d\n", nNum);
+        return -1;
+    }
 
-            fprintf (fp, "\n}\n\n");
-        }
+    FILEMAP_BATCH *psBatch = (FILEMAP_BATCH*)malloc (sizeof(FILEMAP_BATCH));
+    if (NULL == psBatch)
+    {
+        _error ("malloc failed\n");
+        return -1;
     }
 
-    if (1)
-    { /* 哈希映射表 */
-        fprintf (fp, "poshashmap:\n");
-        fprintf (fp, "{\n");
+    /* 其他调用读取的文件内容与内存副本一致之前不能进入 */
+    filemap_entrancecall_lockexclusive (hInstance);
+    filemap_batch_begin (pObj, psBatch, 0);
 
-        const int nMaxFileNumEx = filemap_get_poshashmap_num (nMaxFileNum);
+    int nDone = 0;
+    for (int i = 0; i < nNum; ++i)
+    {
+        pnStatus[i] = -1;
 
-        for (int i = 0; i < nMaxFileNumEx; ++i)
+        FILEMAP_WAL_TXN sTxn;
+        FILEMAP_KEYREF sKey;
+        if (filemap_key_make (pObj, psKeys[i].szKey, strnlen (psKeys[i].szKey, sizeof(psKeys[i].szKey)), & sKey) < 0)
         {
-            FILEMAP_POSHASHMAP_ELEMENT sEle = {};
-            int ret = filemap_file_getposhashmapitem (hMem2File, nMaxFileNum, i, & sEle);
-            if (ret < 0)
-            {
-                _error ("get poshashmap item failed\n");
-            }
-
-            int nHashValue = filemap_hashmap_getindex (nMaxFileNum, & (sEle.node.key));
-
-            fprintf (fp, "  [%d] used_flag=%d,key=%s,hash=%d,index=%d,next=%d,ret=%d\n",
-                i, sEle.node.bUsedFlag, sEle.node.key.szKey, nHashValue, sEle.node.nIndex,
-                sEle.node.nNextIndex, ret);
+            continue;
         }
 
-        fprintf (fp, "}\n\n");
-    }
-
-    if (1)
-    { /* 位置哈希链映射表 */
-        fprintf(fp, "poshashlinkmap:\n");
-        fprintf (fp, "{\n");
-
-        for (int i = 0; i < nMaxFileNum; ++i)
+        int ret = filemap_grow_migrate (pObj, & sKey);
+        filemap_bucket_lock (pObj, & sKey, 1);
+        filemap_wal_begin (pObj, &sTxn);
+        if (0 == ret)
         {
-            FILEMAP_POSHASHLINKMAP_ELEMENT sEle = {};
-            int ret = filemap_file_getposhashlinkitem (hMem2File, nMaxFileNum, i, & sEle);
-            if (ret < 0)
-            {
-                _error ("get pos hash link item failed\n");
-            }
-
-            int nHashValue = filemap_hashmap_getindex (nMaxFileNum, & (sEle.node.key));
-
-            fprintf (fp, "  [%d] used_flag=%d,key=%s,hash=%d,index=%d,next=%d,ret=%d\n",
-                i, sEle.node.bUsedFlag, sEle.node.key.szKey, nHashValue, sEle.node.nIndex,
-                sEle.node.nNextIndex, ret);
+            ret = (bDelete ? filemap_file_deleteitem (pObj, & sKey) : filemap_file_setitem (pObj, & sKey, & pValues[i]));
+            ret = (ret == 1 ? 0 : -1);
+        }
+        if (0 == ret)
+        {
+            ret = filemap_wal_commit (pObj, &sTxn);
+        }
+        else 
+        {
+            filemap_wal_abort (pObj, &sTxn);
         }
+        filemap_bucket_unlock (pObj, & sKey, 1);
 
-        fprintf (fp, "}\n\n");
+        pnStatus[i] = ret;
+        nDone += (0 == ret ? 1 : 0);
     }
 
-    if (1)
-    { /* 数据段 */
-        fprintf (fp, "dataseg:\n");
-        fprintf (fp, "{\n");
+    int ret = filemap_batch_end (pObj, psBatch);
+    if (0 == ret && nDone > 0)
+    { /* 整批只写一次磁盘 */
+        ret = filemap_sync_afterwrite (pObj);
+    }
+    filemap_entrancecall_unlock (hInstance);
 
-        for (int i = 0; i < nMaxFileNum; ++i)
-        {
-            FILEMAP_SECTION_DATA_ELEMENT sEle = {};
-            int ret = filemap_file_getdatasegitem (hMem2File, nMaxFileNum, i, & sEle);
-            if (ret < 0)
-            {
-                _error ("get data at [%d] fail, break\n", i);
-                break;
-            }
-            char value[32] = {};
-            strncpy (value, sEle.value.byteData, sizeof(value) - 1);
-            fprintf (fp, "  [%d] value=%s...\n", i, value);
-        }
+    free (psBatch);
 
-        fprintf (fp, "}\n");
-    }
+    return ret < 0 ? -1 : nDone;
+}
 
-    fclose(fp);
-    return 0;
+int filemap_multiset (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, const FILEMAP_VALUE *pValues, int *pnStatus)
+{
+    return filemap_multiwrite (hInstance, psKeys, nNum, pValues, pnStatus, 0);
 }
 
-static int filemap_getsegmap (int nMaxFileNum, FILEMAP_GLOBAL_MAP *psMap)
+int filemap_multidelete (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, int *pnStatus)
 {
-    int nPosTmp = 0;
+    return filemap_multiwrite (hInstance, psKeys, nNum, NULL, pnStatus, 1);
+}
 
-    /* 整体 */
-    psMap->seg.pos = nPosTmp;
+int filemap_setdurability (FILEMAP_HANDLE hInstance, int nMode, int nIntervalMs)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
 
-    /* 定义段 */
-    filemap_getdefsegmap (& psMap->seg_def);
+    filemap_entrancecall_lockexclusive (hInstance);
+    int ret = filemap_file_setdurability (pObj, nMode, nIntervalMs);
+    filemap_entrancecall_unlock (hInstance);
 
-    nPosTmp = psMap->seg_def.seg.size + psMap->seg_def.seg.pos;
+    return ret;
+}
 
-    /* 索引段 */
-    psMap->seg_index.seg.pos = nPosTmp;
+int filemap_generateinfo (FILEMAP_HANDLE hInstance, const char *szFileName)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
 
-    /* 索引-数据段比特表 */
-    psMap->seg_index.seg_bitmap_data.seg.pos = nPosTmp;
-    psMap->seg_index.seg_bitmap_data.seg.size = nMaxFileNum / 8 + (nMaxFileNum % 8 ? 1 : 0);
+    filemap_entrancecall_lockexclusive (hInstance);
+    if (pObj->psShared != NULL)
+    { /* 其他进程的写操作 */
+        filemap_shared_lock (pObj);
+    }
+    /* 输出的索引以新的哈希表为准，先完成迁移 */
+    int ret = filemap_grow_finish (pObj);
+    if (0 == ret)
+    {
+        ret = filemap_file_generateinfo (pObj, szFileName);
+    }
+    if (pObj->psShared != NULL)
+    {
+        filemap_shared_unlock (pObj);
+    }
+    filemap_entrancecall_unlock (hInstance);
 
-    nPosTmp += psMap->seg_index.seg_bitmap_data.seg.size;
+    return ret;
+}
 
-    /* 索引-位置链表比特表 */
-    psMap->seg_index.seg_bitmap_hashlink.seg.pos = nPosTmp;
-    psMap->seg_index.seg_bitmap_hashlink.seg.size = nMaxFileNum / 8 + (nMaxFileNum % 8 ? 1 : 0);
+FILEMAP_ITER_HANDLE filemap_iter_open (FILEMAP_HANDLE hInstance)
+{
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
 
-    nPosTmp += psMap->seg_index.seg_bitmap_hashlink.seg.size;
+    FILEMAP_ITER *psIter = (FILEMAP_ITER*)calloc (1, sizeof(FILEMAP_ITER));
+    if (NULL == psIter)
+    {
+        _error ("calloc failed\n");
+        return NULL;
+    }
 
-    /* 索引-位置哈希表 */
-    psMap->seg_index.seg_hashmap.seg.pos = nPosTmp;
-    psMap->seg_index.seg_hashmap.seg.size = filemap_get_poshashmap_num (nMaxFileNum) *
-                    sizeof(FILEMAP_POSHASHMAP_ELEMENT);
-    
-    nPosTmp += psMap->seg_index.seg_hashmap.seg.size;
+    psIter->nBufferSize = FILEMAP_ITER_BUFFER_SIZE;
+    psIter->pBuffer = (char*)malloc (psIter->nBufferSize);
+    if (NULL == psIter->pBuffer || filemap_iter_load (pObj, psIter) < 0)
+    {
+        _error ("open iterator failed\n");
+        filemap_iter_close (psIter);
+        return NULL;
+    }
 
-    /* 索引-位置哈希链表 */
-    psMap->seg_index.seg_hashlink.seg.pos = nPosTmp;
-    psMap->seg_index.seg_hashlink.seg.size = nMaxFileNum * 
-                    sizeof(FILEMAP_POSHASHLINKMAP_ELEMENT);
-    
-    nPosTmp += psMap->seg_index.seg_hashlink.seg.size;
+    return psIter;
+}
 
-    /* 索引段整体 */
-    psMap->seg_index.seg.size = psMap->seg_index.seg_bitmap_data.seg.size + 
-                    psMap->seg_index.seg_bitmap_hashlink.seg.size +
-                    psMap->seg_index.seg_hashmap.seg.size +
-                    psMap->seg_index.seg_hashlink.seg.size;
+int filemap_iter_next (FILEMAP_ITER_HANDLE hIter, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen)
+{
+    FILEMAP_ITER *psIter = (FILEMAP_ITER*)hIter;
+    if (NULL == psIter || nSize < 0 || NULL == pKey || NULL == pnKeyLen)
+    {
+        _error ("param invalid\n");
+        return -1;
+    }
 
-    /* 数据段 */
-    psMap->seg_data.seg.pos = nPosTmp;
-    psMap->seg_data.seg.size = nMaxFileNum * sizeof(FILEMAP_SECTION_DATA_ELEMENT);
+    return filemap_iter_step (psIter, pKey, pnKeyLen, pData, nSize, pnLen);
+}
 
-    /* 整体 */
-    psMap->seg.size = psMap->seg_def.seg.size +
-                    psMap->seg_index.seg.size +
-                    psMap->seg_data.seg.size;
+int filemap_iter_close (FILEMAP_ITER_HANDLE hIter)
+{
+    FILEMAP_ITER *psIter = (FILEMAP_ITER*)hIter;
+    if (NULL == psIter)
+    {
+        return -1;
+    }
+
+    free (psIter->psEntry);
+    free (psIter->pBuffer);
+    free (psIter);
 
     return 0;
 }
 
-/************ GLOBAL FUNCS ************/
-
-/**
- * 单进单出
- */
-FILEMAP_HANDLE filemap_create (const char *szFileName, int nNum)
+int filemap_parallel_foreach (FILEMAP_HANDLE hInstance, int nThreadNum, 
+                int (*pfnCallback)(void *pCtx, const void *pKey, int nKeyLen, const void *pData, int nLen), void *pCtx)
 {
-    int bError = 0;
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    if (NULL == pfnCallback)
+    {
+        _error ("null callback\n");
+        return -1;
+    }
 
-    FILEMAP_HANDLE hFileMap = NULL;
-    if (0 == bError)
+    if (nThreadNum <= 0)
     {
-        hFileMap = filemap_init_file (szFileName, nNum); 
-        if (NULL == hFileMap)
-        {
-            _error ("init file failed\n");
-            bError = 1;
-        }
+        nThreadNum = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    }
+    if (nThreadNum <= 0 || nThreadNum > FILEMAP_FOREACH_THREAD_MAX)
+    {
+        nThreadNum = (nThreadNum <= 0 ? 1 : FILEMAP_FOREACH_THREAD_MAX);
     }
 
-    return hFileMap;
-}
+    FILEMAP_ITER sAll = {};
+    if (filemap_iter_load (pObj, &sAll) < 0)
+    {
+        _error ("load items failed\n");
+        free (sAll.psEntry);
+        return -1;
+    }
 
-FILEMAP_HANDLE filemap_load (const char *szFileName)
-{
-    int bError = 0;
+    if (nThreadNum > sAll.nEntryNum)
+    {
+        nThreadNum = (sAll.nEntryNum > 0 ? sAll.nEntryNum : 1);
+    }
 
-    FILEMAP_HANDLE hFileMap = NULL;
-    if (0 == bError)
+    FILEMAP_FOREACH_WORKER *psWorker = (FILEMAP_FOREACH_WORKER*)calloc (nThreadNum, sizeof(FILEMAP_FOREACH_WORKER));
+    if (NULL == psWorker)
     {
-        hFileMap = filemap_init_file (szFileName, -1); 
-        if (NULL == hFileMap)
+        _error ("calloc failed\n");
+        free (sAll.psEntry);
+        return -1;
+    }
+
+    /* 每个线程遍历文件中连续的一段 */
+    int bStop = 0;
+    int nStarted = 0;
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        const int nBegin = (int)((long long)sAll.nEntryNum * i / nThreadNum);
+        const int nEnd = (int)((long long)sAll.nEntryNum * (i + 1) / nThreadNum);
+
+        FILEMAP_ITER *psIter = & psWorker[i].sIter;
+        psIter->pObj = pObj;
+        psIter->nMaxFileNum = sAll.nMaxFileNum;
+        psIter->psEntry = sAll.psEntry + nBegin;
+        psIter->nEntryNum = nEnd - nBegin;
+        psIter->nBufferSize = FILEMAP_FOREACH_BUFFER_SIZE;
+        psIter->pBuffer = (char*)malloc (psIter->nBufferSize);
+        psWorker[i].pfnCallback = pfnCallback;
+        psWorker[i].pCtx = pCtx;
+        psWorker[i].pbStop = &bStop;
+
+        if (NULL == psIter->pBuffer || pthread_create (& psWorker[i].thread, NULL, filemap_foreach_thread, & psWorker[i]) != 0)
         {
-            _error ("load file failed\n");
-            bError = 1;
+            _error ("start thread failed, thread=%d\n", i);
+            psWorker[i].nResult = -1;
+            __atomic_store_n (&bStop, 1, __ATOMIC_RELAXED);
+            break;
         }
+        nStarted += 1;
     }
 
-    return hFileMap;
-}
+    int ret = 0;
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        if (i < nStarted)
+        {
+            pthread_join (psWorker[i].thread, NULL);
+        }
+        free (psWorker[i].sIter.pBuffer);
 
-int filemap_close (FILEMAP_HANDLE hInstance)
-{
-    filemap_entrancecall_lock (hInstance);
-    int ret = filemap_close_file (hInstance);
-    filemap_entrancecall_unlock (hInstance);
+        if (psWorker[i].nResult < 0)
+        {
+            ret = -1;
+        }
+        else if (psWorker[i].nResult > 0 && 0 == ret)
+        {
+            ret = 1;
+        }
+    }
+
+    free (psWorker);
+    free (sAll.psEntry);
 
     return ret;
 }
 
-int filemap_existitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key)
+int filemap_bulkload (const char *szFileName, int nNum, const FILEMAP_OPTION *psOption, 
+                int (*pfnSource)(void *pArg, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen), void *pArg)
 {
-    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    if (NULL == szFileName || NULL == pfnSource)
+    {
+        _error ("param invalid\n");
+        return -1;
+    }
 
-    filemap_entrancecall_lock (hInstance);
-    int ret = filemap_file_existitem (pObj->hMem2File, pObj->nMaxFileNum, key);
-    filemap_entrancecall_unlock (hInstance);
+    char szTmpName[1024] = {};
+    char szTmpWalName[1024] = {};
+    char szWalName[1024] = {};
+    if (snprintf (szTmpName, sizeof(szTmpName), "%s%s", szFileName, FILEMAP_BULKLOAD_SUFFIX) >= (int)sizeof(szTmpName) ||
+            snprintf (szTmpWalName, sizeof(szTmpWalName), "%s%s", szTmpName, FILEMAP_WAL_SUFFIX) >= (int)sizeof(szTmpWalName) ||
+            snprintf (szWalName, sizeof(szWalName), "%s%s", szFileName, FILEMAP_WAL_SUFFIX) >= (int)sizeof(szWalName))
+    {
+        _error ("file name too long, <%s>\n", szFileName);
+        return -1;
+    }
 
-    return ret;
-}
+    /* 上次中途退出留下的临时文件 */
+    unlink (szTmpName);
+    unlink (szTmpWalName);
 
-int filemap_getitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, FILEMAP_VALUE *value)
-{
-    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)hInstance;
+    /* 不使用日志和映射，索引段和空位栈在内存中修改 */
+    FILEMAP_OPTION sOption = {};
+    if (psOption != NULL)
+    {
+        sOption = *psOption;
+    }
+    sOption.nFlags = 0;
 
-    filemap_entrancecall_lock (hInstance);
-    int ret = filemap_file_getitem (pObj->hMem2File, pObj->nMaxFileNum, key, value);
-    filemap_entrancecall_unlock (hInstance);
+    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*)filemap_create_opt (szTmpName, nNum, &sOption);
+    if (NULL == pObj)
+    {
+        _error ("create file failed, <%s>\n", szTmpName);
+        unlink (szTmpName);
+        return -1;
+    }
 
-    return ret;
-}
+    int bError = 0;
+    int nItemNum = 0;
+    if (filemap_bulkload_file (pObj, psOption, pfnSource, pArg, &nItemNum) < 0)
+    {
+        _error ("load failed, item=%d\n", nItemNum);
+        bError = 1;
+    }
 
-int filemap_setitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, const FILEMAP_VALUE *value)
-{
-    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    /* 比特表平时在关闭时才写回，这里先写回，再整个写磁盘 */
+    if (0 == bError && filemap_bitmap_sync (pObj) < 0)
+    {
+        _error ("sync bitmap failed\n");
+        bError = 1;
+    }
+    if (0 == bError && mem2file_sync (pObj->hMem2File) < 0)
+    {
+        _error ("sync file failed\n");
+        bError = 1;
+    }
+    if (filemap_close (pObj) < 0)
+    {
+        bError = 1;
+    }
 
-    filemap_entrancecall_lock (hInstance);
-    int ret = filemap_file_setitem (pObj->hMem2File, pObj->nMaxFileNum, key, value);
-    ret = (ret == 1 ? 0 : -1);
-    filemap_entrancecall_unlock (hInstance);
+    /* 旧文件的日志不能在新文件上重做：先在旧文件上重做并清空，改名前异常退出时旧文件和日志都不丢失 */
+    struct stat stWal = {};
+    if (0 == bError && stat (szWalName, &stWal) == 0 && stWal.st_size > 0)
+    {
+        FILEMAP_HANDLE hOld = filemap_init_file (szFileName, NULL, 0);
+        if (NULL == hOld)
+        {
+            _error ("replay wal <%s> on old file failed, remove it to discard\n", szWalName);
+            bError = 1;
+        }
+        else if (filemap_close (hOld) < 0)
+        {
+            bError = 1;
+        }
+    }
 
-    return ret;
-}
+    /* 改名是原子的，之前异常退出时旧文件不变 */
+    if (0 == bError && rename (szTmpName, szFileName) < 0)
+    {
+        _error ("rename <%s> failed, errno=%d\n", szTmpName, errno);
+        bError = 1;
+    }
 
-int filemap_deleteitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key)
-{
-    FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    if (bError)
+    {
+        unlink (szTmpName);
+        return -1;
+    }
 
-    filemap_entrancecall_lock (hInstance);
-    int ret = filemap_file_deleteitem (pObj->hMem2File, pObj->nMaxFileNum, key);
-    ret = (ret == 1 ? 0 : -1);
-    filemap_entrancecall_unlock (hInstance);
+    /* 改名写磁盘后再删除已清空的日志，之间异常退出时留下的空日志不影响新文件 */
+    filemap_migrate_syncdir (szFileName);
+    if (unlink (szWalName) < 0 && errno != ENOENT)
+    {
+        _error ("remove wal <%s> failed, errno=%d\n", szWalName, errno);
+    }
 
-    return ret;
+    if (psOption != NULL && psOption->pfnProgress != NULL)
+    {
+        psOption->pfnProgress (psOption->pProgressArg, nItemNum, nNum);
+    }
+
+    _info ("bulkload successful, <%s,num=%d,item=%d>\n", szFileName, nNum, nItemNum);
+
+    return nItemNum;
 }
 
-int filemap_generateinfo (FILEMAP_HANDLE hInstance, const char *szFileName)
+int filemap_grow (FILEMAP_HANDLE hInstance, int nNewNum)
 {
     FILEMAP_OBJ *pObj = (FILEMAP_OBJ*) hInstance;
+    FILEMAP_GROW_STATE sState;
+    memset (&sState, 0, sizeof(sState));
+
+    pthread_mutex_lock (& pObj->mutex_grow);
 
+    /* 准备新的区域时其他调用照常进行，只在切换时独占 */
     filemap_entrancecall_lock (hInstance);
-    int ret = filemap_file_generateinfo (pObj->hMem2File, pObj->nMaxFileNum, szFileName);
+    int ret = filemap_grow_prepare (pObj, nNewNum, &sState);
     filemap_entrancecall_unlock (hInstance);
 
+    if (0 == ret)
+    {
+        filemap_entrancecall_lockexclusive (hInstance);
+        ret = filemap_grow_switch (pObj, &sState);
+        filemap_entrancecall_unlock (hInstance);
+    }
+
+    filemap_grow_release (pObj, &sState);
+
+    pthread_mutex_unlock (& pObj->mutex_grow);
+
     return ret;
-}
\ No newline at end of file
+}
@@ -1,7 +1,21 @@
 
 /**
  * 一个建立在文件上的映射表
- * @note 映射表的大小是确定的，不能动态扩展
+ * @note 映射表的大小在创建时确定，可以用filemap_grow扩容
+ *
+ * 文件格式与兼容性：程序只读取自己认识的版本号，其他版本的文件filemap_load失败，
+ * filemap_create则重新初始化（数据丢失）。各版本的程序能读取的文件：
+ *   写V1.0的程序：只有V1.0；
+ *   写V1.1的程序（有空位栈）：V1.0（加载时升级为V1.1）、V1.1；
+ *   写V1.2的程序（有变长值存储区）：V1.0（同上）、V1.1、V1.2；
+ *   本版本：V1.0（需要FILEMAP_FLAG_UPGRADE）、V1.1、V1.2、V2.0～V2.4。
+ * 本版本写出的文件：
+ *   bStringKey且没有变长值存储区：V1.1，写V1.1及之后的程序可以读取；
+ *   bStringKey且有变长值存储区：V1.2，写V1.2及之后的程序可以读取；
+ *   其他（任意字节串的键V2.0、开放寻址V2.1）：只有本版本可以读取；
+ *   扩容过（V2.2）、超过2GB（V2.3）、FILEMAP_FLAG_DIRECT新建（V2.4）的文件不论键的格式，只有本版本可以读取。
+ * 写V1.0的程序不能读取本版本写出的任何文件。交给旧版本的程序之前应正常关闭，
+ * 日志<szFileName>.wal已清空，旧版本的程序不认识本版本的日志记录
  */
 
 #ifndef FILEMAP_H__
@@ -12,6 +26,24 @@ extern "C" {
 #endif 
 
 typedef void *FILEMAP_HANDLE;
+typedef void *FILEMAP_ITER_HANDLE;
+
+/* 实例的工作方式，可组合使用 */
+#define FILEMAP_FLAG_MMAP   0x1     /* 将文件映射到内存进行读写，减少系统调用 */
+#define FILEMAP_FLAG_SHARED 0x2     /* 多个进程同时打开同一个文件，包含FILEMAP_FLAG_MMAP */
+#define FILEMAP_FLAG_WAL    0x4     /* 修改索引前先写日志文件<szFileName>.wal，异常退出后加载时重做；掉电的保证见filemap_setdurability */
+#define FILEMAP_FLAG_MIGRATE 0x8    /* 数量或存储区大小与已有文件不符时，将已有的项写入新的文件，见filemap_create_opt */
+#define FILEMAP_FLAG_DIRECT 0x10    /* 以O_DIRECT读写文件，不经过页缓存；索引不整段读入内存，读取经过大小固定的私有缓冲池 */
+#define FILEMAP_FLAG_UPGRADE 0x20   /* 加载V1.0的文件时就地升级为V1.1（在索引段后增加空位栈），升级无法撤销，
+                                       升级后V1.0的程序不能再读取该文件；不设置时V1.0的文件加载失败，文件保持不变 */
+
+/* FILEMAP_FLAG_DIRECT时私有缓冲池的大小（字节），进程的内存占用不随文件大小增长 */
+#define FILEMAP_DIRECT_POOL_SIZE (64 * 1024 * 1024)
+
+/* 持久化方式，见filemap_setdurability */
+#define FILEMAP_DURABILITY_NONE     0   /* 不主动写磁盘，由系统决定；只保证进程异常退出，不保证掉电 */
+#define FILEMAP_DURABILITY_PERIODIC 1   /* 后台线程每隔一段时间写一次磁盘；只保证进程异常退出，不保证掉电 */
+#define FILEMAP_DURABILITY_GROUP    2   /* 写操作返回前已写磁盘，同时进行的写操作共用一次写磁盘 */
 
 typedef struct 
 {
@@ -26,23 +58,93 @@ typedef struct
 typedef FILEMAP_DATA_64B FILEMAP_KEY;
 typedef FILEMAP_DATA_10K FILEMAP_VALUE;
 
+/* 变长值的最大长度，见filemap_setvalue */
+#define FILEMAP_VALUE_MAX (1024 * 1024 - 8)
+
+/* 任意字节串的键的最大长度，见filemap_setvalue_bin */
+#define FILEMAP_KEY_MAX 64
+
+/* 键的hash函数，见FILEMAP_OPTION.nHashType */
+#define FILEMAP_HASH_DEFAULT    0   /* 新文件使用FILEMAP_HASH_WYHASH，字符串键的文件使用FILEMAP_HASH_BKDR */
+#define FILEMAP_HASH_BKDR       1   /* 旧版本的hash函数，V1.x文件总是使用 */
+#define FILEMAP_HASH_WYHASH     2   /* 每次处理8字节，使用创建文件时生成的随机种子 */
+
+/* 索引的结构，见FILEMAP_OPTION.nIndexLayout */
+#define FILEMAP_INDEX_CHAIN     0   /* 哈希表加冲突链表 */
+#define FILEMAP_INDEX_OPEN      1   /* 开放寻址，每个位置一个控制字节，按组顺序探测；只用于任意字节串的键 */
+
+/* 创建选项，见filemap_create_opt */
+typedef struct 
+{
+    int nFlags;                 /* FILEMAP_FLAG_* 的组合 */
+    long long llValueHeapSize;  /* 变长值存储区的大小（字节），为0时每项占用固定的sizeof(FILEMAP_VALUE)；文件超过2GB时为V2.3格式，只有本版本可以读取 */
+    int bStringKey;             /* 为1时索引中的键为64字节的字符串（V1.1/V1.2格式），写V1.1或V1.2的程序可以读取，见文件开头 */
+    int nHashType;              /* FILEMAP_HASH_*，字符串键的文件只能使用FILEMAP_HASH_BKDR */
+    int nIndexLayout;           /* FILEMAP_INDEX_*，FILEMAP_INDEX_OPEN的文件（V2.1格式）只有本版本可以读取 */
+    void (*pfnProgress)(void *pArg, int nDone, int nTotal);    /* 可以为NULL，FILEMAP_FLAG_MIGRATE时报告已读取的旧哈希表位置数，见filemap_bulkload */
+    void *pProgressArg;         /* pfnProgress的pArg */
+} FILEMAP_OPTION;
+
 /**
  * @brief filemap_create 创建实例
  * @param [IN] szFileName 绑定的文件
  * @param [IN] nNum 创建的数量
  * @return 失败返回NULL，否则返回新创建的实例句柄
- * @note 对同一个文件只应创建一个实例
+ * @note 对同一个文件只应创建一个实例，多进程共享时使用FILEMAP_FLAG_SHARED
  */
 FILEMAP_HANDLE filemap_create (const char *szFileName, int nNum);
 
+/**
+ * @brief filemap_create_ex 以指定的方式创建实例
+ * @param [IN] szFileName 绑定的文件
+ * @param [IN] nNum 创建的数量
+ * @param [IN] nFlags FILEMAP_FLAG_* 的组合，为0时与filemap_create相同
+ * @return 失败返回NULL，否则返回新创建的实例句柄
+ * @note 工作方式只影响本实例，不影响文件格式；
+ * 以FILEMAP_FLAG_SHARED打开时，同一个文件的所有实例都应使用该方式，
+ * 且其他进程已打开时不会重新初始化文件，数量与文件不符则失败；
+ * 以FILEMAP_FLAG_WAL打开时，每次修改索引都先写日志，写磁盘的时机见filemap_setdurability；
+ * 不使用该方式打开时，若存在上次异常退出留下的日志，仍会重做；
+ * 以FILEMAP_FLAG_DIRECT新建的文件数据段按4KB对齐（V2.4格式），只有本版本可以读取，
+ * 已有的文件不变，也可以用该方式打开；不能与FILEMAP_FLAG_MMAP、FILEMAP_FLAG_SHARED同时使用，
+ * 文件系统不支持O_DIRECT时失败
+ */
+FILEMAP_HANDLE filemap_create_ex (const char *szFileName, int nNum, int nFlags);
+
+/**
+ * @brief filemap_create_opt 以指定的选项创建实例
+ * @param [IN] szFileName 绑定的文件
+ * @param [IN] nNum 创建的数量
+ * @param [IN] psOption 选项，为NULL时与filemap_create相同
+ * @return 失败返回NULL，否则返回新创建的实例句柄
+ * @note llValueHeapSize大于0时，值按长度分级存放在一个共用的存储区中，
+ * 每项只占用其长度向上取整后的空间；存储区用完后无法再添加。
+ * 选项与已有文件不符时重新初始化，与filemap_create_ex相同；已有文件的键格式、hash函数和索引结构保持不变。
+ * 使用FILEMAP_FLAG_MIGRATE时，数量或存储区大小与已有文件不符则不重新初始化，
+ * 而是将已有的项逐一写入临时文件<szFileName>.migrate，写磁盘后改名替换原文件；
+ * 新的数量或存储区放不下已有的项时失败，原文件不变；不能与FILEMAP_FLAG_SHARED同时使用。
+ * 索引段整体读写，不能超过2GB，因此数量有上限：字符串键为12540050，任意字节串的键
+ * FILEMAP_INDEX_CHAIN为23794832，FILEMAP_INDEX_OPEN为41698711；超过时失败，已有文件不变。
+ * filemap_create、filemap_create_ex和filemap_grow的数量同样受此限制
+ */
+FILEMAP_HANDLE filemap_create_opt (const char *szFileName, int nNum, const FILEMAP_OPTION *psOption);
+
 /**
  * @brief filemap_load 创建实例
  * @param [IN] szFileName 绑定的文件
  * @return 失败返回NULL，否则返回新创建的实例句柄
- * @note 对同一个文件只应创建一个实例
+ * @note 对同一个文件只应创建一个实例，多进程共享时使用FILEMAP_FLAG_SHARED
  */
 FILEMAP_HANDLE filemap_load (const char *szFileName);
 
+/**
+ * @brief filemap_load_ex 以指定的方式创建实例
+ * @param [IN] szFileName 绑定的文件
+ * @param [IN] nFlags FILEMAP_FLAG_* 的组合，为0时与filemap_load相同
+ * @return 失败返回NULL，否则返回新创建的实例句柄
+ */
+FILEMAP_HANDLE filemap_load_ex (const char *szFileName, int nFlags);
+
 /**
  * @brief filemap_close 关闭实例
  * @param [IN] hInstance 实例句柄
@@ -66,6 +168,58 @@ int filemap_existitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key);
  */
 int filemap_getitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, FILEMAP_VALUE *value);
 
+/**
+ * @brief filemap_multiget 一次获取多个项
+ * @param [IN] psKeys 各个key
+ * @param [IN] nNum key的个数
+ * @param [OUT] pValues 各个key的值，与psKeys一一对应
+ * @param [OUT] pnStatus 各个key的结果，与filemap_getitem的返回值相同
+ * @return 失败返回-1，否则返回找到的项数
+ * @note 只进入一次并锁住所有key所在的段，按文件中的位置排序读取，相邻的数据项合并为一次读取；
+ * 结果是同一时刻的，不会只看到另一个写操作的一部分
+ */
+int filemap_multiget (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, FILEMAP_VALUE *pValues, int *pnStatus);
+
+/**
+ * @brief filemap_getrange 获取一个项的值中的一段
+ * @param [IN] key 键
+ * @param [IN] nOffset 在值中的起始位置
+ * @param [OUT] pData 数据
+ * @param [IN] nSize 数据大小
+ * @return 成功返回0，否则返回-1
+ * @note 只读取指定的范围，范围不能超出FILEMAP_VALUE
+ */
+int filemap_getrange (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, int nOffset, void *pData, int nSize);
+
+/**
+ * @brief filemap_setrange 修改一个已存在项的值中的一段
+ * @param [IN] key 键
+ * @param [IN] nOffset 在值中的起始位置
+ * @param [IN] pData 数据
+ * @param [IN] nSize 数据大小
+ * @return 成功返回0，否则返回-1
+ * @note 只写入指定的范围，其余部分保持不变。项不存在时返回-1
+ */
+int filemap_setrange (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, int nOffset, const void *pData, int nSize);
+
+/**
+ * @brief filemap_acquireitem 借用一个项的值（只读，不拷贝）
+ * @param [IN] key 键
+ * @param [OUT] ppValue 值的地址
+ * @return 成功返回0，否则返回-1
+ * @note 映射方式下直接指向文件的数据段，否则（包括多进程共享方式和变长方式）为一份拷贝。
+ * 归还之前，该项的值不会被改变：修改会写到新的位置，删除会推迟到归还之后。
+ * 每次成功的借用都必须调用filemap_releaseitem归还，且应在关闭实例之前归还。
+ */
+int filemap_acquireitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, const FILEMAP_VALUE **ppValue);
+
+/**
+ * @brief filemap_releaseitem 归还借用的值
+ * @param [IN] pValue filemap_acquireitem得到的地址
+ * @return 成功返回0，否则返回-1
+ */
+int filemap_releaseitem (FILEMAP_HANDLE hInstance, const FILEMAP_VALUE *pValue);
+
 /**
  * @brief filemap_additem 记录一个项，存在则修改，不存在则新增
  * @param [IN] key 键
@@ -75,6 +229,29 @@ int filemap_getitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, FILEMAP_V
  */
 int filemap_setitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, const FILEMAP_VALUE *value);
 
+/**
+ * @brief filemap_setvalue 记录一个变长的值，存在则修改，不存在则新增
+ * @param [IN] key 键
+ * @param [IN] pData 值
+ * @param [IN] nLen 值的长度，不超过FILEMAP_VALUE_MAX
+ * @return 成功返回0，否则返回-1
+ * @note 固定大小方式下nLen不能超过sizeof(FILEMAP_VALUE)，其余部分填0
+ */
+int filemap_setvalue (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, const void *pData, int nLen);
+
+/**
+ * @brief filemap_getvalue 获取一个变长的值
+ * @param [IN] key 键
+ * @param [OUT] pData 值，最多拷贝nSize字节
+ * @param [IN] nSize pData的大小
+ * @param [OUT] pnLen 值的实际长度，可以大于nSize，可为NULL
+ * @return 成功返回0，不存在或失败返回-1
+ * @note 固定大小方式下长度总是sizeof(FILEMAP_VALUE)。
+ * filemap_getitem/filemap_setitem在变长方式下按sizeof(FILEMAP_VALUE)的值读写；
+ * filemap_getrange/filemap_setrange的范围不能超出值的长度
+ */
+int filemap_getvalue (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, void *pData, int nSize, int *pnLen);
+
 /**
  * @brief filemap_deleteitem 删除一个项
  * @param [IN] key 键
@@ -82,6 +259,138 @@ int filemap_setitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key, const FIL
  */
 int filemap_deleteitem (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *key);
 
+/**
+ * @brief filemap_existitem_bin 检查项是否存在，键为任意字节串
+ * @param [IN] pKey 键，可以含有0
+ * @param [IN] nKeyLen 键的长度，不超过FILEMAP_KEY_MAX
+ * @return 存在为1，否则为0
+ * @note 以下*_bin与对应的函数相同，只是键的形式不同；FILEMAP_KEY等同于长度为strlen(szKey)的键。
+ * 短键直接保存在索引中，较长的键保存在单独的键段中。
+ * 以bStringKey创建的文件和V1.x的文件中，键不能含有0，且短于64字节
+ */
+int filemap_existitem_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen);
+
+/**
+ * @brief filemap_getvalue_bin 获取一个变长的值，见filemap_getvalue
+ */
+int filemap_getvalue_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen, void *pData, int nSize, int *pnLen);
+
+/**
+ * @brief filemap_setvalue_bin 记录一个变长的值，见filemap_setvalue
+ */
+int filemap_setvalue_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen, const void *pData, int nLen);
+
+/**
+ * @brief filemap_deleteitem_bin 删除一个项，见filemap_deleteitem
+ */
+int filemap_deleteitem_bin (FILEMAP_HANDLE hInstance, const void *pKey, int nKeyLen);
+
+/**
+ * @brief filemap_multiset 一次记录多个项，与依次调用filemap_setitem相同
+ * @param [IN] psKeys 各个key
+ * @param [IN] nNum key的个数
+ * @param [IN] pValues 各个key的值，与psKeys一一对应
+ * @param [OUT] pnStatus 各个key的结果，与filemap_setitem的返回值相同
+ * @return 失败返回-1，否则返回成功的项数
+ * @note 期间独占实例，其他调用等待；对索引的修改先只写入内存，结束时按位置合并为尽量少的连续写入，
+ * 整批只按持久化方式写一次磁盘。以FILEMAP_FLAG_WAL或映射方式打开时每项仍直接写入；
+ * 不是原子的，中途异常退出时已写入的项保留
+ */
+int filemap_multiset (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, const FILEMAP_VALUE *pValues, int *pnStatus);
+
+/**
+ * @brief filemap_multidelete 一次删除多个项，见filemap_multiset
+ * @param [OUT] pnStatus 各个key的结果，与filemap_deleteitem的返回值相同
+ * @return 失败返回-1，否则返回成功删除的项数
+ */
+int filemap_multidelete (FILEMAP_HANDLE hInstance, const FILEMAP_KEY *psKeys, int nNum, int *pnStatus);
+
+/**
+ * @brief filemap_setdurability 设置写操作的持久化方式
+ * @param [IN] nMode FILEMAP_DURABILITY_*
+ * @param [IN] nIntervalMs FILEMAP_DURABILITY_PERIODIC方式下写磁盘的间隔（毫秒），其他方式忽略
+ * @return 成功返回0，否则返回-1
+ * @note 以FILEMAP_FLAG_WAL打开时默认为FILEMAP_DURABILITY_GROUP，写磁盘的是日志；
+ * 否则默认为FILEMAP_DURABILITY_NONE，写磁盘的是整个文件。
+ * 以FILEMAP_FLAG_WAL打开时，进程异常退出（包括被杀死）后加载时重做日志，每次操作要么完整生效，要么不生效；
+ * 掉电或系统崩溃时只有FILEMAP_DURABILITY_GROUP方式有同样的保证：该方式下日志写磁盘之后才修改索引。
+ * FILEMAP_DURABILITY_NONE和FILEMAP_DURABILITY_PERIODIC方式下日志写磁盘之前索引已经修改，
+ * 系统可能先将索引写磁盘，掉电后一次操作可能只留下一部分修改，日志无法恢复。
+ * FILEMAP_DURABILITY_GROUP方式下写磁盘失败时，写操作已生效但返回-1，该操作掉电时同样没有保证。
+ * 只影响本实例，等待进行中的调用结束后生效
+ */
+int filemap_setdurability (FILEMAP_HANDLE hInstance, int nMode, int nIntervalMs);
+
+/**
+ * @brief filemap_grow 扩容到@nNewNum项
+ * @param [IN] nNewNum 新的数量，大于当前数量
+ * @return 成功返回0，否则返回-1
+ * @note 在文件末尾追加新的索引和数据区域，原有的项不移动。新的区域在其他调用进行的同时准备并写磁盘，
+ * 只有最后切换时短暂等待进行中的调用结束；旧索引中的项由之后的写操作逐步迁移，
+ * 迁移期间读写操作照常并行。有变长值存储区的文件不能扩容，存储区无法原地扩大，
+ * 应以FILEMAP_FLAG_MIGRATE和更大的llValueHeapSize调用filemap_create_opt重建。
+ * 以FILEMAP_FLAG_SHARED打开时不支持；一个文件最多扩容15次；数量的上限见filemap_create_opt
+ */
+int filemap_grow (FILEMAP_HANDLE hInstance, int nNewNum);
+
+/**
+ * @brief filemap_iter_open 开始遍历所有的项
+ * @return 失败返回NULL，否则返回遍历句柄，用filemap_iter_close关闭
+ * @note 打开时记录所有项的位置，期间写操作等待；之后按数据在文件中的位置顺序返回，
+ * 数据段按较大的块顺序读取。打开之后删除的项不再返回，新增的项不返回；
+ * 扩容后不能继续遍历
+ */
+FILEMAP_ITER_HANDLE filemap_iter_open (FILEMAP_HANDLE hInstance);
+
+/**
+ * @brief filemap_iter_next 取得下一项
+ * @param [OUT] pKey 键，至少FILEMAP_KEY_MAX字节
+ * @param [OUT] pnKeyLen 键的长度
+ * @param [OUT] pData 值，超过@nSize的部分不复制
+ * @param [IN] nSize pData的大小
+ * @param [OUT] pnLen 值的长度，可以为NULL
+ * @return 取得一项返回1，遍历结束返回0，失败返回-1
+ * @note 返回的键和值是同一时刻的
+ */
+int filemap_iter_next (FILEMAP_ITER_HANDLE hIter, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen);
+
+/**
+ * @brief filemap_iter_close 结束遍历，应在关闭实例之前调用
+ * @return 成功返回0，否则返回-1
+ */
+int filemap_iter_close (FILEMAP_ITER_HANDLE hIter);
+
+/**
+ * @brief filemap_parallel_foreach 用多个线程对所有的项调用@pfnCallback
+ * @param [IN] nThreadNum 线程数，小于等于0时为CPU核数
+ * @param [IN] pfnCallback 回调函数，在各线程中同时调用；pKey和pData只在调用期间有效，
+ * 返回非0时停止遍历
+ * @param [IN] pCtx 回调函数的pCtx
+ * @return 遍历完成返回0，回调函数要求停止返回1，失败返回-1
+ * @note 所有项按数据在文件中的位置分为连续的几段，每个线程顺序读取一段；
+ * 其余与filemap_iter_open相同
+ */
+int filemap_parallel_foreach (FILEMAP_HANDLE hInstance, int nThreadNum, 
+                int (*pfnCallback)(void *pCtx, const void *pKey, int nKeyLen, const void *pData, int nLen), void *pCtx);
+
+/**
+ * @brief filemap_bulkload 由依次给出的项建立新的文件，替换已有的文件
+ * @param [IN] szFileName 建立的文件
+ * @param [IN] nNum 数量，见filemap_create_opt
+ * @param [IN] psOption 选项，可以为NULL，见filemap_create_opt；不使用其中的nFlags，
+ * pfnProgress报告已写入的项数
+ * @param [IN] pfnSource 依次取得各项：键放入pKey（FILEMAP_KEY_MAX字节），值放入pData（nSize字节），
+ * 并设置长度；取得一项返回1，没有更多的项返回0，失败返回-1
+ * @param [IN] pArg pfnSource的pArg
+ * @return 失败返回-1，否则返回写入的项数
+ * @note 在临时文件<szFileName>.bulkload中建立：索引只在内存中修改，最后一次写入；
+ * 数据按较大的块顺序写入。写磁盘后改名替换已有的文件，失败时已有的文件不变。
+ * 已有文件的日志<szFileName>.wal不为空时，先在已有的文件上重做并清空，不能重做时失败；改名后删除日志。
+ * 重复的键以最后一次为准，放不下时失败；调用期间@szFileName不能被打开
+ */
+int filemap_bulkload (const char *szFileName, int nNum, const FILEMAP_OPTION *psOption, 
+                int (*pfnSource)(void *pArg, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen), void *pArg);
+
 /**
  * @brief 生成@hInstance的信息，并输出到@szFilename中
  * @note 仅用于调试用途
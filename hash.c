@@ -1,6 +1,8 @@
 
 #include "hash.h"
 
+#include <string.h>
+
 
 int BKDRHash(const char *str)
 {
@@ -15,4 +17,107 @@ int BKDRHash(const char *str)
         hash = hash * 131 + ch;
     }
     return hash;
+}
+
+int BKDRHashBin(const char *data, int len)
+{
+    register int hash = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        int ch = (int)data[i];
+        hash = hash * 131 + ch;
+    }
+    return hash;
+}
+
+static const unsigned long long s_ullWySecret[4] = 
+{
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+/* 64位乘法，得到128位结果的高低两部分 */
+static inline void wy_mum(unsigned long long *pA, unsigned long long *pB)
+{
+    __uint128_t r = *pA;
+    r *= *pB;
+    *pA = (unsigned long long)r;
+    *pB = (unsigned long long)(r >> 64);
+}
+
+static inline unsigned long long wy_mix(unsigned long long a, unsigned long long b)
+{
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline unsigned long long wy_r8(const unsigned char *p)
+{
+    unsigned long long v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline unsigned long long wy_r4(const unsigned char *p)
+{
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline unsigned long long wy_r3(const unsigned char *p, int k)
+{
+    return (((unsigned long long)p[0]) << 16) | (((unsigned long long)p[k >> 1]) << 8) | p[k - 1];
+}
+
+unsigned long long WyHash(const void *data, int len, unsigned long long seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned long long *secret = s_ullWySecret;
+    unsigned long long a = 0;
+    unsigned long long b = 0;
+
+    seed ^= wy_mix(seed ^ secret[0], secret[1]);
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = wy_r3(p, len);
+        }
+    }
+    else 
+    {
+        int i = len;
+        if (i > 48)
+        {
+            unsigned long long see1 = seed;
+            unsigned long long see2 = seed;
+            do
+            {
+                seed = wy_mix(wy_r8(p) ^ secret[1], wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ secret[2], wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ secret[3], wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = wy_mix(wy_r8(p) ^ secret[1], wy_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ secret[0] ^ (unsigned long long)len, b ^ secret[1]);
 }
\ No newline at end of file
@@ -6,6 +6,24 @@
 #ifndef HASH_H__
 #define HASH_H__
 
+#ifdef __cplusplus
+extern "C" {
+#endif 
+
 int BKDRHash(const char *str);
 
+/**
+ * 任意字节串的hash函数，不含0的字节串与BKDRHash的结果相同
+ */
+int BKDRHashBin(const char *data, int len);
+
+/**
+ * 任意字节串的64位hash函数（wyhash算法），每次处理8字节；不同的seed得到不相关的结果
+ */
+unsigned long long WyHash(const void *data, int len, unsigned long long seed);
+
+#ifdef __cplusplus
+}
+#endif 
+
 #endif // HASH_H__
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../filemap.h"
+
+#define DEBUG
+
+#ifdef DEBUG
+#define _debug(x...) do {printf("[debug][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _info(x...) do {printf("[info][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _error(x...) do {printf("[error][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#else
+#define _debug(x...) do {;} while (0)
+#define _info(x...) do {printf("[info][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#define _error(x...) do {printf("[error][%s %d %s]", \
+	__FILE__,__LINE__,__FUNCTION__);printf(x);} while (0)
+#endif
+
+/* 输入文件，每行一项：键<TAB>值 */
+typedef struct
+{
+    FILE *fp;
+    char *pLine;
+    size_t nLineSize;
+    int nLineNo;
+} LOADER_SOURCE;
+
+static int loader_source (void *pArg, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen)
+{
+    LOADER_SOURCE *psSource = (LOADER_SOURCE*)pArg;
+
+    ssize_t nRead = 0;
+    while ((nRead = getline (& psSource->pLine, & psSource->nLineSize, psSource->fp)) >= 0)
+    {
+        psSource->nLineNo += 1;
+
+        while (nRead > 0 && ('\n' == psSource->pLine[nRead - 1] || '\r' == psSource->pLine[nRead - 1]))
+        {
+            psSource->pLine[--nRead] = '\0';
+        }
+
+        if (nRead > 0)
+        { /* 跳过空行 */
+            break;
+        }
+    }
+
+    if (nRead < 0)
+    {
+        return 0;
+    }
+
+    const char *pTab = memchr (psSource->pLine, '\t', nRead);
+    const int nKeyLen = (pTab != NULL ? (int)(pTab - psSource->pLine) : (int)nRead);
+    const char *pValue = (pTab != NULL ? pTab + 1 : "");
+    const int nLen = (pTab != NULL ? (int)(nRead - nKeyLen - 1) : 0);
+
+    if (nKeyLen > FILEMAP_KEY_MAX || nLen > nSize)
+    {
+        _error ("line %d too long, <key=%d,value=%d>\n", psSource->nLineNo, nKeyLen, nLen);
+        return -1;
+    }
+
+    memcpy (pKey, psSource->pLine, nKeyLen);
+    memcpy (pData, pValue, nLen);
+    *pnKeyLen = nKeyLen;
+    *pnLen = nLen;
+
+    return 1;
+}
+
+static void loader_progress (void *pArg, int nDone, int nTotal)
+{
+    _info ("loaded %d items\n", nDone);
+}
+
+int main (int argc, const char **argv)
+{
+    if (argc < 4)
+    {
+        _error ("usage: %s <input_file> <output_file> <num> [heap_size]\n", argv[0]);
+        return -1;
+    }
+
+    const char *szSrcFile = argv[1];
+    const char *szDstFile = argv[2];
+    const int nNum = atoi (argv[3]);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.llValueHeapSize = (argc > 4 ? atoll (argv[4]) : 0);
+    sOption.pfnProgress = loader_progress;
+
+    LOADER_SOURCE sSource = {};
+    sSource.fp = fopen (szSrcFile, "r");
+    if (NULL == sSource.fp)
+    {
+        _error ("open <%s> failed\n", szSrcFile);
+        return -1;
+    }
+
+    struct timespec tsBegin = {};
+    struct timespec tsEnd = {};
+    clock_gettime (CLOCK_MONOTONIC, &tsBegin);
+
+    int ret = filemap_bulkload (szDstFile, nNum, &sOption, loader_source, &sSource);
+
+    clock_gettime (CLOCK_MONOTONIC, &tsEnd);
+
+    free (sSource.pLine);
+    fclose (sSource.fp);
+
+    if (ret < 0)
+    {
+        _error ("bulkload <%s> failed\n", szDstFile);
+        return -1;
+    }
+
+    _info ("bulkload <%s> done, item=%d,time=%.3fs\n", szDstFile, ret,
+                    (tsEnd.tv_sec - tsBegin.tv_sec) + (tsEnd.tv_nsec - tsBegin.tv_nsec) / 1e9);
+
+    return 0;
+}
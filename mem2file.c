@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* mremap, O_DIRECT */
 
 #include "mem2file.h"
 
@@ -6,6 +7,10 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -47,16 +52,76 @@
         printf ("timestamp[%s %d %s] %s\n", __FILE__,__LINE__,__FUNCTION__, szResult); \
 	} while (0)
 
+/* 合并写入时同时进行的顺序写入数，例如数据段和键段 */
+#define MEM2FILE_WRITEBUF_NUM 4
+
+/* 缓冲池每组的页数，页按序号分到各组，组内换出最久未使用的 */
+#define MEM2FILE_POOL_WAYS 4
+/* 缓冲池的锁数，各组按序号分配到这些锁上 */
+#define MEM2FILE_POOL_LOCK_NUM 64
+
 /*********** TYPES ***********/
 
+typedef struct 
+{
+    char *pMap;
+    long long llMapSize;
+} MEM2FILE_MAPPING;
+
+/* 缓冲池中的一页 */
+typedef struct 
+{
+    long long llPage;       // 对应文件中的第几页，为-1时未使用
+    unsigned int uStamp;    // 最近一次使用的序号，组内换出最小的
+} MEM2FILE_POOLPAGE;
+
+/* 合并写入的缓冲区，对应文件中从llPos开始的nLen字节 */
+typedef struct 
+{
+    char *pData;
+    long long llPos;
+    int nLen;               // 为0时未使用
+    unsigned int uStamp;    // 最近一次写入的序号，都在使用时换出最久未写入的
+} MEM2FILE_WRITEBUF;
+
 typedef struct 
 {
     int fd;
+    int nFlags;
+
+    /**
+     * 映射方式下有效；扩大时先更新地址再更新大小，
+     * 不加锁的读写先取大小再取地址，不会越过映射的范围
+     */
+    char *pMap;         // 映射的起始地址，文件为空时为NULL
+    long long llMapSize;    // 映射的大小，与文件大小一致
+
+    /* 扩大之前的映射，其他线程可能仍在使用，关闭时才解除 */
+    MEM2FILE_MAPPING *psRetired;
+    int nRetiredNum;
+
+    /* 合并写入，见mem2file_setwritebuffer；nWriteBufSize为0时不合并 */
+    int nWriteBufSize;
+    long long llWriteFileSize;  // 合并写入期间的文件大小，不再每次读取
+    unsigned int uWriteStamp;
+    MEM2FILE_WRITEBUF asWriteBuf[MEM2FILE_WRITEBUF_NUM];
+
+    /**
+     * 直接读写方式下的缓冲池，见mem2file_setbufferpool；页总是与文件一致，换出时不需要写回。
+     * 读取未命中时在组的锁内读文件，写入文件后再在组的锁内更新已有的页，不会留下旧的数据
+     */
+    int nPoolSetNum;                // 组数，为0时不使用缓冲池
+    char *pPoolData;                // 各页的数据，按页对齐
+    MEM2FILE_POOLPAGE *psPoolPage;
+    unsigned int uPoolStamp;
+    pthread_mutex_t amutexPool[MEM2FILE_POOL_LOCK_NUM];
+    pthread_mutex_t mutexDirectWrite;   // 不足一页的部分需要读出、修改、写回，写入之间互斥
+    long long llDirectFileSize;     // 直接读写方式下的文件大小，末尾不足一页的写入会暂时超出，不再每次读取
 } MEM2FILE_Obj;
 
 /*********** STATIC FUNCS ***********/
 
-static int mem2file_getfilesize (int fd, int *pnSize)
+static int mem2file_getfilesize (int fd, long long *pllSize)
 {
     struct stat sStat = {};
     if (fstat (fd, & sStat) < 0)
@@ -65,24 +130,537 @@ static int mem2file_getfilesize (int fd, int *pnSize)
         return -1;
     }
 
-    *pnSize = sStat.st_size;
+    *pllSize = sStat.st_size;
+    return 0;
+}
+
+/**
+ * @brief 按文件当前大小建立映射
+ */
+static int mem2file_map (MEM2FILE_Obj *pObj)
+{
+    long long llFileSize = 0;
+    if (mem2file_getfilesize (pObj->fd, &llFileSize) < 0)
+    {
+        _error ("get file size failed\n");
+        return -1;
+    }
+
+    if (0 == llFileSize)
+    { /* 空文件无法映射 */
+        pObj->pMap = NULL;
+        pObj->llMapSize = 0;
+        return 0;
+    }
+
+    void *pMap = mmap (NULL, llFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, pObj->fd, 0);
+    if (MAP_FAILED == pMap)
+    {
+        _error ("mmap failed, size=%lld\n", llFileSize);
+        return -1;
+    }
+
+    pObj->pMap = (char*)pMap;
+    pObj->llMapSize = llFileSize;
+
+    return 0;
+}
+
+static int mem2file_unmap (MEM2FILE_Obj *pObj)
+{
+    if (pObj->pMap != NULL)
+    {
+        if (munmap (pObj->pMap, pObj->llMapSize) < 0)
+        {
+            _error ("munmap failed\n");
+            return -1;
+        }
+    }
+
+    pObj->pMap = NULL;
+    pObj->llMapSize = 0;
+
+    return 0;
+}
+
+/**
+ * @brief 扩大映射：建立新的映射，旧的映射保留到关闭时
+ * @note 旧的映射与新的映射对应同一个文件，通过任何一个读写的结果都相同
+ */
+static int mem2file_extendmap (MEM2FILE_Obj *pObj, long long llSize)
+{
+    MEM2FILE_MAPPING *psRetired = (MEM2FILE_MAPPING*)realloc (pObj->psRetired, 
+                    sizeof(MEM2FILE_MAPPING) * (pObj->nRetiredNum + 1));
+    if (NULL == psRetired)
+    {
+        _error ("malloc failed\n");
+        return -1;
+    }
+    pObj->psRetired = psRetired;
+
+    void *pMap = mmap (NULL, llSize, PROT_READ | PROT_WRITE, MAP_SHARED, pObj->fd, 0);
+    if (MAP_FAILED == pMap)
+    {
+        _error ("mmap failed, size=%lld\n", llSize);
+        return -1;
+    }
+
+    psRetired[pObj->nRetiredNum].pMap = pObj->pMap;
+    psRetired[pObj->nRetiredNum].llMapSize = pObj->llMapSize;
+    pObj->nRetiredNum += 1;
+
+    __atomic_store_n (& pObj->pMap, (char*)pMap, __ATOMIC_RELEASE);
+    __atomic_store_n (& pObj->llMapSize, llSize, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * @brief 文件大小变化后调整映射
+ */
+static int mem2file_remap (MEM2FILE_Obj *pObj, long long llSize)
+{
+    if (0 == llSize)
+    {
+        return mem2file_unmap (pObj);
+    }
+
+    if (NULL == pObj->pMap)
+    {
+        return mem2file_map (pObj);
+    }
+
+    if (llSize > pObj->llMapSize)
+    { /* 其他线程可能正在不加锁读取，不能移动旧的映射 */
+        return mem2file_extendmap (pObj, llSize);
+    }
+
+    void *pMap = mremap (pObj->pMap, pObj->llMapSize, llSize, MREMAP_MAYMOVE);
+    if (MAP_FAILED == pMap)
+    {
+        _error ("mremap failed, <%lld->%lld>\n", pObj->llMapSize, llSize);
+        return -1;
+    }
+
+    pObj->pMap = (char*)pMap;
+    pObj->llMapSize = llSize;
+
+    return 0;
+}
+
+/**
+ * @brief 将一个合并写入的缓冲区写入文件
+ */
+static int mem2file_writebuf_flush (MEM2FILE_Obj *pObj, MEM2FILE_WRITEBUF *psBuf)
+{
+    if (psBuf->nLen <= 0)
+    {
+        return 0;
+    }
+
+    const int ret_write = pwrite (pObj->fd, psBuf->pData, psBuf->nLen, psBuf->llPos);
+    if (ret_write != psBuf->nLen)
+    {
+        _error ("write buffer failed, <pos=%lld,size=%d>\n", psBuf->llPos, psBuf->nLen);
+        return -1;
+    }
+
+    psBuf->nLen = 0;
     return 0;
 }
 
+/**
+ * @brief 将与文件中一段范围重叠的缓冲区写入文件，@llSize为-1时为所有缓冲区
+ */
+static int mem2file_writebuf_flushrange (MEM2FILE_Obj *pObj, long long pos, long long llSize)
+{
+    int bError = 0;
+    for (int i = 0; i < MEM2FILE_WRITEBUF_NUM; ++i)
+    {
+        MEM2FILE_WRITEBUF *psBuf = & pObj->asWriteBuf[i];
+        if (psBuf->nLen > 0 && (llSize < 0 || (pos < psBuf->llPos + psBuf->nLen && pos + llSize > psBuf->llPos)))
+        {
+            if (mem2file_writebuf_flush (pObj, psBuf) < 0)
+            {
+                bError = 1;
+            }
+        }
+    }
+
+    return bError ? -1 : 0;
+}
+
+/**
+ * @brief 合并写入：接在某个缓冲区末尾或落在其中的写入只拷贝到缓冲区，
+ * 否则换出一个缓冲区，从@pos开始新的一段
+ */
+static int mem2file_writebuf_set (MEM2FILE_Obj *pObj, long long pos, const void *pData, int nSize)
+{
+    if (pos < 0 || nSize < 0 || pos + nSize > pObj->llWriteFileSize)
+    {
+        _error ("param error<pos=%lld,size=%d,total=%lld>\n", pos, nSize, pObj->llWriteFileSize);
+        return -1;
+    }
+
+    const int nBufSize = pObj->nWriteBufSize;
+    MEM2FILE_WRITEBUF *psVictim = NULL;
+    for (int i = 0; i < MEM2FILE_WRITEBUF_NUM; ++i)
+    {
+        MEM2FILE_WRITEBUF *psBuf = & pObj->asWriteBuf[i];
+        if (psBuf->nLen > 0 && pos >= psBuf->llPos && pos <= psBuf->llPos + psBuf->nLen)
+        {
+            if (pos + nSize <= psBuf->llPos + nBufSize)
+            { /* 各缓冲区的范围不重叠，其他缓冲区中被覆盖的旧数据先写入文件 */
+                for (int k = 0; k < MEM2FILE_WRITEBUF_NUM; ++k)
+                {
+                    const MEM2FILE_WRITEBUF *psOther = & pObj->asWriteBuf[k];
+                    if (k != i && psOther->nLen > 0 && pos < psOther->llPos + psOther->nLen && pos + nSize > psOther->llPos &&
+                            mem2file_writebuf_flush (pObj, & pObj->asWriteBuf[k]) < 0)
+                    {
+                        return -1;
+                    }
+                }
+
+                memcpy (psBuf->pData + (pos - psBuf->llPos), pData, nSize);
+                if (pos + nSize > psBuf->llPos + psBuf->nLen)
+                {
+                    psBuf->nLen = (int)(pos + nSize - psBuf->llPos);
+                }
+                psBuf->uStamp = ++pObj->uWriteStamp;
+                return 0;
+            }
+
+            if (pos == psBuf->llPos + psBuf->nLen)
+            { /* 已满的缓冲区写入文件后接着使用 */
+                psVictim = psBuf;
+            }
+        }
+    }
+
+    if (mem2file_writebuf_flushrange (pObj, pos, nSize) < 0)
+    {
+        return -1;
+    }
+
+    if (nSize >= nBufSize)
+    {
+        const int ret_write = pwrite (pObj->fd, pData, nSize, pos);
+        if (ret_write != nSize)
+        {
+            _error ("set data to file failed or error\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < MEM2FILE_WRITEBUF_NUM && NULL == psVictim; ++i)
+    {
+        if (0 == pObj->asWriteBuf[i].nLen)
+        {
+            psVictim = & pObj->asWriteBuf[i];
+        }
+    }
+    if (NULL == psVictim)
+    {
+        psVictim = & pObj->asWriteBuf[0];
+        for (int i = 1; i < MEM2FILE_WRITEBUF_NUM; ++i)
+        {
+            if (pObj->asWriteBuf[i].uStamp < psVictim->uStamp)
+            {
+                psVictim = & pObj->asWriteBuf[i];
+            }
+        }
+    }
+
+    if (mem2file_writebuf_flush (pObj, psVictim) < 0)
+    {
+        return -1;
+    }
+
+    memcpy (psVictim->pData, pData, nSize);
+    psVictim->llPos = pos;
+    psVictim->nLen = nSize;
+    psVictim->uStamp = ++pObj->uWriteStamp;
+
+    return 0;
+}
+
+/**
+ * @brief 直接读取文件中按页对齐的一段，超过文件末尾的部分填0
+ * @param pBuf 按页对齐的缓冲区
+ */
+static int mem2file_direct_read (MEM2FILE_Obj *pObj, long long llPos, char *pBuf, long long llSize)
+{
+    long long llDone = 0;
+    while (llDone < llSize)
+    {
+        const ssize_t ret_read = pread (pObj->fd, pBuf + llDone, llSize - llDone, llPos + llDone);
+        if (ret_read < 0)
+        {
+            _error ("direct read failed, <pos=%lld,size=%lld>\n", llPos + llDone, llSize - llDone);
+            return -1;
+        }
+
+        llDone += ret_read;
+        if (0 == ret_read || ret_read % MEM2FILE_DIRECT_PAGE_SIZE != 0)
+        { /* 读到文件末尾 */
+            break;
+        }
+    }
+
+    memset (pBuf + llDone, 0, llSize - llDone);
+    return 0;
+}
+
+static pthread_mutex_t *mem2file_pool_getlock (MEM2FILE_Obj *pObj, long long llPage)
+{
+    return & pObj->amutexPool[(llPage % pObj->nPoolSetNum) % MEM2FILE_POOL_LOCK_NUM];
+}
+
+/**
+ * @brief 在缓冲池中找到文件的第@llPage页，不在时@bLoad为1则换出组内最久未使用的页后读入
+ * @return 页的数据，不在缓冲池中或读取失败返回NULL
+ * @note 调用者持有该组的锁
+ */
+static char *mem2file_pool_find (MEM2FILE_Obj *pObj, long long llPage, int bLoad)
+{
+    const long long llSet = llPage % pObj->nPoolSetNum;
+    MEM2FILE_POOLPAGE *psSet = pObj->psPoolPage + llSet * MEM2FILE_POOL_WAYS;
+    char *pSetData = pObj->pPoolData + llSet * MEM2FILE_POOL_WAYS * MEM2FILE_DIRECT_PAGE_SIZE;
+    const unsigned int uStamp = __atomic_add_fetch (& pObj->uPoolStamp, 1, __ATOMIC_RELAXED);
+
+    int nVictim = 0;
+    for (int i = 0; i < MEM2FILE_POOL_WAYS; ++i)
+    {
+        if (psSet[i].llPage == llPage)
+        {
+            psSet[i].uStamp = uStamp;
+            return pSetData + i * MEM2FILE_DIRECT_PAGE_SIZE;
+        }
+
+        if (psSet[nVictim].llPage >= 0 && (psSet[i].llPage < 0 || (int)(psSet[i].uStamp - psSet[nVictim].uStamp) < 0))
+        { /* 优先使用空闲的页 */
+            nVictim = i;
+        }
+    }
+
+    if (! bLoad)
+    {
+        return NULL;
+    }
+
+    char *pPage = pSetData + nVictim * MEM2FILE_DIRECT_PAGE_SIZE;
+    psSet[nVictim].llPage = -1;
+    if (mem2file_direct_read (pObj, llPage * MEM2FILE_DIRECT_PAGE_SIZE, pPage, MEM2FILE_DIRECT_PAGE_SIZE) < 0)
+    {
+        return NULL;
+    }
+
+    psSet[nVictim].llPage = llPage;
+    psSet[nVictim].uStamp = uStamp;
+    return pPage;
+}
+
+/**
+ * @brief 缓冲池中的页全部作废，文件大小变化时使用
+ */
+static void mem2file_pool_clear (MEM2FILE_Obj *pObj)
+{
+    for (long long i = 0; i < (long long)pObj->nPoolSetNum * MEM2FILE_POOL_WAYS; ++i)
+    {
+        pObj->psPoolPage[i].llPage = -1;
+        pObj->psPoolPage[i].uStamp = 0;
+    }
+}
+
+/**
+ * @brief 读取文件的第@llPage页，缓冲池中有时不读文件
+ */
+static int mem2file_direct_readpage (MEM2FILE_Obj *pObj, long long llPage, char *pBuf)
+{
+    if (pObj->nPoolSetNum > 0)
+    {
+        pthread_mutex_t *pMutex = mem2file_pool_getlock (pObj, llPage);
+        pthread_mutex_lock (pMutex);
+        const char *pPage = mem2file_pool_find (pObj, llPage, 0);
+        if (pPage != NULL)
+        {
+            memcpy (pBuf, pPage, MEM2FILE_DIRECT_PAGE_SIZE);
+        }
+        pthread_mutex_unlock (pMutex);
+
+        if (pPage != NULL)
+        {
+            return 0;
+        }
+    }
+
+    return mem2file_direct_read (pObj, llPage * MEM2FILE_DIRECT_PAGE_SIZE, pBuf, MEM2FILE_DIRECT_PAGE_SIZE);
+}
+
+/**
+ * @brief 直接读写方式下读取：小于一页时逐页经过缓冲池，否则按页对齐后直接读文件
+ */
+static int mem2file_direct_getdata (MEM2FILE_Obj *pObj, long long pos, void *pData, int nSize)
+{
+    if (pObj->nPoolSetNum > 0 && nSize < MEM2FILE_DIRECT_PAGE_SIZE)
+    {
+        for (int nDone = 0; nDone < nSize; )
+        {
+            const long long llPage = (pos + nDone) / MEM2FILE_DIRECT_PAGE_SIZE;
+            const int nOffset = (int)((pos + nDone) % MEM2FILE_DIRECT_PAGE_SIZE);
+            const int nLen = (nSize - nDone < MEM2FILE_DIRECT_PAGE_SIZE - nOffset ? 
+                            nSize - nDone : MEM2FILE_DIRECT_PAGE_SIZE - nOffset);
+
+            pthread_mutex_t *pMutex = mem2file_pool_getlock (pObj, llPage);
+            pthread_mutex_lock (pMutex);
+            const char *pPage = mem2file_pool_find (pObj, llPage, 1);
+            if (pPage != NULL)
+            {
+                memcpy ((char*)pData + nDone, pPage + nOffset, nLen);
+            }
+            pthread_mutex_unlock (pMutex);
+
+            if (NULL == pPage)
+            {
+                _error ("read page failed, page=%lld\n", llPage);
+                return -1;
+            }
+
+            nDone += nLen;
+        }
+        return 0;
+    }
+
+    if (nSize <= 0)
+    {
+        return 0;
+    }
+
+    const long long llBegin = pos / MEM2FILE_DIRECT_PAGE_SIZE * MEM2FILE_DIRECT_PAGE_SIZE;
+    const long long llEnd = (pos + nSize + MEM2FILE_DIRECT_PAGE_SIZE - 1) / MEM2FILE_DIRECT_PAGE_SIZE * MEM2FILE_DIRECT_PAGE_SIZE;
+
+    void *pBuf = NULL;
+    if (posix_memalign (&pBuf, MEM2FILE_DIRECT_PAGE_SIZE, llEnd - llBegin) != 0)
+    {
+        _error ("malloc failed, size=%lld\n", llEnd - llBegin);
+        return -1;
+    }
+
+    const int ret = mem2file_direct_read (pObj, llBegin, (char*)pBuf, llEnd - llBegin);
+    if (0 == ret)
+    {
+        memcpy (pData, (char*)pBuf + (pos - llBegin), nSize);
+    }
+
+    free (pBuf);
+    return ret;
+}
+
+/**
+ * @brief 直接读写方式下写入：按页对齐后一次写入文件，首尾不足一页的部分先读出原来的内容，
+ * 写入后再更新缓冲池中已有的页
+ */
+static int mem2file_direct_setdata (MEM2FILE_Obj *pObj, long long pos, const void *pData, int nSize)
+{
+    if (nSize <= 0)
+    {
+        return 0;
+    }
+
+    const long long llBegin = pos / MEM2FILE_DIRECT_PAGE_SIZE * MEM2FILE_DIRECT_PAGE_SIZE;
+    const long long llEnd = (pos + nSize + MEM2FILE_DIRECT_PAGE_SIZE - 1) / MEM2FILE_DIRECT_PAGE_SIZE * MEM2FILE_DIRECT_PAGE_SIZE;
+    const long long llFirstPage = llBegin / MEM2FILE_DIRECT_PAGE_SIZE;
+    const long long llLastPage = llEnd / MEM2FILE_DIRECT_PAGE_SIZE - 1;
+
+    void *pMem = NULL;
+    if (posix_memalign (&pMem, MEM2FILE_DIRECT_PAGE_SIZE, llEnd - llBegin) != 0)
+    {
+        _error ("malloc failed, size=%lld\n", llEnd - llBegin);
+        return -1;
+    }
+    char *pBuf = (char*)pMem;
+
+    int bError = 0;
+    pthread_mutex_lock (& pObj->mutexDirectWrite);
+
+    if (pos != llBegin && mem2file_direct_readpage (pObj, llFirstPage, pBuf) < 0)
+    {
+        bError = 1;
+    }
+
+    if (0 == bError && pos + nSize != llEnd && (llLastPage != llFirstPage || pos == llBegin) &&
+            mem2file_direct_readpage (pObj, llLastPage, pBuf + (llEnd - llBegin - MEM2FILE_DIRECT_PAGE_SIZE)) < 0)
+    {
+        bError = 1;
+    }
+
+    if (0 == bError)
+    {
+        memcpy (pBuf + (pos - llBegin), pData, nSize);
+
+        const ssize_t ret_write = pwrite (pObj->fd, pBuf, llEnd - llBegin, llBegin);
+        if (ret_write != llEnd - llBegin)
+        {
+            _error ("direct write failed, <pos=%lld,size=%lld>\n", llBegin, llEnd - llBegin);
+            bError = 1;
+        }
+    }
+
+    /* 末尾的页超出文件大小的部分截掉 */
+    const long long llFileSize = __atomic_load_n (& pObj->llDirectFileSize, __ATOMIC_ACQUIRE);
+    if (0 == bError && llEnd > llFileSize && ftruncate (pObj->fd, llFileSize) < 0)
+    {
+        _error ("truncate failed\n");
+        bError = 1;
+    }
+
+    for (long long llPage = llFirstPage; 0 == bError && pObj->nPoolSetNum > 0 && llPage <= llLastPage; ++llPage)
+    {
+        pthread_mutex_t *pMutex = mem2file_pool_getlock (pObj, llPage);
+        pthread_mutex_lock (pMutex);
+        char *pPage = mem2file_pool_find (pObj, llPage, 0);
+        if (pPage != NULL)
+        {
+            memcpy (pPage, pBuf + (llPage - llFirstPage) * MEM2FILE_DIRECT_PAGE_SIZE, MEM2FILE_DIRECT_PAGE_SIZE);
+        }
+        pthread_mutex_unlock (pMutex);
+    }
+
+    pthread_mutex_unlock (& pObj->mutexDirectWrite);
+
+    free (pBuf);
+    return bError ? -1 : 0;
+}
+
 /*********** GLOBAL FUNCS ***********/
 
 /**
  * @note 单进单出
  */
-MEM2FILE_HANDLE mem2file_create(const char *szFileName)
+MEM2FILE_HANDLE mem2file_create(const char *szFileName)
+{
+    return mem2file_create_ex (szFileName, 0);
+}
+
+/**
+ * @note 单进单出
+ */
+MEM2FILE_HANDLE mem2file_create_ex(const char *szFileName, int nFlags)
 {
     int bError = 0;
 
+    if ((nFlags & MEM2FILE_FLAG_MMAP) && (nFlags & MEM2FILE_FLAG_DIRECT))
+    {
+        _error ("mmap and direct can not be used together\n");
+        bError = 1;
+    }
+
     /* 打开文件 */
-    int fd = 0;
+    int fd = -1;
     if (0 == bError)
     {
-        fd = open (szFileName, O_RDWR | O_CREAT, 0664);
+        fd = open (szFileName, O_RDWR | O_CREAT | ((nFlags & MEM2FILE_FLAG_DIRECT) ? O_DIRECT : 0), 0664);
         if (fd < 0)
         {
             _error ("open <%s> failed\n", szFileName);
@@ -116,6 +694,45 @@ MEM2FILE_HANDLE mem2file_create(const char *szFileName)
     if (0 == bError)
     {
         pObj->fd = fd;
+        pObj->nFlags = nFlags;
+        pObj->pMap = NULL;
+        pObj->llMapSize = 0;
+        pObj->psRetired = NULL;
+        pObj->nRetiredNum = 0;
+        pObj->nWriteBufSize = 0;
+        pObj->llWriteFileSize = 0;
+        pObj->uWriteStamp = 0;
+        memset (pObj->asWriteBuf, 0, sizeof(pObj->asWriteBuf));
+        pObj->nPoolSetNum = 0;
+        pObj->pPoolData = NULL;
+        pObj->psPoolPage = NULL;
+        pObj->uPoolStamp = 0;
+        for (int i = 0; i < MEM2FILE_POOL_LOCK_NUM; ++i)
+        {
+            pthread_mutex_init (& pObj->amutexPool[i], NULL);
+        }
+        pthread_mutex_init (& pObj->mutexDirectWrite, NULL);
+        pObj->llDirectFileSize = 0;
+    }
+
+    /* 直接读写方式下记录文件大小 */
+    if (0 == bError && (nFlags & MEM2FILE_FLAG_DIRECT))
+    {
+        if (mem2file_getfilesize (fd, & pObj->llDirectFileSize) < 0)
+        {
+            _error ("get file size failed\n");
+            bError = 1;
+        }
+    }
+
+    /* 建立映射 */
+    if (0 == bError && (nFlags & MEM2FILE_FLAG_MMAP))
+    {
+        if (mem2file_map (pObj) < 0)
+        {
+            _error ("map <%s> failed\n", szFileName);
+            bError = 1;
+        }
     }
 
     /* 错误处理 */
@@ -129,7 +746,13 @@ MEM2FILE_HANDLE mem2file_create(const char *szFileName)
         }
         if (pObj != NULL)
         {
+            for (int i = 0; i < MEM2FILE_POOL_LOCK_NUM; ++i)
+            {
+                pthread_mutex_destroy (& pObj->amutexPool[i]);
+            }
+            pthread_mutex_destroy (& pObj->mutexDirectWrite);
             _debug ("free %p\n", pObj);
+            free (pObj);
             pObj = NULL;
         }
     }
@@ -150,6 +773,30 @@ int mem2file_close(MEM2FILE_HANDLE hInstance)
         return -1;
     }
 
+    if (pObj->nWriteBufSize > 0)
+    {
+        mem2file_setwritebuffer (hInstance, 0);
+    }
+
+    if (pObj->nFlags & MEM2FILE_FLAG_MMAP)
+    {
+        mem2file_unmap (pObj);
+    }
+
+    free (pObj->pPoolData);
+    free (pObj->psPoolPage);
+    for (int i = 0; i < MEM2FILE_POOL_LOCK_NUM; ++i)
+    {
+        pthread_mutex_destroy (& pObj->amutexPool[i]);
+    }
+    pthread_mutex_destroy (& pObj->mutexDirectWrite);
+
+    for (int i = 0; i < pObj->nRetiredNum; ++i)
+    {
+        munmap (pObj->psRetired[i].pMap, pObj->psRetired[i].llMapSize);
+    }
+    free (pObj->psRetired);
+
     if (pObj->fd >= 0)
     {
         _debug ("close fd = %d\n", pObj->fd);
@@ -167,7 +814,7 @@ int mem2file_close(MEM2FILE_HANDLE hInstance)
     return 0;
 }
 
-int mem2file_size (MEM2FILE_HANDLE hInstance, int *pnSize)
+int mem2file_size (MEM2FILE_HANDLE hInstance, long long *pllSize)
 {
     MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
 
@@ -177,10 +824,22 @@ int mem2file_size (MEM2FILE_HANDLE hInstance, int *pnSize)
         return -1;
     }
 
-    return mem2file_getfilesize (pObj->fd, pnSize);
+    if (pObj->nFlags & MEM2FILE_FLAG_MMAP)
+    { /* 映射大小与文件大小一致 */
+        *pllSize = __atomic_load_n (& pObj->llMapSize, __ATOMIC_ACQUIRE);
+        return 0;
+    }
+
+    if (pObj->nFlags & MEM2FILE_FLAG_DIRECT)
+    {
+        *pllSize = __atomic_load_n (& pObj->llDirectFileSize, __ATOMIC_ACQUIRE);
+        return 0;
+    }
+
+    return mem2file_getfilesize (pObj->fd, pllSize);
 }
 
-int mem2file_resize (MEM2FILE_HANDLE hInstance, int nSize)
+int mem2file_resize (MEM2FILE_HANDLE hInstance, long long llSize)
 {
     MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
 
@@ -190,15 +849,53 @@ int mem2file_resize (MEM2FILE_HANDLE hInstance, int nSize)
         return -1;
     }
 
-    if (ftruncate (pObj->fd, nSize) < 0)
+    if (pObj->nWriteBufSize > 0 && mem2file_writebuf_flushrange (pObj, 0, -1) < 0)
+    {
+        return -1;
+    }
+
+    if (pObj->nFlags & MEM2FILE_FLAG_DIRECT)
+    { /* 写入时按文件大小截掉末尾的页，与写入互斥 */
+        pthread_mutex_lock (& pObj->mutexDirectWrite);
+        const long long llOldSize = pObj->llDirectFileSize;
+        const int ret = ftruncate (pObj->fd, llSize);
+        if (0 == ret)
+        {
+            __atomic_store_n (& pObj->llDirectFileSize, llSize, __ATOMIC_RELEASE);
+        }
+        if (0 == ret && llSize < llOldSize)
+        { /* 缩小后再扩大的部分应为0，缓冲池中的页全部作废；扩大时缓冲池中的页仍然有效 */
+            mem2file_pool_clear (pObj);
+        }
+        pthread_mutex_unlock (& pObj->mutexDirectWrite);
+
+        if (ret < 0)
+        {
+            _error ("truncate failed\n");
+            return -1;
+        }
+    }
+    else if (ftruncate (pObj->fd, llSize) < 0)
     {
         _error ("truncate failed\n");
         return -1;
     }
+
+    pObj->llWriteFileSize = llSize;
+
+    if (pObj->nFlags & MEM2FILE_FLAG_MMAP)
+    {
+        if (mem2file_remap (pObj, llSize) < 0)
+        {
+            _error ("remap failed\n");
+            return -1;
+        }
+    }
+
     return 0;
 }
 
-int mem2file_setdata (MEM2FILE_HANDLE hInstance, int pos, const void *pData, int nSize)
+int mem2file_setdata (MEM2FILE_HANDLE hInstance, long long pos, const void *pData, int nSize)
 {
     MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
 
@@ -208,26 +905,51 @@ int mem2file_setdata (MEM2FILE_HANDLE hInstance, int pos, const void *pData, int
         return -1;
     }
 
-    int nFileSize = 0;
-    if (mem2file_getfilesize (pObj->fd, &nFileSize) < 0)
+    if (pObj->nFlags & MEM2FILE_FLAG_MMAP)
     {
-        _error ("get file size failed\n");
-        return -1;
+        const long long llMapSize = __atomic_load_n (& pObj->llMapSize, __ATOMIC_ACQUIRE);
+        if (pos < 0 || nSize < 0 || pos + nSize > llMapSize)
+        {
+            _error ("param error<pos=%lld,size=%d,total=%lld>\n", pos, nSize, llMapSize);
+            return -1;
+        }
+
+        memcpy (__atomic_load_n (& pObj->pMap, __ATOMIC_ACQUIRE) + pos, pData, nSize);
+        return 0;
+    }
+
+    if (pObj->nFlags & MEM2FILE_FLAG_DIRECT)
+    {
+        const long long llFileSize = __atomic_load_n (& pObj->llDirectFileSize, __ATOMIC_ACQUIRE);
+        if (pos < 0 || nSize < 0 || pos + nSize > llFileSize)
+        {
+            _error ("param error<pos=%lld,size=%d,total=%lld>\n", pos, nSize, llFileSize);
+            return -1;
+        }
+
+        return mem2file_direct_setdata (pObj, pos, pData, nSize);
     }
 
-    if (pos + nSize > nFileSize)
+    if (pObj->nWriteBufSize > 0)
     {
-        _error ("param error<pos=%d,size=%d,total=%d>\n", pos, nSize, nFileSize);
+        return mem2file_writebuf_set (pObj, pos, pData, nSize);
+    }
+
+    long long llFileSize = 0;
+    if (mem2file_getfilesize (pObj->fd, &llFileSize) < 0)
+    {
+        _error ("get file size failed\n");
         return -1;
     }
 
-    if (lseek (pObj->fd, pos, SEEK_SET) < 0)
+    if (pos + nSize > llFileSize)
     {
-        _error ("lseek failed\n");
+        _error ("param error<pos=%lld,size=%d,total=%lld>\n", pos, nSize, llFileSize);
         return -1;
     }
 
-    const int ret_write = write (pObj->fd, pData, nSize);
+    /* 不移动文件位置，多线程同时读写不同位置时互不影响 */
+    const int ret_write = pwrite (pObj->fd, pData, nSize, pos);
     if (ret_write != nSize)
     {
         _error ("set data to file failed or error\n");
@@ -237,7 +959,7 @@ int mem2file_setdata (MEM2FILE_HANDLE hInstance, int pos, const void *pData, int
     return 0;
 }
 
-int mem2file_getdata (MEM2FILE_HANDLE hInstance, int pos, void *pData, int nSize)
+int mem2file_getdata (MEM2FILE_HANDLE hInstance, long long pos, void *pData, int nSize)
 {
     MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
 
@@ -247,26 +969,63 @@ int mem2file_getdata (MEM2FILE_HANDLE hInstance, int pos, void *pData, int nSize
         return -1;
     }
 
-    int nFileSize = 0;
-    if (mem2file_getfilesize (pObj->fd, &nFileSize) < 0)
+    if (pObj->nFlags & MEM2FILE_FLAG_MMAP)
     {
-        _error ("get file size failed\n");
-        return -1;
+        const long long llMapSize = __atomic_load_n (& pObj->llMapSize, __ATOMIC_ACQUIRE);
+        if (pos < 0 || nSize < 0 || pos + nSize > llMapSize)
+        {
+            _error ("<pos=%lld,size=%d,total=%lld>\n", pos, nSize, llMapSize);
+            return -1;
+        }
+
+        memcpy (pData, __atomic_load_n (& pObj->pMap, __ATOMIC_ACQUIRE) + pos, nSize);
+        return 0;
+    }
+
+    if (pObj->nFlags & MEM2FILE_FLAG_DIRECT)
+    {
+        const long long llFileSize = __atomic_load_n (& pObj->llDirectFileSize, __ATOMIC_ACQUIRE);
+        if (pos < 0 || nSize < 0 || pos + nSize > llFileSize)
+        {
+            _error ("<pos=%lld,size=%d,total=%lld>\n", pos, nSize, llFileSize);
+            return -1;
+        }
+
+        return mem2file_direct_getdata (pObj, pos, pData, nSize);
+    }
+
+    if (pObj->nWriteBufSize > 0)
+    { /* 整段在缓冲区中时直接取，部分重叠时先写入文件 */
+        for (int i = 0; i < MEM2FILE_WRITEBUF_NUM; ++i)
+        {
+            const MEM2FILE_WRITEBUF *psBuf = & pObj->asWriteBuf[i];
+            if (psBuf->nLen > 0 && pos >= psBuf->llPos && nSize >= 0 && pos + nSize <= psBuf->llPos + psBuf->nLen)
+            {
+                memcpy (pData, psBuf->pData + (pos - psBuf->llPos), nSize);
+                return 0;
+            }
+        }
+
+        if (mem2file_writebuf_flushrange (pObj, pos, nSize) < 0)
+        {
+            return -1;
+        }
     }
 
-    if (pos + nSize > nFileSize)
+    long long llFileSize = 0;
+    if (mem2file_getfilesize (pObj->fd, &llFileSize) < 0)
     {
-        _error ("<pos=%d,size=%d,total=%d>\n", pos, nSize, nFileSize);
+        _error ("get file size failed\n");
         return -1;
     }
 
-    if (lseek (pObj->fd, pos, SEEK_SET) < 0)
+    if (pos + nSize > llFileSize)
     {
-        _error ("lseek failed\n");
+        _error ("<pos=%lld,size=%d,total=%lld>\n", pos, nSize, llFileSize);
         return -1;
     }
 
-    const int ret_read = read (pObj->fd, pData, nSize);
+    const int ret_read = pread (pObj->fd, pData, nSize, pos);
     if (ret_read != nSize)
     {
         _error ("get data from file failed or error\n");
@@ -276,6 +1035,165 @@ int mem2file_getdata (MEM2FILE_HANDLE hInstance, int pos, void *pData, int nSize
     return 0;
 }
 
+int mem2file_getdatav (MEM2FILE_HANDLE hInstance, long long pos, const struct iovec *psIov, int nIovNum)
+{
+    MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    long long llSize = 0;
+    for (int i = 0; i < nIovNum; ++i)
+    {
+        llSize += psIov[i].iov_len;
+    }
+
+    if (pObj->nFlags & MEM2FILE_FLAG_MMAP)
+    {
+        const long long llMapSize = __atomic_load_n (& pObj->llMapSize, __ATOMIC_ACQUIRE);
+        if (pos < 0 || nIovNum < 0 || pos + llSize > llMapSize)
+        {
+            _error ("<pos=%lld,size=%lld,total=%lld>\n", pos, llSize, llMapSize);
+            return -1;
+        }
+
+        const char *pMap = __atomic_load_n (& pObj->pMap, __ATOMIC_ACQUIRE) + pos;
+        for (int i = 0; i < nIovNum; ++i)
+        {
+            memcpy (psIov[i].iov_base, pMap, psIov[i].iov_len);
+            pMap += psIov[i].iov_len;
+        }
+        return 0;
+    }
+
+    if (pos < 0 || nIovNum < 0)
+    {
+        _error ("<pos=%lld,num=%d>\n", pos, nIovNum);
+        return -1;
+    }
+
+    if (pObj->nFlags & MEM2FILE_FLAG_DIRECT)
+    { /* 整段读入后分到各缓冲区 */
+        const long long llFileSize = __atomic_load_n (& pObj->llDirectFileSize, __ATOMIC_ACQUIRE);
+        if (pos + llSize > llFileSize || llSize > INT_MAX)
+        {
+            _error ("<pos=%lld,size=%lld,total=%lld>\n", pos, llSize, llFileSize);
+            return -1;
+        }
+
+        char *pBuf = (char*)malloc (llSize > 0 ? llSize : 1);
+        if (NULL == pBuf)
+        {
+            _error ("malloc failed, size=%lld\n", llSize);
+            return -1;
+        }
+
+        const int ret = mem2file_direct_getdata (pObj, pos, pBuf, (int)llSize);
+        const char *p = pBuf;
+        for (int i = 0; 0 == ret && i < nIovNum; ++i)
+        {
+            memcpy (psIov[i].iov_base, p, psIov[i].iov_len);
+            p += psIov[i].iov_len;
+        }
+
+        free (pBuf);
+        return ret;
+    }
+
+    if (pObj->nWriteBufSize > 0 && mem2file_writebuf_flushrange (pObj, pos, llSize) < 0)
+    {
+        return -1;
+    }
+
+    /* 每次最多IOV_MAX个缓冲区；不另外取文件大小，读到文件末尾时读取的长度不足 */
+    for (int i = 0; i < nIovNum; )
+    {
+        const int nNum = (nIovNum - i < IOV_MAX ? nIovNum - i : IOV_MAX);
+        long long llPart = 0;
+        for (int k = i; k < i + nNum; ++k)
+        {
+            llPart += psIov[k].iov_len;
+        }
+
+        const ssize_t ret_read = preadv (pObj->fd, psIov + i, nNum, pos);
+        if (ret_read != llPart)
+        {
+            _error ("get data from file failed or error, <pos=%lld,size=%lld,read=%lld>\n", pos, llPart, (long long)ret_read);
+            return -1;
+        }
+
+        pos += llPart;
+        i += nNum;
+    }
+
+    return 0;
+}
+
+int mem2file_getaddr (MEM2FILE_HANDLE hInstance, long long pos, int nSize, void **ppAddr)
+{
+    MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    const long long llMapSize = __atomic_load_n (& pObj->llMapSize, __ATOMIC_ACQUIRE);
+    char *pMap = __atomic_load_n (& pObj->pMap, __ATOMIC_ACQUIRE);
+    if (! (pObj->nFlags & MEM2FILE_FLAG_MMAP) || NULL == pMap)
+    {
+        return -1;
+    }
+
+    if (pos < 0 || nSize < 0 || pos + nSize > llMapSize)
+    {
+        _error ("<pos=%lld,size=%d,total=%lld>\n", pos, nSize, llMapSize);
+        return -1;
+    }
+
+    *ppAddr = pMap + pos;
+    return 0;
+}
+
+int mem2file_getpos (MEM2FILE_HANDLE hInstance, const void *pAddr, long long *pllPos)
+{
+    MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    if (! (pObj->nFlags & MEM2FILE_FLAG_MMAP))
+    {
+        return -1;
+    }
+
+    const char *p = (const char*)pAddr;
+    if (pObj->pMap != NULL && p >= pObj->pMap && p < pObj->pMap + pObj->llMapSize)
+    {
+        *pllPos = p - pObj->pMap;
+        return 0;
+    }
+
+    for (int i = 0; i < pObj->nRetiredNum; ++i)
+    {
+        const MEM2FILE_MAPPING *psMap = & pObj->psRetired[i];
+        if (p >= psMap->pMap && p < psMap->pMap + psMap->llMapSize)
+        {
+            *pllPos = p - psMap->pMap;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
 int mem2file_sync (MEM2FILE_HANDLE hInstance)
 {
     MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
@@ -286,6 +1204,24 @@ int mem2file_sync (MEM2FILE_HANDLE hInstance)
         return -1;
     }
 
+    /* 先取大小：扩大映射时先替换地址再更新大小，取到的大小不会超过取到的映射 */
+    const long long llMapSize = __atomic_load_n (& pObj->llMapSize, __ATOMIC_ACQUIRE);
+    char *pMap = __atomic_load_n (& pObj->pMap, __ATOMIC_ACQUIRE);
+    if ((pObj->nFlags & MEM2FILE_FLAG_MMAP) && pMap != NULL)
+    {
+        if (msync (pMap, llMapSize, MS_SYNC) < 0)
+        {
+            _error ("msync failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (pObj->nWriteBufSize > 0 && mem2file_writebuf_flushrange (pObj, 0, -1) < 0)
+    {
+        return -1;
+    }
+
     if (fsync (pObj->fd) < 0)
     {
         _error ("fsync failed\n");
@@ -293,4 +1229,115 @@ int mem2file_sync (MEM2FILE_HANDLE hInstance)
     }
 
     return 0;
-}
\ No newline at end of file
+}
+int mem2file_setwritebuffer (MEM2FILE_HANDLE hInstance, int nSize)
+{
+    MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    if (pObj->nFlags & (MEM2FILE_FLAG_MMAP | MEM2FILE_FLAG_DIRECT))
+    { /* 映射方式下写入本来就是内存拷贝，直接读写方式下每次写入都按页对齐 */
+        return 0;
+    }
+
+    int bError = 0;
+    if (mem2file_writebuf_flushrange (pObj, 0, -1) < 0)
+    {
+        bError = 1;
+    }
+
+    for (int i = 0; i < MEM2FILE_WRITEBUF_NUM; ++i)
+    {
+        free (pObj->asWriteBuf[i].pData);
+        pObj->asWriteBuf[i].pData = NULL;
+        pObj->asWriteBuf[i].nLen = 0;
+    }
+    pObj->nWriteBufSize = 0;
+
+    if (bError || nSize <= 0)
+    {
+        return bError ? -1 : 0;
+    }
+
+    if (mem2file_getfilesize (pObj->fd, & pObj->llWriteFileSize) < 0)
+    {
+        _error ("get file size failed\n");
+        return -1;
+    }
+
+    for (int i = 0; i < MEM2FILE_WRITEBUF_NUM; ++i)
+    {
+        pObj->asWriteBuf[i].pData = (char*)malloc (nSize);
+        if (NULL == pObj->asWriteBuf[i].pData)
+        {
+            _error ("malloc failed, size=%d\n", nSize);
+            mem2file_setwritebuffer (hInstance, 0);
+            return -1;
+        }
+    }
+    pObj->nWriteBufSize = nSize;
+
+    return 0;
+}
+
+int mem2file_setbufferpool (MEM2FILE_HANDLE hInstance, long long llSize)
+{
+    MEM2FILE_Obj *pObj = (MEM2FILE_Obj*)hInstance;
+
+    if (NULL == pObj)
+    {
+        _error ("null obj\n");
+        return -1;
+    }
+
+    if (! (pObj->nFlags & MEM2FILE_FLAG_DIRECT))
+    { /* 经过页缓存，不需要 */
+        return 0;
+    }
+
+    free (pObj->pPoolData);
+    free (pObj->psPoolPage);
+    pObj->pPoolData = NULL;
+    pObj->psPoolPage = NULL;
+    pObj->nPoolSetNum = 0;
+
+    const long long llSetNum = llSize / (MEM2FILE_POOL_WAYS * MEM2FILE_DIRECT_PAGE_SIZE);
+    if (llSetNum <= 0)
+    {
+        return 0;
+    }
+
+    if (llSetNum > INT_MAX)
+    {
+        _error ("pool too large, size=%lld\n", llSize);
+        return -1;
+    }
+
+    void *pMem = NULL;
+    if (posix_memalign (&pMem, MEM2FILE_DIRECT_PAGE_SIZE, llSetNum * MEM2FILE_POOL_WAYS * MEM2FILE_DIRECT_PAGE_SIZE) != 0)
+    {
+        _error ("malloc failed, size=%lld\n", llSize);
+        return -1;
+    }
+
+    pObj->psPoolPage = (MEM2FILE_POOLPAGE*)malloc (sizeof(MEM2FILE_POOLPAGE) * llSetNum * MEM2FILE_POOL_WAYS);
+    if (NULL == pObj->psPoolPage)
+    {
+        _error ("malloc failed, num=%lld\n", llSetNum * MEM2FILE_POOL_WAYS);
+        free (pMem);
+        return -1;
+    }
+
+    pObj->pPoolData = (char*)pMem;
+    pObj->nPoolSetNum = (int)llSetNum;
+    mem2file_pool_clear (pObj);
+
+    _debug ("buffer pool set, <size=%lld,set=%d>\n", llSize, pObj->nPoolSetNum);
+
+    return 0;
+}
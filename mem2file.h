@@ -18,6 +18,15 @@ extern "C" {
 
 typedef void * MEM2FILE_HANDLE;
 
+struct iovec;
+
+/* 实例的工作方式，可组合使用 */
+#define MEM2FILE_FLAG_MMAP  0x1     /* 将整个文件映射到内存，读写变为内存拷贝 */
+#define MEM2FILE_FLAG_DIRECT 0x2    /* 以O_DIRECT打开文件，不经过页缓存；不能与MEM2FILE_FLAG_MMAP同时使用 */
+
+/* 直接读写方式下的对齐大小，也是缓冲池中页的大小 */
+#define MEM2FILE_DIRECT_PAGE_SIZE 4096
+
 /**
  * @brief mem2file_create 创建实例
  * @param [IN] szFileName 绑定的文件
@@ -25,6 +34,16 @@ typedef void * MEM2FILE_HANDLE;
  */
 MEM2FILE_HANDLE mem2file_create(const char *szFileName);
 
+/**
+ * @brief mem2file_create_ex 以指定的方式创建实例
+ * @param [IN] szFileName 绑定的文件
+ * @param [IN] nFlags MEM2FILE_FLAG_* 的组合，为0时与mem2file_create相同
+ * @return 失败返回0，否则返回新创建的实例句柄
+ * @note 使用MEM2FILE_FLAG_MMAP时，文件大小的修改只能通过本实例进行；
+ * 使用MEM2FILE_FLAG_DIRECT时，文件系统不支持O_DIRECT则失败
+ */
+MEM2FILE_HANDLE mem2file_create_ex(const char *szFileName, int nFlags);
+
 /**
  * @brief mem2file_close 关闭实例，并释放对应的资源
  * @param [IN] hInstance 实例句柄
@@ -36,19 +55,22 @@ int mem2file_close(MEM2FILE_HANDLE hInstance);
 /**
  * @brief mem2file_size 获取实例的大小
  * @param [IN] hInstace 实例句柄
- * @param [OUT] pSize 实例的大小
+ * @param [OUT] pllSize 实例的大小
  * @return 成功返回0，否则返回-1
  */
-int mem2file_size (MEM2FILE_HANDLE hInstance, int *pnSize);
+int mem2file_size (MEM2FILE_HANDLE hInstance, long long *pllSize);
 
 /**
  * @brief mem2file_resize 修改实例的大小
  * @param [IN] hInstace 实例句柄
- * @param [IN] nSize 新的实例大小
+ * @param [IN] llSize 新的实例大小，可以超过2GB
  * @return 成功返回0，否则返回-1
  * @note 扩展的区域数据被填充为0。当由小扩大时，耗时。
+ * 映射方式下扩大时建立新的映射，之前的映射保留到关闭时才解除，之前得到的地址仍然有效，
+ * 其他线程可以同时读写；缩小时重新映射，之前通过映射得到的地址可能失效。
+ * 直接读写方式下扩大时缓冲池仍然有效，其他线程可以同时读写；缩小时缓冲池清空，不能同时读写。
  */
-int mem2file_resize (MEM2FILE_HANDLE hInstance, int nSize);
+int mem2file_resize (MEM2FILE_HANDLE hInstance, long long llSize);
 
 /**
  * @brief mem2file_setdata 写入数据
@@ -56,7 +78,7 @@ int mem2file_resize (MEM2FILE_HANDLE hInstance, int nSize);
  * @param [IN] pData 数据指针
  * @param [IN] nSize 数据大小
  */
-int mem2file_setdata (MEM2FILE_HANDLE hInstance, int pos, const void *pData, int nSize);
+int mem2file_setdata (MEM2FILE_HANDLE hInstance, long long pos, const void *pData, int nSize);
 
 /**
  * @brief mem2file_getdata 获取数据
@@ -65,13 +87,67 @@ int mem2file_setdata (MEM2FILE_HANDLE hInstance, int pos, const void *pData, int
  * @param [IN] nSize 数据大小
  * @return 成功返回0，否则返回-1
  */
-int mem2file_getdata (MEM2FILE_HANDLE hInstance, int pos, void *pData, int nSize);
+int mem2file_getdata (MEM2FILE_HANDLE hInstance, long long pos, void *pData, int nSize);
+
+/**
+ * @brief mem2file_getdatav 读取一段连续的数据，依次放入多个缓冲区
+ * @param [IN] hInstance 实例句柄
+ * @param [IN] pos 数据位置
+ * @param [IN] psIov 缓冲区，数据总大小为各缓冲区大小之和
+ * @param [IN] nIovNum 缓冲区个数
+ * @return 成功返回0，否则返回-1
+ * @note 非映射方式下合并为preadv，映射方式下为内存拷贝
+ */
+int mem2file_getdatav (MEM2FILE_HANDLE hInstance, long long pos, const struct iovec *psIov, int nIovNum);
+
+/**
+ * @brief mem2file_getaddr 获取数据在内存中的地址
+ * @param [IN] hInstance 实例句柄
+ * @param [IN] pos 数据位置
+ * @param [IN] nSize 数据大小
+ * @param [OUT] ppAddr 数据地址
+ * @return 成功返回0，否则返回-1
+ * @note 仅映射方式下可用，地址在关闭或缩小之前有效
+ */
+int mem2file_getaddr (MEM2FILE_HANDLE hInstance, long long pos, int nSize, void **ppAddr);
+
+/**
+ * @brief mem2file_getpos 由mem2file_getaddr得到的地址取得数据位置
+ * @param [IN] hInstance 实例句柄
+ * @param [IN] pAddr 数据地址，可以是扩大之前得到的
+ * @param [OUT] pllPos 数据位置
+ * @return 成功返回0，不在映射中返回-1
+ * @note 仅映射方式下可用，不能与修改大小同时调用
+ */
+int mem2file_getpos (MEM2FILE_HANDLE hInstance, const void *pAddr, long long *pllPos);
 
 /**
  * @brief mem2file_sync 写磁盘
+ * @note 映射方式下为msync
  */
  int mem2file_sync (MEM2FILE_HANDLE hInstance);
 
+/**
+ * @brief mem2file_setwritebuffer 合并写入：顺序的小块写入先放在缓冲区中，满时一次写入文件
+ * @param [IN] hInstance 实例句柄
+ * @param [IN] nSize 每个缓冲区的大小，为0时写入缓冲区中的数据并停止合并
+ * @return 成功返回0，否则返回-1
+ * @note 同时保留几段顺序写入，读取时能读到缓冲区中的数据；修改大小、写磁盘和关闭前先写入文件。
+ * 合并期间调用者保证没有其他线程同时读写本实例；映射方式和直接读写方式下不合并，直接返回
+ */
+int mem2file_setwritebuffer (MEM2FILE_HANDLE hInstance, int nSize);
+
+/**
+ * @brief mem2file_setbufferpool 设置直接读写方式下的私有缓冲池
+ * @param [IN] hInstance 实例句柄
+ * @param [IN] llSize 缓冲池的大小（字节），为0时不使用缓冲池
+ * @return 成功返回0，否则返回-1
+ * @note 小于一页的读取经过缓冲池，缓冲池满时换出最久未使用的页；一页及以上的读取直接读文件，不占用缓冲池。
+ * 写入总是直接写文件，同时更新缓冲池中已有的页。调用者保证设置期间没有其他线程读写本实例；
+ * 不是直接读写方式时不需要，直接返回
+ */
+int mem2file_setbufferpool (MEM2FILE_HANDLE hInstance, long long llSize);
+
 #ifdef __cplusplus
 }
 #endif 
@@ -9,6 +9,30 @@ int main()
 {
     test_filemap ();
     //test_filemap1 ();
+    test_filemap_mmap ();
+    test_filemap_borrow ();
+    test_filemap_range ();
+    test_bitmap ();
+    test_filemap_freelist ();
+    test_filemap_thread ();
+    test_filemap_seqread ();
+    test_filemap_shared ();
+    test_filemap_wal ();
+    test_filemap_durability ();
+    test_filemap_value ();
+    test_filemap_binkey ();
+    test_filemap_hash ();
+    test_filemap_open ();
+    test_filemap_grow ();
+    test_filemap_migrate ();
+    test_filemap_multiget ();
+    test_filemap_multiset ();
+    test_filemap_iter ();
+    test_filemap_foreach ();
+    test_filemap_bulkload ();
+    test_filemap_large ();
+    test_filemap_direct ();
+    test_filemap_initfail ();
 
     printf ("\nTEST SUCCESSFUL! \n\n\n");
     
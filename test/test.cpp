@@ -7,6 +7,13 @@
 #include <assert.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include <map>
 #include <string>
@@ -48,19 +55,21 @@
 
 // #include <filemap.h>
 #include "../filemap.h"
+#include "../bitmap.h"
+#include "../hash.h"
 
 /**
  * 对合法的操作进行测试
  * 
  */
-int test_filemap_normal (int nTotalNum, int nTestNum, const char *szFileName)
+int test_filemap_normal (int nTotalNum, int nTestNum, const char *szFileName, int nFlags = 0)
 {
-    _debug ("testing: [%d,%d,%s]\n", nTotalNum, nTestNum, szFileName);
+    _debug ("testing: [%d,%d,%s,flags=%#x]\n", nTotalNum, nTestNum, szFileName, nFlags);
 
     char szObjFile[64] = {};
-    snprintf (szObjFile, sizeof(szObjFile), "test.dat_normal_%d_%d", nTotalNum, nTestNum);
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_normal_%d_%d_%x", nTotalNum, nTestNum, nFlags);
 
-    FILEMAP_HANDLE hFileMap = filemap_create (szObjFile, nTotalNum);
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szObjFile, nTotalNum, nFlags);
 
     assert (hFileMap != NULL);
 
@@ -234,10 +243,10 @@ int test_filemap_normal (int nTotalNum, int nTestNum, const char *szFileName)
  * 利用已有的结构 std::map 来对filemap进行检查
  * 两者进行完全一致的操作，行为也应该完全一致
  */
-static int test_filemap_reload (int nTotalNum, const char *szFileName)
+static int test_filemap_reload (int nTotalNum, const char *szFileName, int nFlags = 0)
 {
     char szObjFileName[64] = {};
-    snprintf (szObjFileName, sizeof(szObjFileName), "%s_%d.dat", __FUNCTION__, nTotalNum);
+    snprintf (szObjFileName, sizeof(szObjFileName), "%s_%d_%x.dat", __FUNCTION__, nTotalNum, nFlags);
 
     _debug ("reload test: <num=%d>\n", nTotalNum);
 
@@ -257,11 +266,11 @@ static int test_filemap_reload (int nTotalNum, const char *szFileName)
         FILEMAP_HANDLE hFileMap = 0;
         if (access (szObjFileName, F_OK) == 0)
         {
-            hFileMap = filemap_load (szObjFileName);
+            hFileMap = filemap_load_ex (szObjFileName, nFlags);
         }
         else 
         {
-            hFileMap = filemap_create (szObjFileName, nTotalNum);
+            hFileMap = filemap_create_ex (szObjFileName, nTotalNum, nFlags);
         }
 
         assert (hFileMap != 0);
@@ -400,4 +409,3393 @@ int test_filemap1 ()
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+/* 映射方式下的增删改查及重复载入测试 */
+int test_filemap_mmap ()
+{
+    test_filemap_normal (10, 10, "10_10_mmap.txt", FILEMAP_FLAG_MMAP);
+    test_filemap_normal (1000, 501, "1000_501_mmap.txt", FILEMAP_FLAG_MMAP);
+    test_filemap_normal (1000, 1000, "1000_1000_mmap.txt", FILEMAP_FLAG_MMAP);
+
+    int nNum[] = {
+        5, 57, 950,
+    };
+    for (int i = 0; i < (int)(sizeof(nNum) / sizeof(nNum[0])); ++i)
+    {
+        char szFileName[64] = {};
+        snprintf (szFileName, sizeof(szFileName), "filemap_%s_%d.txt", __FUNCTION__,nNum[i]);
+        test_filemap_reload (nNum[i], szFileName, FILEMAP_FLAG_MMAP);
+    }
+
+    return 0;
+}
+
+/**
+ * 借用测试
+ * 借用期间修改和删除都不应影响借出的值，被占用的位置在归还后才释放
+ */
+static int test_filemap_borrow_flags (int nFlags)
+{
+    const int nTotalNum = 10;
+
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_borrow_%x", nFlags);
+
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szObjFile, nTotalNum, nFlags);
+    assert (hFileMap != NULL);
+
+    for (int i = 0; i < nTotalNum / 2; ++i)
+    {
+        FILEMAP_KEY key = {};
+        FILEMAP_VALUE value = {};
+        snprintf (key.szKey, sizeof(key.szKey), "name%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "value%d", i);
+        int ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+
+    /* 借用后修改 */
+    FILEMAP_KEY key0 = {};
+    snprintf (key0.szKey, sizeof(key0.szKey), "name0");
+
+    const FILEMAP_VALUE *pValue0 = NULL;
+    int ret = filemap_acquireitem (hFileMap, &key0, &pValue0);
+    assert (ret == 0);
+    assert (strcmp (pValue0->byteData, "value0") == 0);
+
+    FILEMAP_VALUE valueMod = {};
+    snprintf (valueMod.byteData, sizeof(valueMod.byteData), "value0_mod");
+    ret = filemap_setitem (hFileMap, &key0, &valueMod);
+    assert (ret == 0);
+    assert (strcmp (pValue0->byteData, "value0") == 0);
+
+    FILEMAP_VALUE valueGet = {};
+    ret = filemap_getitem (hFileMap, &key0, &valueGet);
+    assert (ret == 0);
+    assert (strcmp (valueGet.byteData, "value0_mod") == 0);
+
+    /* 借用后删除 */
+    FILEMAP_KEY key1 = {};
+    snprintf (key1.szKey, sizeof(key1.szKey), "name1");
+
+    const FILEMAP_VALUE *pValue1 = NULL;
+    ret = filemap_acquireitem (hFileMap, &key1, &pValue1);
+    assert (ret == 0);
+
+    ret = filemap_deleteitem (hFileMap, &key1);
+    assert (ret == 0);
+    assert (filemap_existitem (hFileMap, &key1) == 0);
+    assert (strcmp (pValue1->byteData, "value1") == 0);
+
+    /* 修改占用了新位置，且被借用的两个位置尚未释放，只能再加入4项 */
+    for (int i = nTotalNum / 2; i < nTotalNum; ++i)
+    {
+        FILEMAP_KEY key = {};
+        FILEMAP_VALUE value = {};
+        snprintf (key.szKey, sizeof(key.szKey), "name%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "value%d", i);
+        ret = filemap_setitem (hFileMap, &key, &value);
+        assert ((i < nTotalNum - 1) ? (ret == 0) : (ret < 0));
+    }
+
+    ret = filemap_releaseitem (hFileMap, pValue0);
+    assert (ret == 0);
+    ret = filemap_releaseitem (hFileMap, pValue1);
+    assert (ret == 0);
+
+    /* 归还后位置被释放，可以重新加满 */
+    for (int i = nTotalNum - 1; i < nTotalNum + 1; ++i)
+    {
+        FILEMAP_KEY key = {};
+        FILEMAP_VALUE value = {};
+        snprintf (key.szKey, sizeof(key.szKey), "name%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "value%d", i);
+        ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+
+    ret = filemap_getitem (hFileMap, &key0, &valueGet);
+    assert (ret == 0);
+    assert (strcmp (valueGet.byteData, "value0_mod") == 0);
+
+    int ret_close = filemap_close (hFileMap);
+    assert (ret_close == 0);
+
+    return 0;
+}
+
+int test_filemap_borrow ()
+{
+    test_filemap_borrow_flags (0);
+    test_filemap_borrow_flags (FILEMAP_FLAG_MMAP);
+
+    return 0;
+}
+
+/* 部分读写测试 */
+static int test_filemap_range_flags (int nFlags)
+{
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_range_%x", nFlags);
+
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szObjFile, 100, nFlags);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    snprintf (key.szKey, sizeof(key.szKey), "counter");
+    memset (value.byteData, 'a', sizeof(value.byteData));
+    int ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret == 0);
+
+    /* 修改头部计数 */
+    for (long long llCount = 1; llCount <= 10; ++llCount)
+    {
+        ret = filemap_setrange (hFileMap, &key, 16, &llCount, sizeof(llCount));
+        assert (ret == 0);
+
+        long long llGet = 0;
+        ret = filemap_getrange (hFileMap, &key, 16, &llGet, sizeof(llGet));
+        assert (ret == 0);
+        assert (llGet == llCount);
+    }
+
+    /* 其余部分不变 */
+    FILEMAP_VALUE valueGet = {};
+    ret = filemap_getitem (hFileMap, &key, &valueGet);
+    assert (ret == 0);
+    long long llCount = 10;
+    memcpy (value.byteData + 16, &llCount, sizeof(llCount));
+    assert (memcmp (value.byteData, valueGet.byteData, sizeof(value.byteData)) == 0);
+
+    /* 末尾 */
+    ret = filemap_setrange (hFileMap, &key, sizeof(value.byteData) - 1, "z", 1);
+    assert (ret == 0);
+    char c = 0;
+    ret = filemap_getrange (hFileMap, &key, sizeof(value.byteData) - 1, &c, 1);
+    assert (ret == 0 && c == 'z');
+
+    /* 越界和不存在 */
+    ret = filemap_getrange (hFileMap, &key, sizeof(value.byteData) - 1, &llCount, sizeof(llCount));
+    assert (ret < 0);
+    ret = filemap_setrange (hFileMap, &key, -1, &c, 1);
+    assert (ret < 0);
+
+    FILEMAP_KEY keyNone = {};
+    snprintf (keyNone.szKey, sizeof(keyNone.szKey), "none");
+    ret = filemap_setrange (hFileMap, &keyNone, 0, &c, 1);
+    assert (ret < 0);
+    assert (filemap_existitem (hFileMap, &keyNone) == 0);
+
+    /* 借用期间修改 */
+    const FILEMAP_VALUE *pValue = NULL;
+    ret = filemap_acquireitem (hFileMap, &key, &pValue);
+    assert (ret == 0);
+    ret = filemap_setrange (hFileMap, &key, 0, "b", 1);
+    assert (ret == 0);
+    assert (pValue->byteData[0] == 'a');
+    ret = filemap_getrange (hFileMap, &key, 0, &c, 1);
+    assert (ret == 0 && c == 'b');
+    ret = filemap_getrange (hFileMap, &key, sizeof(value.byteData) - 1, &c, 1);
+    assert (ret == 0 && c == 'z');
+    ret = filemap_releaseitem (hFileMap, pValue);
+    assert (ret == 0);
+
+    int ret_close = filemap_close (hFileMap);
+    assert (ret_close == 0);
+
+    return 0;
+}
+
+int test_filemap_range ()
+{
+    test_filemap_range_flags (0);
+    test_filemap_range_flags (FILEMAP_FLAG_MMAP);
+
+    return 0;
+}
+
+/* 空位栈测试：重新加载后继续复用空位，旧版本文件只在明确要求时就地升级 */
+static int test_filemap_freelist_flags (int nFlags)
+{
+    const int nNum = 64;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_freelist_%x", nFlags);
+
+    /* 后面要改写成V1.0文件，使用字符串键的格式 */
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.bStringKey = 1;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    int ret = 0;
+
+    /* 写满 */
+    for (int i = 0; i < nNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "key_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "value_%d", i);
+        ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+    snprintf (key.szKey, sizeof(key.szKey), "key_full");
+    ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret < 0);
+
+    /* 删除一部分后重新加载 */
+    for (int i = 0; i < nNum; i += 4)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "key_%d", i);
+        ret = filemap_deleteitem (hFileMap, &key);
+        assert (ret == 0);
+    }
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+
+    /* 删除的空位可以再次使用，且仅有这么多 */
+    for (int i = 0; i < nNum; i += 4)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "key_new_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "value_new_%d", i);
+        ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+    snprintf (key.szKey, sizeof(key.szKey), "key_full");
+    ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret < 0);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 改写成旧版本文件：去掉末尾的空位栈，版本号改为V1.0 */
+    const int nFreeListSize = (2 + 2 * nNum) * sizeof(int);
+    FILE *fp = fopen (szObjFile, "r+");
+    assert (fp != NULL);
+    fseek (fp, 0, SEEK_END);
+    const long lFileSize = ftell (fp);
+    char szVersion[16] = "FILEMAP V1.0";
+    fseek (fp, 0, SEEK_SET);
+    fwrite (szVersion, sizeof(szVersion), 1, fp);
+    fclose (fp);
+    ret = truncate (szObjFile, lFileSize - nFreeListSize);
+    assert (ret == 0);
+
+    /* 没有要求升级时加载和创建都失败，文件不变 */
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap == NULL);
+    hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap == NULL);
+    struct stat st = {};
+    ret = stat (szObjFile, &st);
+    assert (ret == 0);
+    assert (st.st_size == lFileSize - nFreeListSize);
+    char szVersionGet[16] = {};
+    fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    assert (fread (szVersionGet, sizeof(szVersionGet), 1, fp) == 1);
+    fclose (fp);
+    assert (strcmp (szVersionGet, szVersion) == 0);
+
+    hFileMap = filemap_load_ex (szObjFile, nFlags | FILEMAP_FLAG_UPGRADE);
+    assert (hFileMap != NULL);
+
+    /* 数据不变，已满 */
+    for (int i = 0; i < nNum; ++i)
+    {
+        FILEMAP_VALUE valueExpect = {};
+        if (i % 4 == 0)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "key_new_%d", i);
+            snprintf (valueExpect.byteData, sizeof(valueExpect.byteData), "value_new_%d", i);
+        }
+        else 
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "key_%d", i);
+            snprintf (valueExpect.byteData, sizeof(valueExpect.byteData), "value_%d", i);
+        }
+        FILEMAP_VALUE valueGet = {};
+        ret = filemap_getitem (hFileMap, &key, &valueGet);
+        assert (ret == 0);
+        assert (strcmp (valueGet.byteData, valueExpect.byteData) == 0);
+    }
+    snprintf (key.szKey, sizeof(key.szKey), "key_full");
+    ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret < 0);
+
+    /* 升级后的空位栈可用 */
+    snprintf (key.szKey, sizeof(key.szKey), "key_1");
+    ret = filemap_deleteitem (hFileMap, &key);
+    assert (ret == 0);
+    snprintf (key.szKey, sizeof(key.szKey), "key_full");
+    ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret == 0);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_freelist ()
+{
+    test_filemap_freelist_flags (0);
+    test_filemap_freelist_flags (FILEMAP_FLAG_MMAP);
+
+    return 0;
+}
+
+/* 多线程测试的参数 */
+typedef struct 
+{
+    FILEMAP_HANDLE hFileMap;
+    int nThreadIndex;
+    int nKeyNum;
+    int nRound;
+} TEST_THREAD_ARG;
+
+/* 每个线程反复增删改自己的key，并读取公共的key */
+static void *test_filemap_thread_func (void *pArg)
+{
+    TEST_THREAD_ARG *psArg = (TEST_THREAD_ARG*)pArg;
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    FILEMAP_VALUE valueGet = {};
+
+    for (int r = 0; r < psArg->nRound; ++r)
+    {
+        for (int i = 0; i < psArg->nKeyNum; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "thread_%d_%d", psArg->nThreadIndex, i);
+            snprintf (value.byteData, sizeof(value.byteData), "value_%d_%d_%d", psArg->nThreadIndex, i, r);
+            int ret = filemap_setitem (psArg->hFileMap, &key, &value);
+            assert (ret == 0);
+
+            ret = filemap_getitem (psArg->hFileMap, &key, &valueGet);
+            assert (ret == 0);
+            assert (strcmp (value.byteData, valueGet.byteData) == 0);
+
+            snprintf (key.szKey, sizeof(key.szKey), "shared_%d", i);
+            ret = filemap_getitem (psArg->hFileMap, &key, &valueGet);
+            assert (ret == 0);
+            snprintf (value.byteData, sizeof(value.byteData), "shared_value_%d", i);
+            assert (strcmp (value.byteData, valueGet.byteData) == 0);
+        }
+
+        /* 除最后一轮外删除，让空位在线程间流转 */
+        for (int i = 0; i < psArg->nKeyNum && r + 1 < psArg->nRound; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "thread_%d_%d", psArg->nThreadIndex, i);
+            int ret = filemap_deleteitem (psArg->hFileMap, &key);
+            assert (ret == 0);
+        }
+    }
+
+    return NULL;
+}
+
+static int test_filemap_thread_flags (int nFlags, int nIndexLayout = FILEMAP_INDEX_CHAIN)
+{
+    const int nThreadNum = 8;
+    const int nKeyNum = 50;
+    const int nSharedNum = 50;
+
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_thread_%x_%d", nFlags, nIndexLayout);
+    unlink (szObjFile);
+
+    /* 容量较小，使哈希冲突和链表操作较多 */
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.nIndexLayout = nIndexLayout;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nThreadNum * nKeyNum + nSharedNum, &sOption);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    for (int i = 0; i < nSharedNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "shared_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "shared_value_%d", i);
+        int ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+
+    pthread_t threads[nThreadNum];
+    TEST_THREAD_ARG args[nThreadNum];
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        args[i].hFileMap = hFileMap;
+        args[i].nThreadIndex = i;
+        args[i].nKeyNum = nKeyNum;
+        args[i].nRound = 20;
+        int ret = pthread_create (&threads[i], NULL, test_filemap_thread_func, &args[i]);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        pthread_join (threads[i], NULL);
+    }
+
+    /* 已满，且每一项都正确 */
+    snprintf (key.szKey, sizeof(key.szKey), "key_full");
+    int ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret < 0);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+
+    for (int t = 0; t < nThreadNum; ++t)
+    {
+        for (int i = 0; i < nKeyNum; ++i)
+        {
+            FILEMAP_VALUE valueGet = {};
+            snprintf (key.szKey, sizeof(key.szKey), "thread_%d_%d", t, i);
+            snprintf (value.byteData, sizeof(value.byteData), "value_%d_%d_%d", t, i, args[t].nRound - 1);
+            ret = filemap_getitem (hFileMap, &key, &valueGet);
+            assert (ret == 0);
+            assert (strcmp (value.byteData, valueGet.byteData) == 0);
+        }
+    }
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_thread ()
+{
+    test_filemap_thread_flags (0);
+    test_filemap_thread_flags (FILEMAP_FLAG_MMAP);
+    test_filemap_thread_flags (0, FILEMAP_INDEX_OPEN);
+    test_filemap_thread_flags (FILEMAP_FLAG_MMAP | FILEMAP_FLAG_WAL, FILEMAP_INDEX_OPEN);
+
+    return 0;
+}
+
+/* 不加锁读取测试的参数 */
+typedef struct 
+{
+    FILEMAP_HANDLE hFileMap;
+    int nKeyNum;
+    int nRound;
+    int bWriter;
+} TEST_SEQREAD_ARG;
+
+/* 写线程将值整体改为同一个字符，读线程检查读到的值没有被写了一半 */
+static void *test_filemap_seqread_func (void *pArg)
+{
+    TEST_SEQREAD_ARG *psArg = (TEST_SEQREAD_ARG*)pArg;
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+
+    for (int r = 0; r < psArg->nRound; ++r)
+    {
+        for (int i = 0; i < psArg->nKeyNum; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "seqread_%d", i);
+            if (psArg->bWriter)
+            {
+                memset (value.byteData, 'a' + (r + i) % 26, sizeof(value.byteData));
+                int ret = filemap_setitem (psArg->hFileMap, &key, &value);
+                assert (ret == 0);
+
+                /* 删除后再加入，使链表变化 */
+                if (i % 7 == 0)
+                {
+                    ret = filemap_deleteitem (psArg->hFileMap, &key);
+                    assert (ret == 0);
+                    ret = filemap_setitem (psArg->hFileMap, &key, &value);
+                    assert (ret == 0);
+                }
+            }
+            else 
+            {
+                int ret = filemap_getitem (psArg->hFileMap, &key, &value);
+                if (ret == 0)
+                {
+                    for (int k = 1; k < (int)sizeof(value.byteData); ++k)
+                    {
+                        assert (value.byteData[k] == value.byteData[0]);
+                    }
+                }
+                else 
+                { /* 只有删除后再加入的key可能短暂不存在 */
+                    assert (i % 7 == 0);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int test_filemap_seqread_flags (int nFlags)
+{
+    const int nKeyNum = 60;
+    const int nReaderNum = 4;
+
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_seqread_%x", nFlags);
+
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szObjFile, nKeyNum + 2, nFlags);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    memset (value.byteData, 'z', sizeof(value.byteData));
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "seqread_%d", i);
+        int ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+
+    pthread_t threads[nReaderNum + 1];
+    TEST_SEQREAD_ARG args[nReaderNum + 1];
+    for (int i = 0; i < nReaderNum + 1; ++i)
+    {
+        args[i].hFileMap = hFileMap;
+        args[i].nKeyNum = nKeyNum;
+        args[i].nRound = 50;
+        args[i].bWriter = (i == 0);
+        int ret = pthread_create (&threads[i], NULL, test_filemap_seqread_func, &args[i]);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nReaderNum + 1; ++i)
+    {
+        pthread_join (threads[i], NULL);
+    }
+
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_seqread ()
+{
+    test_filemap_seqread_flags (0);
+    test_filemap_seqread_flags (FILEMAP_FLAG_MMAP);
+
+    return 0;
+}
+
+/* 多进程共享测试：子进程写入自己的key，读取公共的key */
+static int test_filemap_shared_child (const char *szObjFile, int nProcIndex, int nKeyNum, int nSharedNum)
+{
+    FILEMAP_HANDLE hFileMap = filemap_load_ex (szObjFile, FILEMAP_FLAG_SHARED);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    FILEMAP_VALUE valueGet = {};
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "proc_%d_%d", nProcIndex, i);
+        snprintf (value.byteData, sizeof(value.byteData), "proc_value_%d_%d", nProcIndex, i);
+        int ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+
+        snprintf (key.szKey, sizeof(key.szKey), "shared_%d", i % nSharedNum);
+        snprintf (value.byteData, sizeof(value.byteData), "shared_value_%d", i % nSharedNum);
+        ret = filemap_getitem (hFileMap, &key, &valueGet);
+        assert (ret == 0);
+        assert (strcmp (value.byteData, valueGet.byteData) == 0);
+    }
+
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_shared ()
+{
+    const int nProcNum = 4;
+    const int nKeyNum = 50;
+    const int nSharedNum = 20;
+    const char *szObjFile = "test.dat_shared";
+
+    unlink (szObjFile);
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szObjFile, nProcNum * nKeyNum + nSharedNum + 10, FILEMAP_FLAG_SHARED);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    FILEMAP_VALUE valueGet = {};
+    for (int i = 0; i < nSharedNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "shared_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "shared_value_%d", i);
+        int ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+
+    /* 其他进程正在使用时，不能以不同的数量重新初始化 */
+    assert (filemap_create_ex (szObjFile, 10, FILEMAP_FLAG_SHARED) == NULL);
+
+    fflush (stdout);
+    pid_t pids[nProcNum];
+    for (int p = 0; p < nProcNum; ++p)
+    {
+        pids[p] = fork ();
+        assert (pids[p] >= 0);
+        if (0 == pids[p])
+        {
+            test_filemap_shared_child (szObjFile, p, nKeyNum, nSharedNum);
+            fflush (stdout);
+            _exit (0);
+        }
+    }
+    for (int p = 0; p < nProcNum; ++p)
+    {
+        int nStatus = 0;
+        waitpid (pids[p], &nStatus, 0);
+        assert (WIFEXITED (nStatus) && WEXITSTATUS (nStatus) == 0);
+    }
+
+    /* 子进程写入的项对本进程可见 */
+    for (int p = 0; p < nProcNum; ++p)
+    {
+        for (int i = 0; i < nKeyNum; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "proc_%d_%d", p, i);
+            snprintf (value.byteData, sizeof(value.byteData), "proc_value_%d_%d", p, i);
+            int ret = filemap_getitem (hFileMap, &key, &valueGet);
+            assert (ret == 0);
+            assert (strcmp (value.byteData, valueGet.byteData) == 0);
+        }
+    }
+
+    /* 写进程被杀死后，锁可以恢复 */
+    fflush (stdout);
+    pid_t pid = fork ();
+    assert (pid >= 0);
+    if (0 == pid)
+    {
+        FILEMAP_HANDLE hChild = filemap_load_ex (szObjFile, FILEMAP_FLAG_SHARED);
+        snprintf (key.szKey, sizeof(key.szKey), "killed");
+        while (hChild != NULL)
+        {
+            filemap_setitem (hChild, &key, &value);
+            filemap_deleteitem (hChild, &key);
+        }
+        _exit (1);
+    }
+    usleep (200 * 1000);
+    kill (pid, SIGKILL);
+    waitpid (pid, NULL, 0);
+
+    snprintf (key.szKey, sizeof(key.szKey), "after_kill");
+    snprintf (value.byteData, sizeof(value.byteData), "after_kill_value");
+    int ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret == 0);
+    ret = filemap_getitem (hFileMap, &key, &valueGet);
+    assert (ret == 0);
+    assert (strcmp (value.byteData, valueGet.byteData) == 0);
+
+    /* 共享方式下借出的是拷贝 */
+    const FILEMAP_VALUE *pValue = NULL;
+    ret = filemap_acquireitem (hFileMap, &key, &pValue);
+    assert (ret == 0);
+    snprintf (value.byteData, sizeof(value.byteData), "after_kill_value_2");
+    ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret == 0);
+    assert (strcmp (pValue->byteData, "after_kill_value") == 0);
+    ret = filemap_releaseitem (hFileMap, pValue);
+    assert (ret == 0);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 普通方式重新加载，数据不变 */
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    snprintf (key.szKey, sizeof(key.szKey), "proc_%d_%d", nProcNum - 1, nKeyNum - 1);
+    ret = filemap_getitem (hFileMap, &key, &valueGet);
+    assert (ret == 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+/**
+ * 检查重新加载后各项完整，并且空位没有丢失也没有重复：
+ * 已有的项加上能新增的项正好是总数
+ */
+static void test_filemap_wal_check (FILEMAP_HANDLE hFileMap, int nMaxNum, int nKeyNum)
+{
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    FILEMAP_VALUE valueGet = {};
+
+    int nExistNum = 0;
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "wal_%d", i);
+        if (filemap_existitem (hFileMap, &key))
+        {
+            int ret = filemap_getitem (hFileMap, &key, &valueGet);
+            assert (ret == 0);
+            assert (strncmp (valueGet.byteData, key.szKey, strlen (key.szKey)) == 0);
+            nExistNum += 1;
+        }
+    }
+
+    int nFillNum = 0;
+    for (int i = 0; ; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "fill_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "fill_value_%d", i);
+        if (filemap_setitem (hFileMap, &key, &value) < 0)
+        {
+            break;
+        }
+        nFillNum += 1;
+    }
+    _info ("exist=%d,fill=%d,max=%d\n", nExistNum, nFillNum, nMaxNum);
+    assert (nExistNum + nFillNum == nMaxNum);
+
+    for (int i = 0; i < nFillNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "fill_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "fill_value_%d", i);
+        int ret = filemap_getitem (hFileMap, &key, &valueGet);
+        assert (ret == 0);
+        assert (strcmp (value.byteData, valueGet.byteData) == 0);
+    }
+}
+
+/* 日志测试：未关闭或被杀死的进程留下的日志在加载时重做 */
+int test_filemap_wal ()
+{
+    const int nMaxNum = 30;
+    const int nKeyNum = 20;
+    const char *szObjFile = "test.dat_wal";
+    const char *szWalFile = "test.dat_wal.wal";
+
+    unlink (szObjFile);
+    unlink (szWalFile);
+
+    /* 子进程写入后不关闭就退出，日志中留有记录 */
+    fflush (stdout);
+    pid_t pid = fork ();
+    assert (pid >= 0);
+    if (0 == pid)
+    {
+        FILEMAP_HANDLE hChild = filemap_create_ex (szObjFile, nMaxNum, FILEMAP_FLAG_WAL);
+        FILEMAP_KEY key = {};
+        FILEMAP_VALUE value = {};
+        for (int i = 0; hChild != NULL && i < nKeyNum; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "wal_%d", i);
+            snprintf (value.byteData, sizeof(value.byteData), "wal_%d_value", i);
+            filemap_setitem (hChild, &key, &value);
+        }
+        for (int i = 0; hChild != NULL && i < nKeyNum; i += 2)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "wal_%d", i);
+            filemap_deleteitem (hChild, &key);
+        }
+        fflush (stdout);
+        _exit (hChild != NULL ? 0 : 1);
+    }
+    int nStatus = 0;
+    waitpid (pid, &nStatus, 0);
+    assert (WIFEXITED (nStatus) && WEXITSTATUS (nStatus) == 0);
+
+    /* 日志末尾写了一半的记录被忽略 */
+    FILE *fp = fopen (szWalFile, "ab");
+    assert (fp != NULL);
+    long nWalSize = ftell (fp);
+    assert (nWalSize > 0);
+    fwrite ("broken", 1, 6, fp);
+    fclose (fp);
+
+    FILEMAP_HANDLE hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+
+    fp = fopen (szWalFile, "rb");
+    assert (fp != NULL);
+    fseek (fp, 0, SEEK_END);
+    assert (ftell (fp) == 0);
+    fclose (fp);
+
+    FILEMAP_KEY key = {};
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "wal_%d", i);
+        assert (filemap_existitem (hFileMap, &key) == (i % 2 ? 1 : 0));
+    }
+    test_filemap_wal_check (hFileMap, nMaxNum, nKeyNum);
+
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 写进程在任意位置被杀死 */
+    unlink (szObjFile);
+    unlink (szWalFile);
+    hFileMap = filemap_create_ex (szObjFile, nMaxNum, FILEMAP_FLAG_WAL);
+    assert (hFileMap != NULL);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    fflush (stdout);
+    pid = fork ();
+    assert (pid >= 0);
+    if (0 == pid)
+    {
+        FILEMAP_HANDLE hChild = filemap_load_ex (szObjFile, FILEMAP_FLAG_WAL | FILEMAP_FLAG_MMAP);
+        FILEMAP_VALUE value = {};
+        for (unsigned int uRand = 1; hChild != NULL; )
+        {
+            uRand = uRand * 1103515245 + 12345;
+            snprintf (key.szKey, sizeof(key.szKey), "wal_%u", (uRand >> 8) % nKeyNum);
+            snprintf (value.byteData, sizeof(value.byteData), "%s_value_%u", key.szKey, uRand);
+            if (uRand & 0x10000)
+            {
+                filemap_setitem (hChild, &key, &value);
+            }
+            else 
+            {
+                filemap_deleteitem (hChild, &key);
+            }
+        }
+        _exit (1);
+    }
+    usleep (300 * 1000);
+    kill (pid, SIGKILL);
+    waitpid (pid, NULL, 0);
+
+    hFileMap = filemap_load_ex (szObjFile, FILEMAP_FLAG_WAL);
+    assert (hFileMap != NULL);
+    test_filemap_wal_check (hFileMap, nMaxNum, nKeyNum);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+static int test_filemap_durability_mode (int nFlags, int nMode, int nIntervalMs)
+{
+    const int nThreadNum = 4;
+    const int nKeyNum = 20;
+    const int nSharedNum = 20;
+
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_durability_%x_%d", nFlags, nMode);
+    unlink (szObjFile);
+
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szObjFile, nThreadNum * nKeyNum + nSharedNum, nFlags);
+    assert (hFileMap != NULL);
+    int ret = filemap_setdurability (hFileMap, nMode, nIntervalMs);
+    assert (ret == 0);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    for (int i = 0; i < nSharedNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "shared_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "shared_value_%d", i);
+        ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+
+    /* 同时写入的线程共用写磁盘 */
+    pthread_t threads[nThreadNum];
+    TEST_THREAD_ARG args[nThreadNum];
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        args[i].hFileMap = hFileMap;
+        args[i].nThreadIndex = i;
+        args[i].nKeyNum = nKeyNum;
+        args[i].nRound = 3;
+        ret = pthread_create (&threads[i], NULL, test_filemap_thread_func, &args[i]);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        pthread_join (threads[i], NULL);
+    }
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+    for (int t = 0; t < nThreadNum; ++t)
+    {
+        for (int i = 0; i < nKeyNum; ++i)
+        {
+            FILEMAP_VALUE valueGet = {};
+            snprintf (key.szKey, sizeof(key.szKey), "thread_%d_%d", t, i);
+            snprintf (value.byteData, sizeof(value.byteData), "value_%d_%d_%d", t, i, args[t].nRound - 1);
+            ret = filemap_getitem (hFileMap, &key, &valueGet);
+            assert (ret == 0);
+            assert (strcmp (value.byteData, valueGet.byteData) == 0);
+        }
+    }
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+/* 持久化方式测试 */
+int test_filemap_durability ()
+{
+    test_filemap_durability_mode (FILEMAP_FLAG_WAL, FILEMAP_DURABILITY_GROUP, 0);
+    test_filemap_durability_mode (FILEMAP_FLAG_WAL | FILEMAP_FLAG_MMAP, FILEMAP_DURABILITY_PERIODIC, 5);
+    test_filemap_durability_mode (0, FILEMAP_DURABILITY_GROUP, 0);
+    test_filemap_durability_mode (FILEMAP_FLAG_MMAP, FILEMAP_DURABILITY_PERIODIC, 5);
+    test_filemap_durability_mode (0, FILEMAP_DURABILITY_NONE, 0);
+
+    /* 参数检查，切换方式 */
+    const char *szObjFile = "test.dat_durability";
+    FILEMAP_HANDLE hFileMap = filemap_create_ex (szObjFile, 10, FILEMAP_FLAG_WAL);
+    assert (hFileMap != NULL);
+    assert (filemap_setdurability (hFileMap, 100, 0) < 0);
+    assert (filemap_setdurability (hFileMap, FILEMAP_DURABILITY_PERIODIC, 0) < 0);
+    assert (filemap_setdurability (hFileMap, FILEMAP_DURABILITY_PERIODIC, 1000) == 0);
+    assert (filemap_setdurability (hFileMap, FILEMAP_DURABILITY_PERIODIC, 10) == 0);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    snprintf (key.szKey, sizeof(key.szKey), "durability");
+    int ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret == 0);
+    usleep (30 * 1000);
+
+    assert (filemap_setdurability (hFileMap, FILEMAP_DURABILITY_NONE, 0) == 0);
+    ret = filemap_deleteitem (hFileMap, &key);
+    assert (ret == 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+/* 变长值的内容由键和长度决定，便于检查 */
+static void test_filemap_value_fill (char *pData, int nLen, int nSeed)
+{
+    for (int i = 0; i < nLen; ++i)
+    {
+        pData[i] = (char)('a' + (i * 7 + nSeed) % 26);
+    }
+}
+
+static void test_filemap_value_verify (FILEMAP_HANDLE hFileMap, const FILEMAP_KEY *key, int nLen, int nSeed)
+{
+    char *pExpect = (char*)malloc (nLen + 1);
+    char *pGet = (char*)malloc (nLen + 1);
+    assert (pExpect != NULL && pGet != NULL);
+
+    test_filemap_value_fill (pExpect, nLen, nSeed);
+
+    int nLenGet = -1;
+    int ret = filemap_getvalue (hFileMap, key, pGet, nLen + 1, &nLenGet);
+    assert (ret == 0);
+    assert (nLenGet == nLen);
+    assert (memcmp (pExpect, pGet, nLen) == 0);
+
+    free (pExpect);
+    free (pGet);
+}
+
+static int test_filemap_value_flags (int nFlags)
+{
+    const int nNum = 200;
+    const int nKeyNum = 100;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_value_%x", nFlags);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = 4 * 1024 * 1024;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    static char byteData[FILEMAP_VALUE_MAX + 1];
+    FILEMAP_KEY key = {};
+    int anLen[nKeyNum] = {};
+
+    /* 各种长度 */
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        anLen[i] = (i * 397) % 5000;
+        snprintf (key.szKey, sizeof(key.szKey), "value_%d", i);
+        test_filemap_value_fill (byteData, anLen[i], i);
+        int ret = filemap_setvalue (hFileMap, &key, byteData, anLen[i]);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "value_%d", i);
+        test_filemap_value_verify (hFileMap, &key, anLen[i], i);
+    }
+
+    /* 变长、变短、同一级内改写，以及最大长度 */
+    const int anNewLen[] = {
+        100000, 3, 0, FILEMAP_VALUE_MAX, 60,
+    };
+    for (int i = 0; i < (int)(sizeof(anNewLen) / sizeof(anNewLen[0])); ++i)
+    {
+        anLen[i] = anNewLen[i];
+        snprintf (key.szKey, sizeof(key.szKey), "value_%d", i);
+        test_filemap_value_fill (byteData, anLen[i], i + 1000);
+        int ret = filemap_setvalue (hFileMap, &key, byteData, anLen[i]);
+        assert (ret == 0);
+        test_filemap_value_verify (hFileMap, &key, anLen[i], i + 1000);
+    }
+    snprintf (key.szKey, sizeof(key.szKey), "value_0");
+    assert (filemap_setvalue (hFileMap, &key, byteData, FILEMAP_VALUE_MAX + 1) < 0);
+    test_filemap_value_verify (hFileMap, &key, anLen[0], 1000);
+
+    /* 缓冲区不够时只拷贝一部分，返回实际长度 */
+    char szSmall[8] = {};
+    int nLenGet = 0;
+    int ret = filemap_getvalue (hFileMap, &key, szSmall, sizeof(szSmall), &nLenGet);
+    assert (ret == 0 && nLenGet == anLen[0]);
+    test_filemap_value_fill (byteData, sizeof(szSmall), 1000);
+    assert (memcmp (szSmall, byteData, sizeof(szSmall)) == 0);
+
+    /* 范围读写不能超出值的长度 */
+    snprintf (key.szKey, sizeof(key.szKey), "value_4");
+    ret = filemap_setrange (hFileMap, &key, 56, "wxyz", 4);
+    assert (ret == 0);
+    char szRange[4] = {};
+    ret = filemap_getrange (hFileMap, &key, 56, szRange, 4);
+    assert (ret == 0 && memcmp (szRange, "wxyz", 4) == 0);
+    assert (filemap_getrange (hFileMap, &key, 57, szRange, 4) < 0);
+    assert (filemap_setrange (hFileMap, &key, 60, "a", 1) < 0);
+    test_filemap_value_fill (byteData, anLen[4], 1004);
+    ret = filemap_setrange (hFileMap, &key, 56, byteData + 56, 4);
+    assert (ret == 0);
+
+    /* 定长接口：短的值填0，写入后长度为sizeof(FILEMAP_VALUE) */
+    FILEMAP_VALUE valueGet = {};
+    snprintf (key.szKey, sizeof(key.szKey), "value_1");
+    ret = filemap_getitem (hFileMap, &key, &valueGet);
+    assert (ret == 0);
+    test_filemap_value_fill (byteData, 3, 1001);
+    assert (memcmp (valueGet.byteData, byteData, 3) == 0 && valueGet.byteData[3] == 0);
+
+    const FILEMAP_VALUE *pValue = NULL;
+    ret = filemap_acquireitem (hFileMap, &key, &pValue);
+    assert (ret == 0);
+    assert (memcmp (pValue->byteData, byteData, 3) == 0 && pValue->byteData[3] == 0);
+
+    FILEMAP_VALUE value = {};
+    snprintf (value.byteData, sizeof(value.byteData), "fixed");
+    ret = filemap_setitem (hFileMap, &key, &value);
+    assert (ret == 0);
+    assert (memcmp (pValue->byteData, byteData, 3) == 0);
+    ret = filemap_releaseitem (hFileMap, pValue);
+    assert (ret == 0);
+
+    ret = filemap_getvalue (hFileMap, &key, byteData, sizeof(byteData), &nLenGet);
+    assert (ret == 0 && nLenGet == (int)sizeof(FILEMAP_VALUE));
+    assert (strcmp (byteData, "fixed") == 0);
+
+    ret = filemap_deleteitem (hFileMap, &key);
+    assert (ret == 0);
+    assert (filemap_getvalue (hFileMap, &key, byteData, sizeof(byteData), &nLenGet) < 0);
+
+    /* 重新加载 */
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "value_%d", i);
+        if (1 == i)
+        {
+            assert (filemap_existitem (hFileMap, &key) == 0);
+            continue;
+        }
+        test_filemap_value_verify (hFileMap, &key, anLen[i], i < 5 ? i + 1000 : i);
+    }
+
+    /* 存储区写满后失败，删除后空间可以复用 */
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "value_%d", i);
+        filemap_deleteitem (hFileMap, &key);
+    }
+
+    int anFillNum[2] = {};
+    for (int k = 0; k < 2; ++k)
+    {
+        for (int i = 0; i < nNum; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "fill_%d", i);
+            test_filemap_value_fill (byteData, 60000, i);
+            if (filemap_setvalue (hFileMap, &key, byteData, 60000) < 0)
+            {
+                break;
+            }
+            anFillNum[k] += 1;
+        }
+        _info ("fill=%d\n", anFillNum[k]);
+
+        for (int i = 0; i < anFillNum[k]; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "fill_%d", i);
+            test_filemap_value_verify (hFileMap, &key, 60000, i);
+            ret = filemap_deleteitem (hFileMap, &key);
+            assert (ret == 0);
+        }
+    }
+    assert (anFillNum[0] > 0 && anFillNum[0] < nNum);
+    assert (anFillNum[0] == anFillNum[1]);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+/* 变长值的前4个字节为种子，检查其余部分 */
+static void test_filemap_value_check (FILEMAP_HANDLE hFileMap, int nKeyNum)
+{
+    static char byteData[8192];
+    static char byteExpect[8192];
+    FILEMAP_KEY key = {};
+
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "crash_%d", i);
+        int nLen = 0;
+        if (filemap_getvalue (hFileMap, &key, byteData, sizeof(byteData), &nLen) < 0)
+        {
+            continue;
+        }
+
+        int nSeed = 0;
+        assert (nLen >= (int)sizeof(nSeed) && nLen <= (int)sizeof(byteData));
+        memcpy (&nSeed, byteData, sizeof(nSeed));
+        test_filemap_value_fill (byteExpect, nLen - sizeof(nSeed), nSeed);
+        assert (memcmp (byteData + sizeof(nSeed), byteExpect, nLen - sizeof(nSeed)) == 0);
+    }
+}
+
+static void test_filemap_value_random (FILEMAP_HANDLE hFileMap, int nKeyNum, unsigned int uRand, int nOpNum)
+{
+    static char byteData[8192];
+    FILEMAP_KEY key = {};
+
+    for (int i = 0; nOpNum < 0 || i < nOpNum; ++i)
+    {
+        uRand = uRand * 1103515245 + 12345;
+        snprintf (key.szKey, sizeof(key.szKey), "crash_%u", (uRand >> 8) % nKeyNum);
+        if (uRand & 0x10000)
+        {
+            const int nSeed = (int)(uRand >> 4);
+            const int nLen = sizeof(nSeed) + (uRand >> 12) % (sizeof(byteData) - sizeof(nSeed));
+            memcpy (byteData, &nSeed, sizeof(nSeed));
+            test_filemap_value_fill (byteData + sizeof(nSeed), nLen - sizeof(nSeed), nSeed);
+            filemap_setvalue (hFileMap, &key, byteData, nLen);
+        }
+        else 
+        {
+            filemap_deleteitem (hFileMap, &key);
+        }
+    }
+}
+
+/* 变长值测试 */
+int test_filemap_value ()
+{
+    test_filemap_value_flags (0);
+    test_filemap_value_flags (FILEMAP_FLAG_MMAP);
+    test_filemap_value_flags (FILEMAP_FLAG_WAL);
+
+    /* 固定大小方式，长度总是sizeof(FILEMAP_VALUE) */
+    const char *szObjFile = "test.dat_value";
+    FILEMAP_HANDLE hFileMap = filemap_create (szObjFile, 10);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    snprintf (key.szKey, sizeof(key.szKey), "fixed");
+    assert (filemap_setvalue (hFileMap, &key, "abc", 3) == 0);
+    char byteData[sizeof(FILEMAP_VALUE) + 1] = {};
+    int nLenGet = 0;
+    assert (filemap_getvalue (hFileMap, &key, byteData, sizeof(byteData), &nLenGet) == 0);
+    assert (nLenGet == (int)sizeof(FILEMAP_VALUE) && strcmp (byteData, "abc") == 0);
+    assert (filemap_setvalue (hFileMap, &key, byteData, sizeof(byteData)) < 0);
+
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 存储区大小不同时重新初始化 */
+    FILEMAP_OPTION sOption = {};
+    sOption.llValueHeapSize = 64 * 1024;
+    hFileMap = filemap_create_opt (szObjFile, 10, &sOption);
+    assert (hFileMap != NULL);
+    assert (filemap_existitem (hFileMap, &key) == 0);
+    assert (filemap_setvalue (hFileMap, &key, "abc", 3) == 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_create_opt (szObjFile, 10, &sOption);
+    assert (hFileMap != NULL);
+    assert (filemap_getvalue (hFileMap, &key, byteData, sizeof(byteData), &nLenGet) == 0 && nLenGet == 3);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 写进程被杀死后，重做日志并重建存储区，已有的值不被覆盖 */
+    const int nKeyNum = 40;
+    const char *szCrashFile = "test.dat_value_crash";
+    unlink (szCrashFile);
+    sOption.nFlags = FILEMAP_FLAG_WAL;
+    sOption.llValueHeapSize = 256 * 1024;
+    hFileMap = filemap_create_opt (szCrashFile, nKeyNum, &sOption);
+    assert (hFileMap != NULL);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    fflush (stdout);
+    pid_t pid = fork ();
+    assert (pid >= 0);
+    if (0 == pid)
+    {
+        FILEMAP_HANDLE hChild = filemap_load_ex (szCrashFile, FILEMAP_FLAG_WAL | FILEMAP_FLAG_MMAP);
+        if (hChild != NULL)
+        {
+            test_filemap_value_random (hChild, nKeyNum, 1, -1);
+        }
+        _exit (1);
+    }
+    usleep (300 * 1000);
+    kill (pid, SIGKILL);
+    waitpid (pid, NULL, 0);
+
+    hFileMap = filemap_load_ex (szCrashFile, FILEMAP_FLAG_WAL);
+    assert (hFileMap != NULL);
+    test_filemap_value_check (hFileMap, nKeyNum);
+    test_filemap_value_random (hFileMap, nKeyNum, 2, 2000);
+    test_filemap_value_check (hFileMap, nKeyNum);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+/* 检查generateinfo的输出：位置哈希表中使用的项都在自己的hash位置上 */
+static void test_filemap_binkey_checkinfo (FILEMAP_HANDLE hFileMap, const char *szInfoFile)
+{
+    int ret = filemap_generateinfo (hFileMap, szInfoFile);
+    assert (ret == 0);
+
+    FILE *fp = fopen (szInfoFile, "r");
+    assert (fp != NULL);
+
+    char szLine[1024] = {};
+    int bInHashMap = 0;
+    int nUsedNum = 0;
+    while (fgets (szLine, sizeof(szLine), fp) != NULL)
+    {
+        if (strncmp (szLine, "poshashmap:", 11) == 0)
+        {
+            bInHashMap = 1;
+            continue;
+        }
+        if (bInHashMap && szLine[0] == '}')
+        {
+            break;
+        }
+
+        int nPos = -1;
+        int bUsedFlag = 0;
+        const char *pHash = strstr (szLine, ",hash=");
+        if (bInHashMap && pHash != NULL && 
+                sscanf (szLine, "  [%d] used_flag=%d", &nPos, &bUsedFlag) == 2 && bUsedFlag)
+        {
+            assert (atoi (pHash + 6) == nPos);
+            ++nUsedNum;
+        }
+    }
+    fclose (fp);
+
+    assert (nUsedNum > 0);
+}
+
+/* 任意字节串的键 */
+static int test_filemap_binkey_flags (int nFlags, long long llHeapSize)
+{
+    const int nNum = 64;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_binkey_%x_%lld", nFlags, llHeapSize);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    unsigned char byteKey[FILEMAP_KEY_MAX + 1] = {};
+    char byteData[256] = {};
+    int nLenGet = 0;
+    int ret = 0;
+
+    /* 16字节的uuid，含0字节，仅0之后不同 */
+    for (int i = 0; i < 16; ++i)
+    {
+        memset (byteKey, 0, 16);
+        byteKey[0] = 'u';
+        byteKey[15] = (unsigned char)i;
+        snprintf (byteData, sizeof(byteData), "uuid_%d", i);
+        ret = filemap_setvalue_bin (hFileMap, byteKey, 16, byteData, strlen (byteData) + 1);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        memset (byteKey, 0, 16);
+        byteKey[0] = 'u';
+        byteKey[15] = (unsigned char)i;
+        char szExpect[32] = {};
+        snprintf (szExpect, sizeof(szExpect), "uuid_%d", i);
+        memset (byteData, 0, sizeof(byteData));
+        ret = filemap_getvalue_bin (hFileMap, byteKey, 16, byteData, sizeof(byteData), &nLenGet);
+        assert (ret == 0);
+        assert (strcmp (byteData, szExpect) == 0);
+    }
+    /* 长度不同即为不同的键 */
+    assert (filemap_existitem_bin (hFileMap, byteKey, 15) == 0);
+    assert (filemap_existitem_bin (hFileMap, byteKey, 16) == 1);
+
+    /* 长键保存在键段中 */
+    for (int i = 0; i < 16; ++i)
+    {
+        const int nKeyLen = 21 + i * 43 / 15;
+        memset (byteKey, 'L', nKeyLen);
+        byteKey[nKeyLen - 1] = (unsigned char)i;
+        snprintf (byteData, sizeof(byteData), "long_%d", i);
+        ret = filemap_setvalue_bin (hFileMap, byteKey, nKeyLen, byteData, strlen (byteData) + 1);
+        assert (ret == 0);
+    }
+
+    /* 长度无效 */
+    assert (filemap_setvalue_bin (hFileMap, byteKey, FILEMAP_KEY_MAX + 1, "x", 1) < 0);
+    assert (filemap_setvalue_bin (hFileMap, byteKey, -1, "x", 1) < 0);
+    assert (filemap_existitem_bin (hFileMap, byteKey, FILEMAP_KEY_MAX + 1) == 0);
+
+    /* 空键也是合法的键 */
+    ret = filemap_setvalue_bin (hFileMap, "", 0, "empty", 6);
+    assert (ret == 0);
+
+    /* FILEMAP_KEY与长度为strlen的键相同 */
+    FILEMAP_KEY key = {};
+    snprintf (key.szKey, sizeof(key.szKey), "str_key");
+    ret = filemap_setvalue (hFileMap, &key, "str", 4);
+    assert (ret == 0);
+    assert (filemap_existitem_bin (hFileMap, "str_key", 7) == 1);
+    ret = filemap_getvalue_bin (hFileMap, "str_key", 7, byteData, sizeof(byteData), &nLenGet);
+    assert (ret == 0 && strcmp (byteData, "str") == 0);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 重新加载后不变 */
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+
+    for (int i = 0; i < 16; ++i)
+    {
+        const int nKeyLen = 21 + i * 43 / 15;
+        memset (byteKey, 'L', nKeyLen);
+        byteKey[nKeyLen - 1] = (unsigned char)i;
+        char szExpect[32] = {};
+        snprintf (szExpect, sizeof(szExpect), "long_%d", i);
+        ret = filemap_getvalue_bin (hFileMap, byteKey, nKeyLen, byteData, sizeof(byteData), &nLenGet);
+        assert (ret == 0);
+        assert (strcmp (byteData, szExpect) == 0);
+        /* 前缀不是同一个键 */
+        assert (filemap_existitem_bin (hFileMap, byteKey, nKeyLen - 1) == 0);
+    }
+    ret = filemap_getvalue_bin (hFileMap, "", 0, byteData, sizeof(byteData), &nLenGet);
+    assert (ret == 0 && strcmp (byteData, "empty") == 0);
+    assert (filemap_existitem (hFileMap, &key) == 1);
+    test_filemap_binkey_checkinfo (hFileMap, "test.info_binkey");
+
+    /* 删除后，长键的空位可以再次使用 */
+    for (int i = 0; i < 16; ++i)
+    {
+        const int nKeyLen = 21 + i * 43 / 15;
+        memset (byteKey, 'L', nKeyLen);
+        byteKey[nKeyLen - 1] = (unsigned char)i;
+        ret = filemap_deleteitem_bin (hFileMap, byteKey, nKeyLen);
+        assert (ret == 0);
+    }
+    assert (filemap_deleteitem_bin (hFileMap, byteKey, FILEMAP_KEY_MAX) < 0);
+    ret = filemap_deleteitem_bin (hFileMap, "", 0);
+    assert (ret == 0);
+    ret = filemap_deleteitem (hFileMap, &key);
+    assert (ret == 0);
+    for (int i = 0; i < 16; ++i)
+    {
+        memset (byteKey, 0, 16);
+        byteKey[0] = 'u';
+        byteKey[15] = (unsigned char)i;
+        ret = filemap_deleteitem_bin (hFileMap, byteKey, 16);
+        assert (ret == 0);
+    }
+
+    /* 全部是最长的键时正好写满 */
+    for (int i = 0; i < nNum; ++i)
+    {
+        memset (byteKey, 'F', FILEMAP_KEY_MAX);
+        memcpy (byteKey, &i, sizeof(i));
+        ret = filemap_setvalue_bin (hFileMap, byteKey, FILEMAP_KEY_MAX, &i, sizeof(i));
+        assert (ret == 0);
+    }
+    memset (byteKey, 'G', FILEMAP_KEY_MAX);
+    assert (filemap_setvalue_bin (hFileMap, byteKey, FILEMAP_KEY_MAX, "x", 1) < 0);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+    for (int i = 0; i < nNum; ++i)
+    {
+        memset (byteKey, 'F', FILEMAP_KEY_MAX);
+        memcpy (byteKey, &i, sizeof(i));
+        int nValue = -1;
+        ret = filemap_getvalue_bin (hFileMap, byteKey, FILEMAP_KEY_MAX, &nValue, sizeof(nValue), &nLenGet);
+        assert (ret == 0 && nValue == i);
+    }
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_binkey ()
+{
+    test_filemap_binkey_flags (0, 0);
+    test_filemap_binkey_flags (FILEMAP_FLAG_MMAP, 0);
+    test_filemap_binkey_flags (FILEMAP_FLAG_WAL, 0);
+    test_filemap_binkey_flags (0, 256 * 1024);
+
+    /* 字符串键的文件不接受含0或过长的键，可以被写V1.1的程序读取 */
+    const char *szObjFile = "test.dat_binkey_string";
+    FILEMAP_OPTION sOption = {};
+    sOption.bStringKey = 1;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, 10, &sOption);
+    assert (hFileMap != NULL);
+
+    assert (filemap_setvalue_bin (hFileMap, "a\0b", 3, "x", 1) < 0);
+    unsigned char byteKey[FILEMAP_KEY_MAX] = {};
+    memset (byteKey, 'S', sizeof(byteKey));
+    assert (filemap_setvalue_bin (hFileMap, byteKey, FILEMAP_KEY_MAX, "x", 1) < 0);
+    assert (filemap_setvalue_bin (hFileMap, byteKey, FILEMAP_KEY_MAX - 1, "x", 1) == 0);
+
+    FILEMAP_KEY key = {};
+    snprintf (key.szKey, sizeof(key.szKey), "string");
+    assert (filemap_setvalue (hFileMap, &key, "abc", 3) == 0);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    FILE *fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    char szVersion[16] = {};
+    assert (fread (szVersion, sizeof(szVersion), 1, fp) == 1);
+    fclose (fp);
+    assert (strncmp (szVersion, "FILEMAP V1.", 11) == 0);
+
+    /* 已有文件的键格式不变 */
+    hFileMap = filemap_create (szObjFile, 10);
+    assert (hFileMap != NULL);
+    char byteData[16] = {};
+    int nLenGet = 0;
+    assert (filemap_getvalue (hFileMap, &key, byteData, sizeof(byteData), &nLenGet) == 0);
+    assert (strncmp (byteData, "abc", 3) == 0);
+    assert (filemap_existitem_bin (hFileMap, byteKey, FILEMAP_KEY_MAX - 1) == 1);
+    test_filemap_binkey_checkinfo (hFileMap, "test.info_binkey_string");
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+/* 从generateinfo的输出中取得文件的hash函数和种子 */
+static int test_filemap_hash_getinfo (FILEMAP_HANDLE hFileMap, int *pnHashType, unsigned long long *pullSeed)
+{
+    const char *szInfoFile = "test.info_hash";
+    int ret = filemap_generateinfo (hFileMap, szInfoFile);
+    assert (ret == 0);
+
+    FILE *fp = fopen (szInfoFile, "r");
+    assert (fp != NULL);
+
+    char szLine[1024] = {};
+    int bFound = 0;
+    while (fgets (szLine, sizeof(szLine), fp) != NULL)
+    {
+        const char *pType = strstr (szLine, "hashtype=");
+        const char *pSeed = strstr (szLine, "hashseed=");
+        if (pType != NULL && pSeed != NULL)
+        {
+            *pnHashType = atoi (pType + 9);
+            *pullSeed = strtoull (pSeed + 9, NULL, 16);
+            bFound = 1;
+            break;
+        }
+    }
+    fclose (fp);
+
+    return bFound ? 0 : -1;
+}
+
+/* hash函数及文件记录的hash种子 */
+int test_filemap_hash ()
+{
+    /* 字符串的结果与旧的hash函数相同 */
+    const char *szStr = "name12_34";
+    assert (BKDRHashBin (szStr, strlen (szStr)) == BKDRHash (szStr));
+
+    /* 各种长度，结果只由内容和种子决定 */
+    unsigned char byteData[200] = {};
+    for (int i = 0; i < (int)sizeof(byteData); ++i)
+    {
+        byteData[i] = (unsigned char)(i * 7 + 1);
+    }
+    for (int nLen = 0; nLen <= (int)sizeof(byteData); ++nLen)
+    {
+        unsigned long long ullHash = WyHash (byteData, nLen, 1);
+        assert (ullHash == WyHash (byteData, nLen, 1));
+        assert (ullHash != WyHash (byteData, nLen, 2));
+        if (nLen > 0)
+        { /* 改变任意一个字节 */
+            byteData[nLen - 1] ^= 0x80;
+            assert (ullHash != WyHash (byteData, nLen, 1));
+            byteData[nLen - 1] ^= 0x80;
+            assert (ullHash != WyHash (byteData, nLen - 1, 1));
+        }
+    }
+
+    /* 顺序的键分布均匀：低位的取值基本都能出现 */
+    const int nBucketNum = 1024;
+    static int anBucket[nBucketNum];
+    memset (anBucket, 0, sizeof(anBucket));
+    for (int i = 0; i < nBucketNum * 4; ++i)
+    {
+        char szKey[64] = {};
+        int nLen = snprintf (szKey, sizeof(szKey), "name%d_%d", i / 64, i % 64);
+        ++anBucket[WyHash (szKey, nLen, 12345) % nBucketNum];
+    }
+    int nEmptyNum = 0;
+    for (int i = 0; i < nBucketNum; ++i)
+    {
+        nEmptyNum += (anBucket[i] == 0 ? 1 : 0);
+    }
+    assert (nEmptyNum < nBucketNum / 20); /* 泊松分布下约为e^-4 */
+
+    /* 新文件使用wyhash，种子各不相同，重新加载后不变 */
+    const char *szFileA = "test.dat_hash_a";
+    const char *szFileB = "test.dat_hash_b";
+    unlink (szFileA);
+    unlink (szFileB);
+    FILEMAP_HANDLE hFileA = filemap_create (szFileA, 100);
+    FILEMAP_HANDLE hFileB = filemap_create (szFileB, 100);
+    assert (hFileA != NULL && hFileB != NULL);
+
+    int nTypeA = 0, nTypeB = 0;
+    unsigned long long ullSeedA = 0, ullSeedB = 0;
+    assert (test_filemap_hash_getinfo (hFileA, &nTypeA, &ullSeedA) == 0);
+    assert (test_filemap_hash_getinfo (hFileB, &nTypeB, &ullSeedB) == 0);
+    assert (nTypeA == FILEMAP_HASH_WYHASH && nTypeB == FILEMAP_HASH_WYHASH);
+    assert (ullSeedA != ullSeedB);
+
+    FILEMAP_KEY key = {};
+    for (int i = 0; i < 100; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "name%d_%d", i / 10, i % 10);
+        assert (filemap_setvalue (hFileA, &key, &i, sizeof(i)) == 0);
+    }
+    assert (filemap_close (hFileA) == 0);
+    assert (filemap_close (hFileB) == 0);
+
+    /* 按不同的选项打开，已有文件的hash函数不变 */
+    FILEMAP_OPTION sOption = {};
+    sOption.nHashType = FILEMAP_HASH_BKDR;
+    hFileA = filemap_create_opt (szFileA, 100, &sOption);
+    assert (hFileA != NULL);
+    unsigned long long ullSeed = 0;
+    int nType = 0;
+    assert (test_filemap_hash_getinfo (hFileA, &nType, &ullSeed) == 0);
+    assert (nType == FILEMAP_HASH_WYHASH && ullSeed == ullSeedA);
+    for (int i = 0; i < 100; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "name%d_%d", i / 10, i % 10);
+        int nValue = -1;
+        int nLenGet = 0;
+        assert (filemap_getvalue (hFileA, &key, &nValue, sizeof(nValue), &nLenGet) == 0);
+        assert (nValue == i);
+    }
+    assert (filemap_close (hFileA) == 0);
+
+    /* 指定BKDR */
+    unlink (szFileB);
+    hFileB = filemap_create_opt (szFileB, 100, &sOption);
+    assert (hFileB != NULL);
+    assert (test_filemap_hash_getinfo (hFileB, &nType, &ullSeed) == 0);
+    assert (nType == FILEMAP_HASH_BKDR);
+    snprintf (key.szKey, sizeof(key.szKey), "bkdr");
+    assert (filemap_setvalue (hFileB, &key, "x", 1) == 0);
+    assert (filemap_close (hFileB) == 0);
+    hFileB = filemap_load (szFileB);
+    assert (hFileB != NULL);
+    assert (filemap_existitem (hFileB, &key) == 1);
+    assert (filemap_close (hFileB) == 0);
+
+    /* 字符串键的文件只能使用BKDR */
+    sOption.bStringKey = 1;
+    sOption.nHashType = FILEMAP_HASH_WYHASH;
+    assert (filemap_create_opt ("test.dat_hash_string", 100, &sOption) == NULL);
+    sOption.nHashType = 3;
+    sOption.bStringKey = 0;
+    assert (filemap_create_opt ("test.dat_hash_string", 100, &sOption) == NULL);
+
+    return 0;
+}
+
+/* 开放寻址的索引，与std::map对照随机增删 */
+static int test_filemap_open_flags (int nFlags, long long llHeapSize)
+{
+    const int nNum = 300;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_open_%x_%lld", nFlags, llHeapSize);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    sOption.nIndexLayout = FILEMAP_INDEX_OPEN;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    std::map<std::string, int> mapExpect;
+    unsigned int uRand = 7;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    int ret = 0;
+
+    /* 反复增删，已删除的位置较多，并且探测会绕回表头 */
+    for (int nOp = 0; nOp < 20000; ++nOp)
+    {
+        uRand = uRand * 1103515245 + 12345;
+        const int nKey = (uRand >> 8) % (nNum * 2);
+        const int nKeyLen = (nKey % 3 == 0 ? snprintf (szKey, sizeof(szKey), "open_long_key_%040d", nKey) :
+                        snprintf (szKey, sizeof(szKey), "open_%d", nKey));
+        const std::string strKey (szKey, nKeyLen);
+
+        if ((uRand >> 4) % 3 != 0 && (mapExpect.count (strKey) > 0 || (int)mapExpect.size () < nNum))
+        {
+            ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &nOp, sizeof(nOp));
+            assert (ret == 0);
+            mapExpect[strKey] = nOp;
+        }
+        else 
+        {
+            ret = filemap_deleteitem_bin (hFileMap, szKey, nKeyLen);
+            assert ((ret == 0) == (mapExpect.erase (strKey) > 0));
+        }
+    }
+
+    /* 写满，有存储区时数量不受数据段限制 */
+    for (int i = 0; (int)mapExpect.size () < nNum; ++i)
+    {
+        const int nKeyLen = snprintf (szKey, sizeof(szKey), "open_fill_%d", i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+        mapExpect[std::string (szKey, nKeyLen)] = i;
+    }
+    if (0 == llHeapSize)
+    {
+        assert (filemap_setvalue_bin (hFileMap, "open_full", 9, "x", 1) < 0);
+    }
+
+    for (int nRound = 0; nRound < 2; ++nRound)
+    {
+        for (std::map<std::string, int>::const_iterator it = mapExpect.begin (); it != mapExpect.end (); ++it)
+        {
+            int nValue = -1;
+            int nLenGet = 0;
+            ret = filemap_getvalue_bin (hFileMap, it->first.data (), it->first.size (), &nValue, sizeof(nValue), &nLenGet);
+            assert (ret == 0);
+            assert (nValue == it->second);
+        }
+        assert (filemap_existitem_bin (hFileMap, "open_none", 9) == 0);
+
+        /* 重新加载后不变 */
+        ret = filemap_close (hFileMap);
+        assert (ret == 0);
+        hFileMap = filemap_load_ex (szObjFile, nFlags);
+        assert (hFileMap != NULL);
+    }
+
+    /* 全部删除后可以重新写满 */
+    for (std::map<std::string, int>::const_iterator it = mapExpect.begin (); it != mapExpect.end (); ++it)
+    {
+        ret = filemap_deleteitem_bin (hFileMap, it->first.data (), it->first.size ());
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nNum; ++i)
+    {
+        const int nKeyLen = snprintf (szKey, sizeof(szKey), "open_again_%d", i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+    }
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_open ()
+{
+    test_filemap_open_flags (0, 0);
+    test_filemap_open_flags (FILEMAP_FLAG_MMAP, 0);
+    test_filemap_open_flags (FILEMAP_FLAG_WAL, 0);
+    test_filemap_open_flags (0, 256 * 1024);
+
+    /* 版本号为V2.1，字符串键不能使用 */
+    const char *szObjFile = "test.dat_open_version";
+    unlink (szObjFile);
+    FILEMAP_OPTION sOption = {};
+    sOption.nIndexLayout = FILEMAP_INDEX_OPEN;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, 10, &sOption);
+    assert (hFileMap != NULL);
+    assert (filemap_setvalue_bin (hFileMap, "k", 1, "v", 1) == 0);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    FILE *fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    char szVersion[16] = {};
+    assert (fread (szVersion, sizeof(szVersion), 1, fp) == 1);
+    fclose (fp);
+    assert (strcmp (szVersion, "FILEMAP V2.1") == 0);
+
+    /* 按链表方式打开，已有文件的索引结构不变 */
+    hFileMap = filemap_create (szObjFile, 10);
+    assert (hFileMap != NULL);
+    assert (filemap_existitem_bin (hFileMap, "k", 1) == 1);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    sOption.bStringKey = 1;
+    assert (filemap_create_opt ("test.dat_open_string", 10, &sOption) == NULL);
+    sOption.bStringKey = 0;
+    sOption.nIndexLayout = 2;
+    assert (filemap_create_opt ("test.dat_open_string", 10, &sOption) == NULL);
+
+    return 0;
+}
+
+static int test_filemap_grow_key (char *szKey, int nKey)
+{
+    return (nKey % 3 == 0 ? snprintf (szKey, FILEMAP_KEY_MAX, "grow_long_key_%040d", nKey) :
+                    snprintf (szKey, FILEMAP_KEY_MAX, "grow_%d", nKey));
+}
+
+static void test_filemap_grow_check (FILEMAP_HANDLE hFileMap, const std::map<int, int> &mapExpect)
+{
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (std::map<int, int>::const_iterator it = mapExpect.begin (); it != mapExpect.end (); ++it)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, it->first);
+        int nValue = -1;
+        int nLenGet = 0;
+        int ret = filemap_getvalue_bin (hFileMap, szKey, nKeyLen, &nValue, sizeof(nValue), &nLenGet);
+        assert (ret == 0);
+        assert (nValue == it->second);
+    }
+    assert (filemap_existitem_bin (hFileMap, "grow_none", 9) == 0);
+}
+
+typedef struct 
+{
+    FILEMAP_HANDLE hFileMap;
+    int nKeyNum;        // 不会被修改的key为[0,nKeyNum)
+    volatile int bStop;
+} TEST_GROW_READER;
+
+/* 迁移期间不加锁读取，结果始终正确 */
+static void *test_filemap_grow_reader (void *pArg)
+{
+    TEST_GROW_READER *psReader = (TEST_GROW_READER*)pArg;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (int i = 0; ! psReader->bStop; i = (i + 1) % psReader->nKeyNum)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        int nValue = -1;
+        int nLenGet = 0;
+        int ret = filemap_getvalue_bin (psReader->hFileMap, szKey, nKeyLen, &nValue, sizeof(nValue), &nLenGet);
+        assert (ret == 0);
+        assert (nValue == i);
+    }
+
+    return NULL;
+}
+
+static int test_filemap_grow_flags (int nFlags, int nIndexLayout)
+{
+    const int nNum = 200;
+    const int nNewNum = 500;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_grow_%x_%d", nFlags, nIndexLayout);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.nIndexLayout = nIndexLayout;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    std::map<int, int> mapExpect;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    int nKeyLen = 0;
+    int ret = 0;
+
+    /* 写满 */
+    for (int i = 0; i < nNum; ++i)
+    {
+        nKeyLen = test_filemap_grow_key (szKey, i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+        mapExpect[i] = i;
+    }
+    assert (filemap_setvalue_bin (hFileMap, "grow_full", 9, "x", 1) < 0);
+
+    assert (filemap_grow (hFileMap, nNum) < 0);
+    ret = filemap_grow (hFileMap, nNewNum);
+    assert (ret == 0);
+
+    /* 迁移尚未进行，原有的项都在 */
+    test_filemap_grow_check (hFileMap, mapExpect);
+
+    TEST_GROW_READER sReader = {hFileMap, nNum / 2, 0};
+    pthread_t tid;
+    ret = pthread_create (&tid, NULL, test_filemap_grow_reader, &sReader);
+    assert (ret == 0);
+
+    /* 迁移中途重新加载 */
+    for (int i = nNum; i < nNum + 10; ++i)
+    {
+        nKeyLen = test_filemap_grow_key (szKey, i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+        mapExpect[i] = i;
+    }
+
+    sReader.bStop = 1;
+    pthread_join (tid, NULL);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+
+    /* 修改和删除原有的项，写入超出原来数量的项 */
+    sReader.hFileMap = hFileMap;
+    sReader.bStop = 0;
+    ret = pthread_create (&tid, NULL, test_filemap_grow_reader, &sReader);
+    assert (ret == 0);
+
+    for (int i = nNum / 2; i < nNum; i += 2)
+    {
+        nKeyLen = test_filemap_grow_key (szKey, i);
+        const int nValue = i + 1000;
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &nValue, sizeof(nValue));
+        assert (ret == 0);
+        mapExpect[i] = nValue;
+
+        nKeyLen = test_filemap_grow_key (szKey, i + 1);
+        ret = filemap_deleteitem_bin (hFileMap, szKey, nKeyLen);
+        assert (ret == 0);
+        mapExpect.erase (i + 1);
+    }
+    for (int i = nNum + 10; (int)mapExpect.size () < nNewNum; ++i)
+    {
+        nKeyLen = test_filemap_grow_key (szKey, i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+        mapExpect[i] = i;
+    }
+
+    sReader.bStop = 1;
+    pthread_join (tid, NULL);
+
+    test_filemap_grow_check (hFileMap, mapExpect);
+    assert (filemap_setvalue_bin (hFileMap, "grow_full", 9, "x", 1) < 0);
+
+    /* 再次扩容，之前的迁移先完成 */
+    ret = filemap_grow (hFileMap, nNewNum + 100);
+    assert (ret == 0);
+    test_filemap_grow_check (hFileMap, mapExpect);
+
+    /* 输出信息前完成迁移 */
+    const char *szInfoFile = "test.info_grow";
+    ret = filemap_generateinfo (hFileMap, szInfoFile);
+    assert (ret == 0);
+    FILE *fp = fopen (szInfoFile, "r");
+    assert (fp != NULL);
+    char szLine[1024] = {};
+    int bFound = 0;
+    while (fgets (szLine, sizeof(szLine), fp) != NULL)
+    {
+        if (strstr (szLine, "grow_num=") != NULL)
+        {
+            assert (strstr (szLine, "grow_num=2,") != NULL);
+            assert (strstr (szLine, "migrating=0,") != NULL);
+            bFound = 1;
+        }
+    }
+    fclose (fp);
+    assert (bFound);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 全部删除后可以重新写满 */
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    for (std::map<int, int>::const_iterator it = mapExpect.begin (); it != mapExpect.end (); ++it)
+    {
+        nKeyLen = test_filemap_grow_key (szKey, it->first);
+        ret = filemap_deleteitem_bin (hFileMap, szKey, nKeyLen);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nNewNum + 100; ++i)
+    {
+        nKeyLen = test_filemap_grow_key (szKey, i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+    }
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+typedef struct 
+{
+    FILEMAP_HANDLE hFileMap;
+    int nKeyBegin;      // 修改[nKeyBegin,nKeyBegin+nKeyNum)，其中后一半交替写入和删除
+    int nKeyNum;
+    int nRound;         // 已完成的轮数
+    volatile int bStop;
+} TEST_GROW_WRITER;
+
+/* 扩容和迁移期间并行写入，每轮的值为轮数 */
+static void *test_filemap_grow_writer (void *pArg)
+{
+    TEST_GROW_WRITER *psWriter = (TEST_GROW_WRITER*)pArg;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (int nRound = 1; ! psWriter->bStop; ++nRound)
+    {
+        for (int i = psWriter->nKeyBegin; i < psWriter->nKeyBegin + psWriter->nKeyNum; ++i)
+        {
+            const int nKeyLen = test_filemap_grow_key (szKey, i);
+            if (i >= psWriter->nKeyBegin + psWriter->nKeyNum / 2 && nRound % 2 == 0)
+            {
+                assert (filemap_deleteitem_bin (psWriter->hFileMap, szKey, nKeyLen) == 0);
+            }
+            else 
+            {
+                assert (filemap_setvalue_bin (psWriter->hFileMap, szKey, nKeyLen, &nRound, sizeof(nRound)) == 0);
+            }
+        }
+        psWriter->nRound = nRound;
+    }
+
+    return NULL;
+}
+
+/* 扩容的准备和迁移与其他线程的读写同时进行 */
+static int test_filemap_grow_online (int nFlags, int nIndexLayout)
+{
+    const int nNum = 2000;
+    const int nWriterNum = 4;
+    const int nWriterKeyNum = 200;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_grow_online_%x_%d", nFlags, nIndexLayout);
+    unlink (szObjFile);
+    unlink ((std::string (szObjFile) + ".wal").c_str ());
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.nIndexLayout = nIndexLayout;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    /* [0,1000)不修改，各写线程修改之后的一段 */
+    std::map<int, int> mapExpect;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (int i = 0; i < 1000; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i)) == 0);
+        mapExpect[i] = i;
+    }
+
+    TEST_GROW_READER sReader = {hFileMap, 1000, 0};
+    pthread_t tidReader;
+    int ret = pthread_create (&tidReader, NULL, test_filemap_grow_reader, &sReader);
+    assert (ret == 0);
+
+    TEST_GROW_WRITER asWriter[nWriterNum];
+    pthread_t atid[nWriterNum];
+    for (int i = 0; i < nWriterNum; ++i)
+    {
+        asWriter[i].hFileMap = hFileMap;
+        asWriter[i].nKeyBegin = 1000 + i * nWriterKeyNum;
+        asWriter[i].nKeyNum = nWriterKeyNum;
+        asWriter[i].nRound = 0;
+        asWriter[i].bStop = 0;
+        ret = pthread_create (&atid[i], NULL, test_filemap_grow_writer, &asWriter[i]);
+        assert (ret == 0);
+    }
+
+    /* 第二次扩容先完成第一次的迁移 */
+    usleep (10 * 1000);
+    assert (filemap_grow (hFileMap, nNum * 2) == 0);
+    usleep (10 * 1000);
+    assert (filemap_grow (hFileMap, nNum * 4) == 0);
+    usleep (30 * 1000);
+
+    for (int i = 0; i < nWriterNum; ++i)
+    {
+        asWriter[i].bStop = 1;
+        pthread_join (atid[i], NULL);
+        assert (asWriter[i].nRound > 0);
+
+        for (int k = asWriter[i].nKeyBegin; k < asWriter[i].nKeyBegin + nWriterKeyNum; ++k)
+        {
+            if (k < asWriter[i].nKeyBegin + nWriterKeyNum / 2 || asWriter[i].nRound % 2 != 0)
+            {
+                mapExpect[k] = asWriter[i].nRound;
+            }
+        }
+    }
+    sReader.bStop = 1;
+    pthread_join (tidReader, NULL);
+
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 空位栈完整：删除全部后可以写满扩容后的数量 */
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    for (std::map<int, int>::const_iterator it = mapExpect.begin (); it != mapExpect.end (); ++it)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, it->first);
+        assert (filemap_deleteitem_bin (hFileMap, szKey, nKeyLen) == 0);
+    }
+    for (int i = 0; i < nNum * 4; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i)) == 0);
+    }
+    assert (filemap_setvalue_bin (hFileMap, "grow_full", 9, "x", 1) < 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    unlink (szObjFile);
+    unlink ((std::string (szObjFile) + ".wal").c_str ());
+
+    return 0;
+}
+
+/* 在线扩容及索引的逐步迁移 */
+int test_filemap_grow ()
+{
+    test_filemap_grow_flags (0, FILEMAP_INDEX_CHAIN);
+    test_filemap_grow_flags (FILEMAP_FLAG_MMAP, FILEMAP_INDEX_CHAIN);
+    test_filemap_grow_flags (FILEMAP_FLAG_WAL, FILEMAP_INDEX_CHAIN);
+    test_filemap_grow_flags (0, FILEMAP_INDEX_OPEN);
+    test_filemap_grow_flags (FILEMAP_FLAG_MMAP | FILEMAP_FLAG_WAL, FILEMAP_INDEX_OPEN);
+
+    test_filemap_grow_online (0, FILEMAP_INDEX_CHAIN);
+    test_filemap_grow_online (FILEMAP_FLAG_MMAP, FILEMAP_INDEX_CHAIN);
+    test_filemap_grow_online (FILEMAP_FLAG_WAL, FILEMAP_INDEX_OPEN);
+    test_filemap_grow_online (FILEMAP_FLAG_DIRECT, FILEMAP_INDEX_CHAIN);
+
+    /* 版本号为V2.2 */
+    const char *szObjFile = "test.dat_grow_version";
+    unlink (szObjFile);
+    FILEMAP_HANDLE hFileMap = filemap_create (szObjFile, 10);
+    assert (hFileMap != NULL);
+    assert (filemap_setvalue_bin (hFileMap, "k", 1, "v", 1) == 0);
+    assert (filemap_grow (hFileMap, 20) == 0);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    FILE *fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    char szVersion[16] = {};
+    assert (fread (szVersion, sizeof(szVersion), 1, fp) == 1);
+    fclose (fp);
+    assert (strcmp (szVersion, "FILEMAP V2.2") == 0);
+
+    /* 多进程共享方式下不支持 */
+    hFileMap = filemap_load_ex (szObjFile, FILEMAP_FLAG_SHARED);
+    assert (hFileMap != NULL);
+    assert (filemap_existitem_bin (hFileMap, "k", 1) == 1);
+    assert (filemap_grow (hFileMap, 30) < 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 有存储区的文件不能扩容，文件不变 */
+    const char *szHeapFile = "test.dat_grow_heap";
+    unlink (szHeapFile);
+    FILEMAP_OPTION sOption = {};
+    sOption.llValueHeapSize = 256 * 1024;
+    hFileMap = filemap_create_opt (szHeapFile, 10, &sOption);
+    assert (hFileMap != NULL);
+    assert (filemap_setvalue_bin (hFileMap, "k", 1, "v", 1) == 0);
+    assert (filemap_grow (hFileMap, 20) < 0);
+    char szValue[8] = {};
+    int nLen = 0;
+    assert (filemap_getvalue_bin (hFileMap, "k", 1, szValue, sizeof(szValue), &nLen) == 0);
+    assert (1 == nLen && 'v' == szValue[0]);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+    hFileMap = filemap_load (szHeapFile);
+    assert (hFileMap != NULL);
+    assert (filemap_existitem_bin (hFileMap, "k", 1) == 1);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+typedef struct 
+{
+    int nCallNum;
+    int nDone;
+    int nTotal;
+} TEST_MIGRATE_PROGRESS;
+
+static void test_filemap_migrate_progress (void *pArg, int nDone, int nTotal)
+{
+    TEST_MIGRATE_PROGRESS *psProgress = (TEST_MIGRATE_PROGRESS*)pArg;
+    assert (nDone > psProgress->nDone && nDone <= nTotal);
+    psProgress->nCallNum += 1;
+    psProgress->nDone = nDone;
+    psProgress->nTotal = nTotal;
+}
+
+static int test_filemap_migrate_flags (int nFlags, int nIndexLayout, long long llHeapSize, long long llNewHeapSize)
+{
+    const int nNum = 300;
+    const int nNewNum = 5000;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_migrate_%x_%d_%lld_%lld", nFlags, nIndexLayout, 
+                    llHeapSize, llNewHeapSize);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    sOption.nIndexLayout = nIndexLayout;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    std::map<int, int> mapExpect;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    int ret = 0;
+    for (int i = 0; i < nNum; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+        mapExpect[i] = i;
+    }
+    for (int i = 0; i < nNum; i += 7)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        ret = filemap_deleteitem_bin (hFileMap, szKey, nKeyLen);
+        assert (ret == 0);
+        mapExpect.erase (i);
+    }
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 数量不足时失败，已有文件不变 */
+    TEST_MIGRATE_PROGRESS sProgress = {};
+    sOption.nFlags = nFlags | FILEMAP_FLAG_MIGRATE;
+    sOption.llValueHeapSize = llNewHeapSize;
+    sOption.pfnProgress = test_filemap_migrate_progress;
+    sOption.pProgressArg = &sProgress;
+    hFileMap = filemap_create_opt (szObjFile, nNum / 8, &sOption);
+    assert (NULL == hFileMap);
+
+    char szTmpFile[128] = {};
+    snprintf (szTmpFile, sizeof(szTmpFile), "%s.migrate", szObjFile);
+    assert (access (szTmpFile, F_OK) < 0);
+
+    FILEMAP_OPTION sOldOption = {};
+    sOldOption.nFlags = nFlags;
+    sOldOption.llValueHeapSize = llHeapSize;
+    sOldOption.nIndexLayout = nIndexLayout;
+    hFileMap = filemap_create_opt (szObjFile, nNum, &sOldOption);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 按新的数量重建，已有的项保留 */
+    memset (&sProgress, 0, sizeof(sProgress));
+    hFileMap = filemap_create_opt (szObjFile, nNewNum, &sOption);
+    assert (hFileMap != NULL);
+    assert (sProgress.nCallNum > 0 && sProgress.nDone == sProgress.nTotal);
+    assert (access (szTmpFile, F_OK) < 0);
+    test_filemap_grow_check (hFileMap, mapExpect);
+
+    /* 超过原来的数量后可以继续添加 */
+    for (int i = nNum; i < nNum * 2; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        ret = filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i));
+        assert (ret == 0);
+        mapExpect[i] = i;
+    }
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 数量相同时不再重建 */
+    memset (&sProgress, 0, sizeof(sProgress));
+    hFileMap = filemap_create_opt (szObjFile, nNewNum, &sOption);
+    assert (hFileMap != NULL);
+    assert (0 == sProgress.nCallNum);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_migrate ()
+{
+    test_filemap_migrate_flags (0, FILEMAP_INDEX_CHAIN, 0, 0);
+    /* 固定大小方式的值都是sizeof(FILEMAP_VALUE) */
+    test_filemap_migrate_flags (FILEMAP_FLAG_MMAP, FILEMAP_INDEX_CHAIN, 0, 4 * 1024 * 1024);
+    test_filemap_migrate_flags (FILEMAP_FLAG_WAL, FILEMAP_INDEX_CHAIN, 256 * 1024, 512 * 1024);
+    test_filemap_migrate_flags (0, FILEMAP_INDEX_OPEN, 0, 0);
+    test_filemap_migrate_flags (FILEMAP_FLAG_MMAP, FILEMAP_INDEX_OPEN, 256 * 1024, 256 * 1024);
+
+    /* 扩容后的文件先完成迁移再重建 */
+    const char *szObjFile = "test.dat_migrate_grown";
+    unlink (szObjFile);
+    FILEMAP_HANDLE hFileMap = filemap_create (szObjFile, 100);
+    assert (hFileMap != NULL);
+    std::map<int, int> mapExpect;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (int i = 0; i < 100; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i)) == 0);
+        mapExpect[i] = i;
+    }
+    assert (filemap_grow (hFileMap, 200) == 0);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = FILEMAP_FLAG_MIGRATE;
+    hFileMap = filemap_create_opt (szObjFile, 150, &sOption);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 多进程共享方式下不支持，已有文件不变 */
+    sOption.nFlags = FILEMAP_FLAG_MIGRATE | FILEMAP_FLAG_SHARED;
+    assert (NULL == filemap_create_opt (szObjFile, 300, &sOption));
+    hFileMap = filemap_create (szObjFile, 150);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+static int test_filemap_multiget_flags (int nFlags, int nIndexLayout, long long llHeapSize)
+{
+    const int nNum = 1000;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_multiget_%x_%d_%lld", nFlags, nIndexLayout, llHeapSize);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    sOption.nIndexLayout = nIndexLayout;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    int ret = 0;
+    for (int i = 0; i < nNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "multiget_%d", i);
+        snprintf (value.byteData, sizeof(value.byteData), "value_%d", i);
+        ret = filemap_setitem (hFileMap, &key, &value);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nNum; i += 5)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "multiget_%d", i);
+        ret = filemap_deleteitem (hFileMap, &key);
+        assert (ret == 0);
+    }
+
+    /* 包含不存在和重复的key */
+    const int nBatch = 700;
+    FILEMAP_KEY *psKeys = (FILEMAP_KEY*)calloc (nBatch, sizeof(FILEMAP_KEY));
+    FILEMAP_VALUE *psValues = (FILEMAP_VALUE*)calloc (nBatch, sizeof(FILEMAP_VALUE));
+    int *pnStatus = (int*)calloc (nBatch, sizeof(int));
+    assert (psKeys != NULL && psValues != NULL && pnStatus != NULL);
+
+    int nExpect = 0;
+    unsigned int uRand = 1;
+    for (int i = 0; i < nBatch; ++i)
+    {
+        const int nItem = rand_r (&uRand) % (nNum + nNum / 10);
+        snprintf (psKeys[i].szKey, sizeof(psKeys[i].szKey), "multiget_%d", nItem);
+        nExpect += (nItem < nNum && nItem % 5 != 0 ? 1 : 0);
+    }
+
+    ret = filemap_multiget (hFileMap, psKeys, nBatch, psValues, pnStatus);
+    assert (ret == nExpect);
+    for (int i = 0; i < nBatch; ++i)
+    {
+        memset (&value, 0, sizeof(value));
+        ret = filemap_getitem (hFileMap, &psKeys[i], &value);
+        assert (pnStatus[i] == ret);
+        if (0 == ret)
+        {
+            assert (memcmp (&value, &psValues[i], sizeof(value)) == 0);
+        }
+    }
+
+    /* 按顺序写入的项在文件中相邻 */
+    for (int i = 0; i < nBatch; ++i)
+    {
+        snprintf (psKeys[i].szKey, sizeof(psKeys[i].szKey), "multiget_%d", nBatch - i);
+    }
+    ret = filemap_multiget (hFileMap, psKeys, nBatch, psValues, pnStatus);
+    assert (ret == nBatch - nBatch / 5);
+    for (int i = 0; i < nBatch; ++i)
+    {
+        const int nItem = nBatch - i;
+        assert (pnStatus[i] == (nItem % 5 == 0 ? -1 : 0));
+        snprintf (value.byteData, sizeof(value.byteData), "value_%d", nItem);
+        assert (pnStatus[i] < 0 || strcmp (psValues[i].byteData, value.byteData) == 0);
+    }
+
+    assert (filemap_multiget (hFileMap, psKeys, 0, psValues, pnStatus) == 0);
+
+    free (psKeys);
+    free (psValues);
+    free (pnStatus);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_multiget ()
+{
+    test_filemap_multiget_flags (0, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_multiget_flags (FILEMAP_FLAG_MMAP, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_multiget_flags (FILEMAP_FLAG_WAL, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_multiget_flags (0, FILEMAP_INDEX_CHAIN, 16 * 1024 * 1024);
+    test_filemap_multiget_flags (0, FILEMAP_INDEX_OPEN, 0);
+    test_filemap_multiget_flags (FILEMAP_FLAG_SHARED, FILEMAP_INDEX_CHAIN, 0);
+
+    return 0;
+}
+
+static int test_filemap_multiset_flags (int nFlags, int nIndexLayout, long long llHeapSize)
+{
+    const int nNum = 2000;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_multiset_%x_%d_%lld", nFlags, nIndexLayout, llHeapSize);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    sOption.nIndexLayout = nIndexLayout;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    /* 最后一个key重复，后写入的生效 */
+    const int nBatch = nNum / 2 + 1;
+    FILEMAP_KEY *psKeys = (FILEMAP_KEY*)calloc (nBatch, sizeof(FILEMAP_KEY));
+    FILEMAP_VALUE *psValues = (FILEMAP_VALUE*)calloc (nBatch, sizeof(FILEMAP_VALUE));
+    int *pnStatus = (int*)calloc (nBatch, sizeof(int));
+    assert (psKeys != NULL && psValues != NULL && pnStatus != NULL);
+
+    for (int nRound = 0; nRound < 2; ++nRound)
+    {
+        for (int i = 0; i < nBatch - 1; ++i)
+        {
+            const int nItem = nRound * (nBatch - 1) + i;
+            snprintf (psKeys[i].szKey, sizeof(psKeys[i].szKey), "multiset_%d", nItem);
+            snprintf (psValues[i].byteData, sizeof(psValues[i].byteData), "value_%d", nItem);
+        }
+        psKeys[nBatch - 1] = psKeys[0];
+        snprintf (psValues[nBatch - 1].byteData, sizeof(psValues[nBatch - 1].byteData), "last_%d", nRound);
+
+        int ret = filemap_multiset (hFileMap, psKeys, nBatch, psValues, pnStatus);
+        assert (ret == nBatch);
+        for (int i = 0; i < nBatch; ++i)
+        {
+            assert (0 == pnStatus[i]);
+        }
+    }
+
+    FILEMAP_KEY key = {};
+    FILEMAP_VALUE value = {};
+    assert (filemap_getitem (hFileMap, &psKeys[0], &value) == 0 && strcmp (value.byteData, "last_1") == 0);
+
+    /* 已满，变长方式下由存储区决定 */
+    if (0 == llHeapSize)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "multiset_full");
+        assert (filemap_multiset (hFileMap, &key, 1, &value, pnStatus) == 0 && pnStatus[0] < 0);
+    }
+
+    /* 删除偶数项，包含不存在的key */
+    for (int i = 0; i < nBatch; ++i)
+    {
+        snprintf (psKeys[i].szKey, sizeof(psKeys[i].szKey), "multiset_%d", i * 2);
+    }
+    int ret = filemap_multidelete (hFileMap, psKeys, nBatch, pnStatus);
+    assert (ret == nNum / 2);
+    assert (pnStatus[nBatch - 1] < 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 重新加载后检查文件中的索引和空位 */
+    hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+    for (int i = 0; i < nNum; ++i)
+    {
+        snprintf (key.szKey, sizeof(key.szKey), "multiset_%d", i);
+        ret = filemap_getitem (hFileMap, &key, &value);
+        if (i % 2 == 0)
+        {
+            assert (ret < 0);
+            continue;
+        }
+        assert (ret == 0);
+        char szExpect[32] = {};
+        snprintf (szExpect, sizeof(szExpect), "value_%d", i);
+        assert (strcmp (value.byteData, szExpect) == 0);
+    }
+    /* 空位可以再次使用 */
+    for (int i = 0; i < nBatch - 1; ++i)
+    {
+        snprintf (psKeys[i].szKey, sizeof(psKeys[i].szKey), "multiset_new_%d", i);
+    }
+    ret = filemap_multiset (hFileMap, psKeys, nBatch - 1, psValues, pnStatus);
+    assert (ret == nNum / 2);
+
+    free (psKeys);
+    free (psValues);
+    free (pnStatus);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_multiset ()
+{
+    test_filemap_multiset_flags (0, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_multiset_flags (FILEMAP_FLAG_MMAP, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_multiset_flags (FILEMAP_FLAG_WAL, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_multiset_flags (0, FILEMAP_INDEX_CHAIN, 32 * 1024 * 1024);
+    test_filemap_multiset_flags (0, FILEMAP_INDEX_OPEN, 0);
+
+    return 0;
+}
+
+static int test_filemap_iter_flags (int nFlags, int nIndexLayout, long long llHeapSize)
+{
+    const int nNum = 3000;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_iter_%x_%d_%lld", nFlags, nIndexLayout, llHeapSize);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    sOption.nIndexLayout = nIndexLayout;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    /* 空表 */
+    FILEMAP_ITER_HANDLE hIter = filemap_iter_open (hFileMap);
+    assert (hIter != NULL);
+    char byteKey[FILEMAP_KEY_MAX] = {};
+    int nKeyLen = 0;
+    FILEMAP_VALUE value = {};
+    int nLen = 0;
+    assert (filemap_iter_next (hIter, byteKey, &nKeyLen, &value, sizeof(value), &nLen) == 0);
+    assert (filemap_iter_close (hIter) == 0);
+
+    /* 值的长度各不相同，包含长键 */
+    std::map<std::string, int> mapExpect;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    int ret = 0;
+    for (int i = 0; i < nNum; ++i)
+    {
+        const int nLenKey = test_filemap_grow_key (szKey, i);
+        char byteValue[256] = {};
+        const int nValueLen = 4 + i % 200;
+        memcpy (byteValue, &i, sizeof(i));
+        ret = filemap_setvalue_bin (hFileMap, szKey, nLenKey, byteValue, nValueLen);
+        assert (ret == 0);
+        mapExpect[std::string (szKey, nLenKey)] = i;
+    }
+    for (int i = 0; i < nNum; i += 3)
+    {
+        const int nLenKey = test_filemap_grow_key (szKey, i);
+        ret = filemap_deleteitem_bin (hFileMap, szKey, nLenKey);
+        assert (ret == 0);
+        mapExpect.erase (std::string (szKey, nLenKey));
+    }
+
+    hIter = filemap_iter_open (hFileMap);
+    assert (hIter != NULL);
+
+    /* 遍历期间删除和修改的项 */
+    const int nDeleted = 1;
+    const int nModified = 2;
+    nKeyLen = test_filemap_grow_key (szKey, nDeleted);
+    assert (filemap_deleteitem_bin (hFileMap, szKey, nKeyLen) == 0);
+    mapExpect.erase (std::string (szKey, nKeyLen));
+    nKeyLen = test_filemap_grow_key (szKey, nModified);
+    const int nNewValue = -nModified;
+    assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &nNewValue, sizeof(nNewValue)) == 0);
+    mapExpect[std::string (szKey, nKeyLen)] = nNewValue;
+
+    std::map<std::string, int> mapGot;
+    while ((ret = filemap_iter_next (hIter, byteKey, &nKeyLen, &value, sizeof(value), &nLen)) == 1)
+    {
+        int nValue = 0;
+        memcpy (&nValue, value.byteData, sizeof(nValue));
+        const std::string strKey ((const char*)byteKey, nKeyLen);
+        assert (mapGot.find (strKey) == mapGot.end ());
+        mapGot[strKey] = nValue;
+
+        if (0 == llHeapSize)
+        {
+            assert (nLen == (int)sizeof(FILEMAP_VALUE));
+        }
+        else 
+        {
+            assert (nLen == (nValue < 0 ? (int)sizeof(int) : 4 + nValue % 200));
+        }
+    }
+    assert (ret == 0);
+    assert (mapGot == mapExpect);
+    assert (filemap_iter_close (hIter) == 0);
+
+    /* 扩容后不能继续 */
+    hIter = filemap_iter_open (hFileMap);
+    assert (hIter != NULL);
+    if (0 == (nFlags & FILEMAP_FLAG_SHARED))
+    {
+        assert (filemap_iter_next (hIter, byteKey, &nKeyLen, &value, sizeof(value), &nLen) == 1);
+        if (0 == llHeapSize)
+        {
+            assert (filemap_grow (hFileMap, nNum * 2) == 0);
+            assert (filemap_iter_next (hIter, byteKey, &nKeyLen, &value, sizeof(value), &nLen) < 0);
+        }
+        else 
+        { /* 有存储区的文件不能扩容 */
+            assert (filemap_grow (hFileMap, nNum * 2) < 0);
+        }
+    }
+    assert (filemap_iter_close (hIter) == 0);
+
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_iter ()
+{
+    test_filemap_iter_flags (0, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_iter_flags (FILEMAP_FLAG_MMAP, FILEMAP_INDEX_CHAIN, 0);
+    test_filemap_iter_flags (FILEMAP_FLAG_WAL, FILEMAP_INDEX_CHAIN, 1024 * 1024);
+    test_filemap_iter_flags (0, FILEMAP_INDEX_OPEN, 0);
+    test_filemap_iter_flags (FILEMAP_FLAG_SHARED, FILEMAP_INDEX_OPEN, 1024 * 1024);
+
+    return 0;
+}
+
+typedef struct 
+{
+    long long llSum;        // 值之和
+    long long llLen;        // 值的总长度
+    int nCount;
+    int nStopAt;            // 调用次数达到后要求停止，为0时不停止
+} TEST_FOREACH_CTX;
+
+static int test_filemap_foreach_callback (void *pCtx, const void *pKey, int nKeyLen, const void *pData, int nLen)
+{
+    TEST_FOREACH_CTX *psCtx = (TEST_FOREACH_CTX*)pCtx;
+
+    /* 键与值对应 */
+    int nValue = 0;
+    memcpy (&nValue, pData, sizeof(nValue));
+    char szKey[FILEMAP_KEY_MAX] = {};
+    const int nExpectLen = test_filemap_grow_key (szKey, nValue);
+    assert (nKeyLen == nExpectLen && memcmp (pKey, szKey, nKeyLen) == 0);
+
+    __atomic_add_fetch (& psCtx->llSum, nValue, __ATOMIC_RELAXED);
+    __atomic_add_fetch (& psCtx->llLen, nLen, __ATOMIC_RELAXED);
+    const int nCount = __atomic_add_fetch (& psCtx->nCount, 1, __ATOMIC_RELAXED);
+
+    return (psCtx->nStopAt > 0 && nCount >= psCtx->nStopAt) ? 1 : 0;
+}
+
+static int test_filemap_foreach_flags (int nFlags, long long llHeapSize)
+{
+    const int nNum = 5000;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_foreach_%x_%lld", nFlags, llHeapSize);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    /* 空表 */
+    TEST_FOREACH_CTX sCtx = {};
+    assert (filemap_parallel_foreach (hFileMap, 4, test_filemap_foreach_callback, &sCtx) == 0);
+    assert (0 == sCtx.nCount);
+
+    long long llSum = 0;
+    long long llLen = 0;
+    int nCount = 0;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (int i = 0; i < nNum; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        char byteValue[128] = {};
+        const int nValueLen = 4 + i % 100;
+        memcpy (byteValue, &i, sizeof(i));
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, byteValue, nValueLen) == 0);
+    }
+    for (int i = 0; i < nNum; ++i)
+    {
+        if (i % 7 == 0)
+        {
+            const int nKeyLen = test_filemap_grow_key (szKey, i);
+            assert (filemap_deleteitem_bin (hFileMap, szKey, nKeyLen) == 0);
+            continue;
+        }
+        llSum += i;
+        llLen += (llHeapSize > 0 ? 4 + i % 100 : (int)sizeof(FILEMAP_VALUE));
+        nCount += 1;
+    }
+
+    const int anThreadNum[] = {1, 3, 16, 0};
+    for (int i = 0; i < (int)(sizeof(anThreadNum) / sizeof(anThreadNum[0])); ++i)
+    {
+        memset (&sCtx, 0, sizeof(sCtx));
+        assert (filemap_parallel_foreach (hFileMap, anThreadNum[i], test_filemap_foreach_callback, &sCtx) == 0);
+        assert (sCtx.nCount == nCount && sCtx.llSum == llSum && sCtx.llLen == llLen);
+    }
+
+    /* 回调函数要求停止 */
+    memset (&sCtx, 0, sizeof(sCtx));
+    sCtx.nStopAt = 100;
+    assert (filemap_parallel_foreach (hFileMap, 4, test_filemap_foreach_callback, &sCtx) == 1);
+    assert (sCtx.nCount >= 100 && sCtx.nCount < nCount);
+
+    assert (filemap_parallel_foreach (hFileMap, 4, NULL, &sCtx) < 0);
+
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_foreach ()
+{
+    test_filemap_foreach_flags (0, 0);
+    test_filemap_foreach_flags (FILEMAP_FLAG_MMAP, 0);
+    test_filemap_foreach_flags (0, 1024 * 1024);
+
+    return 0;
+}
+
+typedef struct 
+{
+    int nNext;
+    int nNum;           // 给出的项数，key为i % nKeyNum，值为i
+    int nKeyNum;
+    int nFailAt;        // 给出这么多项后失败，为-1时不失败
+} TEST_BULKLOAD_SOURCE;
+
+static int test_filemap_bulkload_source (void *pArg, void *pKey, int *pnKeyLen, void *pData, int nSize, int *pnLen)
+{
+    TEST_BULKLOAD_SOURCE *psSource = (TEST_BULKLOAD_SOURCE*)pArg;
+    if (psSource->nNext == psSource->nFailAt)
+    {
+        return -1;
+    }
+    if (psSource->nNext >= psSource->nNum)
+    {
+        return 0;
+    }
+
+    const int i = psSource->nNext++;
+    *pnKeyLen = test_filemap_grow_key ((char*)pKey, i % psSource->nKeyNum);
+
+    /* 值的长度各不相同，开头为i */
+    *pnLen = 4 + i % 200;
+    assert (nSize >= *pnLen);
+    memset (pData, i & 0xFF, *pnLen);
+    memcpy (pData, &i, sizeof(i));
+
+    return 1;
+}
+
+static int test_filemap_bulkload_flags (int nIndexLayout, long long llHeapSize, int bStringKey)
+{
+    const int nNum = 3000;
+    const int nKeyNum = 2000;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_bulkload_%d_%lld_%d", nIndexLayout, llHeapSize, bStringKey);
+    unlink (szObjFile);
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = FILEMAP_FLAG_MMAP;     // 不使用
+    sOption.llValueHeapSize = llHeapSize;
+    sOption.nIndexLayout = nIndexLayout;
+    sOption.bStringKey = bStringKey;
+
+    /* 重复的key以最后一次为准 */
+    TEST_BULKLOAD_SOURCE sSource = {0, nNum, nKeyNum, -1};
+    int ret = filemap_bulkload (szObjFile, nKeyNum, &sOption, test_filemap_bulkload_source, &sSource);
+    assert (ret == nNum);
+    assert (access ((std::string (szObjFile) + ".bulkload").c_str (), F_OK) < 0);
+
+    std::map<int, int> mapExpect;
+    for (int i = 0; i < nNum; ++i)
+    {
+        mapExpect[i % nKeyNum] = i;
+    }
+
+    FILEMAP_HANDLE hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+
+    /* 值的长度和内容 */
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (int k = 0; k < nKeyNum; k += 97)
+    {
+        const int i = mapExpect[k];
+        const int nKeyLen = test_filemap_grow_key (szKey, k);
+        char byteValue[256] = {};
+        int nLen = 0;
+        assert (filemap_getvalue_bin (hFileMap, szKey, nKeyLen, byteValue, sizeof(byteValue), &nLen) == 0);
+        assert (nLen == (llHeapSize > 0 ? 4 + i % 200 : (int)sizeof(FILEMAP_VALUE)));
+        for (int j = 4; j < 4 + i % 200; ++j)
+        {
+            assert (byteValue[j] == (char)(i & 0xFF));
+        }
+    }
+
+    /* 空位栈和比特表正确，之后可以继续删除和写入 */
+    for (int k = 0; k < nKeyNum; k += 2)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, k);
+        assert (filemap_deleteitem_bin (hFileMap, szKey, nKeyLen) == 0);
+        mapExpect.erase (k);
+    }
+    for (int k = nKeyNum; k < nKeyNum + nKeyNum / 2; ++k)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, k);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &k, sizeof(k)) == 0);
+        mapExpect[k] = k;
+    }
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 中途失败时已有的文件不变 */
+    TEST_BULKLOAD_SOURCE sFail = {0, nNum, nKeyNum, 100};
+    assert (filemap_bulkload (szObjFile, nKeyNum, &sOption, test_filemap_bulkload_source, &sFail) < 0);
+    assert (access ((std::string (szObjFile) + ".bulkload").c_str (), F_OK) < 0);
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+int test_filemap_bulkload ()
+{
+    test_filemap_bulkload_flags (FILEMAP_INDEX_CHAIN, 0, 0);
+    test_filemap_bulkload_flags (FILEMAP_INDEX_CHAIN, 0, 1);
+    test_filemap_bulkload_flags (FILEMAP_INDEX_CHAIN, 1024 * 1024, 0);
+    test_filemap_bulkload_flags (FILEMAP_INDEX_OPEN, 0, 0);
+    test_filemap_bulkload_flags (FILEMAP_INDEX_OPEN, 1024 * 1024, 0);
+
+    /* 固定大小方式下放不下时失败 */
+    const char *szObjFile = "test.dat_bulkload_full";
+    unlink (szObjFile);
+    TEST_BULKLOAD_SOURCE sSource = {0, 200, 200, -1};
+    assert (filemap_bulkload (szObjFile, 100, NULL, test_filemap_bulkload_source, &sSource) < 0);
+    assert (access (szObjFile, F_OK) < 0);
+
+    assert (filemap_bulkload (szObjFile, 100, NULL, NULL, NULL) < 0);
+
+    /* 写进程异常退出留下日志：先在旧文件上重做，不在新文件上重做，替换后日志删除 */
+    const char *szWalFile = "test.dat_bulkload_wal";
+    const std::string strWalName = std::string (szWalFile) + ".wal";
+    unlink (szWalFile);
+    unlink (strWalName.c_str ());
+    fflush (stdout);
+    pid_t pid = fork ();
+    assert (pid >= 0);
+    if (0 == pid)
+    {
+        FILEMAP_HANDLE hChild = filemap_create_ex (szWalFile, 100, FILEMAP_FLAG_WAL);
+        if (NULL == hChild)
+        {
+            _exit (1);
+        }
+        FILEMAP_KEY key = {};
+        FILEMAP_VALUE *pValue = new FILEMAP_VALUE ();
+        for (int i = 0; i < 50; ++i)
+        {
+            snprintf (key.szKey, sizeof(key.szKey), "old_%d", i);
+            filemap_setitem (hChild, &key, pValue);
+        }
+        _exit (0);
+    }
+    int nStatus = 0;
+    waitpid (pid, &nStatus, 0);
+    assert (WIFEXITED (nStatus) && WEXITSTATUS (nStatus) == 0);
+    struct stat st = {};
+    assert (stat (strWalName.c_str (), &st) == 0 && st.st_size > 0);
+
+    TEST_BULKLOAD_SOURCE sWalSource = {0, 80, 80, -1};
+    assert (filemap_bulkload (szWalFile, 100, NULL, test_filemap_bulkload_source, &sWalSource) == 80);
+    assert (access (strWalName.c_str (), F_OK) < 0);
+    FILEMAP_HANDLE hFileMap = filemap_load (szWalFile);
+    assert (hFileMap != NULL);
+    std::map<int, int> mapExpect;
+    for (int i = 0; i < 80; ++i)
+    {
+        mapExpect[i] = i;
+    }
+    test_filemap_grow_check (hFileMap, mapExpect);
+    FILEMAP_KEY key = {};
+    snprintf (key.szKey, sizeof(key.szKey), "old_0");
+    assert (filemap_existitem (hFileMap, &key) == 0);
+    assert (filemap_close (hFileMap) == 0);
+
+    return 0;
+}
+
+/**
+ * 超过2GB的文件：键段和空位栈在数据段之后，位置超过2GB；
+ * 扩容后新的索引段在文件末尾，日志中记录的位置也超过2GB
+ */
+static int test_filemap_large_flags (int nFlags, long long llHeapSize)
+{
+    const int nNum = (llHeapSize > 0 ? 1000 : 220000);    // 固定大小方式下每项占用sizeof(FILEMAP_VALUE)
+    const int nKeyNum = 600;
+    const long long llSize2G = 2LL * 1024 * 1024 * 1024;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_large_%d_%lld", nFlags, llHeapSize);
+    unlink (szObjFile);
+    unlink ((std::string (szObjFile) + ".wal").c_str ());
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags;
+    sOption.llValueHeapSize = llHeapSize;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    std::map<int, int> mapExpect;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i)) == 0);
+        mapExpect[i] = i;
+    }
+    for (int i = 0; i < nKeyNum; i += 4)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        assert (filemap_deleteitem_bin (hFileMap, szKey, nKeyLen) == 0);
+        mapExpect.erase (i);
+    }
+    test_filemap_grow_check (hFileMap, mapExpect);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 版本号为V2.3 */
+    FILE *fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    char szVersion[16] = {};
+    assert (fread (szVersion, sizeof(szVersion), 1, fp) == 1);
+    fseek (fp, 0, SEEK_END);
+    assert (ftell (fp) > llSize2G);
+    fclose (fp);
+    assert (strcmp (szVersion, "FILEMAP V2.3") == 0);
+
+    hFileMap = filemap_load_ex (szObjFile, nFlags);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+
+    if (0 == llHeapSize)
+    {
+        assert (filemap_grow (hFileMap, nNum + 1000) == 0);
+    }
+    else 
+    { /* 有存储区的文件不能扩容 */
+        assert (filemap_grow (hFileMap, nNum + 1000) < 0);
+    }
+    for (int i = nKeyNum; i < nKeyNum + 300; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &i, sizeof(i)) == 0);
+        mapExpect[i] = i;
+    }
+    for (int i = 1; i < nKeyNum; i += 3)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        const int nValue = i + 1;
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, &nValue, sizeof(nValue)) == 0);
+        mapExpect[i] = nValue;
+    }
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    test_filemap_grow_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 稀疏文件，不占用多少磁盘，但仍不保留 */
+    unlink (szObjFile);
+    unlink ((std::string (szObjFile) + ".wal").c_str ());
+
+    return 0;
+}
+
+int test_filemap_large ()
+{
+    test_filemap_large_flags (0, 0);
+    test_filemap_large_flags (FILEMAP_FLAG_MMAP, 0);
+    test_filemap_large_flags (FILEMAP_FLAG_WAL, 3LL * 1024 * 1024 * 1024);
+
+    /* 旧版本的程序留下的日志，记录中的位置为32位，仍然重做 */
+    const char *szObjFile = "test.dat_large_oldwal";
+    const std::string strWalFile = std::string (szObjFile) + ".wal";
+    unlink (szObjFile);
+    unlink (strWalFile.c_str ());
+
+    FILEMAP_HANDLE hFileMap = filemap_create (szObjFile, 10);
+    assert (hFileMap != NULL);
+    assert (filemap_setvalue_bin (hFileMap, "k", 1, "v", 1) == 0);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 写入定义段中未使用的位置 */
+    struct 
+    {
+        unsigned int uMagic;
+        int nWriteNum;
+        int nDataSize;
+        unsigned int uChecksum;
+        int nPos;
+        int nSize;
+        char byteData[8];
+    } sRecord = {0x46574C47, 1, 8, 0, 512, 8, "old_wal"};
+    unsigned int uHash = 2166136261u;
+    for (int i = 0; i < (int)sizeof(sRecord); ++i)
+    {
+        uHash = (uHash ^ ((const unsigned char*)&sRecord)[i]) * 16777619u;
+    }
+    sRecord.uChecksum = uHash;
+
+    FILE *fp = fopen (strWalFile.c_str (), "wb");
+    assert (fp != NULL);
+    assert (fwrite (&sRecord, sizeof(sRecord), 1, fp) == 1);
+    fclose (fp);
+
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    assert (filemap_existitem_bin (hFileMap, "k", 1) == 1);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    char byteRead[8] = {};
+    fseek (fp, 512, SEEK_SET);
+    assert (fread (byteRead, sizeof(byteRead), 1, fp) == 1);
+    fclose (fp);
+    assert (memcmp (byteRead, "old_wal", 8) == 0);
+
+    /* 索引段超过2GB的数量在打开文件之前失败，已有文件不变；扩容同样 */
+    FILEMAP_OPTION sOption = {};
+    sOption.bStringKey = 1;
+    assert (filemap_create_opt (szObjFile, 12540051, &sOption) == NULL);
+    sOption.bStringKey = 0;
+    assert (filemap_create_opt (szObjFile, 23794833, &sOption) == NULL);
+    sOption.nIndexLayout = FILEMAP_INDEX_OPEN;
+    assert (filemap_create_opt (szObjFile, 41698712, &sOption) == NULL);
+    assert (filemap_create (szObjFile, INT_MAX) == NULL);
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    assert (filemap_existitem_bin (hFileMap, "k", 1) == 1);
+    assert (filemap_grow (hFileMap, 23794833) < 0);
+    assert (filemap_existitem_bin (hFileMap, "k", 1) == 1);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    return 0;
+}
+
+/* 直接读写测试：数据段按页对齐，索引读取经过私有缓冲池 */
+static int test_filemap_direct_len (int nKey, int nRound)
+{
+    return 100 + (nKey * 997 + nRound * 131) % 9000;
+}
+
+static void test_filemap_direct_fill (char *pData, int nKey, int nRound)
+{
+    const int nLen = test_filemap_direct_len (nKey, nRound);
+    for (int i = 0; i < nLen; ++i)
+    {
+        pData[i] = (char)(nKey * 31 + nRound * 7 + i);
+    }
+}
+
+static void test_filemap_direct_check (FILEMAP_HANDLE hFileMap, const std::map<int, int> &mapExpect)
+{
+    char szKey[FILEMAP_KEY_MAX] = {};
+    static char byteExpect[sizeof(FILEMAP_VALUE)];
+    static char byteGet[sizeof(FILEMAP_VALUE)];
+    for (std::map<int, int>::const_iterator it = mapExpect.begin (); it != mapExpect.end (); ++it)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, it->first);
+        const int nLen = test_filemap_direct_len (it->first, it->second);
+        test_filemap_direct_fill (byteExpect, it->first, it->second);
+        int nLenGet = 0;
+        int ret = filemap_getvalue_bin (hFileMap, szKey, nKeyLen, byteGet, sizeof(byteGet), &nLenGet);
+        assert (ret == 0);
+        assert (nLenGet >= nLen);
+        assert (memcmp (byteGet, byteExpect, nLen) == 0);
+    }
+    assert (filemap_existitem_bin (hFileMap, "grow_none", 9) == 0);
+}
+
+typedef struct 
+{
+    FILEMAP_HANDLE hFileMap;
+    int nKeyBegin;
+    int nKeyNum;
+} TEST_DIRECT_WRITER;
+
+/* 各线程写入不同的键，索引中的节点可能在同一页中 */
+static void *test_filemap_direct_writer (void *pArg)
+{
+    TEST_DIRECT_WRITER *psWriter = (TEST_DIRECT_WRITER*)pArg;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    static __thread char byteValue[sizeof(FILEMAP_VALUE)];
+    for (int nRound = 0; nRound < 2; ++nRound)
+    {
+        for (int i = psWriter->nKeyBegin; i < psWriter->nKeyBegin + psWriter->nKeyNum; ++i)
+        {
+            const int nKeyLen = test_filemap_grow_key (szKey, i);
+            test_filemap_direct_fill (byteValue, i, nRound);
+            int ret = filemap_setvalue_bin (psWriter->hFileMap, szKey, nKeyLen, byteValue, test_filemap_direct_len (i, nRound));
+            assert (ret == 0);
+        }
+    }
+    return NULL;
+}
+
+static int test_filemap_direct_flags (int nFlags, long long llHeapSize)
+{
+    const int nNum = 2000;
+    const int nKeyNum = 1200;
+    const int nThreadNum = 4;
+    char szObjFile[64] = {};
+    snprintf (szObjFile, sizeof(szObjFile), "test.dat_direct_%d_%lld", nFlags, llHeapSize);
+    unlink (szObjFile);
+    unlink ((std::string (szObjFile) + ".wal").c_str ());
+
+    FILEMAP_OPTION sOption = {};
+    sOption.nFlags = nFlags | FILEMAP_FLAG_DIRECT;
+    sOption.llValueHeapSize = llHeapSize;
+    FILEMAP_HANDLE hFileMap = filemap_create_opt (szObjFile, nNum, &sOption);
+    assert (hFileMap != NULL);
+
+    std::map<int, int> mapExpect;
+    char szKey[FILEMAP_KEY_MAX] = {};
+    static char byteValue[sizeof(FILEMAP_VALUE)];
+    for (int i = 0; i < nKeyNum; ++i)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        test_filemap_direct_fill (byteValue, i, 0);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, byteValue, test_filemap_direct_len (i, 0)) == 0);
+        mapExpect[i] = 0;
+    }
+    for (int i = 0; i < nKeyNum; i += 5)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        assert (filemap_deleteitem_bin (hFileMap, szKey, nKeyLen) == 0);
+        mapExpect.erase (i);
+    }
+    test_filemap_direct_check (hFileMap, mapExpect);
+
+    /* 同时写入 */
+    pthread_t threads[nThreadNum];
+    TEST_DIRECT_WRITER args[nThreadNum];
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        args[i].hFileMap = hFileMap;
+        args[i].nKeyBegin = nKeyNum + i * 100;
+        args[i].nKeyNum = 100;
+        int ret = pthread_create (&threads[i], NULL, test_filemap_direct_writer, &args[i]);
+        assert (ret == 0);
+    }
+    for (int i = 0; i < nThreadNum; ++i)
+    {
+        pthread_join (threads[i], NULL);
+    }
+    for (int i = nKeyNum; i < nKeyNum + nThreadNum * 100; ++i)
+    {
+        mapExpect[i] = 1;
+    }
+    test_filemap_direct_check (hFileMap, mapExpect);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 版本号为V2.4，文件大小按页对齐 */
+    FILE *fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    char szVersion[16] = {};
+    assert (fread (szVersion, sizeof(szVersion), 1, fp) == 1);
+    fseek (fp, 0, SEEK_END);
+    assert (ftell (fp) % 4096 == 0);
+    fclose (fp);
+    assert (strcmp (szVersion, "FILEMAP V2.4") == 0);
+
+    /* 不使用直接读写也能读取 */
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    test_filemap_direct_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_load_ex (szObjFile, nFlags | FILEMAP_FLAG_DIRECT);
+    assert (hFileMap != NULL);
+    test_filemap_direct_check (hFileMap, mapExpect);
+    if (0 == llHeapSize)
+    {
+        assert (filemap_grow (hFileMap, nNum + 500) == 0);
+    }
+    for (int i = 1; i < nKeyNum; i += 3)
+    {
+        const int nKeyLen = test_filemap_grow_key (szKey, i);
+        test_filemap_direct_fill (byteValue, i, 2);
+        assert (filemap_setvalue_bin (hFileMap, szKey, nKeyLen, byteValue, test_filemap_direct_len (i, 2)) == 0);
+        mapExpect[i] = 2;
+    }
+    test_filemap_direct_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    test_filemap_direct_check (hFileMap, mapExpect);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    unlink (szObjFile);
+    unlink ((std::string (szObjFile) + ".wal").c_str ());
+
+    return 0;
+}
+
+int test_filemap_direct ()
+{
+    test_filemap_direct_flags (0, 0);
+    test_filemap_direct_flags (FILEMAP_FLAG_WAL, 0);
+    test_filemap_direct_flags (0, 16 * 1024 * 1024);
+
+    /* 已有的文件格式不变，也可以直接读写 */
+    const char *szObjFile = "test.dat_direct_old";
+    unlink (szObjFile);
+
+    FILEMAP_HANDLE hFileMap = filemap_create (szObjFile, 100);
+    assert (hFileMap != NULL);
+    assert (filemap_setvalue_bin (hFileMap, "k", 1, "v", 1) == 0);
+    int ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    hFileMap = filemap_create_ex (szObjFile, 100, FILEMAP_FLAG_DIRECT);
+    assert (hFileMap != NULL);
+    char byteValue[8] = {};
+    int nLenGet = 0;
+    assert (filemap_getvalue_bin (hFileMap, "k", 1, byteValue, sizeof(byteValue), &nLenGet) == 0);
+    assert (byteValue[0] == 'v');
+    assert (filemap_setvalue_bin (hFileMap, "k2", 2, "v2", 2) == 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    FILE *fp = fopen (szObjFile, "r");
+    assert (fp != NULL);
+    char szVersion[16] = {};
+    assert (fread (szVersion, sizeof(szVersion), 1, fp) == 1);
+    fclose (fp);
+    assert (strcmp (szVersion, "FILEMAP V2.0") == 0);
+
+    hFileMap = filemap_load (szObjFile);
+    assert (hFileMap != NULL);
+    assert (filemap_getvalue_bin (hFileMap, "k2", 2, byteValue, sizeof(byteValue), &nLenGet) == 0);
+    assert (memcmp (byteValue, "v2", 2) == 0);
+    ret = filemap_close (hFileMap);
+    assert (ret == 0);
+
+    /* 不能与映射方式同时使用 */
+    assert (filemap_load_ex (szObjFile, FILEMAP_FLAG_DIRECT | FILEMAP_FLAG_MMAP) == NULL);
+
+    unlink (szObjFile);
+
+    return 0;
+}
+
+/* 初始化失败测试：实例建立后的步骤失败时返回NULL，不返回已释放的实例 */
+int test_filemap_initfail ()
+{
+    const char *szObjFile = "test.dat_initfail";
+    unlink (szObjFile);
+
+    pid_t pid = fork ();
+    assert (pid >= 0);
+    if (0 == pid)
+    { /* 限制地址空间，整段读入索引时内存不足 */
+        struct rlimit sLimit = {};
+        sLimit.rlim_cur = 512LL * 1024 * 1024;
+        sLimit.rlim_max = 512LL * 1024 * 1024;
+        setrlimit (RLIMIT_AS, &sLimit);
+
+        FILEMAP_HANDLE hFileMap = filemap_create (szObjFile, 20000000);
+        _exit (NULL == hFileMap ? 0 : 1);
+    }
+
+    int nStatus = 0;
+    assert (waitpid (pid, &nStatus, 0) == pid);
+    assert (WIFEXITED (nStatus) && 0 == WEXITSTATUS (nStatus));
+
+    unlink (szObjFile);
+
+    return 0;
+}
+
+/* 比特表空位查找测试 */
+int test_bitmap ()
+{
+    int nNum[] = {
+        3, 63, 64, 65, 4095, 4096, 4097, 100000,
+    };
+    for (int n = 0; n < (int)(sizeof(nNum) / sizeof(nNum[0])); ++n)
+    {
+        const int nBitNum = nNum[n];
+        BITMAP_HANDLE hBitmap = bitmap_create (nBitNum);
+        assert (hBitmap != NULL);
+
+        /* 依次占满 */
+        for (int i = 0; i < nBitNum; ++i)
+        {
+            int nIndex = -1;
+            int ret = bitmap_findfirstzero (hBitmap, &nIndex);
+            assert (ret == 1 && nIndex == i);
+            ret = bitmap_setbit (hBitmap, nIndex, 1);
+            assert (ret == 0);
+        }
+
+        int nIndex = -1;
+        assert (bitmap_findfirstzero (hBitmap, &nIndex) == 0);
+
+        /* 释放后优先找到最小的空位 */
+        bitmap_setbit (hBitmap, nBitNum - 1, 0);
+        bitmap_setbit (hBitmap, nBitNum / 2, 0);
+        assert (bitmap_findfirstzero (hBitmap, &nIndex) == 1 && nIndex == nBitNum / 2);
+        bitmap_setbit (hBitmap, nBitNum / 2, 1);
+        assert (bitmap_findfirstzero (hBitmap, &nIndex) == 1 && nIndex == nBitNum - 1);
+        assert (bitmap_getbit (hBitmap, nBitNum - 1) == 0);
+
+        /* 从文件格式导入，每字节高位在前 */
+        const int nSize = nBitNum / 8 + (nBitNum % 8 ? 1 : 0);
+        char *pMem = (char*)malloc (nSize);
+        memset (pMem, 0xFF, nSize);
+        const int nZero = nBitNum / 3;
+        pMem[nZero / 8] &= ~(0x80 >> (nZero % 8));
+        bitmap_load (hBitmap, pMem, nSize);
+        free (pMem);
+        assert (bitmap_findfirstzero (hBitmap, &nIndex) == 1 && nIndex == nZero);
+        assert (bitmap_getbit (hBitmap, nZero) == 0);
+
+        bitmap_destroy (hBitmap);
+    }
+
+    return 0;
+}
@@ -5,5 +5,29 @@
 
 int test_filemap ();
 int test_filemap1 ();
+int test_filemap_mmap ();
+int test_filemap_borrow ();
+int test_filemap_range ();
+int test_bitmap ();
+int test_filemap_freelist ();
+int test_filemap_thread ();
+int test_filemap_seqread ();
+int test_filemap_shared ();
+int test_filemap_wal ();
+int test_filemap_durability ();
+int test_filemap_value ();
+int test_filemap_binkey ();
+int test_filemap_hash ();
+int test_filemap_open ();
+int test_filemap_grow ();
+int test_filemap_migrate ();
+int test_filemap_multiget ();
+int test_filemap_multiset ();
+int test_filemap_iter ();
+int test_filemap_foreach ();
+int test_filemap_bulkload ();
+int test_filemap_large ();
+int test_filemap_direct ();
+int test_filemap_initfail ();
 
 #endif // TEST_H__
\ No newline at end of file